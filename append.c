@@ -0,0 +1,554 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define APPEND_STATE_MAGIC 0x53413253 // "S2AS"
+#define APPEND_STATE_VERSION 1
+#define APPEND_BOUNDARY 4096 // midstates are kept at multiples of this, also the sector size for --direct
+#define APPEND_SAMPLE_SIZE 64
+#define APPEND_READ_SIZE (1024 * 1024) // all of the per thread read buffer
+#define SHA256_BLOCK_SIZE 64
+
+// SHA-256 in software, CNG does not hand out the chaining value of a hash object
+typedef struct sha256_context_t
+{
+    DWORD state[8];
+    ULONGLONG bytes;
+    BYTE block[SHA256_BLOCK_SIZE];
+    DWORD blockLength;
+} Sha256Context;
+
+// --append-state file, an AppendStateHeader followed by count AppendStateEntry
+// sorted by volume and file ID
+typedef struct append_state_header_t
+{
+    DWORD magic;
+    WORD version;
+    WORD flags;
+    ULONGLONG count;
+} AppendStateHeader;
+
+typedef struct append_state_entry_t
+{
+    DWORD volumeSerialNumber;
+    DWORD flags;
+    ULONGLONG fileId;
+    ULONGLONG size; // bytes hashed into digest
+    ULONGLONG lastWriteTime;
+    ULONGLONG boundary; // bytes hashed into midstate, a multiple of APPEND_BOUNDARY
+    DWORD midstate[8];
+    BYTE sample[APPEND_SAMPLE_SIZE]; // the last bytes before boundary
+    BYTE digest[SHA256_DIGEST_LENGTH];
+} AppendStateEntry;
+
+#define APPEND_ENTRY_USED 1 // seen in this run, only those are written back
+
+typedef struct append_state_t
+{
+    SRWLOCK lock;
+    AppendStateEntry* entries; // sorted, loaded from the file
+    size_t count;
+    AppendStateEntry* added; // files without an entry yet
+    size_t addedCount;
+    size_t addedCapacity;
+} AppendState;
+
+static AppendState appendState = { SRWLOCK_INIT, NULL, 0, NULL, 0, 0 };
+
+static const DWORD roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const DWORD initialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void Sha256Compress(__inout_ecount(8) DWORD* state, __in_ecount(SHA256_BLOCK_SIZE) const BYTE* block)
+{
+    DWORD w[64];
+    DWORD a = state[0], b = state[1], c = state[2], d = state[3];
+    DWORD e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((DWORD)block[i * 4] << 24) | ((DWORD)block[i * 4 + 1] << 16) | ((DWORD)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        DWORD s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        DWORD s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    for (int i = 0; i < 64; i++)
+    {
+        DWORD t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[i] + w[i];
+        DWORD t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void Sha256Update(__inout Sha256Context* context, __in_ecount(size) const BYTE* data, __in size_t size)
+{
+    context->bytes += size;
+
+    if (context->blockLength > 0)
+    {
+        size_t take = SHA256_BLOCK_SIZE - context->blockLength;
+        take = take < size ? take : size;
+        memcpy(context->block + context->blockLength, data, take);
+        context->blockLength += (DWORD)take;
+        data += take;
+        size -= take;
+        if (context->blockLength < SHA256_BLOCK_SIZE)
+        {
+            return;
+        }
+        Sha256Compress(context->state, context->block);
+        context->blockLength = 0;
+    }
+
+    for (; size >= SHA256_BLOCK_SIZE; data += SHA256_BLOCK_SIZE, size -= SHA256_BLOCK_SIZE)
+    {
+        Sha256Compress(context->state, data);
+    }
+
+    memcpy(context->block, data, size);
+    context->blockLength = (DWORD)size;
+}
+
+// pads a copy, so context can still be continued
+static void Sha256Final(__in const Sha256Context* context, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    Sha256Context last = *context;
+    BYTE padding[SHA256_BLOCK_SIZE * 2] = { 0x80 };
+    BYTE length[8];
+    ULONGLONG bits = context->bytes * 8;
+
+    for (int i = 0; i < 8; i++)
+    {
+        length[i] = (BYTE)(bits >> (56 - i * 8));
+    }
+
+    size_t used = (size_t)(context->bytes % SHA256_BLOCK_SIZE);
+    Sha256Update(&last, padding, used < 56 ? 56 - used : 120 - used);
+    Sha256Update(&last, length, sizeof(length));
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (BYTE)(last.state[i] >> 24);
+        digest[i * 4 + 1] = (BYTE)(last.state[i] >> 16);
+        digest[i * 4 + 2] = (BYTE)(last.state[i] >> 8);
+        digest[i * 4 + 3] = (BYTE)last.state[i];
+    }
+}
+
+static int CompareEntries(const void* a, const void* b)
+{
+    const AppendStateEntry* left = (const AppendStateEntry*)a;
+    const AppendStateEntry* right = (const AppendStateEntry*)b;
+
+    if (left->volumeSerialNumber != right->volumeSerialNumber)
+    {
+        return left->volumeSerialNumber < right->volumeSerialNumber ? -1 : 1;
+    }
+    if (left->fileId != right->fileId)
+    {
+        return left->fileId < right->fileId ? -1 : 1;
+    }
+    return 0;
+}
+
+// Reads args->appendState, a missing file is an empty state. A file that is
+// not a state file is an error, so it does not get overwritten.
+ErrorCode LoadAppendState(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    AppendStateHeader header;
+    LARGE_INTEGER fileSize;
+    DWORD bytesRead;
+
+    HANDLE hFile = CreateFileW(args->appendState, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        if (GetLastError() == ERROR_FILE_NOT_FOUND)
+        {
+            return SUCCESS;
+        }
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", args->appendState, GetLastError());
+        return APPEND_STATE_FAILED_TO_OPEN;
+    }
+
+    if (!GetFileSizeEx(hFile, &fileSize)
+        || !ReadFile(hFile, &header, sizeof(header), &bytesRead, NULL)
+        || bytesRead != sizeof(header)
+        || header.magic != APPEND_STATE_MAGIC
+        || header.version != APPEND_STATE_VERSION
+        || header.count != ((ULONGLONG)fileSize.QuadPart - sizeof(header)) / sizeof(AppendStateEntry)
+        || header.count > MAXDWORD / sizeof(AppendStateEntry))
+    {
+        LogError(args, L"'%ls' is not a valid append state\r\n", args->appendState, 0);
+        status = APPEND_STATE_INVALID;
+        goto Cleanup;
+    }
+
+    DWORD size = (DWORD)(header.count * sizeof(AppendStateEntry));
+    appendState.entries = malloc(size > 0 ? size : 1);
+    if (appendState.entries == NULL)
+    {
+        status = APPEND_STATE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    if (!ReadFile(hFile, appendState.entries, size, &bytesRead, NULL) || bytesRead != size)
+    {
+        LogError(args, L"failed to read '%ls' with error: %lu\r\n", args->appendState, GetLastError());
+        status = APPEND_STATE_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+    appendState.count = (size_t)header.count;
+
+    for (size_t i = 0; i < appendState.count; i++)
+    {
+        appendState.entries[i].flags &= ~APPEND_ENTRY_USED;
+    }
+
+Cleanup:
+    CloseHandle(hFile);
+    if (status != SUCCESS)
+    {
+        free(appendState.entries);
+        appendState.entries = NULL;
+    }
+
+    return status;
+}
+
+static BOOL ReadAt(__in HANDLE hFile, __in ULONGLONG offset, __out_ecount(size) PBYTE buffer, __in DWORD size)
+{
+    LARGE_INTEGER position;
+    DWORD bytesRead;
+
+    position.QuadPart = (LONGLONG)offset;
+    if (!SetFilePointerEx(hFile, position, NULL, FILE_BEGIN) || !ReadFile(hFile, buffer, size, &bytesRead, NULL))
+    {
+        return FALSE;
+    }
+    InterlockedAddNoFence64(&runStats.bytesRead, bytesRead);
+    return bytesRead == size;
+}
+
+// Looks for a saved state of the file that is still a prefix of it: same file
+// ID, not smaller, and the bytes before the midstate unchanged. *unchanged is
+// set when size and last write time are as saved, digest is then final.
+static BOOL FindPrefix(__in HANDLE hFile, __in AppendStateEntry* key, __in PBYTE buffer, __out AppendStateEntry* found, __out BOOL* unchanged)
+{
+    *unchanged = FALSE;
+
+    AcquireSRWLockShared(&appendState.lock);
+    AppendStateEntry* entry = appendState.count > 0
+        ? bsearch(key, appendState.entries, appendState.count, sizeof(AppendStateEntry), CompareEntries)
+        : NULL;
+    if (entry != NULL)
+    {
+        *found = *entry;
+    }
+    ReleaseSRWLockShared(&appendState.lock);
+
+    if (entry == NULL || key->size < found->size)
+    {
+        return FALSE;
+    }
+
+    if (key->size == found->size && key->lastWriteTime == found->lastWriteTime)
+    {
+        *unchanged = TRUE;
+        return TRUE;
+    }
+
+    // a rewritten file that grew past its old size usually differs in the tail
+    return found->boundary > 0
+        && ReadAt(hFile, found->boundary - APPEND_BOUNDARY, buffer, APPEND_BOUNDARY)
+        && memcmp(buffer + APPEND_BOUNDARY - APPEND_SAMPLE_SIZE, found->sample, APPEND_SAMPLE_SIZE) == 0;
+}
+
+static ErrorCode StoreEntry(__in AppendStateEntry* update)
+{
+    ErrorCode status = SUCCESS;
+
+    update->flags = APPEND_ENTRY_USED;
+
+    AcquireSRWLockExclusive(&appendState.lock);
+    AppendStateEntry* entry = appendState.count > 0
+        ? bsearch(update, appendState.entries, appendState.count, sizeof(AppendStateEntry), CompareEntries)
+        : NULL;
+    if (entry != NULL)
+    {
+        *entry = *update;
+        goto Cleanup;
+    }
+
+    if (appendState.addedCount == appendState.addedCapacity)
+    {
+        size_t newCapacity = appendState.addedCapacity == 0 ? 64 : appendState.addedCapacity * 2;
+        AppendStateEntry* grown = realloc(appendState.added, newCapacity * sizeof(AppendStateEntry));
+        if (grown == NULL)
+        {
+            status = APPEND_STATE_ALLOCATE_ERROR;
+            goto Cleanup;
+        }
+        appendState.added = grown;
+        appendState.addedCapacity = newCapacity;
+    }
+    appendState.added[appendState.addedCount++] = *update;
+
+Cleanup:
+    ReleaseSRWLockExclusive(&appendState.lock);
+    return status;
+}
+
+// Hashes a file opened with OpenFileForHashing from the midstate saved by an
+// earlier run, so a file that only grew is read from where that run stopped.
+// The midstate is taken at the last multiple of APPEND_BOUNDARY, where a
+// resumed read is aligned for --direct too.
+ErrorCode HashAppendedFile(__in Args* args, __in HANDLE hFile, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __out ULONGLONG* hashed)
+{
+    ErrorCode status = SUCCESS;
+    BY_HANDLE_FILE_INFORMATION info;
+    AppendStateEntry entry;
+    AppendStateEntry saved;
+    Sha256Context context;
+    Sha256Context boundary;
+    BOOL unchanged;
+    DWORD dwBytesRead;
+
+    PBYTE buffer = GetReadBuffer();
+    if (buffer == NULL)
+    {
+        return CALC_HASH_FAILED_TO_ALLOCATE_READ_BUFFER;
+    }
+
+    if (!GetFileInformationByHandle(hFile, &info))
+    {
+        return CALC_HASH_FAILED_TO_READ;
+    }
+
+    ZeroMemory(&entry, sizeof(entry));
+    entry.volumeSerialNumber = info.dwVolumeSerialNumber;
+    entry.fileId = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    entry.size = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    entry.lastWriteTime = ((ULONGLONG)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+    ZeroMemory(&context, sizeof(context));
+    memcpy(context.state, initialState, sizeof(initialState));
+
+    if (FindPrefix(hFile, &entry, buffer, &saved, &unchanged))
+    {
+        if (unchanged)
+        {
+            memcpy(digest, saved.digest, SHA256_DIGEST_LENGTH);
+            *hashed = saved.size;
+            return StoreEntry(&saved);
+        }
+
+        // positioned at the boundary by the sample read
+        memcpy(context.state, saved.midstate, sizeof(context.state));
+        context.bytes = saved.boundary;
+    }
+    else
+    {
+        LARGE_INTEGER start = { 0 };
+        if (!SetFilePointerEx(hFile, start, NULL, FILE_BEGIN))
+        {
+            return CALC_HASH_FAILED_TO_READ;
+        }
+    }
+
+    boundary = context;
+    if (context.bytes > 0)
+    {
+        memcpy(entry.sample, saved.sample, APPEND_SAMPLE_SIZE);
+    }
+
+    // reads start at a boundary and are whole multiples of it, so each full
+    // read ends on one and only the last may end between two. Like a small
+    // file, the tail is asked for up to a boundary past the size taken at the
+    // open, so --max-rate is charged for what is read and a short read still
+    // proves the end.
+    ULONGLONG size = entry.size;
+    while (TRUE)
+    {
+        if (args->cancelled)
+        {
+            return CALC_HASH_CANCELLED;
+        }
+
+        ULONGLONG left = size > context.bytes ? size - context.bytes : 0;
+        DWORD request = left < APPEND_READ_SIZE
+            ? (DWORD)((left + 1 + APPEND_BOUNDARY - 1) & ~(ULONGLONG)(APPEND_BOUNDARY - 1))
+            : APPEND_READ_SIZE;
+
+        ThrottleRead(args, request);
+        if (!ReadFile(hFile, buffer, request, &dwBytesRead, NULL))
+        {
+            WCHAR message[64];
+            if (!args->status && SUCCEEDED(StringCchPrintfW(message, _countof(message), L"read file failed: %lu\r\n", GetLastError())))
+            {
+                WriteStderr(message);
+            }
+            return CALC_HASH_FAILED_TO_READ;
+        }
+        InterlockedAddNoFence64(&runStats.bytesRead, dwBytesRead);
+        InterlockedAddNoFence64(&runStats.bytesHashed, dwBytesRead);
+
+        DWORD aligned = dwBytesRead & ~(DWORD)(APPEND_BOUNDARY - 1);
+        Sha256Update(&context, buffer, aligned);
+        if (aligned > 0)
+        {
+            boundary = context;
+            memcpy(entry.sample, buffer + aligned - APPEND_SAMPLE_SIZE, APPEND_SAMPLE_SIZE);
+        }
+        Sha256Update(&context, buffer + aligned, dwBytesRead - aligned);
+
+        if (dwBytesRead < request)
+        {
+            break;
+        }
+    }
+
+    Sha256Final(&context, digest);
+    *hashed = context.bytes;
+
+    // what was read, the file may have grown meanwhile and is then resumed next time
+    entry.size = context.bytes;
+    entry.boundary = boundary.bytes;
+    memcpy(entry.midstate, boundary.state, sizeof(entry.midstate));
+    memcpy(entry.digest, digest, SHA256_DIGEST_LENGTH);
+    status = StoreEntry(&entry);
+
+    return status;
+}
+
+// Writes the state of every file hashed in this run next to args->appendState
+// and moves it over the old one. Files not seen in this run are dropped, so
+// rotated logs do not pile up.
+ErrorCode SaveAppendState(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    WCHAR temporary[MAX_PATH];
+    AppendStateHeader header;
+    AppendStateEntry* entries = NULL;
+    size_t count = 0;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    DWORD written;
+
+    entries = malloc((appendState.count + appendState.addedCount + 1) * sizeof(AppendStateEntry));
+    if (entries == NULL)
+    {
+        status = APPEND_STATE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    for (size_t i = 0; i < appendState.count; i++)
+    {
+        if (appendState.entries[i].flags & APPEND_ENTRY_USED)
+        {
+            entries[count++] = appendState.entries[i];
+        }
+    }
+    for (size_t i = 0; i < appendState.addedCount; i++)
+    {
+        entries[count++] = appendState.added[i];
+    }
+    qsort(entries, count, sizeof(AppendStateEntry), CompareEntries);
+
+    // a hard link listed twice is one file
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (unique > 0 && CompareEntries(&entries[unique - 1], &entries[i]) == 0)
+        {
+            entries[unique - 1] = entries[i];
+            continue;
+        }
+        entries[unique++] = entries[i];
+    }
+    count = unique;
+
+    if (FAILED(StringCchPrintfW(temporary, _countof(temporary), L"%ls.tmp", args->appendState)))
+    {
+        status = APPEND_STATE_FAILED_TO_WRITE;
+        goto Cleanup;
+    }
+
+    hFile = CreateFileW(temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        status = APPEND_STATE_FAILED_TO_WRITE;
+        goto Cleanup;
+    }
+
+    ZeroMemory(&header, sizeof(header));
+    header.magic = APPEND_STATE_MAGIC;
+    header.version = APPEND_STATE_VERSION;
+    header.count = count;
+
+    DWORD size = (DWORD)(count * sizeof(AppendStateEntry));
+    if (!WriteFile(hFile, &header, sizeof(header), &written, NULL) || written != sizeof(header)
+        || (size > 0 && (!WriteFile(hFile, entries, size, &written, NULL) || written != size)))
+    {
+        status = APPEND_STATE_FAILED_TO_WRITE;
+    }
+    CloseHandle(hFile);
+
+    if (status == SUCCESS && !MoveFileExW(temporary, args->appendState, MOVEFILE_REPLACE_EXISTING))
+    {
+        status = APPEND_STATE_FAILED_TO_WRITE;
+    }
+    if (status != SUCCESS)
+    {
+        DeleteFileW(temporary);
+    }
+
+Cleanup:
+    if (status == APPEND_STATE_FAILED_TO_WRITE)
+    {
+        LogError(args, L"failed to write '%ls' with error: %lu\r\n", args->appendState, GetLastError());
+    }
+
+    free(entries);
+    free(appendState.entries);
+    free(appendState.added);
+    appendState.entries = NULL;
+    appendState.added = NULL;
+    appendState.count = 0;
+    appendState.addedCount = 0;
+    appendState.addedCapacity = 0;
+
+    return status;
+}
@@ -25,6 +25,44 @@ ErrorCode ParseArgs(__out Args* args, __in int argc, __in LPWSTR argv[])
     args->warn = FALSE;
     args->showVersion = FALSE;
     args->textMode = FALSE;
+    args->serve = FALSE;
+    args->daemon = FALSE;
+    args->stopDaemon = FALSE;
+    args->pipeName = NULL;
+    args->filesFrom = NULL;
+    args->nullDelimited = FALSE;
+    args->failFast = FALSE;
+    args->withSize = FALSE;
+    args->jobs = 0;
+    args->order = ORDER_SIZE;
+    args->direct = FALSE;
+    args->dropCache = FALSE;
+    args->showStats = FALSE;
+    args->convertFrom = NULL;
+    args->convertTo = NULL;
+    args->lookup = NULL;
+    args->diffManifest = NULL;
+    args->diffDirectory = NULL;
+    args->includes = NULL;
+    args->excludes = NULL;
+    args->pathsFrom = NULL;
+    args->progress = FALSE;
+    args->maxRate.limit = 0;
+    args->maxRate.next = 0;
+    args->maxIops.limit = 0;
+    args->maxIops.next = 0;
+    args->storage = STORAGE_AUTO;
+    args->prefetch = DEFAULT_PREFETCH;
+    args->treeDirectory = NULL;
+    args->treeCache = NULL;
+    args->watchDirectory = NULL;
+    args->watchOutput = NULL;
+    args->journal = NULL;
+    args->appendState = NULL;
+    args->tarFile = NULL;
+    args->copyTo = NULL;
+    args->tee = FALSE;
+    args->expect = NULL;
 
     // check if there are any argments given
     if (argc < 2)
@@ -78,6 +116,489 @@ ErrorCode ParseArgs(__out Args* args, __in int argc, __in LPWSTR argv[])
             continue;
         }
 
+        // --fail-fast
+        if (wcscmp(argv[i], L"--fail-fast") == 0)
+        {
+            args->failFast = TRUE;
+            continue;
+        }
+
+        // --with-size
+        if (wcscmp(argv[i], L"--with-size") == 0)
+        {
+            args->withSize = TRUE;
+            continue;
+        }
+
+        // -j, --jobs <n>, 0 uses one worker per logical processor
+        if (wcscmp(argv[i], L"-j") == 0 || wcscmp(argv[i], L"--jobs") == 0)
+        {
+            LPWSTR end = NULL;
+            if (i + 1 < argc)
+            {
+                long jobs = wcstol(argv[i + 1], &end, 10);
+                if (end != argv[i + 1] && *end == L'\0' && jobs >= 0 && jobs <= MAXIMUM_JOBS)
+                {
+                    args->jobs = (DWORD)jobs;
+                    ++i;
+                    continue;
+                }
+            }
+            PrintUsage(argv[0], L"invalid number of jobs");
+            status = PARSE_ARGS_INVALID_JOBS;
+            goto Cleanup;
+        }
+
+        // --order <size|input|fileid|physical>
+        if (wcscmp(argv[i], L"--order") == 0)
+        {
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"size") == 0)
+            {
+                args->order = ORDER_SIZE;
+                ++i;
+                continue;
+            }
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"input") == 0)
+            {
+                args->order = ORDER_INPUT;
+                ++i;
+                continue;
+            }
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"fileid") == 0)
+            {
+                args->order = ORDER_FILE_ID;
+                ++i;
+                continue;
+            }
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"physical") == 0)
+            {
+                args->order = ORDER_PHYSICAL;
+                ++i;
+                continue;
+            }
+            PrintUsage(argv[0], L"invalid order, use size, input, fileid or physical");
+            status = PARSE_ARGS_INVALID_ORDER;
+            goto Cleanup;
+        }
+
+        // --prefetch <n>, files opened ahead of the workers at most, 0 turns it off
+        if (wcscmp(argv[i], L"--prefetch") == 0)
+        {
+            LPWSTR end = NULL;
+            if (i + 1 < argc)
+            {
+                long prefetch = wcstol(argv[i + 1], &end, 10);
+                if (end != argv[i + 1] && *end == L'\0' && prefetch >= 0 && prefetch <= MAXIMUM_JOBS)
+                {
+                    args->prefetch = (DWORD)prefetch;
+                    ++i;
+                    continue;
+                }
+            }
+            PrintUsage(argv[0], L"invalid number of files to open ahead");
+            status = PARSE_ARGS_INVALID_PREFETCH;
+            goto Cleanup;
+        }
+
+        // --storage <auto|hdd|ssd>, overrides what is detected for every disk
+        if (wcscmp(argv[i], L"--storage") == 0)
+        {
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"auto") == 0)
+            {
+                args->storage = STORAGE_AUTO;
+                ++i;
+                continue;
+            }
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"hdd") == 0)
+            {
+                args->storage = STORAGE_ROTATIONAL;
+                ++i;
+                continue;
+            }
+            if (i + 1 < argc && wcscmp(argv[i + 1], L"ssd") == 0)
+            {
+                args->storage = STORAGE_SOLID_STATE;
+                ++i;
+                continue;
+            }
+            PrintUsage(argv[0], L"invalid storage, use auto, hdd or ssd");
+            status = PARSE_ARGS_INVALID_STORAGE;
+            goto Cleanup;
+        }
+
+        // --direct
+        if (wcscmp(argv[i], L"--direct") == 0)
+        {
+            args->direct = TRUE;
+            continue;
+        }
+
+        // --drop-cache
+        if (wcscmp(argv[i], L"--drop-cache") == 0)
+        {
+            args->dropCache = TRUE;
+            continue;
+        }
+
+        // --stats
+        if (wcscmp(argv[i], L"--stats") == 0)
+        {
+            args->showStats = TRUE;
+            continue;
+        }
+
+        // --serve
+        if (wcscmp(argv[i], L"--serve") == 0)
+        {
+            args->serve = TRUE;
+            continue;
+        }
+
+        // --daemon
+        if (wcscmp(argv[i], L"--daemon") == 0)
+        {
+            args->daemon = TRUE;
+            continue;
+        }
+
+        // --stop-daemon
+        if (wcscmp(argv[i], L"--stop-daemon") == 0)
+        {
+            args->stopDaemon = TRUE;
+            continue;
+        }
+
+        // --convert <from> <to>
+        if (wcscmp(argv[i], L"--convert") == 0)
+        {
+            if (i + 2 < argc)
+            {
+                args->convertFrom = argv[i + 1];
+                args->convertTo = argv[i + 2];
+                i += 2;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing manifest files to convert");
+                status = PARSE_ARGS_MISSING_CONVERT_FILES;
+                goto Cleanup;
+            }
+        }
+
+        // --diff <manifest> <dir>
+        if (wcscmp(argv[i], L"--diff") == 0)
+        {
+            if (i + 2 < argc)
+            {
+                args->diffManifest = argv[i + 1];
+                args->diffDirectory = argv[i + 2];
+                i += 2;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing manifest or directory to compare");
+                status = PARSE_ARGS_MISSING_DIFF_ARGUMENTS;
+                goto Cleanup;
+            }
+        }
+
+        // --tree-digest <dir>
+        if (wcscmp(argv[i], L"--tree-digest") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->treeDirectory = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing directory for the tree digest");
+                status = PARSE_ARGS_MISSING_TREE_DIRECTORY;
+                goto Cleanup;
+            }
+        }
+
+        // --tree-cache <file>
+        if (wcscmp(argv[i], L"--tree-cache") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->treeCache = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing tree cache file");
+                status = PARSE_ARGS_MISSING_TREE_CACHE;
+                goto Cleanup;
+            }
+        }
+
+        // --watch <dir>
+        if (wcscmp(argv[i], L"--watch") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->watchDirectory = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing directory to watch");
+                status = PARSE_ARGS_MISSING_WATCH_DIRECTORY;
+                goto Cleanup;
+            }
+        }
+
+        // --output <file>
+        if (wcscmp(argv[i], L"--output") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->watchOutput = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing output file");
+                status = PARSE_ARGS_MISSING_OUTPUT;
+                goto Cleanup;
+            }
+        }
+
+        // --journal <file>
+        if (wcscmp(argv[i], L"--journal") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->journal = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing journal file");
+                status = PARSE_ARGS_MISSING_JOURNAL;
+                goto Cleanup;
+            }
+        }
+
+        // --copy-to <file or directory>
+        if (wcscmp(argv[i], L"--copy-to") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->copyTo = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing destination for --copy-to");
+                status = PARSE_ARGS_MISSING_COPY_TO;
+                goto Cleanup;
+            }
+        }
+
+        // --tee
+        if (wcscmp(argv[i], L"--tee") == 0)
+        {
+            args->tee = TRUE;
+            continue;
+        }
+
+        // --expect <hash>
+        if (wcscmp(argv[i], L"--expect") == 0)
+        {
+            if (i + 1 < argc && wcslen(argv[i + 1]) == SHA256_DIGEST_LENGTH * 2 && wcsspn(argv[i + 1], L"0123456789abcdefABCDEF") == SHA256_DIGEST_LENGTH * 2)
+            {
+                args->expect = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"--expect needs a SHA-256 digest of 64 hex digits");
+                status = PARSE_ARGS_INVALID_EXPECT;
+                goto Cleanup;
+            }
+        }
+
+        // --tar <file>, - for stdin
+        if (wcscmp(argv[i], L"--tar") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->tarFile = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing tar archive");
+                status = PARSE_ARGS_MISSING_TAR;
+                goto Cleanup;
+            }
+        }
+
+        // --append-state <file>
+        if (wcscmp(argv[i], L"--append-state") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->appendState = argv[i + 1];
+                i++;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing append state file");
+                status = PARSE_ARGS_MISSING_APPEND_STATE;
+                goto Cleanup;
+            }
+        }
+
+        // --lookup <file>
+        if (wcscmp(argv[i], L"--lookup") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->lookup = argv[i + 1];
+                ++i;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing file to look up");
+                status = PARSE_ARGS_MISSING_LOOKUP_FILE;
+                goto Cleanup;
+            }
+        }
+
+        // --max-rate <bytes>[K|M|G], --max-iops <reads>, per second for the whole run
+        if (wcscmp(argv[i], L"--max-rate") == 0 || wcscmp(argv[i], L"--max-iops") == 0)
+        {
+            BOOL isRate = argv[i][6] == L'r';
+            LPWSTR end = NULL;
+            if (i + 1 < argc)
+            {
+                ULONGLONG limit = _wcstoui64(argv[i + 1], &end, 10);
+                if (isRate && (*end == L'K' || *end == L'k' || *end == L'M' || *end == L'm' || *end == L'G' || *end == L'g'))
+                {
+                    int shift = (*end == L'K' || *end == L'k') ? 10 : (*end == L'M' || *end == L'm') ? 20 : 30;
+                    limit = limit < (1ULL << (63 - shift)) ? limit << shift : 0;
+                    ++end;
+                }
+                if (end != argv[i + 1] && *end == L'\0' && limit > 0)
+                {
+                    (isRate ? &args->maxRate : &args->maxIops)->limit = limit;
+                    ++i;
+                    continue;
+                }
+            }
+            PrintUsage(argv[0], isRate ? L"invalid rate, use bytes per second with an optional K, M or G" : L"invalid number of reads per second");
+            status = PARSE_ARGS_INVALID_LIMIT;
+            goto Cleanup;
+        }
+
+        // --progress
+        if (wcscmp(argv[i], L"--progress") == 0)
+        {
+            args->progress = TRUE;
+            continue;
+        }
+
+        // --include <pattern>, --exclude <pattern>, both can be repeated
+        if (wcscmp(argv[i], L"--include") == 0 || wcscmp(argv[i], L"--exclude") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                FileList* pattern = malloc(sizeof(FileList));
+                if (pattern == NULL)
+                {
+                    wprintf(L"allocation for new pattern failed\n");
+                    status = PARSE_ARGS_ALLOCATE_ERROR;
+                    goto Cleanup;
+                }
+                FileList** patterns = argv[i][2] == L'i' ? &args->includes : &args->excludes;
+                pattern->file = argv[i + 1];
+                pattern->next = *patterns;
+                *patterns = pattern;
+                ++i;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing pattern");
+                status = PARSE_ARGS_MISSING_PATTERN;
+                goto Cleanup;
+            }
+        }
+
+        // --paths-from <file>
+        if (wcscmp(argv[i], L"--paths-from") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->pathsFrom = argv[i + 1];
+                ++i;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing path list");
+                status = PARSE_ARGS_MISSING_PATHS_FROM_FILE;
+                goto Cleanup;
+            }
+        }
+
+        // --pipe <name>
+        if (wcscmp(argv[i], L"--pipe") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->pipeName = argv[i + 1];
+                ++i;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing pipe name");
+                status = PARSE_ARGS_MISSING_PIPE_NAME;
+                goto Cleanup;
+            }
+        }
+
+        // -0, --null
+        if (wcscmp(argv[i], L"-0") == 0 || wcscmp(argv[i], L"--null") == 0)
+        {
+            args->nullDelimited = TRUE;
+            continue;
+        }
+
+        // --files-from <file>, - reads the list from stdin
+        if (wcscmp(argv[i], L"--files-from") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                args->filesFrom = argv[i + 1];
+                ++i;
+                continue;
+            }
+            else
+            {
+                PrintUsage(argv[0], L"missing file list");
+                status = PARSE_ARGS_MISSING_FILES_FROM_FILE;
+                goto Cleanup;
+            }
+        }
+
         // -c, --check <file>
         // checks for -c or --check and checks the following argument
         // fails when there is no other argument after -c
@@ -125,6 +646,20 @@ ErrorCode ParseArgs(__out Args* args, __in int argc, __in LPWSTR argv[])
         }
     }
 
+    // only the stream of --tee has a single digest to compare
+    if (args->expect != NULL && !args->tee)
+    {
+        PrintUsage(argv[0], L"--expect needs --tee");
+        status = PARSE_ARGS_INVALID_EXPECT;
+    }
+
+    // the watched manifest has no default place
+    if (args->watchDirectory != NULL && args->watchOutput == NULL)
+    {
+        PrintUsage(argv[0], L"missing output file for --watch");
+        status = PARSE_ARGS_MISSING_OUTPUT;
+    }
+
 Cleanup:
     return status;
 }
@@ -0,0 +1,203 @@
+#include <strsafe.h>
+#include <shlwapi.h>
+
+#include "sha256sum.h"
+
+#define BATCH_READ_BUFFER_SIZE 65536
+#define BATCH_MAX_PATH_BYTES (MAX_PATH * 3) // worst case of UTF-16 to UTF-8 growth
+#define BATCH_WINDOW 1024                   // paths in flight
+
+typedef struct list_entry_t
+{
+    WCHAR path[MAX_PATH];
+    WCHAR absFilePath[MAX_PATH];
+} ListEntry;
+
+typedef struct list_state_t
+{
+    HashPool* pool;
+    ListEntry* entries; // ring of BATCH_WINDOW, the slot of a job in the pool
+    ULONGLONG submitted;
+    ErrorCode status;   // of writing the output
+    BOOL stopped;       // writing failed, the rest of the list is not read
+} ListState;
+
+static BOOL PrintListResult(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    ListEntry* entry = (ListEntry*)job->context;
+    ListState* state = (ListState*)context;
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+
+    // CalcDigest already reported the failure, like PrintHash we go on with the next path
+    if (job->status != SUCCESS)
+    {
+        return TRUE;
+    }
+
+    FormatDigest(hash, job->digest);
+    state->status = WriteHashLine(args, entry->path, PathFindFileNameW(entry->path), entry->absFilePath, hash, job->hashedSize);
+    return state->status == SUCCESS;
+}
+
+// converts one UTF-8 path from the list and hands it to the pool right away
+static ErrorCode HashListEntry(__in Args* args, __inout ListState* state, __in LPSTR path, __in UINT pathLength)
+{
+    // paths from text files may end with \r
+    if (!args->nullDelimited && pathLength > 0 && path[pathLength - 1] == '\r')
+    {
+        --pathLength;
+    }
+
+    if (pathLength == 0)
+    {
+        return SUCCESS;
+    }
+
+    HashJob* job = ReserveHashJob(state->pool);
+    if (job == NULL)
+    {
+        state->stopped = TRUE; // by PrintListResult
+        return SUCCESS;
+    }
+
+    // the path that had the slot was reported
+    ListEntry* entry = &state->entries[state->submitted % BATCH_WINDOW];
+    int reqSize = MultiByteToWideChar(CP_UTF8, 0, path, pathLength, entry->path, MAX_PATH - 1);
+    if (reqSize == 0)
+    {
+        LogError(args, L"path in '%ls' is too long or not UTF-8, error: %lu\r\n", args->filesFrom, GetLastError());
+        return FILES_FROM_PATH_TOO_LONG;
+    }
+    entry->path[reqSize] = L'\0';
+
+    ErrorCode status = BuildFilePath(entry->path, PathFindFileNameW(entry->path), entry->absFilePath);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    job->file = entry->absFilePath;
+    job->context = entry;
+    SubmitHashJob(state->pool, job);
+    ++state->submitted;
+    return SUCCESS;
+}
+
+// reads the list in fixed chunks and queues every path as soon as its delimiter
+// was seen. The paths are hashed on the workers while the list is read, and at
+// most BATCH_WINDOW are in flight, so memory stays the same no matter how many
+// paths the list has
+ErrorCode HashFilesFrom(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ListState state = { NULL, NULL, 0, SUCCESS, FALSE };
+    HANDLE hList = INVALID_HANDLE_VALUE;
+    BOOL isStdin = wcscmp(args->filesFrom, L"-") == 0;
+    CHAR delimiter = args->nullDelimited ? '\0' : '\n';
+    DWORD dwBytesRead;
+    UINT pathLength = 0;
+
+    PBYTE buffer = malloc(BATCH_READ_BUFFER_SIZE);
+    LPSTR path = malloc(BATCH_MAX_PATH_BYTES);
+    state.entries = malloc(BATCH_WINDOW * sizeof(ListEntry));
+    if (buffer == NULL || path == NULL || state.entries == NULL)
+    {
+        status = FILES_FROM_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    if (isStdin)
+    {
+        hList = GetStdHandle(STD_INPUT_HANDLE);
+    }
+    else
+    {
+        hList = CreateFileW(args->filesFrom,
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+    }
+    if (hList == INVALID_HANDLE_VALUE || hList == NULL)
+    {
+        LogError(args, L"failed to open file list '%ls' with error: %lu\r\n", args->filesFrom, GetLastError());
+        status = FILES_FROM_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    status = StartHashPool(args, BATCH_WINDOW, PrintListResult, &state, &state.pool);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    while (TRUE)
+    {
+        if (!ReadFile(hList, buffer, BATCH_READ_BUFFER_SIZE, &dwBytesRead, NULL))
+        {
+            // the writing end of a pipe was closed, that is the end of the list
+            if (GetLastError() == ERROR_BROKEN_PIPE)
+            {
+                break;
+            }
+            LogError(args, L"failed to read file list '%ls' with error: %lu\r\n", args->filesFrom, GetLastError());
+            status = FILES_FROM_FAILED_TO_READ;
+            goto Cleanup;
+        }
+
+        if (dwBytesRead == 0)
+        {
+            break;
+        }
+
+        for (DWORD i = 0; i < dwBytesRead; i++)
+        {
+            if (buffer[i] == delimiter)
+            {
+                status = HashListEntry(args, &state, path, pathLength);
+                if (status != SUCCESS || state.stopped)
+                {
+                    goto Cleanup;
+                }
+                pathLength = 0;
+            }
+            else if (pathLength < BATCH_MAX_PATH_BYTES)
+            {
+                path[pathLength++] = buffer[i];
+            }
+            else
+            {
+                LogError(args, L"path in '%ls' is longer than %lu bytes\r\n", args->filesFrom, BATCH_MAX_PATH_BYTES);
+                status = FILES_FROM_PATH_TOO_LONG;
+                goto Cleanup;
+            }
+        }
+    }
+
+    // last path without trailing delimiter
+    status = HashListEntry(args, &state, path, pathLength);
+
+Cleanup:
+    // the paths queued before a failure are still hashed and printed
+    if (state.pool != NULL)
+    {
+        ErrorCode poolStatus = FinishHashPool(state.pool);
+        if (status == SUCCESS)
+        {
+            status = poolStatus != SUCCESS ? poolStatus : state.status;
+        }
+    }
+
+    if (!isStdin && hList != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hList);
+    }
+
+    free(buffer);
+    free(path);
+    free(state.entries);
+
+    return status;
+}
@@ -0,0 +1,56 @@
+# Time per run on a log that keeps growing, by default 2 GiB that grow by 16 MiB
+# between runs. Each step appends to the log and hashes it once without and once
+# with --append-state. Without the state every run reads the whole log; with it
+# a run reads only what was appended. The digests of both are compared on every
+# step.
+#
+#   .\bench\append.ps1 -Exe .\x64\Release\sha256sum.exe -Size 2GB -Step 16MB
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [long]$Size = 2GB,
+    [int]$Step = 16MB,
+    [int]$Steps = 5
+)
+
+$ErrorActionPreference = "Stop"
+
+$Exe = (Resolve-Path $Exe).Path
+$dir = Join-Path $env:TEMP "sha256sum-bench-append"
+$log = Join-Path $dir "growing.log"
+$state = Join-Path $dir "growing.state"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function Append([long]$bytes) {
+    $data = New-Object byte[] (64MB)
+    (New-Object Random ([int]($bytes % 1000))).NextBytes($data)
+    $stream = [IO.File]::Open($log, [IO.FileMode]::Append)
+    try {
+        for ($left = $bytes; $left -gt 0; $left -= $data.Length) {
+            $stream.Write($data, 0, [Math]::Min($left, $data.Length))
+        }
+    }
+    finally {
+        $stream.Close()
+    }
+}
+
+try {
+    Append $Size
+    & $Exe --append-state $state $log | Out-Null
+
+    for ($i = 1; $i -le $Steps; $i++) {
+        Append $Step
+        $full = $null
+        $resumed = $null
+        $tFull = Measure-Command { $full = & $Exe $log }
+        $tResumed = Measure-Command { $resumed = & $Exe --append-state $state $log }
+        if ($full -ne $resumed) {
+            throw "digests differ after step ${i}: $full <> $resumed"
+        }
+        "step {0}: full {1,8:N0} ms, resumed {2,8:N0} ms" -f $i, $tFull.TotalMilliseconds, $tResumed.TotalMilliseconds
+    }
+}
+finally {
+    Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+}
@@ -0,0 +1,56 @@
+# Throughput and file cache footprint of default, --direct and --drop-cache reads.
+# The standby counters show how much of the hashed data stays in memory and at
+# which priority, --drop-cache should move it from normal to the lowest priority.
+#
+#   .\bench\cache.ps1 -Exe .\x64\Release\sha256sum.exe -FileSize 4GB
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [long]$FileSize = 4GB
+)
+
+$ErrorActionPreference = "Stop"
+
+$dir = Join-Path $env:TEMP "sha256sum-bench-cache"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+$counters = @(
+    "\Memory\Cache Bytes",
+    "\Memory\Standby Cache Normal Priority Bytes",
+    "\Memory\Standby Cache Reserve Bytes"
+)
+
+function Sample() {
+    $values = @{}
+    (Get-Counter $counters).CounterSamples | ForEach-Object { $values[$_.Path.Split("\")[-1]] = $_.CookedValue }
+    $values
+}
+
+function Report([string]$name, [string[]]$options) {
+    $before = Sample
+    $t = Measure-Command { & $Exe @options big.bin | Out-Null }
+    $after = Sample
+    "{0,-20} {1,8:N0} MB/s" -f $name, ($FileSize / 1MB / $t.TotalSeconds)
+    foreach ($key in $before.Keys) {
+        "    {0,-45} {1,+10:N0} MB" -f $key, (($after[$key] - $before[$key]) / 1MB)
+    }
+}
+
+Push-Location $dir
+try {
+    $big = [IO.File]::Create((Join-Path $dir "big.bin"))
+    $chunk = New-Object byte[] 64MB
+    (New-Object Random 42).NextBytes($chunk)
+    for ($written = 0L; $written -lt $FileSize; $written += $chunk.Length) { $big.Write($chunk, 0, $chunk.Length) }
+    $big.Close()
+
+    # each run starts from the same state, --direct does not touch the cache
+    Report "--direct" @("--direct")
+    Report "--drop-cache" @("--drop-cache")
+    Report "default" @()
+    Report "default, warm" @()
+}
+finally {
+    Pop-Location
+    Remove-Item -Recurse -Force $dir
+}
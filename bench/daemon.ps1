@@ -0,0 +1,37 @@
+# Compares the end-to-end latency of hashing one small file by spawning
+# sha256sum.exe per file against sending the same request to a running daemon.
+#
+#   .\bench\daemon.ps1 -Exe .\x64\Release\sha256sum.exe -Iterations 500
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [int]$Iterations = 200
+)
+
+$ErrorActionPreference = "Stop"
+
+$dir = Join-Path $env:TEMP "sha256sum-bench-daemon"
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+$file = Join-Path $dir "small.bin"
+[IO.File]::WriteAllBytes($file, (New-Object byte[] 4096))
+
+$pipe = "\\.\pipe\sha256sum-bench"
+$server = Start-Process -FilePath $Exe -ArgumentList "--serve", "--pipe", $pipe -PassThru -WindowStyle Hidden
+Start-Sleep -Milliseconds 500
+
+try {
+    $spawn = Measure-Command {
+        for ($i = 0; $i -lt $Iterations; $i++) { & $Exe $file | Out-Null }
+    }
+    $daemon = Measure-Command {
+        for ($i = 0; $i -lt $Iterations; $i++) { & $Exe --daemon --pipe $pipe $file | Out-Null }
+    }
+
+    "{0,-24} {1,10:N1} us/request" -f "spawn", ($spawn.TotalMilliseconds * 1000 / $Iterations)
+    "{0,-24} {1,10:N1} us/request" -f "spawn + daemon", ($daemon.TotalMilliseconds * 1000 / $Iterations)
+    "in-process request latency over the pipe is logged by the fRunDaemon unit test"
+}
+finally {
+    & $Exe --stop-daemon --pipe $pipe | Out-Null
+    $server.WaitForExit(5000) | Out-Null
+    Remove-Item -Recurse -Force $dir
+}
@@ -0,0 +1,107 @@
+# Read pattern of --order input, fileid and physical on a fresh volume image.
+# The files are written in a shuffled order, so their names, file IDs and
+# clusters disagree. Every run starts from a freshly attached image to get a
+# cold cache. The seek distance is computed from the first cluster of each
+# file (fsutil) in the order the mode reads them. On a VHDX kept on a rotational
+# disk, the times show what that distance costs. Needs an elevated prompt for
+# diskpart.
+#
+#   .\bench\layout.ps1 -Exe .\x64\Release\sha256sum.exe -Files 2000 -FileSize 256KB
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [int]$Files = 2000,
+    [int]$FileSize = 256KB,
+    [int]$ImageSize = 2048 # MB
+)
+
+$ErrorActionPreference = "Stop"
+
+$Exe = (Resolve-Path $Exe).Path
+$dir = Join-Path $env:TEMP "sha256sum-bench-layout"
+$image = Join-Path $dir "layout.vhdx"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function DiskPart([string[]]$commands) {
+    $script = Join-Path $dir "diskpart.txt"
+    Set-Content -Encoding ASCII $script $commands
+    diskpart /s $script | Out-Null
+}
+
+function Attach() {
+    DiskPart @("select vdisk file=`"$image`"", "attach vdisk")
+    Start-Sleep -Seconds 2
+    (Get-DiskImage $image | Get-Disk | Get-Partition | Where-Object DriveLetter).DriveLetter + ":\"
+}
+
+function Detach() {
+    DiskPart @("select vdisk file=`"$image`"", "detach vdisk")
+}
+
+function FirstCluster([string]$file) {
+    $line = fsutil file queryextents $file 0 1 | Select-Object -First 1
+    if ($line -match "Lcn: (0x[0-9a-f]+)") { [long]$Matches[1] } else { -1 }
+}
+
+# clusters between the end of one file and the start of the next
+function SeekDistance([object[]]$order) {
+    $distance = 0L
+    $position = 0L
+    foreach ($file in $order) {
+        if ($file.Cluster -lt 0) { continue }
+        $distance += [Math]::Abs($file.Cluster - $position)
+        $position = $file.Cluster + $file.Clusters
+    }
+    $distance
+}
+
+try {
+    DiskPart @("create vdisk file=`"$image`" maximum=$ImageSize type=fixed", "select vdisk file=`"$image`"",
+               "attach vdisk", "create partition primary", "format fs=ntfs quick", "assign")
+    Start-Sleep -Seconds 2
+    $root = (Get-DiskImage $image | Get-Disk | Get-Partition | Where-Object DriveLetter).DriveLetter + ":\"
+
+    $data = New-Object byte[] $FileSize
+    $random = New-Object Random 42
+    $random.NextBytes($data)
+    $names = 0..($Files - 1) | ForEach-Object { "f{0:D7}.bin" -f $_ }
+    foreach ($name in ($names | Sort-Object { $random.Next() })) {
+        [IO.File]::WriteAllBytes((Join-Path $root $name), $data)
+    }
+
+    $clusterSize = 4096
+    $layout = foreach ($name in $names) {
+        $path = Join-Path $root $name
+        $id = (fsutil file queryfileid $path).Split(" ")[-1]
+        [PSCustomObject]@{
+            Name = $name
+            FileId = [Convert]::ToUInt64($id.Substring($id.Length - 12), 16) # MFT record, without the reuse count
+            Cluster = FirstCluster $path
+            Clusters = [Math]::Ceiling($FileSize / $clusterSize)
+        }
+    }
+    Detach
+
+    $modes = [ordered]@{
+        input = $layout
+        fileid = $layout | Sort-Object FileId
+        physical = $layout | Sort-Object Cluster
+    }
+
+    foreach ($mode in $modes.Keys) {
+        $root = Attach
+        Push-Location $root
+        try {
+            $t = Measure-Command { & $Exe -j 1 --order $mode *.bin | Out-Null }
+        }
+        finally {
+            Pop-Location
+            Detach
+        }
+        "{0,-10} {1,10:N0} ms {2,16:N0} clusters seeked" -f $mode, $t.TotalMilliseconds, (SeekDistance $modes[$mode])
+    }
+}
+finally {
+    Detach
+    Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+}
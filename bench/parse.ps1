@@ -0,0 +1,74 @@
+# Parse throughput of large text manifests. --convert reads the whole manifest
+# through the segment parser and writes an index, no file is opened or hashed.
+# The same manifest is converted on 1, 2, 4, ... processors by process affinity,
+# the parser still starts one thread per processor of the machine, so the rows
+# show how parsing scales with the cores it gets. The last rows convert
+# manifests of growing size on all processors. Every run is repeated and the
+# best one counts, after a first run that warms the cache.
+#
+#   .\bench\parse.ps1 -Exe .\x64\Release\sha256sum.exe -ManifestLines 5000000
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [int]$ManifestLines = 5000000,
+    [int]$Runs = 3
+)
+
+$ErrorActionPreference = "Stop"
+
+$Exe = (Resolve-Path $Exe).Path
+$dir = Join-Path $env:TEMP "sha256sum-bench-parse"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function WriteManifest([string]$name, [int]$lines) {
+    $writer = New-Object IO.StreamWriter (Join-Path $dir $name)
+    for ($i = 0; $i -lt $lines; $i++) {
+        $writer.Write("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *d{0:D4}\f{1:D8}.bin`r`n" -f ($i % 1000), $i)
+    }
+    $writer.Close()
+}
+
+function Convert([string]$manifest, [long]$mask) {
+    Remove-Item -Force PARSE.idx -ErrorAction SilentlyContinue
+    cmd.exe /c ('start "" /wait /affinity {0:X} "{1}" --convert {2} PARSE.idx' -f $mask, $Exe, $manifest) | Out-Null
+}
+
+# best of $Runs, converting on the processors in $mask
+function BestOf([string]$manifest, [long]$mask) {
+    Convert $manifest $mask
+    $best = [double]::MaxValue
+    for ($i = 0; $i -lt $Runs; $i++) {
+        $t = Measure-Command { Convert $manifest $mask }
+        $best = [Math]::Min($best, $t.TotalSeconds)
+    }
+    return $best
+}
+
+Push-Location $dir
+try {
+    $processors = [Environment]::ProcessorCount
+    $all = if ($processors -ge 63) { [long]::MaxValue } else { (1L -shl $processors) - 1 }
+
+    WriteManifest "PARSE.SHA256SUMS" $ManifestLines
+    $size = (Get-Item "PARSE.SHA256SUMS").Length
+
+    $single = 0
+    for ($cores = 1; $cores -le $processors; $cores *= 2) {
+        $mask = if ($cores -ge 63) { $all } else { (1L -shl $cores) - 1 }
+        $best = BestOf "PARSE.SHA256SUMS" $mask
+        if ($cores -eq 1) { $single = $best }
+        "{0,-24} {1,10:N0} ms {2,10:N0} MB/s {3,8:N2}x" -f ("{0} processors" -f $cores), ($best * 1000), ($size / 1MB / $best), ($single / $best)
+    }
+
+    # parsing time should grow with the manifest, not faster
+    foreach ($lines in @([int]($ManifestLines / 4), [int]($ManifestLines / 2), $ManifestLines)) {
+        $name = "PARSE{0}.SHA256SUMS" -f $lines
+        WriteManifest $name $lines
+        $best = BestOf $name $all
+        "{0,-24} {1,10:N0} ms {2,10:N0} MB/s" -f ("{0:N0} lines" -f $lines), ($best * 1000), ((Get-Item $name).Length / 1MB / $best)
+    }
+}
+finally {
+    Pop-Location
+    Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+}
@@ -0,0 +1,82 @@
+# Files per second on a cold cache small-file corpus, with and without opening
+# files ahead. The corpus lives on a VHDX that is detached and attached again
+# before every run, which drops its cached pages. Keep the image on solid state
+# storage, the prefetcher stays off on rotational disks. Needs an elevated
+# prompt for diskpart.
+#
+#   .\bench\prefetch.ps1 -Exe .\x64\Release\sha256sum.exe -Files 20000 -FileSize 16KB
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [int]$Files = 20000,
+    [int]$FileSize = 16KB,
+    [int]$ImageSize = 2048 # MB
+)
+
+$ErrorActionPreference = "Stop"
+
+$Exe = (Resolve-Path $Exe).Path
+$dir = Join-Path $env:TEMP "sha256sum-bench-prefetch"
+$image = Join-Path $dir "prefetch.vhdx"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function DiskPart([string[]]$commands) {
+    $script = Join-Path $dir "diskpart.txt"
+    Set-Content -Encoding ASCII $script $commands
+    diskpart /s $script | Out-Null
+}
+
+function Attach() {
+    DiskPart @("select vdisk file=`"$image`"", "attach vdisk")
+    Start-Sleep -Seconds 2
+    (Get-DiskImage $image | Get-Disk | Get-Partition | Where-Object DriveLetter).DriveLetter + ":\"
+}
+
+function Detach() {
+    DiskPart @("select vdisk file=`"$image`"", "detach vdisk")
+}
+
+function Report([string]$name, [string[]]$options) {
+    $root = Attach
+    Push-Location $root
+    try {
+        $t = Measure-Command { & $Exe @options -c SHA256SUMS | Out-Null }
+    }
+    finally {
+        Pop-Location
+        Detach
+    }
+    "{0,-20} {1,10:N0} ms {2,10:N0} files/s" -f $name, $t.TotalMilliseconds, ($Files / $t.TotalSeconds)
+}
+
+try {
+    DiskPart @("create vdisk file=`"$image`" maximum=$ImageSize type=fixed", "select vdisk file=`"$image`"",
+               "attach vdisk", "create partition primary", "format fs=ntfs quick", "assign")
+    Start-Sleep -Seconds 2
+    $root = (Get-DiskImage $image | Get-Disk | Get-Partition | Where-Object DriveLetter).DriveLetter + ":\"
+
+    $data = New-Object byte[] $FileSize
+    (New-Object Random 42).NextBytes($data)
+    for ($i = 0; $i -lt $Files; $i++) {
+        $data[0] = [byte]($i % 256)
+        [IO.File]::WriteAllBytes((Join-Path $root ("f{0:D7}.bin" -f $i)), $data)
+    }
+    Push-Location $root
+    try {
+        & $Exe *.bin | Set-Content -Encoding ASCII SHA256SUMS
+    }
+    finally {
+        Pop-Location
+    }
+    Detach
+
+    Report "--prefetch 0" @("--prefetch", "0")
+    Report "default" @()
+    Report "--prefetch 128" @("--prefetch", "128")
+    Report "-j 1 --prefetch 0" @("-j", "1", "--prefetch", "0")
+    Report "-j 1" @("-j", "1")
+}
+finally {
+    Detach
+    Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+}
@@ -0,0 +1,67 @@
+# Files per second verifying a corpus of tiny files, by default a million of 1 KiB,
+# spread over 1000 directories. Every run is repeated and the best one counts,
+# after a first run that warms the cache, so the time is opening, reading and
+# hashing and not the disk. Pass -BaselineExe with a build from before the
+# small file path to compare both on the same corpus.
+#
+#   .\bench\small.ps1 -Exe .\x64\Release\sha256sum.exe -BaselineExe .\old\sha256sum.exe
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [string]$BaselineExe = "",
+    [int]$Files = 1000000,
+    [int]$FileSize = 1KB,
+    [int]$Runs = 3
+)
+
+$ErrorActionPreference = "Stop"
+
+$Exe = (Resolve-Path $Exe).Path
+$dir = Join-Path $env:TEMP "sha256sum-bench-small"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function Report([string]$name, [string]$exe, [string[]]$options) {
+    & $exe @options -c SHA256SUMS | Out-Null
+    $best = [double]::MaxValue
+    for ($i = 0; $i -lt $Runs; $i++) {
+        $t = Measure-Command { & $exe @options -c SHA256SUMS | Out-Null }
+        $best = [Math]::Min($best, $t.TotalSeconds)
+    }
+    "{0,-24} {1,10:N0} ms {2,10:N0} files/s" -f $name, ($best * 1000), ($Files / $best)
+}
+
+try {
+    $data = New-Object byte[] $FileSize
+    (New-Object Random 42).NextBytes($data)
+    $list = New-Object Collections.Generic.List[string]
+    for ($i = 0; $i -lt $Files; $i++) {
+        $sub = Join-Path $dir ("d{0:D4}" -f ($i % 1000))
+        if ($i -lt 1000) {
+            New-Item -ItemType Directory -Force -Path $sub | Out-Null
+        }
+        $file = Join-Path $sub ("f{0:D7}.bin" -f $i)
+        $data[0] = [byte]($i % 256)
+        [IO.File]::WriteAllBytes($file, $data)
+        $list.Add($file)
+    }
+
+    Push-Location $dir
+    try {
+        [IO.File]::WriteAllLines((Join-Path $dir "list.txt"), $list)
+        & $Exe --files-from list.txt | Set-Content -Encoding ASCII SHA256SUMS
+
+        Report "default" $Exe @()
+        Report "-j 1" $Exe @("-j", "1")
+        if ($BaselineExe -ne "") {
+            $BaselineExe = (Resolve-Path $BaselineExe).Path
+            Report "baseline" $BaselineExe @()
+            Report "baseline -j 1" $BaselineExe @("-j", "1")
+        }
+    }
+    finally {
+        Pop-Location
+    }
+}
+finally {
+    Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+}
@@ -0,0 +1,89 @@
+# Benchmarks for --check on large manifests.
+#
+#   .\bench\verify.ps1 -Exe .\x64\Release\sha256sum.exe -Files 2000 -FileSize 1MB
+param(
+    [string]$Exe = ".\x64\Release\sha256sum.exe",
+    [int]$Files = 2000,
+    [int]$FileSize = 1MB,
+    [long]$BigFileSize = 4GB,
+    [int]$ManifestLines = 5000000
+)
+
+$ErrorActionPreference = "Stop"
+
+$dir = Join-Path $env:TEMP "sha256sum-bench-verify"
+Remove-Item -Recurse -Force $dir -ErrorAction SilentlyContinue
+New-Item -ItemType Directory -Force -Path $dir | Out-Null
+
+function Report([string]$name, [scriptblock]$block) {
+    $t = Measure-Command $block
+    "{0,-40} {1,10:N0} ms" -f $name, $t.TotalMilliseconds
+}
+
+Push-Location $dir
+try {
+    $data = New-Object byte[] $FileSize
+    (New-Object Random 42).NextBytes($data)
+    for ($i = 0; $i -lt $Files; $i++) {
+        $data[0] = [byte]($i % 256)
+        [IO.File]::WriteAllBytes((Join-Path $dir ("f{0:D7}.bin" -f $i)), $data)
+    }
+    & $Exe --with-size *.bin | Set-Content -Encoding ASCII SHA256SUMS
+
+    # one corrupted file in the middle of the manifest, same size
+    $victim = Join-Path $dir ("f{0:D7}.bin" -f [int]($Files / 2))
+    $bytes = [IO.File]::ReadAllBytes($victim)
+    $bytes[$bytes.Length - 1] = $bytes[$bytes.Length - 1] -bxor 0xff
+    [IO.File]::WriteAllBytes($victim, $bytes)
+
+    Report "check, corrupted content" { & $Exe -q -c SHA256SUMS | Out-Null }
+    Report "check --fail-fast, corrupted content" { & $Exe -q --fail-fast -c SHA256SUMS | Out-Null }
+
+    # the same file truncated, the size in the manifest catches it without reading
+    [IO.File]::WriteAllBytes($victim, $bytes[0..($bytes.Length - 2)])
+
+    Report "check, truncated file" { & $Exe -q -c SHA256SUMS | Out-Null }
+    Report "check --fail-fast, truncated file" { & $Exe -q --fail-fast -c SHA256SUMS | Out-Null }
+
+    # skewed corpus, one big file listed after all the small ones
+    & $Exe *.bin | Set-Content -Encoding ASCII SHA256SUMS
+    $big = [IO.File]::Create((Join-Path $dir "zzz_big.bin"))
+    $chunk = New-Object byte[] 64MB
+    for ($written = 0L; $written -lt $BigFileSize; $written += $chunk.Length) { $big.Write($chunk, 0, $chunk.Length) }
+    $big.Close()
+    & $Exe zzz_big.bin | Add-Content -Encoding ASCII SHA256SUMS
+
+    Report "check -j 1, skewed" { & $Exe -q -j 1 -c SHA256SUMS | Out-Null }
+    Report "check --order input, skewed" { & $Exe -q --order input -c SHA256SUMS | Out-Null }
+    Report "check --order size, skewed" { & $Exe -q --order size -c SHA256SUMS | Out-Null }
+
+    # huge manifest, time to the first OK line and peak memory stay flat
+    $line = (& $Exe f0000000.bin) + "`n"
+    $writer = New-Object IO.StreamWriter (Join-Path $dir "HUGE.SHA256SUMS")
+    for ($i = 0; $i -lt $ManifestLines; $i++) { $writer.Write($line) }
+    $writer.Close()
+
+    $watch = [Diagnostics.Stopwatch]::StartNew()
+    $process = New-Object Diagnostics.Process
+    $process.StartInfo.FileName = (Resolve-Path $Exe)
+    $process.StartInfo.Arguments = "-c HUGE.SHA256SUMS"
+    $process.StartInfo.WorkingDirectory = $dir
+    $process.StartInfo.UseShellExecute = $false
+    $process.StartInfo.RedirectStandardOutput = $true
+    $process.Start() | Out-Null
+    $process.StandardOutput.ReadLine() | Out-Null
+    $first = $watch.ElapsedMilliseconds
+    $peak = 0
+    while (-not $process.HasExited) {
+        $process.Refresh()
+        $peak = [Math]::Max($peak, $process.PeakWorkingSet64)
+        $process.StandardOutput.ReadLine() | Out-Null
+    }
+    "{0,-40} {1,10:N0} ms" -f "check huge manifest, first line", $first
+    "{0,-40} {1,10:N0} ms" -f "check huge manifest, total", $watch.ElapsedMilliseconds
+    "{0,-40} {1,10:N0} MB" -f "check huge manifest, peak working set", ($peak / 1MB)
+}
+finally {
+    Pop-Location
+    Remove-Item -Recurse -Force $dir
+}
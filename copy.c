@@ -0,0 +1,403 @@
+#include <strsafe.h>
+#include <shlwapi.h>
+
+#include "sha256sum.h"
+
+#define COPY_BUFFER_SIZE (4 * 1024 * 1024)
+#define COPY_SECTOR_ALIGNMENT 4096 // --direct reads whole sectors
+
+// Reads into one buffer and hashes it while a writer thread writes the other,
+// so the data is read once and written from the same memory it was hashed in.
+// Both buffers and the thread are kept for all files of the run.
+typedef struct copy_pump_t
+{
+    Args* args;
+    PBYTE buffers[2];
+    HANDLE hOutput;
+    PBYTE pending; // handed to the writer, NULL stops it
+    DWORD pendingSize;
+    BOOL writing;
+    DWORD writeError;
+    HANDLE ready;
+    HANDLE done;
+    HANDLE thread;
+} CopyPump;
+
+static DWORD WINAPI CopyWriter(__in LPVOID parameter)
+{
+    CopyPump* pump = (CopyPump*)parameter;
+
+    while (WaitForSingleObject(pump->ready, INFINITE) == WAIT_OBJECT_0 && pump->pending != NULL)
+    {
+        // a pipe may take less than it was given
+        for (DWORD offset = 0; offset < pump->pendingSize && pump->writeError == ERROR_SUCCESS;)
+        {
+            DWORD written = 0;
+            if (!WriteFile(pump->hOutput, pump->pending + offset, pump->pendingSize - offset, &written, NULL))
+            {
+                pump->writeError = GetLastError();
+            }
+            offset += written;
+        }
+        SetEvent(pump->done);
+    }
+    return 0;
+}
+
+static ErrorCode StartPump(__in Args* args, __out CopyPump* pump)
+{
+    ZeroMemory(pump, sizeof(*pump));
+    pump->args = args;
+
+    // page aligned, so --direct can read into them
+    for (int i = 0; i < 2; i++)
+    {
+        pump->buffers[i] = VirtualAlloc(NULL, COPY_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (pump->buffers[i] == NULL)
+        {
+            return COPY_ALLOCATE_ERROR;
+        }
+    }
+
+    pump->ready = CreateEventW(NULL, FALSE, FALSE, NULL);
+    pump->done = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (pump->ready == NULL || pump->done == NULL)
+    {
+        return COPY_ALLOCATE_ERROR;
+    }
+
+    pump->thread = CreateThread(NULL, 0, CopyWriter, pump, 0, NULL);
+    if (pump->thread == NULL)
+    {
+        return COPY_ALLOCATE_ERROR;
+    }
+    return SUCCESS;
+}
+
+// waits until the writer is done with the buffer it was handed
+static void WaitWriter(__inout CopyPump* pump)
+{
+    if (pump->writing)
+    {
+        WaitForSingleObject(pump->done, INFINITE);
+        pump->writing = FALSE;
+    }
+}
+
+static void StopPump(__inout CopyPump* pump)
+{
+    if (pump->thread != NULL)
+    {
+        WaitWriter(pump);
+        pump->pending = NULL;
+        SetEvent(pump->ready);
+        WaitForSingleObject(pump->thread, INFINITE);
+        CloseHandle(pump->thread);
+    }
+    if (pump->ready != NULL)
+    {
+        CloseHandle(pump->ready);
+    }
+    if (pump->done != NULL)
+    {
+        CloseHandle(pump->done);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (pump->buffers[i] != NULL)
+        {
+            VirtualFree(pump->buffers[i], 0, MEM_RELEASE);
+        }
+    }
+}
+
+// Copies hInput to hOutput and hashes what was written. isPipe ends at a
+// closed pipe and leaves out the rate limits, which are for files. size is
+// what is left of a file, the rate limit is charged for the reads up to it.
+// copied is the number of bytes written and hashed.
+static ErrorCode Pump(__inout CopyPump* pump, __in HANDLE hInput, __in BOOL isPipe, __in ULONGLONG size, __in LPCWSTR name, __in HANDLE hOutput, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __out ULONGLONG* copied)
+{
+    Args* args = pump->args;
+    StreamHash* hash = NULL;
+    int current = 0;
+
+    ErrorCode status = CreateStreamHash(args, &hash);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    pump->hOutput = hOutput;
+    pump->writeError = ERROR_SUCCESS;
+    *copied = 0;
+
+    while (status == SUCCESS)
+    {
+        DWORD dwBytesRead = 0;
+        PBYTE buffer = pump->buffers[current];
+
+        // the last read of a file asks up to the sector past its end, so the
+        // short read that proves the end is not charged as a full buffer
+        DWORD request = isPipe || size >= COPY_BUFFER_SIZE
+            ? COPY_BUFFER_SIZE
+            : (DWORD)((size + 1 + COPY_SECTOR_ALIGNMENT - 1) & ~(ULONGLONG)(COPY_SECTOR_ALIGNMENT - 1));
+        if (!isPipe)
+        {
+            ThrottleRead(args, request);
+        }
+        if (!ReadFile(hInput, buffer, request, &dwBytesRead, NULL))
+        {
+            if (!isPipe || GetLastError() != ERROR_BROKEN_PIPE)
+            {
+                LogError(args, L"failed to read '%ls' with error: %lu\r\n", name, GetLastError());
+                status = COPY_FAILED_TO_READ;
+            }
+            break;
+        }
+        if (dwBytesRead == 0)
+        {
+            break;
+        }
+        InterlockedAddNoFence64(&runStats.bytesRead, dwBytesRead);
+        size = size > dwBytesRead ? size - dwBytesRead : 0;
+
+        // hashed while the writer still writes the other buffer
+        status = StreamHashData(args, hash, buffer, dwBytesRead);
+        WaitWriter(pump);
+        if (status != SUCCESS || pump->writeError != ERROR_SUCCESS)
+        {
+            break;
+        }
+
+        *copied += dwBytesRead;
+        pump->pending = buffer;
+        pump->pendingSize = dwBytesRead;
+        pump->writing = TRUE;
+        SetEvent(pump->ready);
+        current ^= 1;
+    }
+
+    WaitWriter(pump);
+    if (status == SUCCESS && pump->writeError != ERROR_SUCCESS)
+    {
+        LogError(args, L"failed to write the copy of '%ls' with error: %lu\r\n", name, pump->writeError);
+        status = COPY_FAILED_TO_WRITE;
+    }
+    if (status == SUCCESS)
+    {
+        status = FinishStreamHash(args, hash, digest);
+    }
+
+    FreeStreamHash(hash);
+    return status;
+}
+
+// Copies one file to target through a temporary file next to it, which is
+// moved over target once it is complete. The copy keeps the last write time.
+static ErrorCode CopyOne(__inout CopyPump* pump, __in LPWSTR source, __in LPWSTR target)
+{
+    Args* args = pump->args;
+    HANDLE hSource = INVALID_HANDLE_VALUE;
+    HANDLE hTarget = INVALID_HANDLE_VALUE;
+    WCHAR absTarget[MAX_PATH];
+    WCHAR temporary[MAX_PATH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+    ULONGLONG copied;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    LARGE_INTEGER size;
+    FILETIME lastWrite;
+    ErrorCode status = SUCCESS;
+
+    // a result of MAX_PATH or more is the size that would have been needed, absTarget is not filled
+    DWORD length = GetFullPathNameW(target, MAX_PATH, absTarget, NULL);
+    if (length == 0 || length >= MAX_PATH
+        || FAILED(StringCchPrintfW(temporary, _countof(temporary), L"%ls.tmp", absTarget)))
+    {
+        return PRINT_HASH_FAILED_GET_FULL_PATH_NAME;
+    }
+
+    ProgressStartFile(source);
+    hSource = OpenFileForHashing(args, source);
+    if (hSource == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", source, GetLastError());
+        status = COPY_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    hTarget = CreateFileW(temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hTarget == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to create '%ls' with error: %lu\r\n", temporary, GetLastError());
+        status = COPY_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    // reserve the space up front, the file system can then place it in one piece
+    if (GetFileSizeEx(hSource, &size))
+    {
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize = size;
+        SetFileInformationByHandle(hTarget, FileAllocationInfo, &allocation, sizeof(allocation));
+    }
+    else
+    {
+        size.QuadPart = MAXLONGLONG; // full reads until the end
+    }
+
+    status = Pump(pump, hSource, FALSE, (ULONGLONG)size.QuadPart, source, hTarget, digest, &copied);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    if (GetFileTime(hSource, NULL, NULL, &lastWrite))
+    {
+        SetFileTime(hTarget, NULL, NULL, &lastWrite);
+    }
+    CloseHandle(hTarget);
+    hTarget = INVALID_HANDLE_VALUE;
+
+    if (!MoveFileExW(temporary, absTarget, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        LogError(args, L"failed to replace '%ls' with error: %lu\r\n", absTarget, GetLastError());
+        status = COPY_FAILED_TO_WRITE;
+        goto Cleanup;
+    }
+
+    // the line of the copy, as if it had been passed as FILE
+    InterlockedIncrementNoFence64(&runStats.filesHashed);
+    FormatDigest(hash, digest);
+    status = WriteHashLine(args, target, PathFindFileNameW(target), absTarget, hash, copied);
+
+Cleanup:
+    if (hSource != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hSource);
+    }
+    if (hTarget != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hTarget);
+        DeleteFileW(temporary);
+    }
+    return status;
+}
+
+// Copies the FILE arguments to args->copyTo and prints the digests of the
+// copies, reading every file once. copyTo is a directory, or the target file
+// when a single file is copied.
+ErrorCode CopyFiles(__in Args* args)
+{
+    CopyPump pump;
+    WCHAR source[MAX_PATH];
+    WCHAR target[MAX_PATH];
+
+    DWORD attributes = GetFileAttributesW(args->copyTo);
+    size_t length = wcslen(args->copyTo);
+    BOOL isDirectory = (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        || (length > 0 && (args->copyTo[length - 1] == L'\\' || args->copyTo[length - 1] == L'/'));
+
+    // a second file would overwrite the first, before anything was copied
+    if (!isDirectory && args->files != NULL && (args->files->next != NULL || wcspbrk(args->files->file, L"*?") != NULL))
+    {
+        LogError(args, L"'%ls' is not a directory, it can only take one file\r\n", args->copyTo, 0);
+        return COPY_FAILED_TO_OPEN;
+    }
+
+    ErrorCode status = StartPump(args, &pump);
+
+    for (FileList* current = args->files; current != NULL && status == SUCCESS; current = current->next)
+    {
+        WIN32_FIND_DATAW findFileData;
+        HANDLE hFind = FindFirstFileW(current->file, &findFileData);
+        if (hFind == INVALID_HANDLE_VALUE)
+        {
+            LogError(args, L"failed to find files for argument '%ls' with error %lu\r\n", current->file, GetLastError());
+            status = MAIN_FAILED_TO_FIND_FILES;
+            break;
+        }
+
+        do
+        {
+            if (findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                continue;
+            }
+
+            status = BuildFilePath(current->file, findFileData.cFileName, source);
+            if (status == SUCCESS)
+            {
+                if (isDirectory)
+                {
+                    PathCombineW(target, args->copyTo, findFileData.cFileName);
+                }
+                else
+                {
+                    StringCchCopyW(target, _countof(target), args->copyTo);
+                }
+                status = CopyOne(&pump, source, target);
+            }
+        } while (status == SUCCESS && FindNextFileW(hFind, &findFileData) != 0);
+
+        FindClose(hFind);
+    }
+
+    StopPump(&pump);
+    return status;
+}
+
+// Passes stdin through to stdout and hashes it on the way. The digest goes to
+// stderr, with --expect only whether it matched.
+ErrorCode TeeStdin(__in Args* args)
+{
+    CopyPump pump;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR message[SHA256_DIGEST_LENGTH * 2 + 16];
+    ULONGLONG copied;
+
+    ErrorCode status = StartPump(args, &pump);
+    if (status == SUCCESS)
+    {
+        status = Pump(&pump, GetStdHandle(STD_INPUT_HANDLE), TRUE, 0, L"-", GetStdHandle(STD_OUTPUT_HANDLE), digest, &copied);
+    }
+    StopPump(&pump);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+    InterlockedIncrementNoFence64(&runStats.filesHashed);
+
+    if (args->expect != NULL)
+    {
+        CHAR expectedHash[SHA256_DIGEST_LENGTH * 2 + 1];
+        BYTE expected[SHA256_DIGEST_LENGTH];
+        for (int i = 0; i <= SHA256_DIGEST_LENGTH * 2; i++)
+        {
+            expectedHash[i] = (CHAR)args->expect[i];
+        }
+
+        BOOL matched = ParseDigest(expectedHash, expected) && memcmp(digest, expected, SHA256_DIGEST_LENGTH) == 0;
+        if (!matched)
+        {
+            status = CHECK_SUM_CHECKSUM_FAILED;
+        }
+        if (args->status || (matched && args->quiet))
+        {
+            return status;
+        }
+        StringCchCopyW(message, _countof(message), matched ? L"-: OK\r\n" : L"-: FAILED\r\n");
+    }
+    else
+    {
+        if (args->status)
+        {
+            return status;
+        }
+        FormatDigest(message, digest);
+        StringCchCatW(message, _countof(message), L" *-\r\n");
+    }
+
+    // a redirected stderr is where a pipeline usually collects the digest
+    WriteStderr(message);
+    return status;
+}
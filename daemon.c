@@ -0,0 +1,551 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define DAEMON_DEFAULT_PIPE_NAME L"\\\\.\\pipe\\sha256sum"
+#define DAEMON_MAGIC 0x64363532 // "256d"
+#define DAEMON_OP_HASH 1
+#define DAEMON_OP_SHUTDOWN 2
+#define DAEMON_PIPE_BUFFER_SIZE 4096
+#define DAEMON_CONNECT_TIMEOUT 2000
+#define DAEMON_CACHE_BUCKETS 4096
+#define DAEMON_CACHE_MAX_ENTRIES 1000000
+#define DAEMON_MAX_PATH 32767
+#define DAEMON_CANCEL_INTERVAL 50 // ms between cancelling the reads of idle clients on shutdown
+
+// Every request on the pipe is a DaemonRequest directly followed by pathLength
+// UTF-16 characters without a terminating zero, the daemon answers each one with
+// a DaemonResponse. A client may send any number of requests over one connection.
+typedef struct daemon_request_t
+{
+    DWORD magic;
+    WORD op;
+    WORD pathLength;
+} DaemonRequest;
+
+typedef struct daemon_response_t
+{
+    DWORD magic;
+    DWORD status;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG size; // bytes that went into digest
+    DWORD openError; // Win32 error when the file could not be opened
+} DaemonResponse;
+
+// digests are cached by file identity and the metadata that changes on writes,
+// the path is not part of the key so renamed or hardlinked files hit as well
+typedef struct daemon_cache_entry_t
+{
+    DWORD volumeSerialNumber;
+    DWORD fileIndexHigh;
+    DWORD fileIndexLow;
+    DWORD fileSizeHigh;
+    DWORD fileSizeLow;
+    FILETIME lastWriteTime;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    struct daemon_cache_entry_t* next;
+} DaemonCacheEntry;
+
+typedef struct daemon_client_t
+{
+    Args* args;
+    HANDLE hPipe;
+    struct daemon_client_t* next;
+    struct daemon_client_t* prev;
+} DaemonClient;
+
+static DaemonCacheEntry* cache[DAEMON_CACHE_BUCKETS];
+static LONG cacheEntries = 0;
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+
+static volatile LONG stopping = FALSE;
+
+// connections being served, the shutdown cancels their pending reads
+static DaemonClient* liveClients = NULL;
+static SRWLOCK clientsLock = SRWLOCK_INIT;
+
+// connection of this thread to the daemon, kept open for all its requests of a
+// run. Every -j worker has its own, the daemon serves each on its own thread.
+static __declspec(thread) HANDLE hDaemonPipe = INVALID_HANDLE_VALUE;
+
+static LPCWSTR PipeName(__in Args* args)
+{
+    return args->pipeName != NULL ? args->pipeName : DAEMON_DEFAULT_PIPE_NAME;
+}
+
+static BOOL ReadExact(__in HANDLE handle, __out_ecount(size) PBYTE buffer, __in DWORD size)
+{
+    DWORD total = 0;
+    while (total < size)
+    {
+        DWORD dwBytesRead = 0;
+        if (!ReadFile(handle, buffer + total, size - total, &dwBytesRead, NULL) || dwBytesRead == 0)
+        {
+            return FALSE;
+        }
+        total += dwBytesRead;
+    }
+    return TRUE;
+}
+
+static BOOL WriteExact(__in HANDLE handle, __in PBYTE buffer, __in DWORD size)
+{
+    DWORD total = 0;
+    while (total < size)
+    {
+        DWORD dwBytesWritten = 0;
+        if (!WriteFile(handle, buffer + total, size - total, &dwBytesWritten, NULL))
+        {
+            return FALSE;
+        }
+        total += dwBytesWritten;
+    }
+    return TRUE;
+}
+
+static DWORD CacheBucket(__in BY_HANDLE_FILE_INFORMATION* info)
+{
+    ULONGLONG key = ((ULONGLONG)info->nFileIndexHigh << 32 | info->nFileIndexLow) ^ info->dwVolumeSerialNumber;
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 32;
+    return (DWORD)(key % DAEMON_CACHE_BUCKETS);
+}
+
+static BOOL CacheMatches(__in DaemonCacheEntry* entry, __in BY_HANDLE_FILE_INFORMATION* info)
+{
+    return entry->volumeSerialNumber == info->dwVolumeSerialNumber
+        && entry->fileIndexHigh == info->nFileIndexHigh
+        && entry->fileIndexLow == info->nFileIndexLow
+        && entry->fileSizeHigh == info->nFileSizeHigh
+        && entry->fileSizeLow == info->nFileSizeLow
+        && entry->lastWriteTime.dwHighDateTime == info->ftLastWriteTime.dwHighDateTime
+        && entry->lastWriteTime.dwLowDateTime == info->ftLastWriteTime.dwLowDateTime;
+}
+
+static BOOL CacheLookup(__in BY_HANDLE_FILE_INFORMATION* info, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    BOOL found = FALSE;
+
+    AcquireSRWLockShared(&cacheLock);
+    for (DaemonCacheEntry* entry = cache[CacheBucket(info)]; entry != NULL; entry = entry->next)
+    {
+        if (CacheMatches(entry, info))
+        {
+            memcpy(digest, entry->digest, SHA256_DIGEST_LENGTH);
+            found = TRUE;
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&cacheLock);
+
+    return found;
+}
+
+static void CacheInsert(__in BY_HANDLE_FILE_INFORMATION* info, __in PBYTE digest)
+{
+    DWORD bucket = CacheBucket(info);
+
+    AcquireSRWLockExclusive(&cacheLock);
+
+    // an older version of the same file is updated in place
+    for (DaemonCacheEntry* entry = cache[bucket]; entry != NULL; entry = entry->next)
+    {
+        if (entry->volumeSerialNumber == info->dwVolumeSerialNumber
+            && entry->fileIndexHigh == info->nFileIndexHigh
+            && entry->fileIndexLow == info->nFileIndexLow)
+        {
+            entry->fileSizeHigh = info->nFileSizeHigh;
+            entry->fileSizeLow = info->nFileSizeLow;
+            entry->lastWriteTime = info->ftLastWriteTime;
+            memcpy(entry->digest, digest, SHA256_DIGEST_LENGTH);
+            goto Cleanup;
+        }
+    }
+
+    if (cacheEntries >= DAEMON_CACHE_MAX_ENTRIES)
+    {
+        goto Cleanup;
+    }
+
+    DaemonCacheEntry* entry = malloc(sizeof(DaemonCacheEntry));
+    if (entry == NULL)
+    {
+        goto Cleanup;
+    }
+    entry->volumeSerialNumber = info->dwVolumeSerialNumber;
+    entry->fileIndexHigh = info->nFileIndexHigh;
+    entry->fileIndexLow = info->nFileIndexLow;
+    entry->fileSizeHigh = info->nFileSizeHigh;
+    entry->fileSizeLow = info->nFileSizeLow;
+    entry->lastWriteTime = info->ftLastWriteTime;
+    memcpy(entry->digest, digest, SHA256_DIGEST_LENGTH);
+    entry->next = cache[bucket];
+    cache[bucket] = entry;
+    ++cacheEntries;
+
+Cleanup:
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+static ErrorCode HandleHashRequest(__in Args* args, __in LPWSTR path, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __out ULONGLONG* hashed, __out DWORD* openError)
+{
+    ErrorCode status = SUCCESS;
+    BY_HANDLE_FILE_INFORMATION info;
+    FileFacts facts;
+
+    HANDLE hFile = OpenFileForHashing(args, path);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        *openError = GetLastError();
+        LogError(args, L"failed to open file '%ls' with error: %lu\r\n", path, *openError);
+        return CALC_HASH_FAILED_TO_OPEN_FILE;
+    }
+
+    BOOL hasInfo = GetFileInformationByHandle(hFile, &info);
+    facts.known = TRUE;
+    facts.size = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    facts.attributes = info.dwFileAttributes;
+    if (hasInfo && CacheLookup(&info, digest))
+    {
+        *hashed = facts.size;
+        goto Cleanup;
+    }
+
+    status = HashHandle(args, hFile, hasInfo ? &facts : NULL, digest, hashed);
+    if (status == SUCCESS && hasInfo && *hashed == facts.size)
+    {
+        CacheInsert(&info, digest);
+    }
+
+Cleanup:
+    CloseHandle(hFile);
+    return status;
+}
+
+static void AddClient(__inout DaemonClient* client)
+{
+    AcquireSRWLockExclusive(&clientsLock);
+    client->prev = NULL;
+    client->next = liveClients;
+    if (liveClients != NULL)
+    {
+        liveClients->prev = client;
+    }
+    liveClients = client;
+    ReleaseSRWLockExclusive(&clientsLock);
+}
+
+static void RemoveClient(__inout DaemonClient* client)
+{
+    AcquireSRWLockExclusive(&clientsLock);
+    if (client->prev != NULL)
+    {
+        client->prev->next = client->next;
+    }
+    else
+    {
+        liveClients = client->next;
+    }
+    if (client->next != NULL)
+    {
+        client->next->prev = client->prev;
+    }
+    ReleaseSRWLockExclusive(&clientsLock);
+}
+
+// Cancels the pipe reads of all clients still connected, an idle client blocks
+// in ReadExact until it sends its next request. Returns FALSE once none is left.
+static BOOL CancelClients(void)
+{
+    AcquireSRWLockShared(&clientsLock);
+    BOOL live = liveClients != NULL;
+    for (DaemonClient* client = liveClients; client != NULL; client = client->next)
+    {
+        CancelIoEx(client->hPipe, NULL);
+    }
+    ReleaseSRWLockShared(&clientsLock);
+
+    return live;
+}
+
+static void CALLBACK ServeClient(__inout PTP_CALLBACK_INSTANCE instance, __inout_opt PVOID context)
+{
+    DaemonClient* client = (DaemonClient*)context;
+    WCHAR path[DAEMON_MAX_PATH + 1];
+
+    UNREFERENCED_PARAMETER(instance);
+
+    while (!stopping)
+    {
+        DaemonRequest request;
+        DaemonResponse response = { 0 };
+
+        if (!ReadExact(client->hPipe, (PBYTE)&request, sizeof(request)))
+        {
+            break; // client went away
+        }
+
+        if (request.magic != DAEMON_MAGIC || request.pathLength > DAEMON_MAX_PATH)
+        {
+            break;
+        }
+
+        if (!ReadExact(client->hPipe, (PBYTE)path, request.pathLength * sizeof(WCHAR)))
+        {
+            break;
+        }
+        path[request.pathLength] = L'\0';
+
+        response.magic = DAEMON_MAGIC;
+        switch (request.op)
+        {
+        case DAEMON_OP_HASH:
+            response.status = HandleHashRequest(client->args, path, response.digest, &response.size, &response.openError);
+            break;
+
+        case DAEMON_OP_SHUTDOWN:
+            InterlockedExchange(&stopping, TRUE);
+            response.status = SUCCESS;
+            break;
+
+        default:
+            response.status = DAEMON_PROTOCOL_ERROR;
+            break;
+        }
+
+        if (!WriteExact(client->hPipe, (PBYTE)&response, sizeof(response)))
+        {
+            break;
+        }
+
+        // the listener is blocked in ConnectNamedPipe, connect once so it sees the stop flag
+        if (request.op == DAEMON_OP_SHUTDOWN)
+        {
+            HANDLE hWake = CreateFileW(PipeName(client->args), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+            if (hWake != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(hWake);
+            }
+            break;
+        }
+    }
+
+    RemoveClient(client);
+    FlushFileBuffers(client->hPipe);
+    DisconnectNamedPipe(client->hPipe);
+    CloseHandle(client->hPipe);
+    free(client);
+}
+
+ErrorCode RunDaemon(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    LPCWSTR pipeName = PipeName(args);
+    TP_CALLBACK_ENVIRON environment;
+
+    // clients are served as members of a cleanup group, so shutting down can
+    // wait for all of them at once, they still use args
+    PTP_CLEANUP_GROUP clients = CreateThreadpoolCleanupGroup();
+    if (clients == NULL)
+    {
+        LogError(args, L"failed to create thread pool cleanup group for '%ls' with error: %lu\r\n", pipeName, GetLastError());
+        return DAEMON_ALLOCATE_ERROR;
+    }
+    InitializeThreadpoolEnvironment(&environment);
+    SetThreadpoolCallbackCleanupGroup(&environment, clients, NULL);
+
+    InterlockedExchange(&stopping, FALSE);
+
+    while (!stopping)
+    {
+        HANDLE hPipe = CreateNamedPipeW(pipeName,
+                                        PIPE_ACCESS_DUPLEX,
+                                        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                        PIPE_UNLIMITED_INSTANCES,
+                                        DAEMON_PIPE_BUFFER_SIZE,
+                                        DAEMON_PIPE_BUFFER_SIZE,
+                                        0,
+                                        NULL);
+        if (hPipe == INVALID_HANDLE_VALUE)
+        {
+            LogError(args, L"failed to create pipe '%ls' with error: %lu\r\n", pipeName, GetLastError());
+            status = DAEMON_FAILED_TO_CREATE_PIPE;
+            break;
+        }
+
+        if (!ConnectNamedPipe(hPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(hPipe);
+            continue;
+        }
+
+        if (stopping)
+        {
+            DisconnectNamedPipe(hPipe);
+            CloseHandle(hPipe);
+            break;
+        }
+
+        // every connection is served from the system thread pool so a slow hash
+        // does not block other clients
+        DaemonClient* client = malloc(sizeof(DaemonClient));
+        if (client == NULL)
+        {
+            DisconnectNamedPipe(hPipe);
+            CloseHandle(hPipe);
+            continue;
+        }
+        client->args = args;
+        client->hPipe = hPipe;
+        AddClient(client);
+
+        if (!TrySubmitThreadpoolCallback(ServeClient, client, &environment))
+        {
+            RemoveClient(client);
+            DisconnectNamedPipe(hPipe);
+            CloseHandle(hPipe);
+            free(client);
+        }
+    }
+
+    // Connections stay open for a whole run, one per -j worker of a client, so
+    // idle ones wait in a read that has to be cancelled. A client that is between
+    // two reads sees the stop flag, or its read is cancelled on the next round.
+    while (CancelClients())
+    {
+        Sleep(DAEMON_CANCEL_INTERVAL);
+    }
+
+    // blocks until every ServeClient has returned
+    CloseThreadpoolCleanupGroupMembers(clients, FALSE, NULL);
+    CloseThreadpoolCleanupGroup(clients);
+    DestroyThreadpoolEnvironment(&environment);
+
+    return status;
+}
+
+static HANDLE ConnectDaemon(__in Args* args)
+{
+    LPCWSTR pipeName = PipeName(args);
+
+    while (TRUE)
+    {
+        HANDLE hPipe = CreateFileW(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe != INVALID_HANDLE_VALUE)
+        {
+            return hPipe;
+        }
+
+        // all instances are busy, wait for the daemon to create the next one
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipeName, DAEMON_CONNECT_TIMEOUT))
+        {
+            LogError(args, L"failed to connect to daemon '%ls' with error: %lu\r\n", pipeName, GetLastError());
+            return INVALID_HANDLE_VALUE;
+        }
+    }
+}
+
+static ErrorCode SendRequest(__in Args* args, __in WORD op, __in LPCWSTR path, __out DaemonResponse* response)
+{
+    BYTE request[sizeof(DaemonRequest) + MAX_PATH * sizeof(WCHAR)];
+    DaemonRequest* header = (DaemonRequest*)request;
+    size_t pathLength = 0;
+
+    if (FAILED(StringCchLengthW(path, MAX_PATH, &pathLength)))
+    {
+        return DAEMON_PROTOCOL_ERROR;
+    }
+
+    header->magic = DAEMON_MAGIC;
+    header->op = op;
+    header->pathLength = (WORD)pathLength;
+    memcpy(request + sizeof(DaemonRequest), path, pathLength * sizeof(WCHAR));
+
+    if (hDaemonPipe == INVALID_HANDLE_VALUE)
+    {
+        hDaemonPipe = ConnectDaemon(args);
+        if (hDaemonPipe == INVALID_HANDLE_VALUE)
+        {
+            return DAEMON_FAILED_TO_CONNECT;
+        }
+    }
+
+    if (!WriteExact(hDaemonPipe, request, (DWORD)(sizeof(DaemonRequest) + pathLength * sizeof(WCHAR)))
+        || !ReadExact(hDaemonPipe, (PBYTE)response, sizeof(DaemonResponse))
+        || response->magic != DAEMON_MAGIC)
+    {
+        LogError(args, L"lost connection to daemon '%ls' with error: %lu\r\n", PipeName(args), GetLastError());
+        DisconnectDaemon();
+        return DAEMON_PROTOCOL_ERROR;
+    }
+
+    // the daemon closes its end after a shutdown, so we do too
+    if (op == DAEMON_OP_SHUTDOWN)
+    {
+        DisconnectDaemon();
+    }
+
+    return SUCCESS;
+}
+
+// closes the connection of the calling thread, workers call it before they exit
+void DisconnectDaemon(void)
+{
+    if (hDaemonPipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hDaemonPipe);
+        hDaemonPipe = INVALID_HANDLE_VALUE;
+    }
+}
+
+// like DigestFile, a file the daemon could not open goes to openError instead of stderr if it is given
+ErrorCode DaemonCalcDigest(__in Args* args, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __in LPWSTR file, __out ULONGLONG* hashed, __out_opt DWORD* openError)
+{
+    DaemonResponse response;
+
+    // the daemon has its own working directory, so it only gets absolute paths
+    // a result of MAX_PATH or more is the size that would have been needed, absFilePath is not filled
+    WCHAR absFilePath[MAX_PATH];
+    DWORD length = GetFullPathNameW(file, MAX_PATH, absFilePath, NULL);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        DWORD error = length == 0 ? GetLastError() : ERROR_FILENAME_EXCED_RANGE;
+        if (openError != NULL)
+        {
+            *openError = error;
+        }
+        else
+        {
+            LogError(args, L"failed to open file '%ls' with error: %lu\r\n", file, error);
+        }
+        return CALC_HASH_FAILED_TO_OPEN_FILE;
+    }
+
+    ErrorCode status = SendRequest(args, DAEMON_OP_HASH, absFilePath, &response);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    if (response.status == CALC_HASH_FAILED_TO_OPEN_FILE && openError != NULL)
+    {
+        *openError = response.openError;
+        return CALC_HASH_FAILED_TO_OPEN_FILE;
+    }
+    if (response.status != SUCCESS)
+    {
+        LogError(args, L"daemon failed to hash file '%ls' with error: %lu\r\n", file, response.status);
+        return (ErrorCode)response.status;
+    }
+
+    memcpy(digest, response.digest, SHA256_DIGEST_LENGTH);
+    *hashed = response.size;
+    return SUCCESS;
+}
+
+ErrorCode StopDaemon(__in Args* args)
+{
+    DaemonResponse response;
+    return SendRequest(args, DAEMON_OP_SHUTDOWN, L"", &response);
+}
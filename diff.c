@@ -0,0 +1,507 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define DIFF_MAX_PATH 32767
+
+// one file, from the manifest or from the directory walk
+typedef struct diff_entry_t
+{
+    LPWSTR path; // relative to the compared directory, backslash separated
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG size;
+    BOOL hasSize;
+    PVOID line; // owns the path of manifest entries
+} DiffEntry;
+
+typedef struct entry_list_t
+{
+    DiffEntry* items;
+    size_t count;
+    size_t capacity;
+} EntryList;
+
+// Directories still to list are kept on a stack shared by all walker threads,
+// the walk is done when the stack is empty and no thread is listing anymore.
+typedef struct tree_walk_t
+{
+    Args* args;
+    PathFilter* filter;
+    LPWSTR root;
+    LPWSTR* pending;
+    size_t pendingCount;
+    size_t pendingCapacity;
+    LONG busy;
+    EntryList files;
+    ErrorCode status;
+    SRWLOCK lock;
+    CONDITION_VARIABLE changed;
+} TreeWalk;
+
+// a line of the diff, kind is NULL for files on both sides until they are hashed
+typedef struct diff_item_t
+{
+    LPCWSTR kind;
+    DiffEntry* entry;
+    PBYTE expected;
+    LPWSTR file; // absolute path of files that are hashed
+} DiffItem;
+
+typedef struct diff_state_t
+{
+    ErrorCode status;
+    BOOL differences;
+} DiffState;
+
+static DiffEntry* AddEntry(__inout EntryList* list)
+{
+    if (list->count == list->capacity)
+    {
+        size_t newCapacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        DiffEntry* grown = realloc(list->items, newCapacity * sizeof(DiffEntry));
+        if (grown == NULL)
+        {
+            return NULL;
+        }
+        list->items = grown;
+        list->capacity = newCapacity;
+    }
+
+    DiffEntry* entry = &list->items[list->count++];
+    ZeroMemory(entry, sizeof(DiffEntry));
+    return entry;
+}
+
+static void FreeEntries(__inout EntryList* list, __in BOOL ownsPaths)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(ownsPaths ? list->items[i].path : list->items[i].line);
+    }
+    free(list->items);
+}
+
+// file systems on Windows compare names case insensitive
+static int ComparePaths(__in LPCWSTR left, __in LPCWSTR right)
+{
+    return CompareStringOrdinal(left, -1, right, -1, TRUE) - CSTR_EQUAL;
+}
+
+static int CompareEntries(const void* a, const void* b)
+{
+    return ComparePaths(((const DiffEntry*)a)->path, ((const DiffEntry*)b)->path);
+}
+
+// manifests written from the directory use .\ or ./ prefixes and either separator
+static LPWSTR NormalizePath(__inout LPWSTR path)
+{
+    while ((path[0] == L'.' && (path[1] == L'\\' || path[1] == L'/')))
+    {
+        path += 2;
+    }
+    for (LPWSTR c = path; *c != L'\0'; c++)
+    {
+        if (*c == L'/')
+        {
+            *c = L'\\';
+        }
+    }
+    return path;
+}
+
+static ErrorCode ReadManifestEntries(__in Args* args, __out EntryList* list)
+{
+    ErrorCode status = SUCCESS;
+    ManifestReader* reader = NULL;
+    FileHash fh = { 0 };
+    BOOL found = TRUE;
+
+    status = OpenManifest(args, args->diffManifest, &reader);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    while (TRUE)
+    {
+        status = NextManifestEntry(reader, &fh, &found);
+        if (status != SUCCESS || !found)
+        {
+            break;
+        }
+
+        DiffEntry* entry = AddEntry(list);
+        if (entry == NULL)
+        {
+            free(fh.line);
+            status = DIFF_ALLOCATE_ERROR;
+            break;
+        }
+        entry->path = NormalizePath(fh.file);
+        memcpy(entry->digest, fh.digest, SHA256_DIGEST_LENGTH);
+        entry->size = fh.size;
+        entry->hasSize = fh.hasSize;
+        entry->line = fh.line;
+    }
+
+    CloseManifest(reader);
+    return status;
+}
+
+static LPWSTR JoinPath(__in LPCWSTR directory, __in LPCWSTR name)
+{
+    size_t length = wcslen(directory) + wcslen(name) + 2;
+    LPWSTR path = malloc(length * sizeof(WCHAR));
+    if (path != NULL)
+    {
+        if (directory[0] == L'\0')
+        {
+            StringCchCopyW(path, length, name);
+        }
+        else
+        {
+            StringCchPrintfW(path, length, L"%ls\\%ls", directory, name);
+        }
+    }
+    return path;
+}
+
+static BOOL PushDirectory(__inout TreeWalk* walk, __in LPWSTR directory)
+{
+    if (walk->pendingCount == walk->pendingCapacity)
+    {
+        size_t newCapacity = walk->pendingCapacity == 0 ? 64 : walk->pendingCapacity * 2;
+        LPWSTR* grown = realloc(walk->pending, newCapacity * sizeof(LPWSTR));
+        if (grown == NULL)
+        {
+            return FALSE;
+        }
+        walk->pending = grown;
+        walk->pendingCapacity = newCapacity;
+    }
+    walk->pending[walk->pendingCount++] = directory;
+    return TRUE;
+}
+
+// lists one directory, files go to the result, subdirectories back on the stack
+static ErrorCode ListDirectory(__inout TreeWalk* walk, __in LPCWSTR directory)
+{
+    ErrorCode status = SUCCESS;
+    WIN32_FIND_DATAW data;
+
+    LPWSTR absolute = directory[0] != L'\0' ? JoinPath(walk->root, directory) : JoinPath(L"", walk->root);
+    LPWSTR pattern = absolute != NULL ? JoinPath(absolute, L"*") : NULL;
+    free(absolute);
+    if (pattern == NULL)
+    {
+        return DIFF_ALLOCATE_ERROR;
+    }
+
+    HANDLE hFind = FindFirstFileExW(pattern, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        LogError(walk->args, L"failed to list '%ls' with error: %lu\r\n", pattern, GetLastError());
+        free(pattern);
+        // without the root there is nothing to compare, other directories are skipped
+        return directory[0] == L'\0' ? DIFF_FAILED_TO_WALK : SUCCESS;
+    }
+    free(pattern);
+
+    do
+    {
+        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        LPWSTR path = JoinPath(directory, data.cFileName);
+        if (path == NULL)
+        {
+            status = DIFF_ALLOCATE_ERROR;
+            break;
+        }
+
+        // files left out of the selection are not compared, like in the manifest
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            && walk->filter != NULL && !PathFilterMatches(walk->filter, path))
+        {
+            free(path);
+            continue;
+        }
+
+        AcquireSRWLockExclusive(&walk->lock);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            // junctions and symlinks to directories could loop
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            {
+                free(path);
+            }
+            else if (!PushDirectory(walk, path))
+            {
+                status = DIFF_ALLOCATE_ERROR;
+                free(path);
+            }
+        }
+        else
+        {
+            DiffEntry* entry = AddEntry(&walk->files);
+            if (entry == NULL)
+            {
+                status = DIFF_ALLOCATE_ERROR;
+                free(path);
+            }
+            else
+            {
+                entry->path = path;
+                entry->size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+                entry->hasSize = TRUE;
+            }
+        }
+        ReleaseSRWLockExclusive(&walk->lock);
+        WakeAllConditionVariable(&walk->changed);
+    } while (status == SUCCESS && FindNextFileW(hFind, &data) != 0);
+
+    FindClose(hFind);
+    return status;
+}
+
+static DWORD WINAPI TreeWalker(__in LPVOID parameter)
+{
+    TreeWalk* walk = (TreeWalk*)parameter;
+
+    while (TRUE)
+    {
+        AcquireSRWLockExclusive(&walk->lock);
+        while (walk->pendingCount == 0 && walk->busy > 0 && walk->status == SUCCESS)
+        {
+            SleepConditionVariableSRW(&walk->changed, &walk->lock, INFINITE, 0);
+        }
+        if (walk->pendingCount == 0 || walk->status != SUCCESS)
+        {
+            ReleaseSRWLockExclusive(&walk->lock);
+            break;
+        }
+        LPWSTR directory = walk->pending[--walk->pendingCount];
+        ++walk->busy;
+        ReleaseSRWLockExclusive(&walk->lock);
+
+        ErrorCode status = ListDirectory(walk, directory);
+        free(directory);
+
+        AcquireSRWLockExclusive(&walk->lock);
+        --walk->busy;
+        if (status != SUCCESS && walk->status == SUCCESS)
+        {
+            walk->status = status;
+        }
+        ReleaseSRWLockExclusive(&walk->lock);
+        WakeAllConditionVariable(&walk->changed);
+    }
+
+    return 0;
+}
+
+// lists all files below the directory on the scheduler's number of threads
+static ErrorCode WalkTree(__in Args* args, __inout TreeWalk* walk)
+{
+    DWORD threadCount = SchedulerThreadCount(args);
+    HANDLE* threads = malloc(threadCount * sizeof(HANDLE));
+    LPWSTR root = JoinPath(L"", L"");
+    DWORD started = 0;
+
+    walk->args = args;
+    walk->root = args->diffDirectory;
+    InitializeSRWLock(&walk->lock);
+    InitializeConditionVariable(&walk->changed);
+
+    if (threads == NULL || root == NULL || !PushDirectory(walk, root))
+    {
+        free(threads);
+        free(root);
+        return DIFF_ALLOCATE_ERROR;
+    }
+
+    for (; started < threadCount; started++)
+    {
+        threads[started] = CreateThread(NULL, 0, TreeWalker, walk, 0, NULL);
+        if (threads[started] == NULL)
+        {
+            break;
+        }
+    }
+
+    // no thread at all, walk on this one
+    if (started == 0)
+    {
+        TreeWalker(walk);
+    }
+
+    for (DWORD i = 0; i < started; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    free(threads);
+
+    // directories left over after a failure
+    for (size_t i = 0; i < walk->pendingCount; i++)
+    {
+        free(walk->pending[i]);
+    }
+    free(walk->pending);
+
+    return walk->status;
+}
+
+static BOOL PrintDifference(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    DiffItem* item = (DiffItem*)job->context;
+    DiffState* state = (DiffState*)context;
+    LPCWSTR kind = item->kind;
+
+    if (kind == NULL)
+    {
+        // CalcDigest already reported it, the remaining files are still compared
+        if (job->status != SUCCESS)
+        {
+            state->status = job->status;
+            return TRUE;
+        }
+
+        if (memcmp(job->digest, item->expected, SHA256_DIGEST_LENGTH) == 0)
+        {
+            return TRUE;
+        }
+        kind = L"changed";
+    }
+
+    state->differences = TRUE;
+    if (!args->status)
+    {
+        WCHAR line[DIFF_MAX_PATH + 20];
+        if (SUCCEEDED(StringCchPrintfW(line, _countof(line), L"%ls\t%ls\r\n", kind, item->entry->path)))
+        {
+            WriteStdout(line);
+        }
+    }
+
+    return TRUE;
+}
+
+// Compares a directory with a manifest. Both sides are sorted by path and merged,
+// files on one side only are added or removed without being read, a size that
+// differs from the one recorded by --with-size marks a file as changed without
+// reading it either. Only the remaining files are hashed.
+ErrorCode DiffTree(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    EntryList manifest = { 0 };
+    TreeWalk walk = { 0 };
+    DiffItem* items = NULL;
+    HashJob* jobs = NULL;
+    size_t count = 0;
+
+    status = ReadManifestEntries(args, &manifest);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    status = CreatePathFilter(args, &walk.filter);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    status = WalkTree(args, &walk);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    qsort(manifest.items, manifest.count, sizeof(DiffEntry), CompareEntries);
+    qsort(walk.files.items, walk.files.count, sizeof(DiffEntry), CompareEntries);
+
+    size_t total = manifest.count + walk.files.count;
+    items = malloc((total > 0 ? total : 1) * sizeof(DiffItem));
+    jobs = calloc(total > 0 ? total : 1, sizeof(HashJob));
+    if (items == NULL || jobs == NULL)
+    {
+        status = DIFF_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    size_t m = 0;
+    size_t f = 0;
+    while (m < manifest.count || f < walk.files.count)
+    {
+        int order = m == manifest.count ? 1
+                  : f == walk.files.count ? -1
+                  : ComparePaths(manifest.items[m].path, walk.files.items[f].path);
+        DiffItem* item = &items[count];
+        HashJob* job = &jobs[count];
+
+        item->file = NULL;
+        item->expected = NULL;
+        job->context = item;
+        job->skip = TRUE;
+
+        if (order < 0)
+        {
+            item->kind = L"removed";
+            item->entry = &manifest.items[m++];
+        }
+        else if (order > 0)
+        {
+            item->kind = L"added";
+            item->entry = &walk.files.items[f++];
+        }
+        else
+        {
+            DiffEntry* recorded = &manifest.items[m++];
+            DiffEntry* current = &walk.files.items[f++];
+
+            item->entry = current;
+            item->expected = recorded->digest;
+            if (recorded->hasSize && recorded->size != current->size)
+            {
+                item->kind = L"changed";
+            }
+            else
+            {
+                item->file = JoinPath(args->diffDirectory, current->path);
+                if (item->file == NULL)
+                {
+                    status = DIFF_ALLOCATE_ERROR;
+                    ++count;
+                    goto Cleanup;
+                }
+                item->kind = NULL;
+                job->file = item->file;
+                job->skip = FALSE;
+            }
+        }
+        ++count;
+    }
+
+    DiffState state = { SUCCESS, FALSE };
+    status = RunHashJobs(args, jobs, count, PrintDifference, &state);
+    if (status == SUCCESS)
+    {
+        status = state.status != SUCCESS ? state.status : (state.differences ? DIFF_DIFFERENCES_FOUND : SUCCESS);
+    }
+
+Cleanup:
+    for (size_t i = 0; i < count; i++)
+    {
+        free(items[i].file);
+    }
+    free(jobs);
+    free(items);
+    FreeEntries(&manifest, FALSE);
+    FreeEntries(&walk.files, TRUE);
+    FreePathFilter(walk.filter);
+
+    return status;
+}
@@ -0,0 +1,479 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define FILTER_MINIMUM_PATH_SLOTS 64
+
+typedef enum glob_token_kind_t
+{
+    GLOB_LITERAL = 0,
+    GLOB_ANY_CHAR = 1, // ?
+    GLOB_STAR = 2,     // * within one path component
+    GLOB_GLOBSTAR = 3, // ** across components
+} GlobTokenKind;
+
+typedef struct glob_token_t
+{
+    GlobTokenKind kind;
+    LPCWSTR literal; // folded
+    size_t length;
+    BOOL directories; // **\ matches nothing or whole directories only
+} GlobToken;
+
+typedef struct glob_t
+{
+    GlobToken* tokens;
+    size_t count;
+    BOOL matchName; // a pattern without separator is matched against the file name
+    LPWSTR text;
+} Glob;
+
+// Globs are compiled once into token lists with folded literals, --paths-from
+// is kept in an open addressing set of folded paths. Matching a path does not
+// allocate or copy it.
+struct path_filter_t
+{
+    Glob* includes;
+    size_t includeCount;
+    Glob* excludes;
+    size_t excludeCount;
+    LPWSTR* paths;
+    size_t pathSlots;
+    BOOL hasPaths;
+};
+
+// paths compare case insensitive and with either separator
+static WCHAR FoldChar(__in WCHAR c)
+{
+    if (c < 128)
+    {
+        if (c >= L'a' && c <= L'z')
+        {
+            return (WCHAR)(c - L'a' + L'A');
+        }
+        return c == L'/' ? L'\\' : c;
+    }
+    return (WCHAR)(ULONG_PTR)CharUpperW((LPWSTR)(ULONG_PTR)c);
+}
+
+static BOOL IsSeparator(__in WCHAR c)
+{
+    return c == L'\\' || c == L'/';
+}
+
+// manifests written from the directory start their paths with .\ or ./
+static LPCWSTR SkipCurrentDirectory(__in LPCWSTR path)
+{
+    while (path[0] == L'.' && IsSeparator(path[1]))
+    {
+        path += 2;
+    }
+    return path;
+}
+
+static ErrorCode CompileGlob(__in LPCWSTR pattern, __out Glob* glob)
+{
+    pattern = SkipCurrentDirectory(pattern);
+    size_t length = wcslen(pattern);
+
+    ZeroMemory(glob, sizeof(Glob));
+    glob->text = malloc((length + 1) * sizeof(WCHAR));
+    glob->tokens = malloc((length + 1) * sizeof(GlobToken));
+    if (glob->text == NULL || glob->tokens == NULL)
+    {
+        return FILTER_ALLOCATE_ERROR;
+    }
+
+    glob->matchName = TRUE;
+    for (size_t i = 0; i < length; i++)
+    {
+        glob->text[i] = FoldChar(pattern[i]);
+        if (glob->text[i] == L'\\')
+        {
+            glob->matchName = FALSE;
+        }
+    }
+    glob->text[length] = L'\0';
+
+    for (size_t i = 0; i < length;)
+    {
+        GlobToken* token = &glob->tokens[glob->count++];
+        ZeroMemory(token, sizeof(GlobToken));
+
+        if (glob->text[i] == L'*' && glob->text[i + 1] == L'*')
+        {
+            token->kind = GLOB_GLOBSTAR;
+            i += 2;
+            while (glob->text[i] == L'*')
+            {
+                ++i;
+            }
+            if (glob->text[i] == L'\\')
+            {
+                token->directories = TRUE;
+                ++i;
+            }
+        }
+        else if (glob->text[i] == L'*')
+        {
+            token->kind = GLOB_STAR;
+            ++i;
+        }
+        else if (glob->text[i] == L'?')
+        {
+            token->kind = GLOB_ANY_CHAR;
+            ++i;
+        }
+        else
+        {
+            token->kind = GLOB_LITERAL;
+            token->literal = &glob->text[i];
+            while (i < length && glob->text[i] != L'*' && glob->text[i] != L'?')
+            {
+                ++token->length;
+                ++i;
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+static BOOL MatchTokens(__in Glob* glob, __in size_t t, __in LPCWSTR s)
+{
+    for (; t < glob->count; t++)
+    {
+        GlobToken* token = &glob->tokens[t];
+        GlobToken* next = t + 1 < glob->count ? &glob->tokens[t + 1] : NULL;
+
+        switch (token->kind)
+        {
+        case GLOB_LITERAL:
+            for (size_t i = 0; i < token->length; i++, s++)
+            {
+                if (*s == L'\0' || FoldChar(*s) != token->literal[i])
+                {
+                    return FALSE;
+                }
+            }
+            break;
+
+        case GLOB_ANY_CHAR:
+            if (*s == L'\0' || IsSeparator(*s))
+            {
+                return FALSE;
+            }
+            ++s;
+            break;
+
+        case GLOB_STAR:
+            for (;; s++)
+            {
+                // only try where the following literal can start
+                if ((next == NULL || next->kind != GLOB_LITERAL || FoldChar(*s) == next->literal[0])
+                    && MatchTokens(glob, t + 1, s))
+                {
+                    return TRUE;
+                }
+                if (*s == L'\0' || IsSeparator(*s))
+                {
+                    return FALSE;
+                }
+            }
+
+        case GLOB_GLOBSTAR:
+            for (LPCWSTR start = s;; s++)
+            {
+                if ((!token->directories || s == start || IsSeparator(s[-1]))
+                    && MatchTokens(glob, t + 1, s))
+                {
+                    return TRUE;
+                }
+                if (*s == L'\0')
+                {
+                    return FALSE;
+                }
+            }
+        }
+    }
+
+    return *s == L'\0';
+}
+
+static BOOL MatchGlob(__in Glob* glob, __in LPCWSTR path, __in LPCWSTR name)
+{
+    return MatchTokens(glob, 0, glob->matchName ? name : path);
+}
+
+static BOOL MatchAny(__in Glob* globs, __in size_t count, __in LPCWSTR path, __in LPCWSTR name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (MatchGlob(&globs[i], path, name))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static size_t HashPath(__in LPCWSTR path)
+{
+    size_t hash = (size_t)14695981039346656037ULL;
+    for (; *path != L'\0'; path++)
+    {
+        hash ^= FoldChar(*path);
+        hash *= (size_t)1099511628211ULL;
+    }
+    return hash;
+}
+
+static BOOL SamePath(__in LPCWSTR left, __in LPCWSTR right)
+{
+    for (; *left != L'\0' && *right != L'\0'; left++, right++)
+    {
+        if (FoldChar(*left) != FoldChar(*right))
+        {
+            return FALSE;
+        }
+    }
+    return *left == *right;
+}
+
+static LPWSTR* FindPathSlot(__in LPWSTR* slots, __in size_t slotCount, __in LPCWSTR path)
+{
+    size_t slot = HashPath(path) & (slotCount - 1);
+    while (slots[slot] != NULL && !SamePath(slots[slot], path))
+    {
+        slot = (slot + 1) & (slotCount - 1);
+    }
+    return &slots[slot];
+}
+
+// reads the --paths-from list, one UTF-8 path per line
+static ErrorCode LoadPaths(__in Args* args, __inout PathFilter* filter)
+{
+    ErrorCode status = SUCCESS;
+    LARGE_INTEGER fileSize;
+    PBYTE content = NULL;
+    DWORD dwBytesRead;
+
+    HANDLE hFile = CreateFileW(args->pathsFrom, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to open path list '%ls' with error: %lu\r\n", args->pathsFrom, GetLastError());
+        return FILTER_FAILED_TO_READ_PATHS;
+    }
+
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart > MAXDWORD - 1)
+    {
+        status = FILTER_FAILED_TO_READ_PATHS;
+        goto Cleanup;
+    }
+
+    content = malloc((size_t)fileSize.QuadPart + 1);
+    if (content == NULL)
+    {
+        status = FILTER_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    if (!ReadFile(hFile, content, (DWORD)fileSize.QuadPart, &dwBytesRead, NULL))
+    {
+        LogError(args, L"failed to read path list '%ls' with error: %lu\r\n", args->pathsFrom, GetLastError());
+        status = FILTER_FAILED_TO_READ_PATHS;
+        goto Cleanup;
+    }
+
+    // a line per path at most, the set is kept at most half full
+    size_t lines = 1;
+    for (DWORD i = 0; i < dwBytesRead; i++)
+    {
+        lines += content[i] == '\n';
+    }
+    filter->pathSlots = FILTER_MINIMUM_PATH_SLOTS;
+    while (filter->pathSlots < lines * 2)
+    {
+        filter->pathSlots *= 2;
+    }
+    filter->paths = calloc(filter->pathSlots, sizeof(LPWSTR));
+    if (filter->paths == NULL)
+    {
+        status = FILTER_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    filter->hasPaths = TRUE;
+
+    for (DWORD start = 0, end = 0; start < dwBytesRead; start = end + 1)
+    {
+        for (end = start; end < dwBytesRead && content[end] != '\n'; end++)
+        {
+        }
+        DWORD length = end - start;
+        if (length > 0 && content[start + length - 1] == '\r')
+        {
+            --length;
+        }
+        if (length == 0)
+        {
+            continue;
+        }
+
+        int wideLength = MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)content + start, (int)length, NULL, 0);
+        LPWSTR path = malloc((wideLength + 1) * sizeof(WCHAR));
+        if (path == NULL)
+        {
+            status = FILTER_ALLOCATE_ERROR;
+            goto Cleanup;
+        }
+        MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)content + start, (int)length, path, wideLength);
+        path[wideLength] = L'\0';
+
+        LPWSTR* slot = FindPathSlot(filter->paths, filter->pathSlots, SkipCurrentDirectory(path));
+        if (*slot == NULL)
+        {
+            // the set keeps the normalized path, the allocation starts at most 2 characters earlier
+            *slot = (LPWSTR)SkipCurrentDirectory(path);
+            if (*slot != path)
+            {
+                memmove(path, *slot, (wcslen(*slot) + 1) * sizeof(WCHAR));
+                *slot = path;
+            }
+        }
+        else
+        {
+            free(path);
+        }
+    }
+
+Cleanup:
+    CloseHandle(hFile);
+    free(content);
+
+    return status;
+}
+
+static ErrorCode CompileGlobs(__in FileList* patterns, __out Glob** globs, __out size_t* count)
+{
+    size_t total = 0;
+    for (FileList* current = patterns; current != NULL; current = current->next)
+    {
+        ++total;
+    }
+
+    *count = 0;
+    *globs = calloc(total > 0 ? total : 1, sizeof(Glob));
+    if (*globs == NULL)
+    {
+        return FILTER_ALLOCATE_ERROR;
+    }
+
+    for (FileList* current = patterns; current != NULL; current = current->next)
+    {
+        ErrorCode status = CompileGlob(current->file, &(*globs)[(*count)++]);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// *filter stays NULL when no --include, --exclude or --paths-from was given
+ErrorCode CreatePathFilter(__in Args* args, __out PathFilter** filter)
+{
+    ErrorCode status = SUCCESS;
+
+    *filter = NULL;
+    if (args->includes == NULL && args->excludes == NULL && args->pathsFrom == NULL)
+    {
+        return SUCCESS;
+    }
+
+    PathFilter* created = calloc(1, sizeof(PathFilter));
+    if (created == NULL)
+    {
+        return FILTER_ALLOCATE_ERROR;
+    }
+
+    status = CompileGlobs(args->includes, &created->includes, &created->includeCount);
+    if (status == SUCCESS)
+    {
+        status = CompileGlobs(args->excludes, &created->excludes, &created->excludeCount);
+    }
+    if (status == SUCCESS && args->pathsFrom != NULL)
+    {
+        status = LoadPaths(args, created);
+    }
+
+    if (status != SUCCESS)
+    {
+        FreePathFilter(created);
+        return status;
+    }
+
+    *filter = created;
+    return SUCCESS;
+}
+
+// Without --include and --paths-from every path is selected, otherwise it has to
+// match one of them. --exclude removes paths from the selection.
+BOOL PathFilterMatches(__in PathFilter* filter, __in LPCWSTR path)
+{
+    path = SkipCurrentDirectory(path);
+
+    LPCWSTR name = path;
+    for (LPCWSTR c = path; *c != L'\0'; c++)
+    {
+        if (IsSeparator(*c))
+        {
+            name = c + 1;
+        }
+    }
+
+    if (filter->includeCount > 0 || filter->hasPaths)
+    {
+        BOOL selected = filter->hasPaths && *FindPathSlot(filter->paths, filter->pathSlots, path) != NULL;
+        if (!selected && !MatchAny(filter->includes, filter->includeCount, path, name))
+        {
+            return FALSE;
+        }
+    }
+
+    return !MatchAny(filter->excludes, filter->excludeCount, path, name);
+}
+
+static void FreeGlobs(__in_opt Glob* globs, __in size_t count)
+{
+    if (globs == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        free(globs[i].text);
+        free(globs[i].tokens);
+    }
+    free(globs);
+}
+
+void FreePathFilter(__in_opt PathFilter* filter)
+{
+    if (filter == NULL)
+    {
+        return;
+    }
+
+    FreeGlobs(filter->includes, filter->includeCount);
+    FreeGlobs(filter->excludes, filter->excludeCount);
+    if (filter->paths != NULL)
+    {
+        for (size_t i = 0; i < filter->pathSlots; i++)
+        {
+            free(filter->paths[i]);
+        }
+        free(filter->paths);
+    }
+    free(filter);
+}
@@ -0,0 +1,562 @@
+#include <limits.h>
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define INDEX_MAGIC 0x58493253 // "S2IX"
+#define INDEX_VERSION 2
+#define INDEX_HAS_SIZE 1
+#define INDEX_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// ordinal byte order, a path sorts before every longer path it is a prefix of
+static int ComparePath(__in LPCSTR left, __in DWORD leftLength, __in LPCSTR right, __in DWORD rightLength)
+{
+    int result = memcmp(left, right, leftLength < rightLength ? leftLength : rightLength);
+    if (result != 0)
+    {
+        return result;
+    }
+    return leftLength < rightLength ? -1 : (leftLength > rightLength ? 1 : 0);
+}
+
+// the path of an entry, NULL if it points outside of the pool
+static LPCSTR EntryPath(__in ManifestIndex* index, __in IndexEntry* entry)
+{
+    if (entry->pathOffset > index->header->poolSize
+        || entry->pathLength > index->header->poolSize - entry->pathOffset)
+    {
+        return NULL;
+    }
+    return (LPCSTR)index->pool + entry->pathOffset;
+}
+
+BOOL IsIndexFile(__in LPCWSTR file)
+{
+    BOOL isIndex = FALSE;
+    HANDLE hFile = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        DWORD magic;
+        DWORD bytesRead;
+
+        if (ReadFile(hFile, &magic, sizeof(magic), &bytesRead, NULL) && bytesRead == sizeof(magic))
+        {
+            isIndex = magic == INDEX_MAGIC;
+        }
+
+        CloseHandle(hFile);
+    }
+
+    return isIndex;
+}
+
+// maps the index read only and checks that header, entries and pool fit the file
+ErrorCode OpenIndex(__in Args* args, __in LPCWSTR file, __out ManifestIndex* index)
+{
+    ErrorCode status = SUCCESS;
+    LARGE_INTEGER fileSize;
+
+    ZeroMemory(index, sizeof(ManifestIndex));
+
+    index->hFile = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (index->hFile == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to open index '%ls' with error: %lu\r\n", file, GetLastError());
+        index->hFile = NULL;
+        return INDEX_FAILED_TO_OPEN;
+    }
+
+    if (!GetFileSizeEx(index->hFile, &fileSize) || (ULONGLONG)fileSize.QuadPart < sizeof(IndexHeader))
+    {
+        status = INDEX_INVALID;
+        goto Cleanup;
+    }
+
+    index->hMapping = CreateFileMappingW(index->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (index->hMapping == NULL)
+    {
+        LogError(args, L"failed to map index '%ls' with error: %lu\r\n", file, GetLastError());
+        status = INDEX_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    index->view = (PBYTE)MapViewOfFile(index->hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (index->view == NULL)
+    {
+        LogError(args, L"failed to map index '%ls' with error: %lu\r\n", file, GetLastError());
+        status = INDEX_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    index->header = (IndexHeader*)index->view;
+    index->entries = (IndexEntry*)(index->view + sizeof(IndexHeader));
+
+    // every entry has its slot in the order table as well
+    ULONGLONG available = (ULONGLONG)fileSize.QuadPart - sizeof(IndexHeader);
+    ULONGLONG entrySize = sizeof(IndexEntry) + sizeof(ULONGLONG);
+    if (index->header->magic != INDEX_MAGIC
+        || index->header->version != INDEX_VERSION
+        || index->header->count > available / entrySize
+        || index->header->poolSize != available - index->header->count * entrySize)
+    {
+        status = INDEX_INVALID;
+        goto Cleanup;
+    }
+    index->order = (ULONGLONG*)(index->entries + index->header->count);
+    index->pool = (PBYTE)(index->order + index->header->count);
+
+Cleanup:
+    if (status == INDEX_INVALID)
+    {
+        LogError(args, L"'%ls' is not a valid index\r\n", file, 0);
+    }
+    if (status != SUCCESS)
+    {
+        CloseIndex(index);
+    }
+
+    return status;
+}
+
+void CloseIndex(__in ManifestIndex* index)
+{
+    if (index->view)
+    {
+        UnmapViewOfFile(index->view);
+    }
+    if (index->hMapping)
+    {
+        CloseHandle(index->hMapping);
+    }
+    if (index->hFile)
+    {
+        CloseHandle(index->hFile);
+    }
+    ZeroMemory(index, sizeof(ManifestIndex));
+}
+
+// binary search over the sorted entries, NULL if the path is not listed. Of a
+// path listed more than once, the first entry in the manifest.
+IndexEntry* IndexLookup(__in ManifestIndex* index, __in LPCSTR path, __in DWORD length)
+{
+    IndexEntry* found = NULL;
+    ULONGLONG low = 0;
+    ULONGLONG high = index->header->count;
+
+    while (low < high)
+    {
+        ULONGLONG middle = low + (high - low) / 2;
+        IndexEntry* entry = &index->entries[middle];
+        LPCSTR entryPath = EntryPath(index, entry);
+        if (entryPath == NULL)
+        {
+            return NULL;
+        }
+
+        int result = ComparePath(entryPath, entry->pathLength, path, length);
+        if (result == 0)
+        {
+            found = entry;
+        }
+        if (result < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return found;
+}
+
+// fills fh like ParseLine does for a text line, fh->line owns both paths
+ErrorCode IndexEntryToFileHash(__in Args* args, __in ManifestIndex* index, __in ULONGLONG position, __out FileHash* fh)
+{
+    IndexEntry* entry = position < index->header->count ? &index->entries[position] : NULL;
+    LPCSTR path = entry != NULL ? EntryPath(index, entry) : NULL;
+    if (path == NULL || entry->pathLength > INT_MAX)
+    {
+        if (!args->status)
+        {
+            WCHAR message[100];
+            HRESULT hr = StringCchPrintfW(message, _countof(message), L"index entry %llu points outside of the index\r\n", position);
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(message);
+            }
+        }
+        return INDEX_INVALID;
+    }
+
+    int pathSize = MultiByteToWideChar(CP_UTF8, 0, path, (int)entry->pathLength, NULL, 0);
+    PBYTE line = malloc(sizeof(WCHAR) * (pathSize + 1) + entry->pathLength + 1);
+    if (line == NULL)
+    {
+        return INDEX_ALLOCATE_ERROR;
+    }
+
+    memcpy(fh->digest, entry->digest, SHA256_DIGEST_LENGTH);
+    fh->file = (LPWSTR)line;
+    MultiByteToWideChar(CP_UTF8, 0, path, (int)entry->pathLength, fh->file, pathSize);
+    fh->file[pathSize] = L'\0';
+    fh->path = (LPSTR)(line + sizeof(WCHAR) * (pathSize + 1));
+    memcpy(fh->path, path, entry->pathLength);
+    fh->path[entry->pathLength] = '\0';
+    fh->pathLength = entry->pathLength;
+    fh->size = entry->size;
+    fh->hasSize = (entry->flags & INDEX_HAS_SIZE) != 0;
+    fh->line = line;
+
+    return SUCCESS;
+}
+
+static int CompareEntries(void* context, const void* a, const void* b)
+{
+    PBYTE pool = (PBYTE)context;
+    const IndexEntry* left = (const IndexEntry*)a;
+    const IndexEntry* right = (const IndexEntry*)b;
+
+    // qsort is not stable, a repeated path keeps the order of the manifest
+    int result = ComparePath((LPCSTR)pool + left->pathOffset, left->pathLength,
+                             (LPCSTR)pool + right->pathOffset, right->pathLength);
+    if (result != 0)
+    {
+        return result;
+    }
+    return left->ordinal < right->ordinal ? -1 : (left->ordinal > right->ordinal ? 1 : 0);
+}
+
+static BOOL WriteAll(__in HANDLE hFile, __in LPCVOID data, __in ULONGLONG size)
+{
+    const BYTE* current = (const BYTE*)data;
+    while (size > 0)
+    {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written;
+        if (!WriteFile(hFile, current, chunk, &written, NULL))
+        {
+            return FALSE;
+        }
+        current += written;
+        size -= written;
+    }
+    return TRUE;
+}
+
+static HANDLE CreateOutput(__in Args* args, __in LPCWSTR file)
+{
+    HANDLE hFile = CreateFileW(file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to create '%ls' with error: %lu\r\n", file, GetLastError());
+    }
+    return hFile;
+}
+
+// text manifest to index, the whole manifest is read into memory to sort it
+static ErrorCode WriteIndex(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ManifestReader* reader = NULL;
+    HANDLE hOutput = INVALID_HANDLE_VALUE;
+    IndexEntry* entries = NULL;
+    ULONGLONG* order = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    PBYTE pool = NULL;
+    ULONGLONG poolSize = 0;
+    ULONGLONG poolCapacity = 0;
+    FileHash fh = { 0 };
+    BOOL found = TRUE;
+
+    status = OpenManifest(args, args->convertFrom, &reader);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    while (TRUE)
+    {
+        status = NextManifestEntry(reader, &fh, &found);
+        if (status != SUCCESS || !found)
+        {
+            break;
+        }
+
+        DWORD pathSize = fh.pathLength;
+        if (count == capacity || poolSize + pathSize > poolCapacity)
+        {
+            size_t newCapacity = count == capacity ? (capacity == 0 ? 1024 : capacity * 2) : capacity;
+            ULONGLONG newPoolCapacity = poolCapacity == 0 ? 64 * 1024 : poolCapacity;
+            while (poolSize + pathSize > newPoolCapacity)
+            {
+                newPoolCapacity *= 2;
+            }
+
+            IndexEntry* grownEntries = realloc(entries, newCapacity * sizeof(IndexEntry));
+            if (grownEntries != NULL)
+            {
+                entries = grownEntries;
+                capacity = newCapacity;
+            }
+            PBYTE grownPool = realloc(pool, (size_t)newPoolCapacity);
+            if (grownPool != NULL)
+            {
+                pool = grownPool;
+                poolCapacity = newPoolCapacity;
+            }
+            if (grownEntries == NULL || grownPool == NULL)
+            {
+                status = INDEX_ALLOCATE_ERROR;
+                break;
+            }
+        }
+
+        IndexEntry* entry = &entries[count];
+        ZeroMemory(entry, sizeof(IndexEntry));
+        memcpy(entry->digest, fh.digest, SHA256_DIGEST_LENGTH);
+        entry->size = fh.size;
+        entry->flags = fh.hasSize ? INDEX_HAS_SIZE : 0;
+        entry->pathOffset = poolSize;
+        entry->pathLength = pathSize;
+        entry->ordinal = count;
+        memcpy(pool + poolSize, fh.path, pathSize);
+        poolSize += pathSize;
+        ++count;
+
+        free(fh.line);
+        fh.line = NULL;
+    }
+    free(fh.line);
+
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    qsort_s(entries, count, sizeof(IndexEntry), CompareEntries, pool);
+
+    // -c and converting back go through the entries in manifest order
+    order = malloc((count > 0 ? count : 1) * sizeof(ULONGLONG));
+    if (order == NULL)
+    {
+        status = INDEX_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        order[entries[i].ordinal] = i;
+    }
+
+    hOutput = CreateOutput(args, args->convertTo);
+    if (hOutput == INVALID_HANDLE_VALUE)
+    {
+        status = INDEX_FAILED_TO_WRITE;
+        goto Cleanup;
+    }
+
+    IndexHeader header = { 0 };
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.count = count;
+    header.poolSize = poolSize;
+    if (!WriteAll(hOutput, &header, sizeof(header))
+        || !WriteAll(hOutput, entries, count * sizeof(IndexEntry))
+        || !WriteAll(hOutput, order, count * sizeof(ULONGLONG))
+        || !WriteAll(hOutput, pool, poolSize))
+    {
+        LogError(args, L"failed to write '%ls' with error: %lu\r\n", args->convertTo, GetLastError());
+        status = INDEX_FAILED_TO_WRITE;
+    }
+
+Cleanup:
+    if (hOutput != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hOutput);
+    }
+    CloseManifest(reader);
+    free(entries);
+    free(order);
+    free(pool);
+
+    return status;
+}
+
+// index to text manifest in the format sha256sum writes, lines are in the order
+// of the manifest the index was converted from
+static ErrorCode WriteText(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ManifestIndex index;
+    HANDLE hOutput = INVALID_HANDLE_VALUE;
+    CHAR* output = NULL;
+    size_t used = 0;
+
+    status = OpenIndex(args, args->convertFrom, &index);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    output = malloc(INDEX_OUTPUT_BUFFER_SIZE);
+    if (output == NULL)
+    {
+        status = INDEX_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    hOutput = CreateOutput(args, args->convertTo);
+    if (hOutput == INVALID_HANDLE_VALUE)
+    {
+        status = INDEX_FAILED_TO_WRITE;
+        goto Cleanup;
+    }
+
+    for (ULONGLONG i = 0; i < index.header->count && status == SUCCESS; i++)
+    {
+        IndexEntry* entry = index.order[i] < index.header->count ? &index.entries[index.order[i]] : NULL;
+        LPCSTR path = entry != NULL ? EntryPath(&index, entry) : NULL;
+        CHAR prefix[SHA256_DIGEST_LENGTH * 2 + 32];
+        size_t prefixLength = 0;
+
+        if (path == NULL)
+        {
+            status = INDEX_INVALID;
+            break;
+        }
+
+        FormatDigestUTF8(prefix, entry->digest);
+        if (entry->flags & INDEX_HAS_SIZE)
+        {
+            StringCchPrintfA(prefix + SHA256_DIGEST_LENGTH * 2, 32, " %llu *", entry->size);
+        }
+        else
+        {
+            StringCchCopyA(prefix + SHA256_DIGEST_LENGTH * 2, 32, " *");
+        }
+        StringCchLengthA(prefix, _countof(prefix), &prefixLength);
+
+        // flush before the line does not fit anymore, long paths go out directly
+        if (used + prefixLength + entry->pathLength + 2 > INDEX_OUTPUT_BUFFER_SIZE)
+        {
+            if (!WriteAll(hOutput, output, used))
+            {
+                status = INDEX_FAILED_TO_WRITE;
+                break;
+            }
+            used = 0;
+        }
+
+        if (prefixLength + entry->pathLength + 2 > INDEX_OUTPUT_BUFFER_SIZE)
+        {
+            if (!WriteAll(hOutput, prefix, prefixLength)
+                || !WriteAll(hOutput, path, entry->pathLength)
+                || !WriteAll(hOutput, "\r\n", 2))
+            {
+                status = INDEX_FAILED_TO_WRITE;
+            }
+            continue;
+        }
+
+        memcpy(output + used, prefix, prefixLength);
+        used += prefixLength;
+        memcpy(output + used, path, entry->pathLength);
+        used += entry->pathLength;
+        memcpy(output + used, "\r\n", 2);
+        used += 2;
+    }
+
+    if (status == SUCCESS && !WriteAll(hOutput, output, used))
+    {
+        status = INDEX_FAILED_TO_WRITE;
+    }
+
+    if (status == INDEX_FAILED_TO_WRITE)
+    {
+        LogError(args, L"failed to write '%ls' with error: %lu\r\n", args->convertTo, GetLastError());
+    }
+
+Cleanup:
+    if (hOutput != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hOutput);
+    }
+    free(output);
+    CloseIndex(&index);
+
+    return status;
+}
+
+// --convert FROM TO, the direction follows from the format of FROM
+ErrorCode ConvertManifest(__in Args* args)
+{
+    return IsIndexFile(args->convertFrom) ? WriteText(args) : WriteIndex(args);
+}
+
+// --lookup FILE -c INDEX, prints the entry of one file without reading the others
+ErrorCode LookupChecksum(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ManifestIndex index;
+    FileHash fh = { 0 };
+
+    if (!IsIndexFile(args->sumFile))
+    {
+        LogError(args, L"'%ls' is not a valid index\r\n", args->sumFile, 0);
+        return INDEX_INVALID;
+    }
+
+    status = OpenIndex(args, args->sumFile, &index);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    int pathSize = WideCharToMultiByte(CP_UTF8, 0, args->lookup, -1, NULL, 0, NULL, NULL);
+    LPSTR path = malloc(pathSize > 0 ? pathSize : 1);
+    if (path == NULL)
+    {
+        status = INDEX_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, args->lookup, -1, path, pathSize, NULL, NULL);
+
+    IndexEntry* entry = IndexLookup(&index, path, pathSize > 0 ? (DWORD)pathSize - 1 : 0);
+    free(path);
+    if (entry == NULL)
+    {
+        LogError(args, L"'%ls' is not listed\r\n", args->lookup, 0);
+        status = INDEX_ENTRY_NOT_FOUND;
+        goto Cleanup;
+    }
+
+    status = IndexEntryToFileHash(args, &index, (ULONGLONG)(entry - index.entries), &fh);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    if (!args->status)
+    {
+        CHAR prefix[SHA256_DIGEST_LENGTH * 2 + 32];
+        FormatDigestUTF8(prefix, fh.digest);
+        HRESULT hr = fh.hasSize
+            ? StringCchPrintfA(prefix + SHA256_DIGEST_LENGTH * 2, 32, " %llu *", fh.size)
+            : StringCchCopyA(prefix + SHA256_DIGEST_LENGTH * 2, 32, " *");
+        if (SUCCEEDED(hr))
+        {
+            WriteStdoutUTF8(prefix, strlen(prefix));
+            WriteStdoutUTF8(fh.path, fh.pathLength);
+            WriteStdoutUTF8("\r\n", 2);
+        }
+    }
+    free(fh.line);
+
+Cleanup:
+    CloseIndex(&index);
+
+    return status;
+}
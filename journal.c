@@ -0,0 +1,320 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define JOURNAL_MAGIC 0x4A563253 // "S2VJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BUFFER_RECORDS 1024
+#define JOURNAL_SYNC_INTERVAL 5000 // ms between flushes to the disk
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Verification journal, a JournalHeader followed by one JournalRecord for every
+// manifest entry verified, in manifest order. The records are appended as the
+// results come in, so a journal cut off by a crash still holds a prefix of them.
+typedef struct journal_header_t
+{
+    DWORD magic;
+    WORD version;
+    WORD flags;
+    ULONGLONG manifestSize; // the manifest the records belong to
+    ULONGLONG manifestWriteTime;
+    ULONGLONG filter; // FilterHash of the run, the record indexes depend on it
+} JournalHeader;
+
+typedef struct journal_record_t
+{
+    ULONGLONG index; // of the entry after --include, --exclude and --paths-from
+    DWORD status;    // SUCCESS or CHECK_SUM_CHECKSUM_FAILED
+    DWORD reserved;
+    BYTE digest[SHA256_DIGEST_LENGTH]; // zero for entries failed by their size
+} JournalRecord;
+
+struct verify_journal_t
+{
+    Args* args;
+    LPCWSTR file;
+    HANDLE hFile;
+    ULONGLONG resumed; // entries verified by an earlier run
+    PBYTE failed;      // one bit for each of them
+    ULONGLONG next;    // index of the next record to append
+    JournalRecord buffer[JOURNAL_BUFFER_RECORDS];
+    size_t buffered;
+    ULONGLONG lastSync;
+};
+
+static BOOL WriteAll(__in HANDLE hFile, __in LPCVOID data, __in DWORD size)
+{
+    DWORD written;
+    return WriteFile(hFile, data, size, &written, NULL) && written == size;
+}
+
+static ULONGLONG HashBytes(__in ULONGLONG hash, __in_ecount(size) const BYTE* bytes, __in size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static ULONGLONG HashPatterns(__in ULONGLONG hash, __in WCHAR kind, __in_opt FileList* patterns)
+{
+    for (FileList* pattern = patterns; pattern != NULL; pattern = pattern->next)
+    {
+        hash = HashBytes(hash, (const BYTE*)&kind, sizeof(kind));
+        hash = HashBytes(hash, (const BYTE*)pattern->file, (wcslen(pattern->file) + 1) * sizeof(WCHAR));
+    }
+    return hash;
+}
+
+// FNV-1a of --include, --exclude and --paths-from, with the size and last
+// write time of the list, 0 without any of them. Records count the entries the
+// filters left, so they only fit a run with the same filters.
+static ULONGLONG FilterHash(__in Args* args)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (args->includes == NULL && args->excludes == NULL && args->pathsFrom == NULL)
+    {
+        return 0;
+    }
+
+    ULONGLONG hash = HashPatterns(FNV_OFFSET_BASIS, L'i', args->includes);
+    hash = HashPatterns(hash, L'e', args->excludes);
+    if (args->pathsFrom != NULL)
+    {
+        hash = HashBytes(hash, (const BYTE*)L"p", sizeof(WCHAR));
+        hash = HashBytes(hash, (const BYTE*)args->pathsFrom, (wcslen(args->pathsFrom) + 1) * sizeof(WCHAR));
+        if (GetFileAttributesExW(args->pathsFrom, GetFileExInfoStandard, &data))
+        {
+            hash = HashBytes(hash, (const BYTE*)&data.nFileSizeHigh, sizeof(data.nFileSizeHigh));
+            hash = HashBytes(hash, (const BYTE*)&data.nFileSizeLow, sizeof(data.nFileSizeLow));
+            hash = HashBytes(hash, (const BYTE*)&data.ftLastWriteTime, sizeof(data.ftLastWriteTime));
+        }
+    }
+
+    // 0 stays the journal of a run without filters
+    return hash != 0 ? hash : 1;
+}
+
+// Reads the records of an earlier run. A record cut off by a crash and anything
+// after a record out of order is dropped, those entries are verified again.
+static ErrorCode LoadRecords(__inout Journal* journal, __in ULONGLONG fileSize)
+{
+    ULONGLONG available = (fileSize - sizeof(JournalHeader)) / sizeof(JournalRecord);
+
+    if (available > 0)
+    {
+        journal->failed = calloc((size_t)((available + 7) / 8), 1);
+        if (journal->failed == NULL)
+        {
+            return JOURNAL_ALLOCATE_ERROR;
+        }
+    }
+
+    while (journal->resumed < available)
+    {
+        DWORD bytesRead;
+        ULONGLONG left = available - journal->resumed;
+        DWORD wanted = (DWORD)(left < JOURNAL_BUFFER_RECORDS ? left : JOURNAL_BUFFER_RECORDS) * sizeof(JournalRecord);
+        if (!ReadFile(journal->hFile, journal->buffer, wanted, &bytesRead, NULL) || bytesRead != wanted)
+        {
+            break;
+        }
+
+        size_t count = wanted / sizeof(JournalRecord);
+        size_t i = 0;
+        for (; i < count && journal->buffer[i].index == journal->resumed; i++, journal->resumed++)
+        {
+            if (journal->buffer[i].status != SUCCESS)
+            {
+                journal->failed[journal->resumed / 8] |= (BYTE)(1 << (journal->resumed % 8));
+            }
+        }
+        if (i < count)
+        {
+            break;
+        }
+    }
+
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)(sizeof(JournalHeader) + journal->resumed * sizeof(JournalRecord));
+    if (!SetFilePointerEx(journal->hFile, end, NULL, FILE_BEGIN) || !SetEndOfFile(journal->hFile))
+    {
+        return JOURNAL_FAILED_TO_WRITE;
+    }
+
+    journal->next = journal->resumed;
+    return SUCCESS;
+}
+
+// Opens args->journal for the manifest args->sumFile. The records of an earlier
+// run over the same manifest with the same filters are kept, a journal of
+// another manifest, another version of it or other filters is started over.
+ErrorCode OpenJournal(__in Args* args, __out Journal** journal)
+{
+    ErrorCode status = SUCCESS;
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    LARGE_INTEGER fileSize;
+    JournalHeader header;
+    DWORD bytesRead;
+
+    *journal = NULL;
+
+    if (!GetFileAttributesExW(args->sumFile, GetFileExInfoStandard, &data))
+    {
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", args->sumFile, GetLastError());
+        return JOURNAL_FAILED_TO_OPEN;
+    }
+
+    Journal* opened = calloc(1, sizeof(Journal));
+    if (opened == NULL)
+    {
+        return JOURNAL_ALLOCATE_ERROR;
+    }
+    opened->args = args;
+    opened->file = args->journal;
+    opened->lastSync = GetTickCount64();
+
+    opened->hFile = CreateFileW(args->journal, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (opened->hFile == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to open journal '%ls' with error: %lu\r\n", args->journal, GetLastError());
+        status = JOURNAL_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    ZeroMemory(&header, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.manifestSize = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    header.manifestWriteTime = ((ULONGLONG)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    header.filter = FilterHash(args);
+
+    JournalHeader existing;
+    if (GetFileSizeEx(opened->hFile, &fileSize)
+        && (ULONGLONG)fileSize.QuadPart >= sizeof(JournalHeader)
+        && ReadFile(opened->hFile, &existing, sizeof(existing), &bytesRead, NULL)
+        && bytesRead == sizeof(existing)
+        && memcmp(&existing, &header, sizeof(header)) == 0)
+    {
+        status = LoadRecords(opened, (ULONGLONG)fileSize.QuadPart);
+        goto Cleanup;
+    }
+
+    if (GetFileSizeEx(opened->hFile, &fileSize) && fileSize.QuadPart > 0)
+    {
+        LogError(args, L"journal '%ls' belongs to another manifest or other filters, starting over\r\n", args->journal, 0);
+    }
+
+    LARGE_INTEGER start = { 0 };
+    if (!SetFilePointerEx(opened->hFile, start, NULL, FILE_BEGIN)
+        || !SetEndOfFile(opened->hFile)
+        || !WriteAll(opened->hFile, &header, sizeof(header))
+        || !FlushFileBuffers(opened->hFile))
+    {
+        status = JOURNAL_FAILED_TO_WRITE;
+    }
+
+Cleanup:
+    if (status == JOURNAL_FAILED_TO_WRITE)
+    {
+        LogError(args, L"failed to write journal '%ls' with error: %lu\r\n", args->journal, GetLastError());
+    }
+    if (status != SUCCESS)
+    {
+        CloseJournal(opened, FALSE);
+        return status;
+    }
+
+    *journal = opened;
+    return SUCCESS;
+}
+
+// TRUE if an earlier run already verified the entry, *matched is its result
+BOOL JournalLookup(__in Journal* journal, __in ULONGLONG index, __out BOOL* matched)
+{
+    if (index >= journal->resumed)
+    {
+        return FALSE;
+    }
+
+    *matched = (journal->failed[index / 8] & (1 << (index % 8))) == 0;
+    return TRUE;
+}
+
+// writes the buffered records, with sync also through to the disk
+static ErrorCode FlushJournal(__inout Journal* journal, __in BOOL sync)
+{
+    if (journal->buffered > 0)
+    {
+        if (!WriteAll(journal->hFile, journal->buffer, (DWORD)(journal->buffered * sizeof(JournalRecord))))
+        {
+            LogError(journal->args, L"failed to write journal '%ls' with error: %lu\r\n", journal->file, GetLastError());
+            return JOURNAL_FAILED_TO_WRITE;
+        }
+        journal->buffered = 0;
+    }
+
+    if (sync)
+    {
+        if (!FlushFileBuffers(journal->hFile))
+        {
+            LogError(journal->args, L"failed to write journal '%ls' with error: %lu\r\n", journal->file, GetLastError());
+            return JOURNAL_FAILED_TO_WRITE;
+        }
+        journal->lastSync = GetTickCount64();
+    }
+    return SUCCESS;
+}
+
+// Records the result of the next entry. The records reach the disk every
+// JOURNAL_SYNC_INTERVAL ms, a crash loses at most the results since then.
+ErrorCode JournalAppend(__inout Journal* journal, __in BOOL matched, __in_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    JournalRecord* record = &journal->buffer[journal->buffered++];
+
+    record->index = journal->next++;
+    record->status = matched ? SUCCESS : CHECK_SUM_CHECKSUM_FAILED;
+    record->reserved = 0;
+    memcpy(record->digest, digest, SHA256_DIGEST_LENGTH);
+
+    BOOL sync = GetTickCount64() - journal->lastSync >= JOURNAL_SYNC_INTERVAL;
+    if (sync || journal->buffered == JOURNAL_BUFFER_RECORDS)
+    {
+        return FlushJournal(journal, sync);
+    }
+    return SUCCESS;
+}
+
+// Flushes the records and closes the journal. A run that got to its result
+// does not need it anymore, finished deletes it, so the next run verifies
+// everything again.
+ErrorCode CloseJournal(__in_opt Journal* journal, __in BOOL finished)
+{
+    ErrorCode status = SUCCESS;
+
+    if (journal == NULL)
+    {
+        return SUCCESS;
+    }
+
+    if (journal->hFile != INVALID_HANDLE_VALUE && journal->hFile != NULL)
+    {
+        if (!finished)
+        {
+            status = FlushJournal(journal, TRUE);
+        }
+        CloseHandle(journal->hFile);
+
+        if (finished && !DeleteFileW(journal->file))
+        {
+            LogError(journal->args, L"failed to delete journal '%ls' with error: %lu\r\n", journal->file, GetLastError());
+        }
+    }
+
+    free(journal->failed);
+    free(journal);
+    return status;
+}
@@ -4,6 +4,114 @@
 #define MINOR_VERSION 0
 #define PATCH_VERSION 4
 
+typedef struct found_file_t
+{
+    LPWSTR userInputFilePath;
+    WCHAR fileName[MAX_PATH];
+    WCHAR absFilePath[MAX_PATH];
+} FoundFile;
+
+BOOL PrintResult(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    FoundFile* found = (FoundFile*)job->context;
+    ErrorCode* status = (ErrorCode*)context;
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+
+    // CalcDigest already reported the failure, like before we go on with the next file
+    if (job->status != SUCCESS)
+    {
+        return TRUE;
+    }
+
+    FormatDigest(hash, job->digest);
+    *status = WriteHashLine(args, found->userInputFilePath, found->fileName, found->absFilePath, hash, job->hashedSize);
+    return *status == SUCCESS;
+}
+
+// expands all FILE parameters first so the scheduler can hash them in parallel,
+// the output keeps the order of the arguments and of FindNextFile
+ErrorCode HashFiles(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ErrorCode findStatus = SUCCESS;
+    FoundFile* found = NULL;
+    HashJob* jobs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    for (FileList* current = args->files; current != NULL && findStatus == SUCCESS; current = current->next)
+    {
+        WIN32_FIND_DATA findFileData;
+        HANDLE hFind = FindFirstFile(current->file, &findFileData);
+
+        // hash what was found so far and report the failure afterwards
+        if (hFind == INVALID_HANDLE_VALUE)
+        {
+            wchar_t msg[MAX_PATH + 100];
+            wsprintfW(msg, L"failed to find files for argument '%ls' with error %lu\n", current->file, GetLastError());
+            WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+            findStatus = MAIN_FAILED_TO_FIND_FILES;
+            break;
+        }
+
+        do
+        {
+            if (count == capacity)
+            {
+                size_t newCapacity = capacity == 0 ? 64 : capacity * 2;
+                FoundFile* grown = realloc(found, newCapacity * sizeof(FoundFile));
+                if (grown == NULL)
+                {
+                    FindClose(hFind);
+                    status = SCHEDULER_ALLOCATE_ERROR;
+                    goto Cleanup;
+                }
+                found = grown;
+                capacity = newCapacity;
+            }
+
+            FoundFile* file = &found[count];
+            file->userInputFilePath = current->file;
+            wcscpy_s(file->fileName, MAX_PATH, findFileData.cFileName);
+            status = BuildFilePath(current->file, file->fileName, file->absFilePath);
+            if (status != SUCCESS)
+            {
+                FindClose(hFind);
+                goto Cleanup;
+            }
+            ++count;
+        } while (FindNextFile(hFind, &findFileData) != 0);
+
+        FindClose(hFind);
+    }
+
+    jobs = calloc(count > 0 ? count : 1, sizeof(HashJob));
+    if (jobs == NULL)
+    {
+        status = SCHEDULER_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        jobs[i].file = found[i].absFilePath;
+        jobs[i].context = &found[i];
+    }
+
+    ErrorCode printStatus = SUCCESS;
+    status = RunHashJobs(args, jobs, count, PrintResult, &printStatus);
+    if (status == SUCCESS)
+    {
+        status = printStatus != SUCCESS ? printStatus : findStatus;
+    }
+
+Cleanup:
+    free(jobs);
+    free(found);
+
+    return status;
+}
+
 int run(int argc, LPWSTR argv[])
 {
     Args args = { 0 };
@@ -15,6 +123,27 @@ int run(int argc, LPWSTR argv[])
     case PARSE_ARGS_MISSING_PARAMETER:
     case PARSE_ARGS_MISSING_SHASUMS_FILE:
     case PARSE_ARGS_ALLOCATE_ERROR:
+    case PARSE_ARGS_MISSING_PIPE_NAME:
+    case PARSE_ARGS_MISSING_FILES_FROM_FILE:
+    case PARSE_ARGS_INVALID_JOBS:
+    case PARSE_ARGS_INVALID_ORDER:
+    case PARSE_ARGS_MISSING_CONVERT_FILES:
+    case PARSE_ARGS_MISSING_LOOKUP_FILE:
+    case PARSE_ARGS_MISSING_DIFF_ARGUMENTS:
+    case PARSE_ARGS_MISSING_PATTERN:
+    case PARSE_ARGS_MISSING_PATHS_FROM_FILE:
+    case PARSE_ARGS_INVALID_LIMIT:
+    case PARSE_ARGS_INVALID_STORAGE:
+    case PARSE_ARGS_INVALID_PREFETCH:
+    case PARSE_ARGS_MISSING_TREE_DIRECTORY:
+    case PARSE_ARGS_MISSING_TREE_CACHE:
+    case PARSE_ARGS_MISSING_WATCH_DIRECTORY:
+    case PARSE_ARGS_MISSING_OUTPUT:
+    case PARSE_ARGS_MISSING_JOURNAL:
+    case PARSE_ARGS_MISSING_APPEND_STATE:
+    case PARSE_ARGS_MISSING_TAR:
+    case PARSE_ARGS_MISSING_COPY_TO:
+    case PARSE_ARGS_INVALID_EXPECT:
         return parse_result;
     }
 
@@ -32,50 +161,135 @@ int run(int argc, LPWSTR argv[])
         return SUCCESS;
     }
 
+    // keep serving hash requests until a client asks us to stop
+    if (args.serve)
+    {
+        return RunDaemon(&args);
+    }
+
+    if (args.stopDaemon)
+    {
+        return StopDaemon(&args);
+    }
+
+    ErrorCode status = SUCCESS;
+
+    // text manifest to binary index or back
+    if (args.convertFrom != NULL)
+    {
+        return ConvertManifest(&args);
+    }
+
+    // keep a manifest of a directory current until Ctrl+C
+    if (args.watchDirectory != NULL)
+    {
+        return WatchDirectory(&args);
+    }
+
+    // growing files continue from the midstates of the last run
+    if (args.appendState != NULL)
+    {
+        status = LoadAppendState(&args);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    // throughput and ETA on stderr while the files are hashed
+    StartProgress(&args);
+
+    // what changed in a directory since the manifest was written
+    if (args.diffManifest != NULL)
+    {
+        status = DiffTree(&args);
+        goto Cleanup;
+    }
+
+    // one digest for a whole directory tree
+    if (args.treeDirectory != NULL)
+    {
+        status = TreeDigest(&args);
+        goto Cleanup;
+    }
+
+    // stdin to stdout, hashed on the way
+    if (args.tee)
+    {
+        status = TeeStdin(&args);
+        goto Cleanup;
+    }
+
+    // members of a tar archive, from a file or stdin, without extracting it
+    if (args.tarFile != NULL)
+    {
+        status = HashTar(&args);
+        goto Cleanup;
+    }
+
+    // expected hash of a single file from a binary index
+    if (args.sumFile != NULL && args.lookup != NULL)
+    {
+        status = LookupChecksum(&args);
+        goto Cleanup;
+    }
+
     // run check on checksum file
     if (args.sumFile != NULL)
     {
-        return VerifyChecksums(&args);
+        status = VerifyChecksums(&args);
+        goto Cleanup;
+    }
+
+    // FILE parameters copied and hashed in one read
+    if (args.copyTo != NULL)
+    {
+        status = CopyFiles(&args);
+        goto Cleanup;
     }
 
     // handle all FILE parameters
     if (args.files != NULL)
     {
-        FileList* current = args.files;
-        while (current != NULL)
+        status = HashFiles(&args);
+        if (status != SUCCESS)
         {
-            WIN32_FIND_DATA findFileData;
-            HANDLE hFind = FindFirstFile(current->file, &findFileData);
-
-            if (hFind == INVALID_HANDLE_VALUE)
-            {
-                wchar_t msg[MAX_PATH + 100];
-                wsprintfW(msg, L"failed to find files for argument '%ls' with error %lu\n", current->file, GetLastError());
-                WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                return MAIN_FAILED_TO_FIND_FILES;
-            }
+            goto Cleanup;
+        }
+    }
 
-            do
-            {
-                ErrorCode printHashStatus = PrintHash(&args, current->file, findFileData.cFileName);
-                if (printHashStatus != SUCCESS)
-                {
-                    FindClose(hFind);
-                    return printHashStatus;
-                }
-            } while (FindNextFile(hFind, &findFileData) != 0);
+    // paths from a list file or stdin are hashed while the list is read
+    if (args.filesFrom != NULL)
+    {
+        status = HashFilesFrom(&args);
+    }
 
-            FindClose(hFind);
+Cleanup:
+    StopProgress();
 
-            current = current->next;
+    if (args.appendState != NULL)
+    {
+        ErrorCode saveStatus = SaveAppendState(&args);
+        if (status == SUCCESS)
+        {
+            status = saveStatus;
         }
-        return SUCCESS;
     }
 
-    return SUCCESS;
+    if (args.showStats)
+    {
+        PrintRunStats();
+    }
+
+    return status;
 }
 
 int wmain(int argc, LPWSTR argv[])
 {
-    return run(argc, argv);
+    int status = run(argc, argv);
+
+    // redirected results are buffered
+    FlushStdout();
+
+    return status;
 }
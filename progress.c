@@ -0,0 +1,237 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define PROGRESS_CONSOLE_INTERVAL 250 // ms between redraws of the console line
+#define PROGRESS_LOG_INTERVAL 5000    // ms between lines when stderr is redirected
+#define PROGRESS_LINE_LENGTH (MAX_PATH + 160)
+
+// The workers only bump the RunStats counters and copy the name of the file they
+// start, the reporter thread reads the counters on its own schedule and does all
+// formatting and writing.
+typedef struct progress_t
+{
+    HANDLE thread;
+    HANDLE stop;
+    BOOL isConsole;
+    ULONGLONG started;
+    int lastLength;
+    SRWLOCK lock;
+    WCHAR currentFile[MAX_PATH];
+} Progress;
+
+static Progress progress = { 0 };
+
+static void FormatSize(__out_ecount(count) LPWSTR text, __in size_t count, __in ULONGLONG bytes)
+{
+    static const LPCWSTR units[] = { L"B", L"KiB", L"MiB", L"GiB", L"TiB", L"PiB" };
+    ULONGLONG unit = 1;
+    int index = 0;
+
+    while (index + 1 < _countof(units) && bytes >= unit * 1024)
+    {
+        unit *= 1024;
+        ++index;
+    }
+
+    if (index == 0)
+    {
+        StringCchPrintfW(text, count, L"%llu B", bytes);
+    }
+    else
+    {
+        ULONGLONG tenths = bytes * 10 / unit; // fits, unit is at most 2^50
+        StringCchPrintfW(text, count, L"%llu.%llu %ls", tenths / 10, tenths % 10, units[index]);
+    }
+}
+
+// Renders one progress line. total is 0 while the size of the work is not known,
+// rate is in bytes per second and 0 before the first measurement.
+void FormatProgress(__out_ecount(count) LPWSTR line, __in size_t count, __in ULONGLONG bytes, __in ULONGLONG total, __in ULONGLONG files, __in ULONGLONG rate, __in_opt LPCWSTR file)
+{
+    WCHAR done[32];
+    WCHAR planned[32];
+    WCHAR speed[32];
+    WCHAR eta[32] = L"";
+
+    FormatSize(done, _countof(done), bytes);
+    FormatSize(speed, _countof(speed), rate);
+
+    if (total > bytes && rate > 0)
+    {
+        ULONGLONG seconds = (total - bytes + rate - 1) / rate;
+        StringCchPrintfW(eta, _countof(eta), L", ETA %llu:%02llu:%02llu", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    }
+
+    if (total > 0)
+    {
+        FormatSize(planned, _countof(planned), total);
+        StringCchPrintfW(line, count, L"%ls of %ls, %ls/s%ls, %llu files", done, planned, speed, eta, files);
+    }
+    else
+    {
+        StringCchPrintfW(line, count, L"%ls, %ls/s, %llu files", done, speed, files);
+    }
+
+    if (file != NULL && file[0] != L'\0')
+    {
+        StringCchCatW(line, count, L", ");
+        StringCchCatW(line, count, file);
+    }
+}
+
+static void WriteProgress(__in LPCWSTR line, __in BOOL last)
+{
+    HANDLE hErr = GetStdHandle(STD_ERROR_HANDLE);
+
+    // results before the progress line, when both go to the same file
+    FlushStdout();
+
+    if (!progress.isConsole)
+    {
+        WCHAR text[PROGRESS_LINE_LENGTH + 2];
+        if (SUCCEEDED(StringCchPrintfW(text, _countof(text), L"%ls\r\n", line)))
+        {
+            WriteFileUTF8(hErr, text);
+        }
+        return;
+    }
+
+    // the line is redrawn in place, cut to the window and padded over the previous one
+    WCHAR text[PROGRESS_LINE_LENGTH + 4];
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    int width = PROGRESS_LINE_LENGTH;
+    if (GetConsoleScreenBufferInfo(hErr, &info))
+    {
+        width = info.srWindow.Right - info.srWindow.Left;
+    }
+    if (width > PROGRESS_LINE_LENGTH)
+    {
+        width = PROGRESS_LINE_LENGTH;
+    }
+
+    int length = lstrlenW(line);
+    if (length > width)
+    {
+        length = width;
+    }
+
+    text[0] = L'\r';
+    memcpy(text + 1, line, length * sizeof(WCHAR));
+    int end = length + 1;
+    while (end - 1 < progress.lastLength && end - 1 < width)
+    {
+        text[end++] = L' ';
+    }
+    if (last)
+    {
+        text[end++] = L'\r';
+        text[end++] = L'\n';
+    }
+    progress.lastLength = length;
+
+    WriteConsoleW(hErr, text, end, NULL, NULL);
+}
+
+static void ReportProgress(__in ULONGLONG* lastBytes, __in ULONGLONG* lastTime, __inout ULONGLONG* rate, __in BOOL last)
+{
+    WCHAR line[PROGRESS_LINE_LENGTH];
+    WCHAR file[MAX_PATH];
+
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG bytes = (ULONGLONG)runStats.bytesHashed;
+    ULONGLONG total = (ULONGLONG)runStats.bytesPlanned;
+    ULONGLONG files = (ULONGLONG)runStats.filesHashed;
+
+    // smoothed over the recent intervals so the ETA does not jump around
+    if (now > *lastTime)
+    {
+        ULONGLONG sample = (bytes - *lastBytes) * 1000 / (now - *lastTime);
+        *rate = *rate == 0 ? sample : (*rate * 7 + sample * 3) / 10;
+    }
+    *lastBytes = bytes;
+    *lastTime = now;
+
+    AcquireSRWLockShared(&progress.lock);
+    StringCchCopyW(file, _countof(file), progress.currentFile);
+    ReleaseSRWLockShared(&progress.lock);
+
+    FormatProgress(line, _countof(line), bytes, total, files, last ? bytes * 1000 / (now > progress.started ? now - progress.started : 1) : *rate, last ? NULL : file);
+    WriteProgress(line, last);
+}
+
+static DWORD WINAPI ProgressReporter(__in LPVOID parameter)
+{
+    UNREFERENCED_PARAMETER(parameter);
+    DWORD interval = progress.isConsole ? PROGRESS_CONSOLE_INTERVAL : PROGRESS_LOG_INTERVAL;
+    ULONGLONG lastBytes = (ULONGLONG)runStats.bytesHashed;
+    ULONGLONG lastTime = progress.started;
+    ULONGLONG rate = 0;
+
+    while (WaitForSingleObject(progress.stop, interval) == WAIT_TIMEOUT)
+    {
+        ReportProgress(&lastBytes, &lastTime, &rate, FALSE);
+    }
+
+    ReportProgress(&lastBytes, &lastTime, &rate, TRUE);
+    return 0;
+}
+
+// starts the reporter thread for --progress, without it the run goes on silently
+void StartProgress(__in Args* args)
+{
+    DWORD mode;
+
+    if (!args->progress || args->status || progress.thread != NULL)
+    {
+        return;
+    }
+
+    progress.isConsole = GetConsoleMode(GetStdHandle(STD_ERROR_HANDLE), &mode);
+    progress.started = GetTickCount64();
+    progress.lastLength = 0;
+    progress.currentFile[0] = L'\0';
+    InitializeSRWLock(&progress.lock);
+
+    progress.stop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (progress.stop == NULL)
+    {
+        return;
+    }
+
+    progress.thread = CreateThread(NULL, 0, ProgressReporter, NULL, 0, NULL);
+    if (progress.thread == NULL)
+    {
+        CloseHandle(progress.stop);
+        progress.stop = NULL;
+    }
+}
+
+// writes the final line and waits for the reporter
+void StopProgress(void)
+{
+    if (progress.thread == NULL)
+    {
+        return;
+    }
+
+    SetEvent(progress.stop);
+    WaitForSingleObject(progress.thread, INFINITE);
+    CloseHandle(progress.thread);
+    CloseHandle(progress.stop);
+    progress.thread = NULL;
+    progress.stop = NULL;
+}
+
+// called once per file before it is read, never from the read loop
+void ProgressStartFile(__in LPCWSTR file)
+{
+    if (progress.thread == NULL)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&progress.lock);
+    StringCchCopyW(progress.currentFile, _countof(progress.currentFile), file);
+    ReleaseSRWLockExclusive(&progress.lock);
+}
@@ -0,0 +1,1171 @@
+#include "sha256sum.h"
+
+#define FILE_ID_RECORD_MASK 0x0000FFFFFFFFFFFFULL
+#define IDENTITY_BUCKETS 1024                    // first size of the identity map, doubled as it fills
+
+#define PREFETCH_READ_SIZE (256 * 1024)          // first bytes read ahead, all of a small file
+#define PREFETCH_LEAD_MS 250                     // hashing time the prefetcher tries to stay ahead
+#define PREFETCH_MINIMUM_LEAD (4 * 1024 * 1024)  // before the first throughput sample
+#define PREFETCH_POLL_MS 50
+
+// who has the file of an entry open, see Prefetcher
+enum
+{
+    PREFETCH_NONE = 0,
+    PREFETCH_BUSY = 1,  // the prefetcher is opening it
+    PREFETCH_READY = 2, // hFile is open and its first bytes are cached
+    PREFETCH_FAILED = 3,
+    PREFETCH_TAKEN = 4, // a worker has it, opened ahead or not
+};
+
+// where an entry of the window is
+enum
+{
+    ENTRY_FREE = 0,
+    ENTRY_QUEUED = 1,  // in the heap of its disk
+    ENTRY_RUNNING = 2,
+    ENTRY_DONE = 3,    // hashed, skipped or a duplicate, waits to be reported
+};
+
+// a physical file, the same key the daemon cache uses
+typedef struct file_identity_t
+{
+    DWORD volumeSerialNumber;
+    DWORD fileIndexHigh;
+    DWORD fileIndexLow;
+    FILETIME lastWriteTime;
+    ULONGLONG size;
+    DWORD attributes;
+    DWORD links;
+    BOOL mapped;
+    ULONGLONG firstCluster; // logical cluster the data starts at, if mapped
+} FileIdentity;
+
+// FILE_STAT_BASIC_INFORMATION, which the 10.0.22000 SDK does not declare yet
+typedef struct stat_basic_info_t
+{
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG FileAttributes;
+    ULONG ReparseTag;
+    ULONG NumberOfLinks;
+    ULONG DeviceType;
+    ULONG DeviceCharacteristics;
+    ULONG Reserved;
+    LARGE_INTEGER VolumeSerialNumber;
+    BYTE FileId128[16];
+} StatBasicInfo;
+
+#define FILE_STAT_BASIC_BY_NAME_INFO 3 // FileStatBasicByNameInfo
+
+// GetFileInformationByName, Windows 11 24H2 and later
+typedef BOOL (WINAPI* StatByNameFunction)(LPCWSTR, int, PVOID, ULONG);
+
+// A physical file seen in this run. The first entry that refers to it hashes
+// it, the others take its result once it is reported. Files with more than one
+// link stay in the map for the whole run. The others only stay while an entry
+// in the window refers to them, so the map does not grow with the length of a
+// manifest, and a path repeated further apart than the window is read again.
+typedef struct identity_record_t
+{
+    FileIdentity identity;
+    ErrorCode status;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG hashedSize;
+    DWORD openError;
+    size_t references; // entries in the window
+    struct identity_record_t* next;
+} IdentityRecord;
+
+typedef struct pool_entry_t
+{
+    HashJob job;
+    ULONGLONG sequence; // position in the input
+    LONG state;
+    ULONGLONG size;
+    DWORD device;       // in the storage table, see storage.c
+    DWORD volume;
+    BOOL mapped;        // location is the first cluster, otherwise the file ID
+    ULONGLONG location; // for --order fileid and physical
+    size_t heapIndex;
+    IdentityRecord* identity; // NULL if the stat failed
+    BOOL duplicate;           // an earlier entry hashes the file
+    volatile LONG prefetch;
+    HANDLE hFile;             // opened ahead, valid in PREFETCH_READY
+} PoolEntry;
+
+// The caller submits jobs into a window of entries and gets them back in the
+// order it submitted them. Queued entries wait in one heap per disk, ordered by
+// --order, until a worker with a reader of that disk to spare takes them. The
+// workers live as long as the pool.
+struct hash_pool_t
+{
+    Args* args;
+    HashJobCallback onDone;
+    PVOID context;
+    PoolEntry* entries;
+    size_t window;
+    ULONGLONG submitted;
+    ULONGLONG reported;
+    ErrorCode status;
+    BOOL stopped;  // cancelled or failed, nothing is queued or reported anymore
+    BOOL closing;  // idle workers exit
+    SRWLOCK lock;
+    CONDITION_VARIABLE workQueued;
+    CONDITION_VARIABLE jobDone;
+    PoolEntry** heaps[MAXIMUM_STORAGE_DEVICES];
+    size_t heapCounts[MAXIMUM_STORAGE_DEVICES];
+    size_t queued;
+    BOOL used[MAXIMUM_STORAGE_DEVICES];
+    LONG readers[MAXIMUM_STORAGE_DEVICES];
+    LONG active[MAXIMUM_STORAGE_DEVICES];
+    DWORD threadCount; // planned for the disks seen so far
+    DWORD started;
+    DWORD idle;
+    BOOL largestFirst;
+    BOOL rotational;
+    HANDLE threads[MAXIMUM_JOBS];
+    IdentityRecord** buckets;
+    size_t bucketCount;
+    size_t recordCount;
+    BOOL prefetchTried;
+    volatile LONG prefetchOn;
+    HANDLE prefetcher;
+    HANDLE prefetchWake; // auto reset, set whenever a worker takes an entry
+    volatile LONG prefetchStop;
+    PoolEntry* prefetching; // its path is in use until the prefetcher is done with it
+    StatByNameFunction statByName; // NULL before Windows 11 24H2
+};
+
+// largest first, ties keep the input order so runs are reproducible
+static int CompareLargestFirst(__in PoolEntry* left, __in PoolEntry* right)
+{
+    if (left->size != right->size)
+    {
+        return left->size > right->size ? -1 : 1;
+    }
+    return left->sequence < right->sequence ? -1 : (left->sequence > right->sequence ? 1 : 0);
+}
+
+// Volume by volume, files without a cluster of their own first by file ID, the
+// MFT records that hold them are laid out that way, then by their first cluster.
+static int CompareLocation(__in PoolEntry* left, __in PoolEntry* right)
+{
+    if (left->volume != right->volume)
+    {
+        return left->volume < right->volume ? -1 : 1;
+    }
+    if (left->mapped != right->mapped)
+    {
+        return left->mapped ? 1 : -1;
+    }
+    if (left->location != right->location)
+    {
+        return left->location < right->location ? -1 : 1;
+    }
+    return left->sequence < right->sequence ? -1 : (left->sequence > right->sequence ? 1 : 0);
+}
+
+// largest first only pays off with several workers, the layout orders cut
+// seeks on a single one just as well
+static BOOL RunsBefore(__in HashPool* pool, __in PoolEntry* left, __in PoolEntry* right)
+{
+    if (pool->largestFirst)
+    {
+        return CompareLargestFirst(left, right) < 0;
+    }
+    if (pool->args->order == ORDER_FILE_ID || pool->args->order == ORDER_PHYSICAL)
+    {
+        return CompareLocation(left, right) < 0;
+    }
+    return left->sequence < right->sequence;
+}
+
+static void HeapSwap(__inout PoolEntry** heap, __in size_t a, __in size_t b)
+{
+    PoolEntry* entry = heap[a];
+    heap[a] = heap[b];
+    heap[b] = entry;
+    heap[a]->heapIndex = a;
+    heap[b]->heapIndex = b;
+}
+
+static void SiftUp(__in HashPool* pool, __inout PoolEntry** heap, __in size_t i)
+{
+    while (i > 0 && RunsBefore(pool, heap[i], heap[(i - 1) / 2]))
+    {
+        HeapSwap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void SiftDown(__in HashPool* pool, __inout PoolEntry** heap, __in size_t count, __in size_t i)
+{
+    while (TRUE)
+    {
+        size_t first = i;
+        size_t left = i * 2 + 1;
+        if (left < count && RunsBefore(pool, heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (left + 1 < count && RunsBefore(pool, heap[left + 1], heap[first]))
+        {
+            first = left + 1;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        HeapSwap(heap, i, first);
+        i = first;
+    }
+}
+
+static void RemoveQueued(__inout HashPool* pool, __in PoolEntry* entry)
+{
+    PoolEntry** heap = pool->heaps[entry->device];
+    size_t last = --pool->heapCounts[entry->device];
+    size_t i = entry->heapIndex;
+
+    --pool->queued;
+    if (i != last)
+    {
+        heap[i] = heap[last];
+        heap[i]->heapIndex = i;
+        SiftDown(pool, heap, last, i);
+        SiftUp(pool, heap, i);
+    }
+}
+
+static void RunJob(__in Args* args, __inout HashJob* job)
+{
+    if (!job->skip)
+    {
+        job->status = CalcJobDigest(args, job);
+    }
+}
+
+// runs the job of an entry a worker took, on the handle the prefetcher opened
+// if it got there first
+static void RunEntry(__inout HashPool* pool, __inout PoolEntry* entry)
+{
+    HashJob* job = &entry->job;
+
+    if (!pool->prefetchOn)
+    {
+        RunJob(pool->args, job);
+        return;
+    }
+
+    // a file the prefetcher is still opening is opened here as well, the
+    // prefetcher closes its handle when it finds the entry taken
+    LONG state = InterlockedExchange(&entry->prefetch, PREFETCH_TAKEN);
+    SetEvent(pool->prefetchWake);
+    if (state != PREFETCH_READY)
+    {
+        RunJob(pool->args, job);
+        return;
+    }
+
+    ProgressStartFile(job->file);
+    job->status = HashOpenFile(pool->args, job->digest, entry->hFile, &job->facts, &job->hashedSize);
+}
+
+// Opens a file and reads its first bytes so they are in the cache by the time
+// a worker gets to it, then rewinds for the worker. Windows has no WILLNEED
+// hint, the cache manager reads ahead from there on the sequential handle.
+static HANDLE OpenAhead(__in Args* args, __in LPCWSTR file, __in ULONGLONG size)
+{
+    DWORD dwBytesRead;
+    LARGE_INTEGER start;
+    PBYTE buffer = GetReadBuffer();
+
+    HANDLE hFile = OpenFileForHashing(args, file);
+    if (hFile == INVALID_HANDLE_VALUE || buffer == NULL || size == 0)
+    {
+        return hFile;
+    }
+
+    start.QuadPart = 0;
+    if (!ReadFile(hFile, buffer, size < PREFETCH_READ_SIZE ? (DWORD)size : PREFETCH_READ_SIZE, &dwBytesRead, NULL)
+        || !SetFilePointerEx(hFile, start, NULL, FILE_BEGIN))
+    {
+        CloseHandle(hFile);
+        return INVALID_HANDLE_VALUE;
+    }
+    return hFile;
+}
+
+// The queued entry to open next, called with the lock held. The heaps are
+// walked level by level, which roughly follows the order the workers take the
+// entries in. Entries opened ahead already count against the window.
+static PoolEntry* NextPrefetch(__in HashPool* pool, __in ULONGLONG lead)
+{
+    ULONGLONG ahead = 0;
+    DWORD files = 0;
+
+    for (size_t level = 0; ; level++)
+    {
+        BOOL more = FALSE;
+        for (DWORD device = 0; device < MAXIMUM_STORAGE_DEVICES; device++)
+        {
+            if (level >= pool->heapCounts[device])
+            {
+                continue;
+            }
+            more = TRUE;
+
+            if (files >= pool->args->prefetch || ahead >= lead)
+            {
+                return NULL;
+            }
+
+            PoolEntry* entry = pool->heaps[device][level];
+            ++files;
+            ahead += entry->size;
+            if (entry->prefetch == PREFETCH_NONE)
+            {
+                return entry;
+            }
+        }
+
+        if (!more)
+        {
+            return NULL;
+        }
+    }
+}
+
+// Keeps the files the workers take next open and cached. The window is
+// measured in bytes, the hash throughput of the last interval times
+// PREFETCH_LEAD_MS, so it covers many small files or a few large ones and
+// grows and shrinks with the storage. args->prefetch caps the open handles.
+static DWORD WINAPI Prefetcher(__in LPVOID parameter)
+{
+    HashPool* pool = (HashPool*)parameter;
+    Args* args = pool->args;
+    ULONGLONG lastTime = GetTickCount64();
+    ULONGLONG lastBytes = (ULONGLONG)runStats.bytesHashed;
+    ULONGLONG rate = 0;
+
+    while (!pool->prefetchStop)
+    {
+        ULONGLONG now = GetTickCount64();
+        ULONGLONG bytes = (ULONGLONG)runStats.bytesHashed;
+        if (now >= lastTime + PREFETCH_POLL_MS)
+        {
+            ULONGLONG sample = (bytes - lastBytes) * 1000 / (now - lastTime);
+            rate = rate == 0 ? sample : (rate * 7 + sample * 3) / 10;
+            lastTime = now;
+            lastBytes = bytes;
+        }
+
+        ULONGLONG lead = rate * PREFETCH_LEAD_MS / 1000;
+        if (lead < PREFETCH_MINIMUM_LEAD)
+        {
+            lead = PREFETCH_MINIMUM_LEAD;
+        }
+
+        LPCWSTR file = NULL;
+        ULONGLONG size = 0;
+        AcquireSRWLockExclusive(&pool->lock);
+        PoolEntry* entry = pool->stopped ? NULL : NextPrefetch(pool, lead);
+        if (entry != NULL)
+        {
+            InterlockedExchange(&entry->prefetch, PREFETCH_BUSY);
+            pool->prefetching = entry;
+            file = entry->job.file;
+            size = entry->size;
+        }
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        if (entry == NULL)
+        {
+            WaitForSingleObject(pool->prefetchWake, PREFETCH_POLL_MS);
+            continue;
+        }
+
+        // failures are left to the worker, it reports them
+        HANDLE hFile = OpenAhead(args, file, size);
+        entry->hFile = hFile;
+        LONG state = hFile != INVALID_HANDLE_VALUE ? PREFETCH_READY : PREFETCH_FAILED;
+        if (InterlockedCompareExchange(&entry->prefetch, state, PREFETCH_BUSY) != PREFETCH_BUSY)
+        {
+            if (hFile != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(hFile);
+            }
+        }
+        else if (hFile != INVALID_HANDLE_VALUE)
+        {
+            InterlockedIncrementNoFence64(&runStats.filesPrefetched);
+        }
+
+        AcquireSRWLockExclusive(&pool->lock);
+        pool->prefetching = NULL;
+        ReleaseSRWLockExclusive(&pool->lock);
+        WakeAllConditionVariable(&pool->jobDone);
+    }
+
+    FreeReadBuffer();
+    return 0;
+}
+
+// open ahead through the cache, it would only add seeks on a rotational disk,
+// compete with --direct and count twice against the rate limits
+static void StartPrefetcher(__inout HashPool* pool)
+{
+    Args* args = pool->args;
+
+    pool->prefetchTried = TRUE;
+    if (args->prefetch == 0 || pool->rotational || args->direct || args->daemon
+        || args->maxRate.limit > 0 || args->maxIops.limit > 0)
+    {
+        return;
+    }
+
+    // set first, a worker that sees it off took its entry before the prefetcher could
+    InterlockedExchange(&pool->prefetchOn, TRUE);
+    pool->prefetcher = CreateThread(NULL, 0, Prefetcher, pool, 0, NULL);
+    if (pool->prefetcher == NULL)
+    {
+        InterlockedExchange(&pool->prefetchOn, FALSE);
+    }
+}
+
+static void StopPrefetcher(__inout HashPool* pool)
+{
+    if (pool->prefetcher == NULL)
+    {
+        return;
+    }
+
+    InterlockedExchange(&pool->prefetchStop, TRUE);
+    SetEvent(pool->prefetchWake);
+    WaitForSingleObject(pool->prefetcher, INFINITE);
+    CloseHandle(pool->prefetcher);
+    pool->prefetcher = NULL;
+}
+
+// The entry a free worker runs next, called with the lock held. While
+// largest first puts small files back, the entry the caller reports next is
+// taken first if it has not started, so the output does not wait for the
+// large files. Otherwise the entry that sorts first on a disk with a reader
+// to spare, so a worker does not queue up behind a busy rotational disk while
+// files on other disks wait.
+static PoolEntry* TakeEntry(__inout HashPool* pool)
+{
+    PoolEntry* entry = NULL;
+
+    if (pool->largestFirst && pool->reported < pool->submitted)
+    {
+        PoolEntry* next = &pool->entries[pool->reported % pool->window];
+        if (next->state == ENTRY_QUEUED && pool->active[next->device] < pool->readers[next->device])
+        {
+            entry = next;
+        }
+    }
+
+    for (DWORD device = 0; device < MAXIMUM_STORAGE_DEVICES && (entry == NULL || entry->sequence != pool->reported); device++)
+    {
+        if (pool->heapCounts[device] > 0 && pool->active[device] < pool->readers[device]
+            && (entry == NULL || RunsBefore(pool, pool->heaps[device][0], entry)))
+        {
+            entry = pool->heaps[device][0];
+        }
+    }
+
+    if (entry != NULL)
+    {
+        RemoveQueued(pool, entry);
+        entry->state = ENTRY_RUNNING;
+        ++pool->active[entry->device];
+    }
+    return entry;
+}
+
+static DWORD WINAPI PoolWorker(__in LPVOID parameter)
+{
+    HashPool* pool = (HashPool*)parameter;
+
+    AcquireSRWLockExclusive(&pool->lock);
+    while (!pool->stopped)
+    {
+        PoolEntry* entry = TakeEntry(pool);
+        if (entry == NULL)
+        {
+            if (pool->closing)
+            {
+                break;
+            }
+            ++pool->idle;
+            SleepConditionVariableSRW(&pool->workQueued, &pool->lock, INFINITE, 0);
+            --pool->idle;
+            continue;
+        }
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        RunEntry(pool, entry);
+
+        AcquireSRWLockExclusive(&pool->lock);
+        entry->state = ENTRY_DONE;
+        // a disk that was at its limit has a reader again
+        if (pool->active[entry->device]-- == pool->readers[entry->device])
+        {
+            WakeAllConditionVariable(&pool->workQueued);
+        }
+        WakeAllConditionVariable(&pool->jobDone);
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    FreeReadBuffer();
+    DisconnectDaemon();
+    return 0;
+}
+
+// where the first extent of the file starts on the volume, FALSE for files that
+// live in their MFT record, holes and file systems without cluster mapping
+static BOOL FirstCluster(__in HANDLE hFile, __out ULONGLONG* cluster)
+{
+    STARTING_VCN_INPUT_BUFFER start;
+    RETRIEVAL_POINTERS_BUFFER pointers;
+    DWORD dwBytesReturned;
+
+    start.StartingVcn.QuadPart = 0;
+    BOOL complete = DeviceIoControl(hFile, FSCTL_GET_RETRIEVAL_POINTERS, &start, sizeof(start),
+                                    &pointers, sizeof(pointers), &dwBytesReturned, NULL);
+    if ((!complete && GetLastError() != ERROR_MORE_DATA) || pointers.ExtentCount == 0
+        || pointers.Extents[0].Lcn.QuadPart < 0)
+    {
+        return FALSE;
+    }
+
+    *cluster = (ULONGLONG)pointers.Extents[0].Lcn.QuadPart;
+    return TRUE;
+}
+
+// Stats a file by name, without opening it. Returns FALSE where the call is
+// missing, the file system does not support it or the name is a link, whose
+// target is what gets hashed.
+static BOOL StatByName(__in StatByNameFunction statByName, __in LPCWSTR file, __out FileIdentity* identity)
+{
+    StatBasicInfo info;
+
+    if (statByName == NULL || !statByName(file, FILE_STAT_BASIC_BY_NAME_INFO, &info, sizeof(info))
+        || (info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0)
+    {
+        return FALSE;
+    }
+
+    // BY_HANDLE_FILE_INFORMATION has the low half of the serial, keep the two alike
+    identity->volumeSerialNumber = info.VolumeSerialNumber.LowPart;
+    identity->fileIndexHigh = (DWORD)((ULONGLONG)info.FileId.QuadPart >> 32);
+    identity->fileIndexLow = info.FileId.LowPart;
+    identity->lastWriteTime.dwHighDateTime = (DWORD)info.LastWriteTime.HighPart;
+    identity->lastWriteTime.dwLowDateTime = info.LastWriteTime.LowPart;
+    identity->size = (ULONGLONG)info.EndOfFile.QuadPart;
+    identity->attributes = info.FileAttributes;
+    identity->links = info.NumberOfLinks;
+    identity->mapped = FALSE;
+    return TRUE;
+}
+
+// The identity, size and attributes of a file. A stat by name needs no handle,
+// the file is only opened where that is not available, or for its first
+// cluster with --order physical.
+static BOOL StatFile(__in StatByNameFunction statByName, __in LPCWSTR file, __in BOOL physical, __out FileIdentity* identity)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+
+    BOOL named = StatByName(statByName, file, identity);
+    if (named && !physical)
+    {
+        return TRUE;
+    }
+
+    HANDLE hFile = CreateFileW(file,
+                               FILE_READ_ATTRIBUTES,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return named;
+    }
+
+    if (named)
+    {
+        identity->mapped = FirstCluster(hFile, &identity->firstCluster);
+        CloseHandle(hFile);
+        return TRUE;
+    }
+
+    BOOL hasInfo = GetFileInformationByHandle(hFile, &info);
+    identity->mapped = hasInfo && physical && FirstCluster(hFile, &identity->firstCluster);
+    CloseHandle(hFile);
+    if (!hasInfo)
+    {
+        return FALSE;
+    }
+
+    identity->volumeSerialNumber = info.dwVolumeSerialNumber;
+    identity->fileIndexHigh = info.nFileIndexHigh;
+    identity->fileIndexLow = info.nFileIndexLow;
+    identity->lastWriteTime = info.ftLastWriteTime;
+    identity->size = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    identity->attributes = info.dwFileAttributes;
+    identity->links = info.nNumberOfLinks;
+    return TRUE;
+}
+
+static size_t IdentityHash(__in FileIdentity* identity)
+{
+    ULONGLONG key = ((ULONGLONG)identity->fileIndexHigh << 32 | identity->fileIndexLow) ^ identity->volumeSerialNumber;
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 32;
+    return (size_t)key;
+}
+
+static BOOL SameIdentity(__in FileIdentity* left, __in FileIdentity* right)
+{
+    return left->volumeSerialNumber == right->volumeSerialNumber
+        && left->fileIndexHigh == right->fileIndexHigh
+        && left->fileIndexLow == right->fileIndexLow
+        && left->size == right->size
+        && left->lastWriteTime.dwHighDateTime == right->lastWriteTime.dwHighDateTime
+        && left->lastWriteTime.dwLowDateTime == right->lastWriteTime.dwLowDateTime;
+}
+
+// twice the buckets once there are twice as many records, if memory allows
+static void GrowIdentityMap(__inout HashPool* pool)
+{
+    size_t bucketCount = pool->bucketCount * 2;
+    IdentityRecord** buckets = calloc(bucketCount, sizeof(IdentityRecord*));
+    if (buckets == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->bucketCount; i++)
+    {
+        while (pool->buckets[i] != NULL)
+        {
+            IdentityRecord* record = pool->buckets[i];
+            size_t bucket = IdentityHash(&record->identity) & (bucketCount - 1);
+            pool->buckets[i] = record->next;
+            record->next = buckets[bucket];
+            buckets[bucket] = record;
+        }
+    }
+
+    free(pool->buckets);
+    pool->buckets = buckets;
+    pool->bucketCount = bucketCount;
+}
+
+// The record of the physical file, a new one if no entry refers to it yet.
+// duplicate tells whether an earlier entry hashes it. Only the caller's thread
+// uses the map. Returns NULL if memory ran out, the entry is then hashed on
+// its own.
+static IdentityRecord* ClaimIdentity(__inout HashPool* pool, __in FileIdentity* identity, __out BOOL* duplicate)
+{
+    size_t bucket = IdentityHash(identity) & (pool->bucketCount - 1);
+
+    for (IdentityRecord* record = pool->buckets[bucket]; record != NULL; record = record->next)
+    {
+        if (SameIdentity(&record->identity, identity))
+        {
+            ++record->references;
+            *duplicate = TRUE;
+            return record;
+        }
+    }
+
+    *duplicate = FALSE;
+    IdentityRecord* record = malloc(sizeof(IdentityRecord));
+    if (record == NULL)
+    {
+        return NULL;
+    }
+    record->identity = *identity;
+    record->status = SUCCESS;
+    record->references = 1;
+    record->next = pool->buckets[bucket];
+    pool->buckets[bucket] = record;
+
+    if (++pool->recordCount > pool->bucketCount * 2)
+    {
+        GrowIdentityMap(pool);
+    }
+    return record;
+}
+
+static void ReleaseIdentity(__inout HashPool* pool, __inout IdentityRecord* record)
+{
+    // a hardlink may still come up anywhere in the run
+    if (--record->references > 0 || record->identity.links > 1)
+    {
+        return;
+    }
+
+    IdentityRecord** link = &pool->buckets[IdentityHash(&record->identity) & (pool->bucketCount - 1)];
+    while (*link != record)
+    {
+        link = &(*link)->next;
+    }
+    *link = record->next;
+    --pool->recordCount;
+    free(record);
+}
+
+static void StopPool(__inout HashPool* pool, __in ErrorCode status)
+{
+    AcquireSRWLockExclusive(&pool->lock);
+    pool->stopped = TRUE;
+    if (pool->status == SUCCESS)
+    {
+        pool->status = status;
+    }
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    // running jobs stop at their next read, queued ones are dropped
+    InterlockedExchange(&pool->args->cancelled, TRUE);
+    WakeAllConditionVariable(&pool->workQueued);
+}
+
+// a duplicate gets the result of the entry that hashed its file, which was
+// reported before it
+static void ReportEntry(__inout HashPool* pool, __inout PoolEntry* entry)
+{
+    HashJob* job = &entry->job;
+    IdentityRecord* record = entry->identity;
+
+    if (record != NULL)
+    {
+        if (entry->duplicate)
+        {
+            job->status = record->status;
+            memcpy(job->digest, record->digest, SHA256_DIGEST_LENGTH);
+            job->hashedSize = record->hashedSize;
+            job->openError = record->openError;
+            if (record->status == SUCCESS)
+            {
+                InterlockedIncrement64(&runStats.duplicates);
+                InterlockedAdd64(&runStats.bytesSaved, (LONG64)record->identity.size);
+            }
+        }
+        else
+        {
+            record->status = job->status;
+            memcpy(record->digest, job->digest, SHA256_DIGEST_LENGTH);
+            record->hashedSize = job->hashedSize;
+            record->openError = job->openError;
+        }
+        ReleaseIdentity(pool, record);
+    }
+
+    job->done = TRUE;
+    if (!pool->onDone(pool->args, job, pool->context))
+    {
+        StopPool(pool, SUCCESS);
+    }
+}
+
+// Reports the finished entries at the front of the window, in the order they
+// were submitted. With wait it blocks until the first one is finished.
+static void ReportJobs(__inout HashPool* pool, __in BOOL wait)
+{
+    while (!pool->stopped && pool->reported < pool->submitted)
+    {
+        PoolEntry* entry = &pool->entries[pool->reported % pool->window];
+
+        AcquireSRWLockExclusive(&pool->lock);
+        BOOL finished = !pool->stopped && entry->state == ENTRY_DONE && pool->prefetching != entry;
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        if (!finished)
+        {
+            // no further result is ready, the ones reported so far go out before this
+            // waits, without waiting only once they are due so a fast run still
+            // writes in blocks
+            if (!wait)
+            {
+                FlushStdoutIfDue();
+                return;
+            }
+            FlushStdout();
+
+            AcquireSRWLockExclusive(&pool->lock);
+            while (!pool->stopped && (entry->state != ENTRY_DONE || pool->prefetching == entry))
+            {
+                SleepConditionVariableSRW(&pool->jobDone, &pool->lock, INFINITE, 0);
+            }
+            finished = !pool->stopped;
+            ReleaseSRWLockExclusive(&pool->lock);
+
+            if (!finished)
+            {
+                return;
+            }
+        }
+        wait = FALSE;
+
+        ReportEntry(pool, entry);
+
+        AcquireSRWLockExclusive(&pool->lock);
+        entry->state = ENTRY_FREE;
+        ++pool->reported;
+        ReleaseSRWLockExclusive(&pool->lock);
+    }
+}
+
+// A disk not seen before, the workers and the readers per disk are planned
+// again. Called with the lock held. Returns FALSE if memory ran out.
+static BOOL PlanDevice(__inout HashPool* pool, __in DWORD device)
+{
+    BOOL rotational;
+
+    pool->heaps[device] = malloc(pool->window * sizeof(PoolEntry*));
+    if (pool->heaps[device] == NULL)
+    {
+        return FALSE;
+    }
+
+    pool->used[device] = TRUE;
+    pool->threadCount = PlanStorageWorkers(pool->args, pool->used, pool->readers, &rotational);
+    if (pool->threadCount > MAXIMUM_JOBS)
+    {
+        pool->threadCount = MAXIMUM_JOBS;
+    }
+
+    // stop opening ahead once a rotational disk turns up
+    if (rotational && !pool->rotational)
+    {
+        pool->rotational = TRUE;
+        InterlockedExchange(&pool->prefetchStop, TRUE);
+    }
+
+    // the order of the queued entries changes with the number of workers
+    BOOL largestFirst = pool->args->order == ORDER_SIZE && pool->threadCount > 1;
+    if (largestFirst != pool->largestFirst)
+    {
+        pool->largestFirst = largestFirst;
+        for (DWORD i = 0; i < MAXIMUM_STORAGE_DEVICES; i++)
+        {
+            for (size_t j = pool->heapCounts[i] / 2; j-- > 0;)
+            {
+                SiftDown(pool, pool->heaps[i], pool->heapCounts[i], j);
+            }
+        }
+    }
+    return TRUE;
+}
+
+ErrorCode StartHashPool(__in Args* args, __in size_t window, __in HashJobCallback onDone, __in_opt PVOID context, __out HashPool** result)
+{
+    HashPool* pool = calloc(1, sizeof(HashPool));
+    if (pool == NULL)
+    {
+        return SCHEDULER_ALLOCATE_ERROR;
+    }
+
+    pool->entries = calloc(window > 0 ? window : 1, sizeof(PoolEntry));
+    pool->bucketCount = IDENTITY_BUCKETS;
+    pool->buckets = calloc(pool->bucketCount, sizeof(IdentityRecord*));
+    pool->prefetchWake = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (pool->entries == NULL || pool->buckets == NULL || pool->prefetchWake == NULL)
+    {
+        if (pool->prefetchWake != NULL)
+        {
+            CloseHandle(pool->prefetchWake);
+        }
+        free(pool->entries);
+        free(pool->buckets);
+        free(pool);
+        return SCHEDULER_ALLOCATE_ERROR;
+    }
+
+    pool->args = args;
+    pool->onDone = onDone;
+    pool->context = context;
+    pool->window = window > 0 ? window : 1;
+    InitializeSRWLock(&pool->lock);
+    InitializeConditionVariable(&pool->workQueued);
+    InitializeConditionVariable(&pool->jobDone);
+    InterlockedExchange(&args->cancelled, FALSE);
+
+    HMODULE kernel = GetModuleHandleW(L"kernelbase.dll");
+    if (kernel != NULL)
+    {
+        pool->statByName = (StatByNameFunction)GetProcAddress(kernel, "GetFileInformationByName");
+    }
+
+    *result = pool;
+    return SUCCESS;
+}
+
+// Waits until the window has room, reporting the jobs that finished meanwhile
+// on this thread. Returns the job to fill in and pass to SubmitHashJob, or NULL
+// once the pool stopped, because onDone returned FALSE or the pool failed.
+HashJob* ReserveHashJob(__inout HashPool* pool)
+{
+    ReportJobs(pool, FALSE);
+    while (!pool->stopped && pool->submitted - pool->reported == pool->window)
+    {
+        ReportJobs(pool, TRUE);
+    }
+
+    if (pool->stopped)
+    {
+        return NULL;
+    }
+
+    HashJob* job = &pool->entries[pool->submitted % pool->window].job;
+    ZeroMemory(job, sizeof(HashJob));
+    return job;
+}
+
+// Stats the file of the job and queues it on the disk it is on. Jobs that are
+// skipped, whose size does not match, or whose file an earlier job hashes are
+// not queued.
+void SubmitHashJob(__inout HashPool* pool, __inout HashJob* job)
+{
+    Args* args = pool->args;
+    PoolEntry* entry = &pool->entries[pool->submitted % pool->window];
+    FileIdentity identity;
+    BOOL startWorker = FALSE;
+    BOOL startPrefetcher = FALSE;
+
+    entry->sequence = pool->submitted;
+    entry->size = 0;
+    entry->device = 0;
+    entry->volume = 0;
+    entry->mapped = FALSE;
+    entry->location = 0;
+    entry->identity = NULL;
+    entry->duplicate = FALSE;
+    entry->prefetch = PREFETCH_NONE;
+    entry->hFile = INVALID_HANDLE_VALUE;
+    job->done = FALSE;
+    job->facts.known = FALSE;
+
+    // failures are reported by CalcDigest when the job runs
+    if (!job->skip && StatFile(pool->statByName, job->file, args->order == ORDER_PHYSICAL, &identity))
+    {
+        // hashing reuses the stat instead of querying the open handle again
+        job->facts.known = TRUE;
+        job->facts.size = identity.size;
+        job->facts.attributes = identity.attributes;
+
+        // a size that does not match means the content changed, no need to read it
+        if (job->checkSize && identity.size != job->expectedSize)
+        {
+            job->skip = TRUE;
+        }
+        else
+        {
+            entry->identity = ClaimIdentity(pool, &identity, &entry->duplicate);
+            entry->size = identity.size;
+            if (args->jobs == 0)
+            {
+                entry->device = StorageDeviceOf(identity.volumeSerialNumber, job->file);
+            }
+            entry->volume = identity.volumeSerialNumber;
+            entry->mapped = identity.mapped;
+            // the top 16 bits of an NTFS file ID are the reuse count of its MFT record
+            entry->location = identity.mapped
+                ? identity.firstCluster
+                : ((ULONGLONG)identity.fileIndexHigh << 32 | identity.fileIndexLow) & FILE_ID_RECORD_MASK;
+        }
+    }
+
+    if (!job->skip && !entry->duplicate)
+    {
+        InterlockedAddNoFence64(&runStats.bytesPlanned, (LONG64)entry->size);
+    }
+
+    AcquireSRWLockExclusive(&pool->lock);
+    ++pool->submitted;
+    if (job->skip || entry->duplicate)
+    {
+        entry->state = ENTRY_DONE;
+        ReleaseSRWLockExclusive(&pool->lock);
+        return;
+    }
+
+    if (!pool->used[entry->device] && !PlanDevice(pool, entry->device))
+    {
+        ReleaseSRWLockExclusive(&pool->lock);
+        StopPool(pool, SCHEDULER_ALLOCATE_ERROR);
+        return;
+    }
+
+    entry->state = ENTRY_QUEUED;
+    entry->heapIndex = pool->heapCounts[entry->device]++;
+    pool->heaps[entry->device][entry->heapIndex] = entry;
+    SiftUp(pool, pool->heaps[entry->device], entry->heapIndex);
+    ++pool->queued;
+
+    startWorker = pool->queued > pool->idle && pool->started < pool->threadCount;
+    // a worker started means an entry was queued before, one file is not worth it
+    startPrefetcher = !pool->prefetchTried && pool->started > 0;
+    ReleaseSRWLockExclusive(&pool->lock);
+    WakeConditionVariable(&pool->workQueued);
+
+    if (startPrefetcher)
+    {
+        StartPrefetcher(pool);
+    }
+
+    if (startWorker)
+    {
+        HANDLE hThread = CreateThread(NULL, 0, PoolWorker, pool, 0, NULL);
+        if (hThread != NULL)
+        {
+            pool->threads[pool->started++] = hThread;
+        }
+        else if (pool->started == 0)
+        {
+            StopPool(pool, SCHEDULER_FAILED_TO_CREATE_THREAD);
+        }
+    }
+}
+
+// Reports the remaining jobs, unless the pool stopped, and ends the workers.
+// Returns the first failure of the pool itself, the results of the jobs went
+// to onDone.
+ErrorCode FinishHashPool(__inout HashPool* pool)
+{
+    while (!pool->stopped && pool->reported < pool->submitted)
+    {
+        ReportJobs(pool, TRUE);
+    }
+
+    AcquireSRWLockExclusive(&pool->lock);
+    pool->closing = TRUE;
+    ReleaseSRWLockExclusive(&pool->lock);
+    WakeAllConditionVariable(&pool->workQueued);
+
+    // WaitForMultipleObjects is limited to 64 handles so wait one by one
+    for (DWORD i = 0; i < pool->started; i++)
+    {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    StopPrefetcher(pool);
+    CloseHandle(pool->prefetchWake);
+
+    // handles opened ahead for entries that were cancelled
+    for (size_t i = 0; i < pool->window; i++)
+    {
+        if (pool->entries[i].prefetch == PREFETCH_READY)
+        {
+            CloseHandle(pool->entries[i].hFile);
+        }
+    }
+
+    for (size_t i = 0; i < pool->bucketCount; i++)
+    {
+        while (pool->buckets[i] != NULL)
+        {
+            IdentityRecord* record = pool->buckets[i];
+            pool->buckets[i] = record->next;
+            free(record);
+        }
+    }
+    for (DWORD i = 0; i < MAXIMUM_STORAGE_DEVICES; i++)
+    {
+        free(pool->heaps[i]);
+    }
+
+    ErrorCode status = pool->status;
+    InterlockedExchange(&pool->args->cancelled, FALSE);
+    free(pool->buckets);
+    free(pool->entries);
+    free(pool);
+    return status;
+}
+
+DWORD SchedulerThreadCount(__in Args* args)
+{
+    if (args->jobs > 0)
+    {
+        return args->jobs;
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+typedef struct job_array_t
+{
+    HashJob* jobs;
+    HashJobCallback onDone;
+    PVOID context;
+} JobArray;
+
+// hands the result of a pool job back to the array of the caller
+static BOOL ReportArrayJob(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    JobArray* array = (JobArray*)context;
+    HashJob* original = (HashJob*)job->context;
+
+    original->status = job->status;
+    original->facts = job->facts;
+    memcpy(original->digest, job->digest, SHA256_DIGEST_LENGTH);
+    original->hashedSize = job->hashedSize;
+    original->openError = job->openError;
+    original->done = TRUE;
+    return array->onDone(args, original, array->context);
+}
+
+// Hashes all jobs on a pool whose window holds all of them, so duplicates are
+// found across the whole array. onDone is called on this thread in the order of
+// the jobs array. Returning FALSE from onDone cancels all jobs that did not
+// start yet and stops the running ones at their next read.
+ErrorCode RunHashJobs(__in Args* args, __inout HashJob* jobs, __in size_t count, __in HashJobCallback onDone, __in_opt PVOID context)
+{
+    HashPool* pool;
+    JobArray array = { jobs, onDone, context };
+
+    if (count == 0)
+    {
+        return SUCCESS;
+    }
+
+    ErrorCode status = StartHashPool(args, count, ReportArrayJob, &array, &pool);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        HashJob* job = ReserveHashJob(pool);
+        if (job == NULL)
+        {
+            break;
+        }
+
+        jobs[i].done = FALSE;
+        job->file = jobs[i].file;
+        job->skip = jobs[i].skip;
+        job->checkSize = jobs[i].checkSize;
+        job->expectedSize = jobs[i].expectedSize;
+        job->quietOpen = jobs[i].quietOpen;
+        job->context = &jobs[i];
+        SubmitHashJob(pool, job);
+    }
+
+    return FinishHashPool(pool);
+}
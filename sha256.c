@@ -12,70 +12,120 @@
 
 #define HASH_LENGTH 64
 #define LINE_BUFFER_SIZE 1024
+#define MANIFEST_READ_SIZE (64 * 1024)
+#define MANIFEST_SEGMENT_SIZE (16 * 1024 * 1024) // read at once and split between parse threads
+#define MANIFEST_PARALLEL_MIN (4 * 1024 * 1024)  // smaller manifests are parsed on one thread
+#define MANIFEST_RANGE_MIN (1024 * 1024)         // least bytes worth a parse thread
+#define MANIFEST_PARSE_THREADS 16
+#define READ_BUFFER_SIZE (1024 * 1024)
+#define ZERO_BUFFER_SIZE (64 * 1024)
+#define SECTOR_ALIGNMENT 4096
+#define SMALL_FILE_SIZE (64 * 1024)
+#define ALLOCATED_RANGES_PER_QUERY 64
+#define VERIFY_WINDOW 8192 // manifest entries in flight
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define CONSOLE_CHUNK_SIZE 1024
+#define OUTPUT_FLUSH_INTERVAL 250 // ms a result may wait in the output buffer
 #define MAX_PRINT_MSG_LENGTH 200
 
-WCHAR msg[1024];
+// workers hash in parallel, so every thread formats its messages in its own buffer
+__declspec(thread) WCHAR msg[1024];
 
-typedef struct file_hash_t
+// one read buffer per thread, reused for every file the thread hashes, VirtualAlloc
+// returns page aligned memory which also satisfies FILE_FLAG_NO_BUFFERING
+static __declspec(thread) PBYTE readBuffer = NULL;
+static __declspec(thread) BOOL lowMemoryPriority = FALSE;
+
+PBYTE GetReadBuffer(void)
 {
-    LPWSTR file;
-    LPWSTR hash;
-    struct file_hash_t* next;
-} FileHash;
+    if (readBuffer == NULL)
+    {
+        readBuffer = (PBYTE)VirtualAlloc(NULL, READ_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    }
+    return readBuffer;
+}
 
-void RemoveBinaryPrefix(LPWSTR str)
+void FreeReadBuffer(void)
 {
-    if (str[0] == L'*')
+    if (readBuffer != NULL)
     {
-        // Shift all characters one position to the left
-        for (int i = 0; str[i] != L'\0'; ++i)
-        {
-            str[i] = str[i + 1];
-        }
+        VirtualFree(readBuffer, 0, MEM_RELEASE);
+        readBuffer = NULL;
     }
 }
 
-ErrorCode CalcHash(__in Args* args, __out LPWSTR* file_hash, __in LPWSTR file)
+// Windows has no per range cache eviction, but pages read by a thread with a very
+// low memory priority go to the lowest standby list and are reused first, so
+// they do not push out the cache of other processes
+static void LowerMemoryPriority(void)
 {
-    ErrorCode status = SUCCESS;
-    HANDLE hFile;
-    DWORD dwBytesRead;
-    BYTE buffer[LINE_BUFFER_SIZE] = { 0 };
+    MEMORY_PRIORITY_INFORMATION info;
 
-    BCRYPT_ALG_HANDLE hAlg = NULL;
-    BCRYPT_HASH_HANDLE hHash = NULL;
-    NTSTATUS hashStatus = STATUS_UNSUCCESSFUL;
-    DWORD cbData = 0,
-          cbHash = 0,
-          cbHashObject = 0;
-    PBYTE pbHashObject = NULL;
-    PBYTE pbHash = NULL;
+    if (lowMemoryPriority)
+    {
+        return;
+    }
+
+    info.MemoryPriority = MEMORY_PRIORITY_VERY_LOW;
+    SetThreadInformation(GetCurrentThread(), ThreadMemoryPriority, &info, sizeof(info));
+    lowMemoryPriority = TRUE;
+}
 
-    RemoveBinaryPrefix(file);
+HANDLE OpenFileForHashing(__in Args* args, __in LPCWSTR file)
+{
+    HANDLE hFile;
 
-    // open file
+    if (args->dropCache)
+    {
+        LowerMemoryPriority();
+    }
+
+    // --direct bypasses the file cache, the sequential hint lets the cache
+    // manager read ahead more aggressively otherwise
+    DWORD flags = args->direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN;
     hFile = CreateFileW(file,
                         GENERIC_READ,
                         FILE_SHARE_READ,
                         NULL,                  // Default security
                         OPEN_EXISTING,
-                        FILE_ATTRIBUTE_NORMAL,
+                        FILE_ATTRIBUTE_NORMAL | flags,
                         NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
+
+    // some file systems refuse unbuffered handles, hash through the cache then
+    if (hFile == INVALID_HANDLE_VALUE && args->direct && GetLastError() == ERROR_INVALID_PARAMETER)
     {
-        if (!args->status)
-        {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),  // Size of buffer in characters
-                                          L"failed to open file '%ls' with error: %lu\r\n",
-                                          file, GetLastError());
-            if (SUCCEEDED(hr))
-            {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-            }
-        }
-        status = CALC_HASH_FAILED_TO_OPEN_FILE;
-        goto Cleanup;
+        hFile = CreateFileW(file,
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+    }
+
+    return hFile;
+}
+
+// the algorithm provider and the size of its hash object are the same for every
+// file, so they are opened once and kept warm for the lifetime of the process,
+// BCrypt allows sharing the algorithm handle between threads
+static BCRYPT_ALG_HANDLE hSharedAlg = NULL;
+static DWORD cbSharedHashObject = 0;
+
+ErrorCode OpenHashAlgorithm(__in Args* args, __out BCRYPT_ALG_HANDLE* phAlg, __out DWORD* pcbHashObject)
+{
+    ErrorCode status = SUCCESS;
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    NTSTATUS hashStatus = STATUS_UNSUCCESSFUL;
+    DWORD cbData = 0,
+          cbHash = 0,
+          cbHashObject = 0;
+
+    if (hSharedAlg != NULL)
+    {
+        *phAlg = hSharedAlg;
+        *pcbHashObject = cbSharedHashObject;
+        return SUCCESS;
     }
 
     // open an algorithm handle
@@ -89,9 +139,10 @@ ErrorCode CalcHash(__in Args* args, __out LPWSTR* file_hash, __in LPWSTR file)
                                           hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
+        hAlg = NULL;
         status = CALC_HASH_FAILED_TO_OPEN_ALG_HANDLE;
         goto Cleanup;
     }
@@ -107,733 +158,2057 @@ ErrorCode CalcHash(__in Args* args, __out LPWSTR* file_hash, __in LPWSTR file)
                                           hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
         status = CALC_HASH_FAILED_TO_ALLOCATE_HASH_BUFFER_SIZE;
         goto Cleanup;
     }
 
-    // allocate the hash object on the heap
-    pbHashObject = (PBYTE)HeapAlloc(GetProcessHeap(), 0, cbHashObject);
-    if (NULL == pbHashObject)
+    // calculate the length of the hash, digests are passed around as fixed
+    // SHA256_DIGEST_LENGTH byte arrays so anything else is an error
+    if (!NT_SUCCESS(hashStatus = BCryptGetProperty(hAlg, BCRYPT_HASH_LENGTH, (PBYTE)&cbHash, sizeof(DWORD), &cbData, 0))
+        || cbHash != SHA256_DIGEST_LENGTH)
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"memory allocation for hash object failed\r\n");
+                                          L"hash length calculation failed: %ld\r\n",
+                                          hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_ALLOCATE_HASH_OBJECT;
+        status = CALC_HASH_FAILED_TO_CALC_HASH_LENGTH;
         goto Cleanup;
     }
 
-    // calculate the length of the hash
-    if (!NT_SUCCESS(hashStatus = BCryptGetProperty(hAlg, BCRYPT_HASH_LENGTH, (PBYTE)&cbHash, sizeof(DWORD), &cbData, 0)))
+    // publish the handle, if another thread was faster we use its handle instead
+    cbSharedHashObject = cbHashObject;
+    if (InterlockedCompareExchangePointer((PVOID volatile*)&hSharedAlg, hAlg, NULL) == NULL)
+    {
+        hAlg = NULL;
+    }
+
+    *phAlg = hSharedAlg;
+    *pcbHashObject = cbSharedHashObject;
+
+Cleanup:
+    if (hAlg)
+    {
+        BCryptCloseAlgorithmProvider(hAlg, 0);
+    }
+
+    return status;
+}
+
+static ErrorCode HashBytes(__in Args* args, __in BCRYPT_HASH_HANDLE hHash, __in PBYTE data, __in DWORD size)
+{
+    NTSTATUS hashStatus;
+
+    if (!NT_SUCCESS(hashStatus = BCryptHashData(hHash, data, size, 0)))
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"hash length calculation failed: %ld\r\n",
+                                          L"data hashing failed: %ld\r\n",
                                           hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_CALC_HASH_LENGTH;
-        goto Cleanup;
+        return CALC_HASH_FAILED_TO_HASH;
+    }
+    InterlockedAddNoFence64(&runStats.bytesHashed, size);
+
+    return SUCCESS;
+}
+
+// Reads from the current file position until EOF or until size bytes are hashed.
+// Reads are requested in multiples of the sector size so this also works on
+// handles opened with --direct. shortReadEnds is set for files on disk, where a
+// read returns less than asked only at EOF, unlike a pipe.
+static ErrorCode HashFileData(__in Args* args, __in HANDLE hFile, __in BCRYPT_HASH_HANDLE hHash, __in PBYTE buffer, __in ULONGLONG size, __in BOOL shortReadEnds, __inout ULONGLONG* hashed)
+{
+    ErrorCode status;
+    DWORD dwBytesRead;
+
+    while (size > 0)
+    {
+        // --fail-fast or a failed write cancelled the run, no need to read to EOF
+        if (args->cancelled)
+        {
+            return CALC_HASH_CANCELLED;
+        }
+
+        DWORD request = size < READ_BUFFER_SIZE
+            ? (DWORD)((size + SECTOR_ALIGNMENT - 1) & ~(ULONGLONG)(SECTOR_ALIGNMENT - 1))
+            : READ_BUFFER_SIZE;
+
+        ThrottleRead(args, request);
+        if (!ReadFile(hFile, buffer, request, &dwBytesRead, NULL))
+        {
+            if (!args->status)
+            {
+                HRESULT hr = StringCchPrintfW(msg,
+                                              _countof(msg),
+                                              L"read file failed: %lu\r\n",
+                                              GetLastError());
+                if (SUCCEEDED(hr))
+                {
+                    WriteStderr(msg);
+                }
+            }
+            return CALC_HASH_FAILED_TO_READ;
+        }
+
+        if (dwBytesRead == 0)
+        {
+            break;
+        }
+
+        // no need to ask again for nothing
+        BOOL atEnd = shortReadEnds && dwBytesRead < request;
+
+        // the rounded up request may have read into the next range
+        if (dwBytesRead > size)
+        {
+            dwBytesRead = (DWORD)size;
+        }
+        InterlockedAddNoFence64(&runStats.bytesRead, dwBytesRead);
+
+        status = HashBytes(args, hHash, buffer, dwBytesRead);
+        *hashed += dwBytesRead;
+        if (status != SUCCESS || atEnd)
+        {
+            return status;
+        }
+        size -= dwBytesRead;
+    }
+
+    return SUCCESS;
+}
+
+static ErrorCode HashZeros(__in Args* args, __in BCRYPT_HASH_HANDLE hHash, __in ULONGLONG size)
+{
+    static const BYTE zeros[ZERO_BUFFER_SIZE] = { 0 };
+    ErrorCode status;
+
+    while (size > 0)
+    {
+        DWORD chunk = size < ZERO_BUFFER_SIZE ? (DWORD)size : ZERO_BUFFER_SIZE;
+        status = HashBytes(args, hHash, (PBYTE)zeros, chunk);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+        size -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+// the scheduler passes what its stat found, everybody else asks here
+static void GetFileFacts(__in HANDLE hFile, __out FileFacts* facts)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+
+    facts->known = GetFileInformationByHandle(hFile, &info);
+    facts->size = facts->known ? ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow : 0;
+    facts->attributes = facts->known ? info.dwFileAttributes : 0;
+}
+
+// Small files are read with one request a byte larger than the file, a short
+// read proves EOF, and hashed in one shot without a hash object. If the file
+// grew since its size was taken, *done stays FALSE and the file is rewound for
+// the general path.
+static ErrorCode HashSmallFile(__in Args* args, __in HANDLE hFile, __in BCRYPT_ALG_HANDLE hAlg, __in ULONGLONG size, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __out BOOL* done, __out ULONGLONG* hashed)
+{
+    NTSTATUS hashStatus;
+    DWORD dwBytesRead;
+    LARGE_INTEGER start;
+    PBYTE buffer = GetReadBuffer();
+    DWORD request = (DWORD)((size + 1 + SECTOR_ALIGNMENT - 1) & ~(ULONGLONG)(SECTOR_ALIGNMENT - 1));
+
+    *done = FALSE;
+    if (buffer == NULL)
+    {
+        return SUCCESS;
     }
 
-    // allocate the hash buffer on the heap
-    pbHash = (PBYTE)HeapAlloc(GetProcessHeap(), 0, cbHash);
-    if (NULL == pbHash)
+    *done = TRUE;
+    ThrottleRead(args, request);
+    if (!ReadFile(hFile, buffer, request, &dwBytesRead, NULL))
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"memory allocation for hash buffer failed\r\n");
+                                          L"read file failed: %lu\r\n",
+                                          GetLastError());
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_ALLOCATE_HASH_BUFFER;
-        goto Cleanup;
+        return CALC_HASH_FAILED_TO_READ;
     }
 
-    // create a hash
-    if (!NT_SUCCESS(hashStatus = BCryptCreateHash(hAlg, &hHash, pbHashObject, cbHashObject, NULL, 0, 0)))
+    if (dwBytesRead > size)
+    {
+        *done = FALSE;
+        start.QuadPart = 0;
+        return SetFilePointerEx(hFile, start, NULL, FILE_BEGIN) ? SUCCESS : CALC_HASH_FAILED_TO_READ;
+    }
+    InterlockedAddNoFence64(&runStats.bytesRead, dwBytesRead);
+
+    if (!NT_SUCCESS(hashStatus = BCryptHash(hAlg, NULL, 0, buffer, dwBytesRead, digest, SHA256_DIGEST_LENGTH)))
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"hash creation failed: %ld\r\n",
+                                          L"data hashing failed: %ld\r\n",
                                           hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_CREATE_HASH;
-        goto Cleanup;
+        return CALC_HASH_FAILED_TO_HASH;
     }
+    InterlockedAddNoFence64(&runStats.bytesHashed, dwBytesRead);
+    *hashed = dwBytesRead;
 
-    while (TRUE)
+    return SUCCESS;
+}
+
+// Walks the allocated ranges of a sparse file, reads only those and feeds zeros
+// for the holes in between, the digest is the same as for reading every byte.
+static ErrorCode HashSparseFile(__in Args* args, __in HANDLE hFile, __in BCRYPT_HASH_HANDLE hHash, __in PBYTE buffer, __in ULONGLONG fileSize)
+{
+    ErrorCode status = SUCCESS;
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    FILE_ALLOCATED_RANGE_BUFFER ranges[ALLOCATED_RANGES_PER_QUERY];
+    ULONGLONG position = 0;
+    ULONGLONG hashed = 0; // the holes count as well, the caller takes fileSize
+    DWORD dwBytesReturned;
+
+    while (position < fileSize)
     {
-        if (!ReadFile(hFile, buffer, sizeof(buffer), &dwBytesRead, NULL))
+        if (args->cancelled)
         {
-            if (!args->status)
+            return CALC_HASH_CANCELLED;
+        }
+
+        query.FileOffset.QuadPart = (LONGLONG)position;
+        query.Length.QuadPart = (LONGLONG)(fileSize - position);
+
+        BOOL complete = DeviceIoControl(hFile, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+                                        ranges, sizeof(ranges), &dwBytesReturned, NULL);
+        if (!complete && GetLastError() != ERROR_MORE_DATA)
+        {
+            // the file system cannot tell, read the rest as usual
+            LARGE_INTEGER offset;
+            offset.QuadPart = (LONGLONG)position;
+            if (!SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN))
             {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"read file failed: %lu\r\n",
-                                              GetLastError());
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
+                return CALC_HASH_FAILED_TO_READ;
             }
-            status = CALC_HASH_FAILED_TO_READ;
-            goto Cleanup;
+            return HashFileData(args, hFile, hHash, buffer, fileSize - position, TRUE, &hashed);
         }
 
-        if (dwBytesRead == 0)
+        DWORD count = dwBytesReturned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        if (count == 0)
         {
-            break;
+            break; // only holes left
         }
 
-        // hash some data
-        if (!NT_SUCCESS(hashStatus = BCryptHashData(hHash, (PBYTE)buffer, dwBytesRead, 0)))
+        for (DWORD i = 0; i < count; i++)
         {
-            if (!args->status)
+            ULONGLONG start = (ULONGLONG)ranges[i].FileOffset.QuadPart;
+            ULONGLONG end = start + (ULONGLONG)ranges[i].Length.QuadPart;
+            if (end > fileSize)
             {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"data hashing failed: %ld\r\n",
-                                              hashStatus);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
+                end = fileSize;
             }
-            status = CALC_HASH_FAILED_TO_HASH;
-            goto Cleanup;
+            if (start < position)
+            {
+                start = position;
+            }
+            if (start >= end)
+            {
+                continue;
+            }
+
+            status = HashZeros(args, hHash, start - position);
+            if (status != SUCCESS)
+            {
+                return status;
+            }
+
+            LARGE_INTEGER offset;
+            offset.QuadPart = (LONGLONG)start;
+            if (!SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN))
+            {
+                return CALC_HASH_FAILED_TO_READ;
+            }
+
+            status = HashFileData(args, hFile, hHash, buffer, end - start, TRUE, &hashed);
+            if (status != SUCCESS)
+            {
+                return status;
+            }
+            position = end;
+        }
+
+        if (complete)
+        {
+            break;
         }
     }
 
-    // close the hash
-    if (!NT_SUCCESS(hashStatus = BCryptFinishHash(hHash, pbHash, cbHash, 0)))
+    // trailing hole
+    return HashZeros(args, hHash, fileSize - position);
+}
+
+// one shot digest of a buffer, for data that is already in memory
+ErrorCode HashMemory(__in Args* args, __in_ecount(size) PBYTE data, __in DWORD size, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    DWORD cbHashObject = 0;
+    NTSTATUS hashStatus;
+
+    ErrorCode status = OpenHashAlgorithm(args, &hAlg, &cbHashObject);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    if (!NT_SUCCESS(hashStatus = BCryptHash(hAlg, NULL, 0, data, size, digest, SHA256_DIGEST_LENGTH)))
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"hash finalization failed: %ld\r\n",
+                                          L"data hashing failed: %ld\r\n",
                                           hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_FINISH_HASH;
-        goto Cleanup;
+        return CALC_HASH_FAILED_TO_HASH;
     }
 
-    // Output the hash
-    *file_hash = malloc((cbHash * 2 + 1) * sizeof(WCHAR));
-    if (*file_hash == NULL)
+    return SUCCESS;
+}
+
+struct stream_hash_t
+{
+    BCRYPT_HASH_HANDLE hHash;
+    PBYTE pbHashObject;
+    DWORD cbHashObject;
+};
+
+static ErrorCode StartStreamHash(__in Args* args, __inout StreamHash* hash)
+{
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    DWORD cbHashObject = 0;
+    NTSTATUS hashStatus;
+
+    ErrorCode status = OpenHashAlgorithm(args, &hAlg, &cbHashObject);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    if (!NT_SUCCESS(hashStatus = BCryptCreateHash(hAlg, &hash->hHash, hash->pbHashObject, hash->cbHashObject, NULL, 0, 0)))
     {
         if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"memory allocation for file hash failed\r\n");
+                                          L"hash creation failed: %ld\r\n",
+                                          hashStatus);
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        status = CALC_HASH_FAILED_TO_ALLOCATE_FILE_HASH;
-        goto Cleanup;
+        hash->hHash = NULL;
+        return CALC_HASH_FAILED_TO_CREATE_HASH;
     }
 
-    for (DWORD i = 0; i < cbHash; i++)
-    {
-        StringCchPrintfW((*file_hash) + i * 2, 3, L"%02x", pbHash[i]);
-    }
-
-Cleanup:
+    return SUCCESS;
+}
 
-    if (hFile)
-    {
-        CloseHandle(hFile);
-    }
+// A hash that is fed piece by piece, for data that is not a file of its own,
+// like the members of a tar stream. FinishStreamHash starts the next one.
+ErrorCode CreateStreamHash(__in Args* args, __out StreamHash** hash)
+{
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    DWORD cbHashObject = 0;
 
-    if (hAlg)
-    {
-        BCryptCloseAlgorithmProvider(hAlg, 0);
-    }
+    *hash = NULL;
 
-    if (hHash)
+    ErrorCode status = OpenHashAlgorithm(args, &hAlg, &cbHashObject);
+    if (status != SUCCESS)
     {
-        BCryptDestroyHash(hHash);
+        return status;
     }
 
-    if (pbHashObject)
+    StreamHash* created = calloc(1, sizeof(StreamHash));
+    if (created == NULL)
     {
-        HeapFree(GetProcessHeap(), 0, pbHashObject);
+        return CALC_HASH_FAILED_TO_ALLOCATE_HASH_OBJECT;
     }
 
-    if (pbHash)
+    created->cbHashObject = cbHashObject;
+    created->pbHashObject = (PBYTE)HeapAlloc(GetProcessHeap(), 0, cbHashObject);
+    if (created->pbHashObject == NULL)
     {
-        HeapFree(GetProcessHeap(), 0, pbHash);
+        free(created);
+        return CALC_HASH_FAILED_TO_ALLOCATE_HASH_OBJECT;
     }
 
+    status = StartStreamHash(args, created);
     if (status != SUCCESS)
     {
-        *file_hash = NULL;
+        FreeStreamHash(created);
+        return status;
     }
 
-    return status;
+    *hash = created;
+    return SUCCESS;
 }
 
-void WriteFileUTF8(__in HANDLE handle, __in LPWSTR msg)
+ErrorCode StreamHashData(__in Args* args, __in StreamHash* hash, __in_ecount(size) PBYTE data, __in DWORD size)
 {
-    int utf8Size = WideCharToMultiByte(CP_UTF8, 0, msg, -1, NULL, 0, NULL, NULL);
-    if (utf8Size > 0)
-    {
-        LPSTR utf8Msg = (LPSTR)malloc(utf8Size);
+    return HashBytes(args, hash->hHash, data, size);
+}
+
+ErrorCode FinishStreamHash(__in Args* args, __inout StreamHash* hash, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    NTSTATUS hashStatus;
+
+    hashStatus = BCryptFinishHash(hash->hHash, digest, SHA256_DIGEST_LENGTH, 0);
+    BCryptDestroyHash(hash->hHash);
+    hash->hHash = NULL;
+
+    if (!NT_SUCCESS(hashStatus))
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"hash finalization failed: %ld\r\n",
+                                          hashStatus);
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        return CALC_HASH_FAILED_TO_FINISH_HASH;
+    }
+
+    return StartStreamHash(args, hash);
+}
+
+void FreeStreamHash(__in_opt StreamHash* hash)
+{
+    if (hash == NULL)
+    {
+        return;
+    }
+
+    if (hash->hHash)
+    {
+        BCryptDestroyHash(hash->hHash);
+    }
+    if (hash->pbHashObject)
+    {
+        HeapFree(GetProcessHeap(), 0, hash->pbHashObject);
+    }
+    free(hash);
+}
+
+// facts is what is known about the file already, NULL to look it up. hashed is
+// the number of bytes that went into digest, which a growing file may take
+// past the size in facts.
+ErrorCode HashHandle(__in Args* args, __in HANDLE hFile, __in_opt FileFacts* facts, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __out ULONGLONG* hashed)
+{
+    ErrorCode status = SUCCESS;
+    PBYTE buffer = NULL;
+    FileFacts lookedUp;
+    BOOL done = FALSE;
+
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    BCRYPT_HASH_HANDLE hHash = NULL;
+    NTSTATUS hashStatus = STATUS_UNSUCCESSFUL;
+    DWORD cbHashObject = 0;
+    PBYTE pbHashObject = NULL;
+
+    *hashed = 0;
+    status = OpenHashAlgorithm(args, &hAlg, &cbHashObject);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // the sparse walk trusts the size, so a sparse file is asked again on the open handle
+    if (facts == NULL || !facts->known || (facts->attributes & FILE_ATTRIBUTE_SPARSE_FILE))
+    {
+        GetFileFacts(hFile, &lookedUp);
+        facts = &lookedUp;
+    }
+
+    BOOL sparse = facts->known && (facts->attributes & FILE_ATTRIBUTE_SPARSE_FILE);
+    if (facts->known && !sparse && facts->size < SMALL_FILE_SIZE)
+    {
+        status = HashSmallFile(args, hFile, hAlg, facts->size, digest, &done, hashed);
+        if (done || status != SUCCESS)
+        {
+            goto Cleanup;
+        }
+    }
+
+    buffer = GetReadBuffer();
+    if (NULL == buffer)
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"memory allocation for read buffer failed\r\n");
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        status = CALC_HASH_FAILED_TO_ALLOCATE_READ_BUFFER;
+        goto Cleanup;
+    }
+
+    // allocate the hash object on the heap
+    pbHashObject = (PBYTE)HeapAlloc(GetProcessHeap(), 0, cbHashObject);
+    if (NULL == pbHashObject)
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"memory allocation for hash object failed\r\n");
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        status = CALC_HASH_FAILED_TO_ALLOCATE_HASH_OBJECT;
+        goto Cleanup;
+    }
+
+    // create a hash
+    if (!NT_SUCCESS(hashStatus = BCryptCreateHash(hAlg, &hHash, pbHashObject, cbHashObject, NULL, 0, 0)))
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"hash creation failed: %ld\r\n",
+                                          hashStatus);
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        hHash = NULL;
+        status = CALC_HASH_FAILED_TO_CREATE_HASH;
+        goto Cleanup;
+    }
+
+    // holes of sparse files are hashed from memory instead of being read
+    status = sparse
+        ? HashSparseFile(args, hFile, hHash, buffer, facts->size)
+        : HashFileData(args, hFile, hHash, buffer, (ULONGLONG)-1, facts->known, hashed);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+    if (sparse)
+    {
+        *hashed = facts->size;
+    }
+
+    // close the hash
+    if (!NT_SUCCESS(hashStatus = BCryptFinishHash(hHash, digest, SHA256_DIGEST_LENGTH, 0)))
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"hash finalization failed: %ld\r\n",
+                                          hashStatus);
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        status = CALC_HASH_FAILED_TO_FINISH_HASH;
+        goto Cleanup;
+    }
+
+Cleanup:
+
+    if (hHash)
+    {
+        BCryptDestroyHash(hHash);
+    }
+
+    if (pbHashObject)
+    {
+        HeapFree(GetProcessHeap(), 0, pbHashObject);
+    }
+
+    return status;
+}
+
+// hashes a file opened with OpenFileForHashing and closes it
+ErrorCode HashOpenFile(__in Args* args, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __in HANDLE hFile, __in_opt FileFacts* facts, __out ULONGLONG* hashed)
+{
+    ErrorCode status = args->appendState != NULL
+        ? HashAppendedFile(args, hFile, digest, hashed)
+        : HashHandle(args, hFile, facts, digest, hashed);
+    if (status == SUCCESS)
+    {
+        InterlockedIncrementNoFence64(&runStats.filesHashed);
+    }
+
+    CloseHandle(hFile);
+
+    return status;
+}
+
+// a file that cannot be opened goes to openError instead of stderr if it is given
+static ErrorCode DigestFile(__in Args* args, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __in LPWSTR file, __in_opt FileFacts* facts, __out ULONGLONG* hashed, __out_opt DWORD* openError)
+{
+    HANDLE hFile;
+
+    ProgressStartFile(file);
+
+    // let a running daemon do the work, it keeps the provider and its digest cache warm
+    if (args->daemon)
+    {
+        return DaemonCalcDigest(args, digest, file, hashed, openError);
+    }
+
+    // open file
+    hFile = OpenFileForHashing(args, file);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        if (openError != NULL)
+        {
+            *openError = GetLastError();
+        }
+        else if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),  // Size of buffer in characters
+                                          L"failed to open file '%ls' with error: %lu\r\n",
+                                          file, GetLastError());
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        return CALC_HASH_FAILED_TO_OPEN_FILE;
+    }
+
+    return HashOpenFile(args, digest, hFile, facts, hashed);
+}
+
+ErrorCode CalcDigest(__in Args* args, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest, __in LPWSTR file)
+{
+    ULONGLONG hashed;
+    return DigestFile(args, digest, file, NULL, &hashed, NULL);
+}
+
+// like CalcDigest, with the size and attributes the scheduler found in job->facts,
+// the number of bytes hashed goes to job->hashedSize
+ErrorCode CalcJobDigest(__in Args* args, __inout HashJob* job)
+{
+    return DigestFile(args, job->digest, job->file, &job->facts, &job->hashedSize, job->quietOpen ? &job->openError : NULL);
+}
+
+static const CHAR hexDigits[] = "0123456789abcdef";
+
+void FormatDigest(__out_ecount(SHA256_DIGEST_LENGTH * 2 + 1) LPWSTR hash, __in PBYTE digest)
+{
+    for (DWORD i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        hash[i * 2] = hexDigits[digest[i] >> 4];
+        hash[i * 2 + 1] = hexDigits[digest[i] & 0x0f];
+    }
+    hash[SHA256_DIGEST_LENGTH * 2] = L'\0';
+}
+
+void FormatDigestUTF8(__out_ecount(SHA256_DIGEST_LENGTH * 2 + 1) LPSTR hash, __in PBYTE digest)
+{
+    for (DWORD i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        hash[i * 2] = hexDigits[digest[i] >> 4];
+        hash[i * 2 + 1] = hexDigits[digest[i] & 0x0f];
+    }
+    hash[SHA256_DIGEST_LENGTH * 2] = '\0';
+}
+
+static int HexValue(__in CHAR c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// decodes the 64 hex digits of a manifest entry, FALSE if one is not hexadecimal
+BOOL ParseDigest(__in LPCSTR hash, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    for (DWORD i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        int high = HexValue(hash[i * 2]);
+        int low = high < 0 ? -1 : HexValue(hash[i * 2 + 1]);
+        if (low < 0)
+        {
+            return FALSE;
+        }
+        digest[i] = (BYTE)(high << 4 | low);
+    }
+    return TRUE;
+}
+
+ErrorCode CalcHash(__in Args* args, __out LPWSTR* file_hash, __in LPWSTR file)
+{
+    ErrorCode status = SUCCESS;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+
+    *file_hash = NULL;
+
+    status = CalcDigest(args, digest, file);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // Output the hash
+    *file_hash = malloc((SHA256_DIGEST_LENGTH * 2 + 1) * sizeof(WCHAR));
+    if (*file_hash == NULL)
+    {
+        if (!args->status)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"memory allocation for file hash failed\r\n");
+            if (SUCCEEDED(hr))
+            {
+                WriteStderr(msg);
+            }
+        }
+        status = CALC_HASH_FAILED_TO_ALLOCATE_FILE_HASH;
+        goto Cleanup;
+    }
+
+    FormatDigest(*file_hash, digest);
+
+Cleanup:
+
+    if (status != SUCCESS)
+    {
+        *file_hash = NULL;
+    }
+
+    return status;
+}
+
+// Redirected stdout is collected here and written in large blocks instead of a
+// WriteFile per line. The buffer is written once it is full, at least every
+// OUTPUT_FLUSH_INTERVAL while lines come in, when the pool has no further result
+// ready and before anything goes to stderr. Results are only written from the main thread,
+// the lock is for stderr messages from other threads. FlushStdout has to be
+// called before the process exits.
+static CHAR outputBuffer[OUTPUT_BUFFER_SIZE];
+static DWORD outputLength = 0;
+static ULONGLONG outputFlushed = 0; // tick count of the last write
+static SRWLOCK outputLock = SRWLOCK_INIT;
+static int stdoutIsConsole = -1;
+
+static BOOL StdoutIsConsole(void)
+{
+    if (stdoutIsConsole < 0)
+    {
+        DWORD mode;
+        stdoutIsConsole = GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &mode) ? 1 : 0;
+    }
+    return stdoutIsConsole == 1;
+}
+
+// called with outputLock held
+static void WriteOutputBuffer(void)
+{
+    if (outputLength > 0)
+    {
+        WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), outputBuffer, outputLength, NULL, NULL);
+        outputLength = 0;
+    }
+    outputFlushed = GetTickCount64();
+}
+
+void FlushStdout(void)
+{
+    AcquireSRWLockExclusive(&outputLock);
+    WriteOutputBuffer();
+    ReleaseSRWLockExclusive(&outputLock);
+}
+
+// writes the buffer if the last write was OUTPUT_FLUSH_INTERVAL ago
+void FlushStdoutIfDue(void)
+{
+    AcquireSRWLockExclusive(&outputLock);
+    if (outputLength > 0 && GetTickCount64() - outputFlushed >= OUTPUT_FLUSH_INTERVAL)
+    {
+        WriteOutputBuffer();
+    }
+    ReleaseSRWLockExclusive(&outputLock);
+}
+
+// text is UTF-8 and written as is when stdout is redirected, the console only
+// takes UTF-16 so it is converted there
+void WriteStdoutUTF8(__in LPCSTR text, __in size_t length)
+{
+    if (StdoutIsConsole())
+    {
+        WCHAR wide[CONSOLE_CHUNK_SIZE];
+        while (length > 0)
+        {
+            // do not split a UTF-8 sequence between two chunks
+            size_t chunk = length > CONSOLE_CHUNK_SIZE ? CONSOLE_CHUNK_SIZE : length;
+            while (chunk < length && chunk > 1 && (text[chunk] & 0xc0) == 0x80)
+            {
+                --chunk;
+            }
+            int wideLength = MultiByteToWideChar(CP_UTF8, 0, text, (int)chunk, wide, CONSOLE_CHUNK_SIZE);
+            WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), wide, wideLength, NULL, NULL);
+            text += chunk;
+            length -= chunk;
+        }
+        return;
+    }
+
+    AcquireSRWLockExclusive(&outputLock);
+    if (outputLength + length > OUTPUT_BUFFER_SIZE)
+    {
+        WriteOutputBuffer();
+    }
+    if (length > OUTPUT_BUFFER_SIZE)
+    {
+        WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), text, (DWORD)length, NULL, NULL);
+    }
+    else
+    {
+        memcpy(outputBuffer + outputLength, text, length);
+        outputLength += (DWORD)length;
+    }
+    if (GetTickCount64() - outputFlushed >= OUTPUT_FLUSH_INTERVAL)
+    {
+        WriteOutputBuffer();
+    }
+    ReleaseSRWLockExclusive(&outputLock);
+}
+
+// Writes a message to stderr unless --status is set. format takes the text and
+// then the number, most modules pass a path and an error code.
+void LogError(__in Args* args, __in LPCWSTR format, __in LPCWSTR text, __in DWORD value)
+{
+    WCHAR message[MAX_PATH + 100];
+
+    if (args->status)
+    {
+        return;
+    }
+
+    HRESULT hr = StringCchPrintfW(message, _countof(message), format, text, value);
+    if (SUCCEEDED(hr))
+    {
+        WriteStderr(message);
+    }
+}
+
+void WriteFileUTF8(__in HANDLE handle, __in LPWSTR msg)
+{
+    int utf8Size = WideCharToMultiByte(CP_UTF8, 0, msg, -1, NULL, 0, NULL, NULL);
+    if (utf8Size > 0)
+    {
+        LPSTR utf8Msg = (LPSTR)malloc(utf8Size);
         if (utf8Msg)
         {
-            // convert UTF-16 to UTF-8
-            WideCharToMultiByte(CP_UTF8, 0, msg, -1, utf8Msg, utf8Size, NULL, NULL);
-            WriteFile(handle, utf8Msg, utf8Size - 1, NULL, NULL); // -1, um das Nullterminierungszeichen nicht zu schreiben
-            free(utf8Msg);
+            // convert UTF-16 to UTF-8
+            WideCharToMultiByte(CP_UTF8, 0, msg, -1, utf8Msg, utf8Size, NULL, NULL);
+            WriteFile(handle, utf8Msg, utf8Size - 1, NULL, NULL); // -1, um das Nullterminierungszeichen nicht zu schreiben
+            free(utf8Msg);
+        }
+    }
+}
+
+// Results written before text goes out first, so both keep their order when
+// they end up in the same file. WriteConsoleW fails on a redirected stderr, so
+// text is written as UTF-8 there.
+void WriteStderr(__in LPWSTR text)
+{
+    FlushStdout();
+
+    DWORD mode;
+    HANDLE hError = GetStdHandle(STD_ERROR_HANDLE);
+    if (GetConsoleMode(hError, &mode))
+    {
+        WriteConsoleW(hError, text, lstrlenW(text), NULL, NULL);
+    }
+    else
+    {
+        WriteFileUTF8(hError, text);
+    }
+}
+
+// console output is written as UTF-16, redirected output is converted to UTF-8
+// straight into the output buffer
+void WriteStdout(__in LPWSTR line)
+{
+    if (StdoutIsConsole())
+    {
+        WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), line, lstrlenW(line), NULL, NULL);
+        return;
+    }
+
+    int length = lstrlenW(line);
+    int utf8Size = WideCharToMultiByte(CP_UTF8, 0, line, length, NULL, 0, NULL, NULL);
+    if (utf8Size <= 0)
+    {
+        return;
+    }
+    AcquireSRWLockExclusive(&outputLock);
+    if (outputLength + utf8Size > OUTPUT_BUFFER_SIZE)
+    {
+        WriteOutputBuffer();
+    }
+    if (utf8Size > OUTPUT_BUFFER_SIZE)
+    {
+        WriteFileUTF8(GetStdHandle(STD_OUTPUT_HANDLE), line);
+    }
+    else
+    {
+        outputLength += WideCharToMultiByte(CP_UTF8, 0, line, length, outputBuffer + outputLength, utf8Size, NULL, NULL);
+    }
+    if (GetTickCount64() - outputFlushed >= OUTPUT_FLUSH_INTERVAL)
+    {
+        WriteOutputBuffer();
+    }
+    ReleaseSRWLockExclusive(&outputLock);
+}
+
+ErrorCode BuildFilePath(__in LPWSTR userInputFilePath, __in LPWSTR fileName, __out_ecount(MAX_PATH) LPWSTR absFilePath)
+{
+    // get full path from user input path, remove the file and append fileName so we get
+    // a clean absolute file path
+    WCHAR absPath[MAX_PATH];
+    if (GetFullPathNameW(userInputFilePath, MAX_PATH, absPath, NULL) == 0)
+    {
+        return PRINT_HASH_FAILED_GET_FULL_PATH_NAME;
+    }
+
+    PathRemoveFileSpecW(absPath);
+    PathCombineW(absFilePath, absPath, fileName);
+
+    return SUCCESS;
+}
+
+// size is the number of bytes that went into hash
+ErrorCode WriteHashLine(__in Args* args, __in LPWSTR userInputFilePath, __in LPWSTR fileName, __in LPWSTR absFilePath, __in LPWSTR hash, __in ULONGLONG size)
+{
+    // --with-size records the size between hash and file, --check uses it to
+    // fail changed files without reading them. It is the size that was hashed,
+    // not asked again, so a file that grew since is still hashed and sized alike.
+    WCHAR hashWithSize[HASH_LENGTH + 22];
+    LPWSTR field = hash;
+    if (args->withSize)
+    {
+        if (FAILED(StringCchPrintfW(hashWithSize, _countof(hashWithSize), L"%ls %llu", hash, size)))
+        {
+            return PRINT_HASH_FAILED_STRING_CAT3;
+        }
+        field = hashWithSize;
+    }
+
+    // depending whether it is a relative or an absolute path the output needs to be different to
+    // immitade the output of sha256sum from Linux
+    BOOL isRel = PathIsRelativeW(userInputFilePath);
+    if (isRel == TRUE)
+    {
+        size_t userInputFilePathLen;
+        if (FAILED(StringCchLengthW(userInputFilePath, MAX_PATH, &userInputFilePathLen)))
+        {
+            return PRINT_HASH_FAILED_STRING_LENGTH;
+        }
+        WCHAR inputPath[MAX_PATH];
+        BOOL containsPath = PathRemoveFileName(inputPath, userInputFilePath);
+
+        // if the user passed a relative file without a .\ or ..\ and other prefixes
+        if (containsPath == FALSE)
+        {
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"%ls *%ls\r\n",
+                                          field, fileName);
+            if (FAILED(hr))
+            {
+                return PRINT_HASH_FAILED_STRING_CAT3;
+            }
+            WriteStdout(msg);
+        }
+        // if the user passed a relative file with .\, ..\ and so on, we
+        // need to concatenate the inputFilePath and the given fileName
+        else
+        {
+            WCHAR inputFilePath[MAX_PATH] = { 0 };
+            StringCchCopyW(inputFilePath, MAX_PATH, inputPath);
+
+            WCHAR separator = PathFindSeparator(userInputFilePath, userInputFilePathLen);
+            size_t len = lstrlenW(inputFilePath);
+            if (len+1 > MAX_PATH)
+            {
+                return PRINT_HASH_FAILED_STRING_CAT1;
+            }
+            inputFilePath[len] = separator;
+
+            if (FAILED(StringCchCatW(inputFilePath, MAX_PATH, fileName)))
+            {
+                return PRINT_HASH_FAILED_STRING_CAT2;
+            }
+
+            HRESULT hr = StringCchPrintfW(msg,
+                                          _countof(msg),
+                                          L"%ls *%ls\r\n",
+                                          field, inputFilePath);
+            if (FAILED(hr))
+            {
+                return PRINT_HASH_FAILED_STRING_CAT4;
+            }
+            WriteStdout(msg);
+        }
+    }
+    // in case of an absolute path the absolute path shall be used
+    else
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      L"%ls *%ls\r\n",
+                                      field, absFilePath);
+        if (FAILED(hr))
+        {
+            return PRINT_HASH_FAILED_STRING_CAT5;
+        }
+        WriteStdout(msg);
+    }
+    return SUCCESS;
+}
+
+ErrorCode PrintHash(__in Args* args, __in LPWSTR userInputFilePath, __in LPWSTR fileName)
+{
+    WCHAR absFilePath[MAX_PATH];
+    ErrorCode status = BuildFilePath(userInputFilePath, fileName, absFilePath);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    // now calculate the file hash using the absolute file path we just constructed
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+    ULONGLONG hashed;
+    if (DigestFile(args, digest, absFilePath, NULL, &hashed, NULL) == SUCCESS)
+    {
+        FormatDigest(hash, digest);
+        status = WriteHashLine(args, userInputFilePath, fileName, absFilePath, hash, hashed);
+    }
+
+    return status;
+}
+
+// splits the next space separated field off the line in place, like wcstok_s
+static LPSTR NextField(__inout LPSTR* context)
+{
+    LPSTR field = *context;
+    while (*field == ' ')
+    {
+        ++field;
+    }
+    if (*field == '\0')
+    {
+        *context = field;
+        return NULL;
+    }
+
+    LPSTR end = field;
+    while (*end != '\0' && *end != ' ')
+    {
+        ++end;
+    }
+    if (*end != '\0')
+    {
+        *end++ = '\0';
+    }
+    *context = end;
+    return field;
+}
+
+static void WarnInvalidLine(__in Args* args, __in int line_num)
+{
+    if (!args->status && args->warn)
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      L"invalid hash on line %d\r\n",
+                                      line_num);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(msg);
+        }
+    }
+}
+
+// Parses a UTF-8 manifest line in place. The hash is decoded into fh->digest and
+// fh->path points at the path inside line, nothing is converted to UTF-16 here.
+// Prints nothing, so the parse threads can report their lines in order later.
+static ErrorCode ParseFields(__out FileHash* fh, __inout LPSTR line)
+{
+    LPSTR context = line;
+
+    LPSTR hash = NextField(&context);
+    if (hash == NULL)
+    {
+        return PARSE_LINE_INVALID_HASH_TOKEN;
+    }
+
+    if (strlen(hash) != HASH_LENGTH)
+    {
+        return PARSE_LINE_INVALID_HASH_LENGTH;
+    }
+
+    if (!ParseDigest(hash, fh->digest))
+    {
+        return PARSE_LINE_INVALID_HASH_TOKEN;
+    }
+
+    LPSTR file = NextField(&context);
+    if (file == NULL)
+    {
+        return PARSE_LINE_INAVLID_FILE;
+    }
+
+    // optional size extension written by --with-size: <hash> <size> *<file>
+    fh->size = 0;
+    fh->hasSize = FALSE;
+    LPSTR sizeFile = NextField(&context);
+    if (sizeFile != NULL)
+    {
+        LPSTR end = NULL;
+        ULONGLONG size = _strtoui64(file, &end, 10);
+        if (end != file && *end == '\0')
+        {
+            fh->size = size;
+            fh->hasSize = TRUE;
+            file = sizeFile;
+        }
+    }
+
+    // binary mode prefix, stripped here once so the path of a job never changes
+    // after it is queued, the prefetcher reads it while a worker hashes
+    if (file[0] == '*')
+    {
+        ++file;
+    }
+    fh->path = file;
+    fh->pathLength = (DWORD)strlen(file);
+
+    return SUCCESS;
+}
+
+ErrorCode ParseLine(__in Args* args, __out FileHash* fh, __in int line_num, __inout LPSTR line)
+{
+    ErrorCode status = ParseFields(fh, line);
+    if (status != SUCCESS)
+    {
+        WarnInvalidLine(args, line_num);
+    }
+    return status;
+}
+
+typedef struct verify_state_t
+{
+    ErrorCode status;
+    BOOL stopped;
+    Journal* journal;
+    ULONGLONG next; // index of the entry reported next
+} VerifyState;
+
+// the path is written the way the manifest spelled it, without a round trip through UTF-16
+static void WriteResult(__in FileHash* fh, __in LPCSTR result)
+{
+    WriteStdoutUTF8(fh->path, fh->pathLength);
+    WriteStdoutUTF8(result, strlen(result));
+}
+
+// prints the result of one manifest entry, jobs skipped by the size check
+// failed, entries in the --journal of an earlier run print the result it had
+BOOL VerifyResult(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    VerifyState* state = (VerifyState*)context;
+    FileHash* fh = (FileHash*)job->context;
+    BOOL matched;
+
+    if (job->status != SUCCESS)
+    {
+        state->status = job->status;
+        state->stopped = TRUE;
+        return FALSE;
+    }
+
+    if (state->journal == NULL || !JournalLookup(state->journal, state->next, &matched))
+    {
+        matched = !job->skip && memcmp(fh->digest, job->digest, SHA256_DIGEST_LENGTH) == 0;
+        if (state->journal != NULL)
+        {
+            ErrorCode status = JournalAppend(state->journal, matched, job->digest);
+            if (status != SUCCESS)
+            {
+                state->status = status;
+                state->stopped = TRUE;
+                return FALSE;
+            }
+        }
+    }
+    ++state->next;
+
+    if (matched)
+    {
+        if (!args->status && !args->quiet)
+        {
+            WriteResult(fh, ": OK\r\n");
+        }
+    }
+    else
+    {
+        if (!args->status)
+        {
+            WriteResult(fh, ": FAILED\r\n");
+        }
+        state->status = CHECK_SUM_CHECKSUM_FAILED;
+
+        // the remaining entries cannot change the result anymore
+        if (args->failFast)
+        {
+            state->stopped = TRUE;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL IsUTF16File(LPCWSTR filePath)
+{
+    BOOL isUTF16 = FALSE;
+    HANDLE hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        BYTE bom[2];
+        DWORD bytesRead;
+
+        if (ReadFile(hFile, bom, sizeof(bom), &bytesRead, NULL))
+        {
+            // check for UTF-16 header
+            if ((bom[0] == 0xFF && bom[1] == 0xFE) || (bom[0] == 0xFE && bom[1] == 0xFF))
+            {
+                isUTF16 = TRUE;
+            }
+        }
+
+        CloseHandle(hFile);
+    }
+
+    return isUTF16;
+}
+
+// one line of a range parsed by a parse thread, line counts from the start of the range
+typedef struct parsed_line_t
+{
+    FileHash fh;
+    int line;
+    BOOL empty;
+} ParsedLine;
+
+// A part of a segment that ends at a line break, parsed by one thread into its
+// own array of lines. The array is kept for the next segment.
+typedef struct manifest_range_t
+{
+    PCHAR start;
+    DWORD length;
+    ParsedLine* lines;
+    size_t count;
+    size_t capacity;
+    size_t delivered;
+    int lineCount;
+    ErrorCode status; // of the line after the parsed ones, which ends the manifest
+    int statusLine;
+} ManifestRange;
+
+// Reads the manifest in MANIFEST_READ_SIZE chunks, keeps its position between
+// calls so the manifest is never held in memory as a whole. Binary indexes are
+// walked entry by entry instead. Large manifests are read in segments of
+// MANIFEST_SEGMENT_SIZE that are split between parse threads, the next segment
+// is read while the threads parse the current one.
+struct manifest_reader_t
+{
+    Args* args;
+    PathFilter* filter;
+    BOOL isIndex;
+    ManifestIndex index;
+    ULONGLONG indexPosition;
+    HANDLE hFile;
+    CHAR buffer[MANIFEST_READ_SIZE];
+    DWORD bufferLength;
+    DWORD bufferIndex;
+    CHAR lineBuffer[LINE_BUFFER_SIZE];
+    UINT lineIndex;
+    int lineNum;
+    BOOL eof;
+    PCHAR segment; // NULL for manifests parsed on the calling thread
+    DWORD segmentLength;
+    DWORD segmentParsed; // the rest is a line that continues in the next segment
+    PCHAR nextSegment;
+    DWORD nextLength;
+    BOOL nextEof;
+    BOOL readAhead;  // nextSegment holds the segment after this one
+    DWORD nextError; // of reading ahead, reported once the segment is reached
+    ManifestRange ranges[MANIFEST_PARSE_THREADS];
+    DWORD rangeCount;
+    DWORD rangeIndex;
+};
+
+static void WarnEmptyLine(__in Args* args, __in int lineNum)
+{
+    if (!args->status)
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      L"skip empty line %d\r\n",
+                                      lineNum);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(msg);
+        }
+    }
+}
+
+static void WarnLineTooLong(__in Args* args, __in int lineNum)
+{
+    if (!args->status)
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      L"line %d too long, max size: %du\r\n",
+                                      lineNum, LINE_BUFFER_SIZE);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(msg);
+        }
+    }
+}
+
+static void WarnLineAllocation(__in Args* args, __in int lineNum, __in BOOL lastLine)
+{
+    if (!args->status)
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      lastLine ? L"failed to allocate memory for wideBuffer2 for line %d\r\n"
+                                               : L"failed to allocate memory for wideBuffer1 for line %d\r\n",
+                                      lineNum);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(msg);
+        }
+    }
+}
+
+// moves the path of a parsed line into an allocation of its own, only the path
+// is converted to UTF-16 for the file APIs
+static ErrorCode CopyEntryPath(__inout FileHash* fh, __in BOOL lastLine)
+{
+    // one allocation holds the UTF-16 path followed by a copy of the UTF-8 path
+    int wideSize = MultiByteToWideChar(CP_UTF8, 0, fh->path, (int)fh->pathLength, NULL, 0);
+    PBYTE line = malloc(sizeof(WCHAR) * (wideSize + 1) + fh->pathLength + 1);
+    if (line == NULL)
+    {
+        return lastLine ? CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER2 : CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER1;
+    }
+
+    fh->file = (LPWSTR)line;
+    MultiByteToWideChar(CP_UTF8, 0, fh->path, (int)fh->pathLength, fh->file, wideSize);
+    fh->file[wideSize] = L'\0';
+    LPSTR path = (LPSTR)(line + sizeof(WCHAR) * (wideSize + 1));
+    memcpy(path, fh->path, fh->pathLength + 1);
+    fh->path = path;
+
+    fh->line = line;
+    return SUCCESS;
+}
+
+// parses the collected UTF-8 line into fh, empty lines are skipped and leave
+// *found FALSE
+static ErrorCode ParseManifestLine(__inout ManifestReader* reader, __out FileHash* fh, __in BOOL lastLine, __out BOOL* found)
+{
+    Args* args = reader->args;
+    ErrorCode status = SUCCESS;
+    int lineNum = reader->lineNum;
+    UINT lineIndex = reader->lineIndex;
+
+    reader->lineIndex = 0;
+    reader->lineNum++;
+
+    // drop \r of \r\n line breaks
+    if (lineIndex > 0 && reader->lineBuffer[lineIndex - 1] == '\r')
+    {
+        --lineIndex;
+    }
+    reader->lineBuffer[lineIndex] = '\0';
+
+    if (lineIndex == 0)
+    {
+        WarnEmptyLine(args, lineNum);
+        return SUCCESS;
+    }
+
+    status = ParseLine(args, fh, lineNum, reader->lineBuffer);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    status = CopyEntryPath(fh, lastLine);
+    if (status != SUCCESS)
+    {
+        WarnLineAllocation(args, lineNum, lastLine);
+        return status;
+    }
+
+    *found = TRUE;
+    return SUCCESS;
+}
+
+// Parses the lines of a range in place, on a parse thread. Nothing is printed
+// here, the lines and the line that stopped the range are reported in order
+// when the entries are handed out.
+static DWORD WINAPI ParseRange(__in LPVOID parameter)
+{
+    ManifestRange* range = (ManifestRange*)parameter;
+    PCHAR position = range->start;
+    PCHAR end = range->start + range->length;
+
+    range->count = 0;
+    range->delivered = 0;
+    range->lineCount = 0;
+    range->status = SUCCESS;
+
+    while (position < end)
+    {
+        PCHAR newline = memchr(position, '\n', (size_t)(end - position));
+        PCHAR lineEnd = newline != NULL ? newline : end;
+        DWORD length = (DWORD)(lineEnd - position);
+        BOOL lastLine = newline == NULL;
+
+        if (length > LINE_BUFFER_SIZE - 1)
+        {
+            range->status = CHECK_SUMS_LINE_TOO_LONG;
+            break;
+        }
+
+        if (range->count == range->capacity)
+        {
+            size_t newCapacity = range->capacity == 0 ? 4096 : range->capacity * 2;
+            ParsedLine* grown = realloc(range->lines, newCapacity * sizeof(ParsedLine));
+            if (grown == NULL)
+            {
+                range->status = lastLine ? CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER2 : CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER1;
+                break;
+            }
+            range->lines = grown;
+            range->capacity = newCapacity;
+        }
+
+        // drop \r of \r\n line breaks, the segment has room for the terminator of a last line
+        if (length > 0 && position[length - 1] == '\r')
+        {
+            --length;
+        }
+        position[length] = '\0';
+
+        ParsedLine* parsed = &range->lines[range->count];
+        parsed->line = range->lineCount;
+        parsed->empty = length == 0;
+        parsed->fh.line = NULL;
+        if (!parsed->empty)
+        {
+            range->status = ParseFields(&parsed->fh, position);
+            if (range->status == SUCCESS)
+            {
+                range->status = CopyEntryPath(&parsed->fh, lastLine);
+            }
+            if (range->status != SUCCESS)
+            {
+                break;
+            }
+        }
+
+        ++range->count;
+        ++range->lineCount;
+        position = lineEnd + 1;
+    }
+
+    range->statusLine = range->lineCount;
+    return 0;
+}
+
+// frees the entries that were parsed but not handed out
+static void FreeRanges(__inout ManifestReader* reader)
+{
+    for (DWORD i = 0; i < reader->rangeCount; i++)
+    {
+        ManifestRange* range = &reader->ranges[i];
+        for (size_t k = range->delivered; k < range->count; k++)
+        {
+            free(range->lines[k].fh.line);
+        }
+        range->count = 0;
+        range->delivered = 0;
+    }
+    reader->rangeCount = 0;
+    reader->rangeIndex = 0;
+}
+
+static void WarnReadFailed(__in Args* args, __in DWORD error)
+{
+    if (!args->status)
+    {
+        HRESULT hr = StringCchPrintfW(msg,
+                                      _countof(msg),
+                                      L"file read failed: %lu\r\n",
+                                      error);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(msg);
+        }
+    }
+}
+
+// reads behind the length bytes already in segment until it is full or the manifest ends
+static BOOL FillSegment(__in HANDLE hFile, __inout PCHAR segment, __inout DWORD* length, __inout BOOL* eof)
+{
+    DWORD dwBytesRead;
+
+    while (*length < MANIFEST_SEGMENT_SIZE && !*eof)
+    {
+        if (!ReadFile(hFile, segment + *length, MANIFEST_SEGMENT_SIZE - *length, &dwBytesRead, NULL))
+        {
+            return FALSE;
+        }
+        *length += dwBytesRead;
+        *eof = dwBytesRead == 0;
+    }
+    return TRUE;
+}
+
+// Takes the next segment, read ahead behind the line carried over from the last
+// one, and parses every complete line in it. The lines are split into ranges of
+// about equal size at line breaks, one range per thread. While the threads parse,
+// this thread reads the segment after it into the other buffer.
+static ErrorCode ParseSegment(__inout ManifestReader* reader)
+{
+    Args* args = reader->args;
+    HANDLE threads[MANIFEST_PARSE_THREADS];
+
+    if (reader->readAhead)
+    {
+        PCHAR segment = reader->segment;
+        reader->segment = reader->nextSegment;
+        reader->nextSegment = segment;
+        reader->segmentLength = reader->nextLength;
+        reader->eof = reader->nextEof;
+        reader->readAhead = FALSE;
+        if (reader->nextError != ERROR_SUCCESS)
+        {
+            WarnReadFailed(args, reader->nextError);
+            return CHECK_SUMS_FAILED_TO_READ;
+        }
+    }
+    else
+    {
+        DWORD carry = reader->segmentLength - reader->segmentParsed;
+        memmove(reader->segment, reader->segment + reader->segmentParsed, carry);
+        reader->segmentLength = carry;
+        if (!FillSegment(reader->hFile, reader->segment, &reader->segmentLength, &reader->eof))
+        {
+            WarnReadFailed(args, GetLastError());
+            return CHECK_SUMS_FAILED_TO_READ;
+        }
+    }
+    reader->segmentParsed = 0;
+
+    // up to the last line break, or everything at the end of the manifest
+    DWORD parsed = reader->segmentLength;
+    if (!reader->eof)
+    {
+        while (parsed > 0 && reader->segment[parsed - 1] != '\n')
+        {
+            --parsed;
+        }
+        if (parsed == 0)
+        {
+            WarnLineTooLong(args, reader->lineNum);
+            return CHECK_SUMS_LINE_TOO_LONG;
+        }
+    }
+    reader->segmentParsed = parsed;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    DWORD count = parsed / MANIFEST_RANGE_MIN + 1;
+    count = count < info.dwNumberOfProcessors ? count : info.dwNumberOfProcessors;
+    count = count < MANIFEST_PARSE_THREADS ? count : MANIFEST_PARSE_THREADS;
+    count = count > 0 ? count : 1;
+
+    DWORD start = 0;
+    reader->rangeCount = 0;
+    for (DWORD i = 0; i < count && start < parsed; i++)
+    {
+        DWORD end = i + 1 == count ? parsed : start + (parsed - start) / (count - i);
+        end = end > start ? end : start + 1;
+        while (end < parsed && reader->segment[end - 1] != '\n')
+        {
+            ++end;
+        }
+
+        ManifestRange* range = &reader->ranges[reader->rangeCount++];
+        range->start = reader->segment + start;
+        range->length = end - start;
+        start = end;
+    }
+
+    // with more to read every range gets a thread, at the end of the manifest the
+    // first range is parsed on this thread, a range without a thread of its own too
+    DWORD first = reader->eof ? 1 : 0;
+    for (DWORD i = first; i < reader->rangeCount; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, ParseRange, &reader->ranges[i], 0, NULL);
+        if (threads[i] == NULL)
+        {
+            ParseRange(&reader->ranges[i]);
+        }
+    }
+    if (!reader->eof)
+    {
+        // the threads only write to the lines before segmentParsed, the carried line is left alone
+        DWORD carry = reader->segmentLength - parsed;
+        memcpy(reader->nextSegment, reader->segment + parsed, carry);
+        reader->nextLength = carry;
+        reader->nextEof = FALSE;
+        reader->nextError = FillSegment(reader->hFile, reader->nextSegment, &reader->nextLength, &reader->nextEof) ? ERROR_SUCCESS : GetLastError();
+        reader->readAhead = TRUE;
+    }
+    else if (reader->rangeCount > 0)
+    {
+        ParseRange(&reader->ranges[0]);
+    }
+    for (DWORD i = first; i < reader->rangeCount; i++)
+    {
+        if (threads[i] != NULL)
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
         }
     }
+
+    return SUCCESS;
 }
 
-ErrorCode PrintHash(__in Args* args, __in LPWSTR userInputFilePath, __in LPWSTR fileName)
+// hands out the lines of the parsed ranges in manifest order, with their line numbers
+static ErrorCode ReadSegmentEntry(__inout ManifestReader* reader, __out FileHash* fh, __out BOOL* found)
 {
-    // get full path from user input path, remove the file and append fileName so we get
-    // a clean absolute file path
-    WCHAR absPath[MAX_PATH];
-    if (GetFullPathNameW(userInputFilePath, MAX_PATH, absPath, NULL) == 0 || absPath == NULL)
-    {
-        return PRINT_HASH_FAILED_GET_FULL_PATH_NAME;
-    }
-
-    PathRemoveFileSpecW(absPath);
-
-    WCHAR absFilePath[MAX_PATH];
-    PathCombineW(absFilePath, absPath, fileName);
+    Args* args = reader->args;
 
-    // now calculate the file hash using the absolute file path we just constructed
-    LPWSTR hash = NULL;
-    ErrorCode ok = CalcHash(args, &hash, absFilePath);
-    if (hash != NULL && ok == SUCCESS)
+    while (TRUE)
     {
-        // depending whether it is a relative or an absolute path the output needs to be different to
-        // immitade the output of sha256sum from Linux
-        BOOL isRel = PathIsRelativeW(userInputFilePath);
-        if (isRel == TRUE)
+        if (reader->rangeIndex == reader->rangeCount)
         {
-            size_t userInputFilePathLen;
-            if (FAILED(StringCchLengthW(userInputFilePath, MAX_PATH, &userInputFilePathLen)))
+            if (reader->eof && reader->segmentParsed == reader->segmentLength)
             {
-                return PRINT_HASH_FAILED_STRING_LENGTH;
+                return SUCCESS;
             }
-            WCHAR inputPath[MAX_PATH];
-            BOOL containsPath = PathRemoveFileName(inputPath, userInputFilePath);
 
-            // if the user passed a relative file without a .\ or ..\ and other prefixes
-            if (containsPath == FALSE)
+            FreeRanges(reader);
+            ErrorCode status = ParseSegment(reader);
+            if (status != SUCCESS)
             {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"%ls *%ls\r\n",
-                                              hash, fileName);
-                if (FAILED(hr))
-                {
-                    return PRINT_HASH_FAILED_STRING_CAT3;
-                }
-                HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
-                DWORD mode;
-                if (GetConsoleMode(handle, &mode))
-                {
-                    WriteConsoleW(handle, msg, lstrlenW(msg), NULL, NULL);
-                }
-                else // redirect
-                {
-                    WriteFileUTF8(handle, msg);
-                }
+                return status;
             }
-            // if the user passed a relative file with .\, ..\ and so on, we
-            // need to concatenate the inputFilePath and the given fileName
-            else
-            {
-                WCHAR inputFilePath[MAX_PATH] = { 0 };
-                StringCchCopyW(inputFilePath, MAX_PATH, inputPath);
-
-                WCHAR separator = PathFindSeparator(userInputFilePath, userInputFilePathLen);
-                size_t len = lstrlenW(inputFilePath);
-                if (len+1 > MAX_PATH)
-                {
-                    return PRINT_HASH_FAILED_STRING_CAT1;
-                }
-                inputFilePath[len] = separator;
-
-                if (FAILED(StringCchCatW(inputFilePath, MAX_PATH, fileName)))
-                {
-                    return PRINT_HASH_FAILED_STRING_CAT2;
-                }
+            continue;
+        }
 
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"%ls *%ls\r\n",
-                                              hash, inputFilePath);
-                if (FAILED(hr))
-                {
-                    return PRINT_HASH_FAILED_STRING_CAT4;
-                }
-                HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
-                DWORD mode;
-                if (GetConsoleMode(handle, &mode))
-                {
-                    WriteConsoleW(handle, msg, lstrlenW(msg), NULL, NULL);
-                } else // redirect
-                {
-                    WriteFileUTF8(handle, msg);
-                }
+        ManifestRange* range = &reader->ranges[reader->rangeIndex];
+        if (range->delivered < range->count)
+        {
+            ParsedLine* parsed = &range->lines[range->delivered++];
+            if (parsed->empty)
+            {
+                WarnEmptyLine(args, reader->lineNum + parsed->line);
+                continue;
             }
+            *fh = parsed->fh;
+            *found = TRUE;
+            return SUCCESS;
         }
-        // in case of an absolute path the absolute path shall be used
-        else
+
+        // the entries before the broken line are out, the ranges after it are dropped
+        if (range->status != SUCCESS)
         {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),
-                                          L"%ls *%ls\r\n",
-                                          hash, absFilePath);
-            if (FAILED(hr))
+            int lineNum = reader->lineNum + range->statusLine;
+            if (range->status == CHECK_SUMS_LINE_TOO_LONG)
             {
-                return PRINT_HASH_FAILED_STRING_CAT5;
+                WarnLineTooLong(args, lineNum);
             }
-            HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
-            DWORD mode;
-            if (GetConsoleMode(handle, &mode))
+            else if (range->status == CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER1 || range->status == CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER2)
             {
-                WriteConsoleW(handle, msg, lstrlenW(msg), NULL, NULL);
+                WarnLineAllocation(args, lineNum, range->status == CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER2);
             }
-            else // redirect
+            else
             {
-                WriteFileUTF8(handle, msg);
+                WarnInvalidLine(args, lineNum);
             }
+            return range->status;
         }
+
+        reader->lineNum += range->lineCount;
+        ++reader->rangeIndex;
     }
-    return SUCCESS;
 }
 
-ErrorCode ParseLine(__in Args* args, __out FileHash* fh, __in int line_num, __in LPWSTR line)
+// opens a text manifest or a binary index for reading with NextManifestEntry
+ErrorCode OpenManifest(__in Args* args, __in LPCWSTR file, __out ManifestReader** reader)
 {
-    LPWSTR tokContext = NULL;
-    LPWSTR delim = L" ";
+    ManifestReader* opened = calloc(1, sizeof(ManifestReader));
+    if (opened == NULL)
+    {
+        return SCHEDULER_ALLOCATE_ERROR;
+    }
+    opened->args = args;
+    opened->lineNum = 1;
+
+    ErrorCode status = CreatePathFilter(args, &opened->filter);
+    if (status != SUCCESS)
+    {
+        free(opened);
+        return status;
+    }
 
-    fh->hash = wcstok_s(line, delim, &tokContext);
-    if (fh->hash == NULL)
+    if (IsIndexFile(file))
     {
-        if (!args->status && args->warn)
+        status = OpenIndex(args, file, &opened->index);
+        if (status != SUCCESS)
         {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),
-                                          L"invalid hash on line %d\r\n",
-                                          line_num);
-            if (SUCCEEDED(hr))
-            {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-            }
+            FreePathFilter(opened->filter);
+            free(opened);
+            return status;
         }
-        return PARSE_LINE_INVALID_HASH_TOKEN;
+        opened->isIndex = TRUE;
+        *reader = opened;
+        return SUCCESS;
     }
 
-    if (wcslen(fh->hash) != HASH_LENGTH)
+    // open file
+    opened->hFile = CreateFileW(file,                          // File name
+                                GENERIC_READ,                  // Open for reading
+                                FILE_SHARE_READ,               // No sharing
+                                NULL,                          // Default security
+                                OPEN_EXISTING,                 // Existing file only
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                NULL);
+    if (opened->hFile == INVALID_HANDLE_VALUE)
     {
-        if (!args->status && args->warn)
+        if (!args->status)
         {
             HRESULT hr = StringCchPrintfW(msg,
                                           _countof(msg),
-                                          L"invalid hash on line %d\r\n",
-                                          line_num);
+                                          L"failed to open file: %lu\r\n",
+                                          GetLastError());
             if (SUCCEEDED(hr))
             {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
+                WriteStderr(msg);
             }
         }
-        return PARSE_LINE_INVALID_HASH_LENGTH;
+        FreePathFilter(opened->filter);
+        free(opened);
+        return CHECK_SUMS_FAILED_TO_OPEN_SUM_FILE;
     }
 
-    fh->file = wcstok_s(NULL, delim, &tokContext);
-    if (fh->file == NULL)
+    // a large manifest is parsed by several threads, without memory for that
+    // it is still read line by line
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(opened->hFile, &size) && size.QuadPart >= MANIFEST_PARALLEL_MIN)
     {
-        if (!args->status && args->warn)
+        opened->segment = malloc(MANIFEST_SEGMENT_SIZE + 1);
+        opened->nextSegment = malloc(MANIFEST_SEGMENT_SIZE + 1);
+        if (opened->segment == NULL || opened->nextSegment == NULL)
         {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),
-                                          L"invalid hash on line %d\r\n",
-                                          line_num);
-            if (SUCCEEDED(hr))
-            {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-            }
+            free(opened->segment);
+            free(opened->nextSegment);
+            opened->segment = NULL;
+            opened->nextSegment = NULL;
         }
-        return PARSE_LINE_INAVLID_FILE;
     }
 
+    *reader = opened;
     return SUCCESS;
 }
 
-BOOL IsUTF16File(LPCWSTR filePath)
+void CloseManifest(__in ManifestReader* reader)
 {
-    BOOL isUTF16 = FALSE;
-    HANDLE hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-
-    if (hFile != INVALID_HANDLE_VALUE)
+    if (reader->isIndex)
     {
-        BYTE bom[2];
-        DWORD bytesRead;
-
-        if (ReadFile(hFile, bom, sizeof(bom), &bytesRead, NULL))
-        {
-            // check for UTF-16 header
-            if ((bom[0] == 0xFF && bom[1] == 0xFE) || (bom[0] == 0xFE && bom[1] == 0xFF))
-            {
-                isUTF16 = TRUE;
-            }
-        }
-
-        CloseHandle(hFile);
+        CloseIndex(&reader->index);
+    }
+    else
+    {
+        CloseHandle(reader->hFile);
     }
 
-    return isUTF16;
+    FreeRanges(reader);
+    for (int i = 0; i < MANIFEST_PARSE_THREADS; i++)
+    {
+        free(reader->ranges[i].lines);
+    }
+    free(reader->segment);
+    free(reader->nextSegment);
+    FreePathFilter(reader->filter);
+    free(reader);
 }
 
-ErrorCode VerifyChecksums(__in Args* args)
+static ErrorCode ReadManifestEntry(__inout ManifestReader* reader, __out FileHash* fh, __out BOOL* found)
 {
+    Args* args = reader->args;
     ErrorCode status = SUCCESS;
-    HANDLE hFile = NULL;
-    CHAR buffer[LINE_BUFFER_SIZE] = { 0 };
-    CHAR lineBuffer[LINE_BUFFER_SIZE] = { 0 };
-    DWORD dwBytesRead;
-    UINT lineIndex = 0;
-    int lineNum = 1;
-    FileHash* head = NULL;
-    FileHash* current = NULL;
 
-    BOOL isUTF16 = IsUTF16File(args->sumFile);
-    if (isUTF16)
+    *found = FALSE;
+    if (reader->isIndex)
     {
-        return CHECK_SUMS_FAILED_UNSUPPORTED_UTF_16;
+        if (reader->indexPosition == reader->index.header->count)
+        {
+            return SUCCESS;
+        }
+        *found = TRUE;
+        return IndexEntryToFileHash(args, &reader->index, reader->index.order[reader->indexPosition++], fh);
     }
 
-    // open file
-    hFile = CreateFileW(args->sumFile,         // File name
-                        GENERIC_READ,          // Open for reading
-                        FILE_SHARE_READ,       // No sharing
-                        NULL,                  // Default security
-                        OPEN_EXISTING,         // Existing file only
-                        FILE_ATTRIBUTE_NORMAL, // Normal file
-                        NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
+    if (reader->segment != NULL)
     {
-        if (!args->status)
-        {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),
-                                          L"failed to open file: %lu\r\n",
-                                          GetLastError());
-            if (SUCCEEDED(hr))
-            {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-            }
-        }
-        status = CHECK_SUMS_FAILED_TO_OPEN_SUM_FILE;
-        goto Cleanup;
+        return ReadSegmentEntry(reader, fh, found);
     }
 
-    while (ReadFile(hFile, buffer, LINE_BUFFER_SIZE, &dwBytesRead, NULL) && dwBytesRead > 0)
+    while (!*found)
     {
-        for (UINT i = 0; i < dwBytesRead; i++)
+        if (reader->bufferIndex == reader->bufferLength)
         {
-            if (buffer[i] != '\n')
+            if (reader->eof)
             {
-                if (lineIndex < LINE_BUFFER_SIZE - 1)
-                {
-                    lineBuffer[lineIndex++] = buffer[i];
-                }
-                else
-                {
-                    if (!args->status)
-                    {
-                        HRESULT hr = StringCchPrintfW(msg,
-                                                      _countof(msg),
-                                                      L"line %d too long, max size: %du\r\n",
-                                                      lineNum, LINE_BUFFER_SIZE);
-                        if (SUCCEEDED(hr))
-                        {
-                            WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                        }
-                    }
-                    status = CHECK_SUMS_LINE_TOO_LONG;
-                    goto Cleanup;
-                }
+                // last line without trailing line break
+                return reader->lineIndex > 0 ? ParseManifestLine(reader, fh, TRUE, found) : SUCCESS;
             }
-            else
-            {
-                // check if \r is at the end and replace it with \0
-                if (lineIndex > 0 && lineBuffer[lineIndex - 1] == '\r')
-                {
-                    lineBuffer[lineIndex - 1] = '\0';
-                }
-                // add \0 in case there was no \r
-                lineBuffer[lineIndex] = '\0';
-
-                int reqSize = MultiByteToWideChar(CP_UTF8, 0, lineBuffer, lineIndex, NULL, 0);
-                LPWSTR wideBuffer = malloc(sizeof(WCHAR) * (reqSize + 1));
-                if (wideBuffer == NULL)
-                {
-                    if (!args->status)
-                    {
-                        HRESULT hr = StringCchPrintfW(msg,
-                                                      _countof(msg),
-                                                      L"failed to allocate memory for wideBuffer1 for line %d\r\n",
-                                                      lineNum);
-                        if (SUCCEEDED(hr))
-                        {
-                            WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                        }
-                    }
-                    status = CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER1;
-                    goto Cleanup;
-                }
-                MultiByteToWideChar(CP_UTF8, 0, lineBuffer, lineIndex, wideBuffer, reqSize);
-                wideBuffer[reqSize] = L'\0';
-
-                FileHash* fh = malloc(sizeof(FileHash));
-                if (fh == NULL)
-                {
-                    if (!args->status)
-                    {
-                        HRESULT hr = StringCchPrintfW(msg,
-                                                      _countof(msg),
-                                                      L"failed to allocate memory for fh1 for line %d\r\n",
-                                                      lineNum);
-                        if (SUCCEEDED(hr))
-                        {
-                            WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                        }
-                    }
-                    status = CHECK_SUMS_FAILED_TO_ALLOCATE_FILE_HASH1;
-                    goto Cleanup;
-                }
-                fh->next = NULL;
 
-                if (reqSize == 0 || wcslen(wideBuffer) == 0)
-                {
-                    if (!args->status)
-                    {
-                        HRESULT hr = StringCchPrintfW(msg,
-                                                      _countof(msg),
-                                                      L"skip empty line %d\r\n",
-                                                      lineNum);
-                        if (SUCCEEDED(hr))
-                        {
-                            WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                        }
-                    }
-                    free(fh);
-                }
-                else
+            if (!ReadFile(reader->hFile, reader->buffer, MANIFEST_READ_SIZE, &reader->bufferLength, NULL))
+            {
+                if (!args->status)
                 {
-                    ErrorCode parseResult = ParseLine(args, fh, lineNum, wideBuffer);
-                    if (parseResult != SUCCESS)
+                    HRESULT hr = StringCchPrintfW(msg,
+                                                  _countof(msg),
+                                                  L"file read failed: %lu\r\n",
+                                                  GetLastError());
+                    if (SUCCEEDED(hr))
                     {
-                        free(fh);
-                        status = parseResult;
-                        goto Cleanup;
-                    }
-                    else
-                    {
-                        if (head == NULL)
-                        {
-                            head = fh;
-                        }
-                        else
-                        {
-                            current->next = fh;
-                        }
-                        current = fh;
+                        WriteStderr(msg);
                     }
                 }
-
-                lineIndex = 0;
-                lineNum++;
+                return CHECK_SUMS_FAILED_TO_READ;
             }
+            reader->bufferIndex = 0;
+            reader->eof = reader->bufferLength == 0;
+            continue;
         }
-    }
 
-    // last line withtout trailing line break
-    if (lineIndex > 0)
-    {
-        if (lineBuffer[lineIndex - 1] == '\r')
-        {
-            lineBuffer[lineIndex - 1] = '\0';
-        }
-        lineBuffer[lineIndex] = '\0';
+        // copy everything up to the next line break at once
+        PCHAR start = reader->buffer + reader->bufferIndex;
+        DWORD available = reader->bufferLength - reader->bufferIndex;
+        PCHAR newline = memchr(start, '\n', available);
+        DWORD length = newline != NULL ? (DWORD)(newline - start) : available;
 
-        int reqSize = MultiByteToWideChar(CP_UTF8, 0, lineBuffer, lineIndex, NULL, 0);
-        LPWSTR wideBuffer = malloc(sizeof(WCHAR) * (reqSize + 1));
-        if (wideBuffer == NULL)
+        if (reader->lineIndex + length > LINE_BUFFER_SIZE - 1)
         {
-            if (!args->status)
-            {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"failed to allocate memory for wideBuffer2 for line %d\r\n",
-                                              lineNum);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
-            }
-            status = CHECK_SUMS_FAILED_TO_ALLOCATE_WIDE_BUFFER2;
-            goto Cleanup;
+            WarnLineTooLong(args, reader->lineNum);
+            return CHECK_SUMS_LINE_TOO_LONG;
         }
-        MultiByteToWideChar(CP_UTF8, 0, lineBuffer, lineIndex, wideBuffer, reqSize);
-        wideBuffer[reqSize] = L'\0';
 
-        FileHash* fh = malloc(sizeof(struct file_hash_t));
-        if (fh == NULL)
-        {
-            if (!args->status)
-            {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"failed to allocate memory for fh2 for line %d\r\n",
-                                              lineNum);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
-            }
-            status = CHECK_SUMS_FAILED_TO_ALLOCATE_FILE_HASH2;
-            goto Cleanup;
-        }
-        fh->next = NULL;
+        memcpy(reader->lineBuffer + reader->lineIndex, start, length);
+        reader->lineIndex += length;
+        reader->bufferIndex += length;
 
-        if (reqSize == 0 || wcslen(wideBuffer) == 0)
-        {
-            if (!args->status)
-            {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"skip empty line %d\r\n",
-                                              lineNum);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
-            }
-        }
-        else
+        if (newline != NULL)
         {
-            ErrorCode parseResult = ParseLine(args, fh, lineNum, wideBuffer);
-            if (parseResult != SUCCESS)
-            {
-                free(fh);
-                status = parseResult;
-                goto Cleanup;
-            }
-            else
+            ++reader->bufferIndex;
+            status = ParseManifestLine(reader, fh, FALSE, found);
+            if (status != SUCCESS)
             {
-                if (head == NULL)
-                {
-                    head = fh;
-                }
-                else
-                {
-                    current->next = fh;
-                }
-                current = fh;
+                return status;
             }
         }
     }
 
-    if (GetLastError() != 0)
+    return SUCCESS;
+}
+
+// Parses the next manifest entry into fh, *found stays FALSE at the end of the
+// file. fh->line owns the strings and has to be freed by the caller. Entries
+// left out by --include, --exclude or --paths-from are dropped here, before
+// anything stats or hashes them.
+ErrorCode NextManifestEntry(__inout ManifestReader* reader, __out FileHash* fh, __out BOOL* found)
+{
+    while (TRUE)
     {
-        if (!args->status)
+        ErrorCode status = ReadManifestEntry(reader, fh, found);
+        if (status != SUCCESS || !*found || reader->filter == NULL || PathFilterMatches(reader->filter, fh->file))
         {
-            HRESULT hr = StringCchPrintfW(msg,
-                                          _countof(msg),
-                                          L"file read failed: %lu\r\n",
-                                          GetLastError());
-            if (SUCCEEDED(hr))
-            {
-                WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-            }
+            return status;
         }
-        status = CHECK_SUMS_FAILED_TO_READ;
+        free(fh->line);
+    }
+}
+
+// The manifest is parsed on this thread into a ring of VERIFY_WINDOW entries,
+// the slot of a job in the pool is the slot of its entry. Once the window is
+// full, ReserveHashJob reports the oldest job before it hands out its slot, so
+// memory use does not depend on the length of the manifest.
+ErrorCode VerifyChecksums(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    ErrorCode parseStatus = SUCCESS;
+    ManifestReader* reader = NULL;
+    HashPool* pool = NULL;
+    FileHash* entries = NULL;
+    ULONGLONG submitted = 0;
+    VerifyState state = { SUCCESS, FALSE, NULL, 0 };
+
+    BOOL isUTF16 = IsUTF16File(args->sumFile);
+    if (isUTF16)
+    {
+        return CHECK_SUMS_FAILED_UNSUPPORTED_UTF_16;
+    }
+
+    entries = calloc(VERIFY_WINDOW, sizeof(FileHash));
+    if (entries == NULL)
+    {
+        return SCHEDULER_ALLOCATE_ERROR;
+    }
+
+    status = OpenManifest(args, args->sumFile, &reader);
+    if (status != SUCCESS)
+    {
         goto Cleanup;
     }
 
-    current = head;
-    while (current != NULL)
+    if (args->journal != NULL)
     {
-        LPWSTR file_hash = NULL;
-        ErrorCode calcResult = CalcHash(args, &file_hash, current->file);
-        if (calcResult != SUCCESS)
+        status = OpenJournal(args, &state.journal);
+        if (status != SUCCESS)
         {
-            status = calcResult;
             goto Cleanup;
         }
+    }
+
+    status = StartHashPool(args, VERIFY_WINDOW, VerifyResult, &state, &pool);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // every entry is hashed as soon as it is parsed, VerifyResult still sees
+    // them in manifest order
+    while (TRUE)
+    {
+        BOOL found;
+        BOOL matched;
 
-        if (wcscmp(current->hash, file_hash) == 0)
+        HashJob* job = ReserveHashJob(pool);
+        if (job == NULL)
         {
-            if (!args->status && !args->quiet)
-            {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"%ls: OK\r\n",
-                                              current->file);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
-            }
+            break; // stopped by VerifyResult
         }
-        else
+
+        // the entry that had the slot was reported
+        FileHash* fh = &entries[submitted % VERIFY_WINDOW];
+        free(fh->line);
+        fh->line = NULL;
+
+        parseStatus = NextManifestEntry(reader, fh, &found);
+        if (parseStatus != SUCCESS || !found)
         {
-            if (!args->status)
-            {
-                HRESULT hr = StringCchPrintfW(msg,
-                                              _countof(msg),
-                                              L"%ls: FAILED\r\n", 
-                                              current->file);
-                if (SUCCEEDED(hr))
-                {
-                    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), msg, lstrlenW(msg), NULL, NULL);
-                }
-            }
-            status = CHECK_SUM_CHECKSUM_FAILED;
+            fh->line = NULL; // may still point to a line the filter dropped
+            break;
         }
 
-        current = current->next;
+        // entries an earlier run verified are neither opened nor stat'ed again
+        job->file = fh->file;
+        job->skip = state.journal != NULL && JournalLookup(state.journal, submitted, &matched);
+        job->checkSize = fh->hasSize;
+        job->expectedSize = fh->size;
+        job->context = fh;
+        SubmitHashJob(pool, job);
+        ++submitted;
+    }
+
+    // the entries before a broken line are still checked
+    status = FinishHashPool(pool);
+    if (status == SUCCESS)
+    {
+        // a broken line stops the run, unless a failure already stopped it before
+        status = state.stopped || parseStatus == SUCCESS ? state.status : parseStatus;
     }
 
     if (!args->status && status == CHECK_SUM_CHECKSUM_FAILED)
@@ -848,23 +2223,23 @@ ErrorCode VerifyChecksums(__in Args* args)
     }
 
 Cleanup:
-    if (hFile)
+    if (reader)
     {
-        CloseHandle(hFile);
+        CloseManifest(reader);
     }
 
-    // clean file_hashes
-    if (head != NULL)
+    // once the run has its result the journal is done with
+    ErrorCode journalStatus = CloseJournal(state.journal, status == SUCCESS || status == CHECK_SUM_CHECKSUM_FAILED);
+    if (status == SUCCESS)
     {
-        current = head;
-        FileHash* next = NULL;
-        while (current != NULL)
-        {
-            next = current->next;
-            free(current);
-            current = next;
-        }
+        status = journalStatus;
+    }
+
+    for (size_t i = 0; i < VERIFY_WINDOW; i++)
+    {
+        free(entries[i].line);
     }
+    free(entries);
 
     return status;
 }
@@ -15,6 +15,27 @@ typedef enum errorCode
     PARSE_ARGS_MISSING_PARAMETER = 2,
     PARSE_ARGS_MISSING_SHASUMS_FILE = 3,
     PARSE_ARGS_ALLOCATE_ERROR = 4,
+    PARSE_ARGS_MISSING_PIPE_NAME = 38,
+    PARSE_ARGS_MISSING_FILES_FROM_FILE = 39,
+    PARSE_ARGS_INVALID_JOBS = 44,
+    PARSE_ARGS_INVALID_ORDER = 45,
+    PARSE_ARGS_MISSING_CONVERT_FILES = 49,
+    PARSE_ARGS_MISSING_LOOKUP_FILE = 50,
+    PARSE_ARGS_MISSING_DIFF_ARGUMENTS = 60,
+    PARSE_ARGS_MISSING_PATTERN = 61,
+    PARSE_ARGS_MISSING_PATHS_FROM_FILE = 62,
+    PARSE_ARGS_INVALID_LIMIT = 65,
+    PARSE_ARGS_INVALID_STORAGE = 66,
+    PARSE_ARGS_INVALID_PREFETCH = 67,
+    PARSE_ARGS_MISSING_TREE_DIRECTORY = 68,
+    PARSE_ARGS_MISSING_TREE_CACHE = 69,
+    PARSE_ARGS_MISSING_WATCH_DIRECTORY = 73,
+    PARSE_ARGS_MISSING_OUTPUT = 74,
+    PARSE_ARGS_MISSING_JOURNAL = 78,
+    PARSE_ARGS_MISSING_APPEND_STATE = 82,
+    PARSE_ARGS_MISSING_TAR = 87,
+    PARSE_ARGS_MISSING_COPY_TO = 92,
+    PARSE_ARGS_INVALID_EXPECT = 93,
 
     // calc_hash
     CALC_HASH_FAILED_TO_OPEN_FILE = 5,
@@ -28,6 +49,8 @@ typedef enum errorCode
     CALC_HASH_FAILED_TO_HASH = 13,
     CALC_HASH_FAILED_TO_FINISH_HASH = 14,
     CALC_HASH_FAILED_TO_ALLOCATE_FILE_HASH = 15,
+    CALC_HASH_FAILED_TO_ALLOCATE_READ_BUFFER = 48,
+    CALC_HASH_CANCELLED = 99,
 
     // parse_line
     PARSE_LINE_INVALID_HASH_TOKEN = 16,
@@ -53,14 +76,122 @@ typedef enum errorCode
     PRINT_HASH_FAILED_STRING_CAT3 = 31,
     PRINT_HASH_FAILED_STRING_CAT4 = 32,
     PRINT_HASH_FAILED_STRING_CAT5 = 33,
+
+    // daemon
+    DAEMON_FAILED_TO_CREATE_PIPE = 35,
+    DAEMON_FAILED_TO_CONNECT = 36,
+    DAEMON_PROTOCOL_ERROR = 37,
+    DAEMON_ALLOCATE_ERROR = 98,
+
+    // files_from
+    FILES_FROM_FAILED_TO_OPEN = 40,
+    FILES_FROM_FAILED_TO_READ = 41,
+    FILES_FROM_PATH_TOO_LONG = 42,
+    FILES_FROM_ALLOCATE_ERROR = 43,
+
+    // scheduler
+    SCHEDULER_ALLOCATE_ERROR = 46,
+    SCHEDULER_FAILED_TO_CREATE_THREAD = 47,
+
+    // index
+    INDEX_INVALID = 51,
+    INDEX_FAILED_TO_OPEN = 52,
+    INDEX_FAILED_TO_WRITE = 53,
+    INDEX_ALLOCATE_ERROR = 54,
+    INDEX_INVALID_HASH = 55,
+    INDEX_ENTRY_NOT_FOUND = 56,
+
+    // diff
+    DIFF_DIFFERENCES_FOUND = 57,
+    DIFF_FAILED_TO_WALK = 58,
+    DIFF_ALLOCATE_ERROR = 59,
+
+    // filter
+    FILTER_FAILED_TO_READ_PATHS = 63,
+    FILTER_ALLOCATE_ERROR = 64,
+
+    // tree
+    TREE_FAILED_TO_WALK = 70,
+    TREE_ALLOCATE_ERROR = 71,
+    TREE_FAILED_TO_WRITE_CACHE = 72,
+
+    // watch
+    WATCH_FAILED_TO_OPEN = 75,
+    WATCH_FAILED_TO_WRITE = 76,
+    WATCH_ALLOCATE_ERROR = 77,
+
+    // journal
+    JOURNAL_FAILED_TO_OPEN = 79,
+    JOURNAL_FAILED_TO_WRITE = 80,
+    JOURNAL_ALLOCATE_ERROR = 81,
+
+    // append state
+    APPEND_STATE_FAILED_TO_OPEN = 83,
+    APPEND_STATE_INVALID = 84,
+    APPEND_STATE_FAILED_TO_WRITE = 85,
+    APPEND_STATE_ALLOCATE_ERROR = 86,
+
+    // tar
+    TAR_FAILED_TO_OPEN = 88,
+    TAR_INVALID = 89,
+    TAR_FAILED_TO_READ = 90,
+    TAR_ALLOCATE_ERROR = 91,
+
+    // copy
+    COPY_FAILED_TO_OPEN = 94,
+    COPY_FAILED_TO_READ = 95,
+    COPY_FAILED_TO_WRITE = 96,
+    COPY_ALLOCATE_ERROR = 97,
 } ErrorCode;
 
+#define SHA256_DIGEST_LENGTH 32
+#define MAXIMUM_JOBS 1024
+#define MAXIMUM_STORAGE_DEVICES 32
+#define DEFAULT_PREFETCH 32
+
 typedef struct file_list
 {
     LPWSTR file;
     struct file_list* next;
 } FileList;
 
+typedef enum order_t
+{
+    ORDER_SIZE = 0, // largest file first
+    ORDER_INPUT = 1,
+    ORDER_FILE_ID = 2,  // by volume and file ID, the MFT record order
+    ORDER_PHYSICAL = 3, // by volume and first cluster of the data
+} Order;
+
+// --storage, or what was detected for a disk
+typedef enum storage_kind_t
+{
+    STORAGE_AUTO = 0, // detect per disk
+    STORAGE_ROTATIONAL = 1,
+    STORAGE_SOLID_STATE = 2,
+    STORAGE_UNKNOWN = 3,
+} StorageKind;
+
+// A physical disk the files of a run are on, see storage.c. The first entry
+// stands for everything that could not be resolved, like network shares.
+typedef struct storage_device_t
+{
+    DWORD disk;          // PhysicalDrive number
+    DWORD spindles;      // disks a striped or spanned volume reads from
+    BOOL hasSeekPenalty; // the disk answered the seek penalty query
+    BOOL seekPenalty;
+    DWORD busType;       // STORAGE_BUS_TYPE of the adapter
+    StorageKind kind;    // set by PlanStorage
+    LONG readers;        // files read at once, set by PlanStorage
+} StorageDevice;
+
+// --max-rate and --max-iops, shared by all threads reading with the same Args
+typedef struct rate_limit_t
+{
+    ULONGLONG limit;      // per second, 0 is unlimited
+    volatile LONG64 next; // performance counter time everything reserved is paid for
+} RateLimit;
+
 typedef struct prog_args
 {
     FileList* files;
@@ -70,8 +201,148 @@ typedef struct prog_args
     BOOL warn;
     BOOL showVersion;
     BOOL textMode;
+    BOOL serve;
+    BOOL daemon;
+    BOOL stopDaemon;
+    LPWSTR pipeName;
+    LPWSTR filesFrom;
+    BOOL nullDelimited;
+    BOOL failFast;
+    BOOL withSize;
+    DWORD jobs;
+    Order order;
+    BOOL direct;
+    BOOL dropCache;
+    BOOL showStats;
+    LPWSTR convertFrom;
+    LPWSTR convertTo;
+    LPWSTR lookup;
+    LPWSTR diffManifest;
+    LPWSTR diffDirectory;
+    FileList* includes;
+    FileList* excludes;
+    LPWSTR pathsFrom;
+    BOOL progress;
+    RateLimit maxRate;
+    RateLimit maxIops;
+    StorageKind storage;
+    DWORD prefetch; // files opened ahead at most, 0 turns it off
+    LPWSTR treeDirectory;
+    LPWSTR treeCache;
+    LPWSTR watchDirectory;
+    LPWSTR watchOutput;
+    LPWSTR journal;
+    LPWSTR appendState;
+    LPWSTR tarFile; // - for stdin
+    LPWSTR copyTo;
+    BOOL tee;
+    LPWSTR expect; // digest --tee has to match
+    volatile LONG cancelled; // set by the scheduler, files being read stop at the next read
 } Args;
 
+// What a stat of the file found, so hashing does not have to ask again.
+typedef struct file_facts_t
+{
+    BOOL known;
+    ULONGLONG size;
+    DWORD attributes;
+} FileFacts;
+
+typedef struct hash_job_t
+{
+    LPWSTR file;
+    BOOL skip; // already decided, do not hash
+    BOOL checkSize; // a file of another size than expectedSize is skipped unread
+    ULONGLONG expectedSize;
+    FileFacts facts; // filled by the scheduler
+    ErrorCode status;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG hashedSize; // bytes that went into digest, what --with-size writes
+    BOOL quietOpen; // a file that cannot be opened is not reported, openError tells why
+    DWORD openError; // with quietOpen, the Win32 error of the open that failed
+    volatile LONG done;
+    PVOID context;
+} HashJob;
+
+// One manifest entry. path is the UTF-8 path as written in the manifest, file
+// the same path in UTF-16 for the file APIs, both point into line.
+typedef struct file_hash_t
+{
+    LPWSTR file;
+    LPSTR path;
+    DWORD pathLength;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG size;
+    BOOL hasSize;
+    PVOID line;
+} FileHash;
+
+typedef struct manifest_reader_t ManifestReader;
+
+// results of a --check run so far, so a restarted run can skip them, see journal.c
+typedef struct verify_journal_t Journal;
+
+// one digest after another over data that arrives in pieces, see sha256.c
+typedef struct stream_hash_t StreamHash;
+
+// compiled --include, --exclude and --paths-from selection, see filter.c
+typedef struct path_filter_t PathFilter;
+
+// Binary manifest index, an IndexHeader followed by count IndexEntry sorted by
+// path, the positions of the entries in manifest order and the pool of UTF-8
+// paths the entries point into. The file is mapped and used in place, see
+// index.c.
+typedef struct index_header_t
+{
+    DWORD magic;
+    WORD version;
+    WORD flags;
+    ULONGLONG count;
+    ULONGLONG poolSize;
+    ULONGLONG reserved;
+} IndexHeader;
+
+typedef struct index_entry_t
+{
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG size;
+    ULONGLONG pathOffset;
+    DWORD pathLength;
+    DWORD flags;
+    ULONGLONG ordinal; // of the entry in the manifest, keeps repeated paths in order
+} IndexEntry;
+
+typedef struct manifest_index_t
+{
+    HANDLE hFile;
+    HANDLE hMapping;
+    PBYTE view;
+    IndexHeader* header;
+    IndexEntry* entries;
+    ULONGLONG* order; // position in entries of the first, second, ... manifest entry
+    PBYTE pool;
+} ManifestIndex;
+
+// counters of the current run, printed with --stats
+typedef struct run_stats_t
+{
+    volatile LONG64 filesHashed;
+    volatile LONG64 bytesRead;
+    volatile LONG64 duplicates;
+    volatile LONG64 bytesSaved;
+    volatile LONG64 bytesHashed;  // read and sparse holes, for --progress
+    volatile LONG64 bytesPlanned; // size of the files queued so far
+    volatile LONG64 filesPrefetched;
+    DWORD workers;                // of the last scheduled batch and why
+    WCHAR workersReason[160];
+} RunStats;
+
+// called for every finished job in input order, return FALSE to cancel the rest
+typedef BOOL (*HashJobCallback)(__in Args*, __in HashJob*, __in_opt PVOID);
+
+// workers that hash jobs as they are submitted, see scheduler.c
+typedef struct hash_pool_t HashPool;
+
 // this is required for CppUnitTestFramework
 #ifdef __cplusplus
 extern "C" {
@@ -80,13 +351,101 @@ extern "C" {
 ErrorCode ParseArgs(__out Args*, __in int, __in LPWSTR[]);
 
 ErrorCode CalcHash(__in Args*, __out LPWSTR*, __in LPWSTR);
+ErrorCode CalcDigest(__in Args*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE, __in LPWSTR);
+ErrorCode CalcJobDigest(__in Args*, __inout HashJob*);
+ErrorCode HashOpenFile(__in Args*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE, __in HANDLE, __in_opt FileFacts*, __out ULONGLONG*);
+HANDLE OpenFileForHashing(__in Args*, __in LPCWSTR);
+PBYTE GetReadBuffer(void);
+void FreeReadBuffer(void);
+ErrorCode HashHandle(__in Args*, __in HANDLE, __in_opt FileFacts*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE, __out ULONGLONG*);
+ErrorCode HashMemory(__in Args*, __in_ecount(size) PBYTE, __in DWORD size, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE);
+ErrorCode CreateStreamHash(__in Args*, __out StreamHash**);
+ErrorCode StreamHashData(__in Args*, __in StreamHash*, __in_ecount(size) PBYTE, __in DWORD size);
+ErrorCode FinishStreamHash(__in Args*, __inout StreamHash*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE);
+void FreeStreamHash(__in_opt StreamHash*);
 ErrorCode PrintHash(__in Args*, __in LPWSTR, __in LPWSTR);
+ErrorCode BuildFilePath(__in LPWSTR, __in LPWSTR, __out_ecount(MAX_PATH) LPWSTR);
+ErrorCode WriteHashLine(__in Args*, __in LPWSTR, __in LPWSTR, __in LPWSTR, __in LPWSTR, __in ULONGLONG);
+void FormatDigest(__out_ecount(SHA256_DIGEST_LENGTH * 2 + 1) LPWSTR, __in PBYTE);
+void FormatDigestUTF8(__out_ecount(SHA256_DIGEST_LENGTH * 2 + 1) LPSTR, __in PBYTE);
+BOOL ParseDigest(__in LPCSTR, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE);
 ErrorCode VerifyChecksums(__in Args*);
+ErrorCode OpenManifest(__in Args*, __in LPCWSTR, __out ManifestReader**);
+ErrorCode NextManifestEntry(__inout ManifestReader*, __out FileHash*, __out BOOL*);
+void CloseManifest(__in ManifestReader*);
 
 void WriteFileUTF8(__in HANDLE, __in LPWSTR);
+void LogError(__in Args*, __in LPCWSTR, __in LPCWSTR, __in DWORD);
+void WriteStderr(__in LPWSTR);
+void WriteStdout(__in LPWSTR);
+void WriteStdoutUTF8(__in LPCSTR, __in size_t);
+void FlushStdout(void);
+void FlushStdoutIfDue(void);
 WCHAR PathFindSeparator(__in LPWSTR, __in size_t);
 BOOL PathRemoveFileName(__out_ecount(MAX_PATH) LPWSTR, __in LPWSTR);
 
+ErrorCode RunDaemon(__in Args*);
+ErrorCode StopDaemon(__in Args*);
+ErrorCode DaemonCalcDigest(__in Args*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE, __in LPWSTR, __out ULONGLONG*, __out_opt DWORD*);
+void DisconnectDaemon(void);
+
+ErrorCode HashFilesFrom(__in Args*);
+
+DWORD SchedulerThreadCount(__in Args*);
+ErrorCode RunHashJobs(__in Args*, __inout HashJob*, __in size_t, __in HashJobCallback, __in_opt PVOID);
+ErrorCode StartHashPool(__in Args*, __in size_t, __in HashJobCallback, __in_opt PVOID, __out HashPool**);
+HashJob* ReserveHashJob(__inout HashPool*);
+void SubmitHashJob(__inout HashPool*, __inout HashJob*);
+ErrorCode FinishHashPool(__inout HashPool*);
+
+DWORD PlanStorage(__inout_ecount(count) StorageDevice*, __in size_t count, __in StorageKind, __in DWORD);
+DWORD StorageDeviceOf(__in DWORD, __in LPCWSTR);
+DWORD PlanStorageWorkers(__in Args*, __in_ecount(MAXIMUM_STORAGE_DEVICES) BOOL*, __out_ecount(MAXIMUM_STORAGE_DEVICES) LONG*, __out BOOL*);
+
+BOOL IsIndexFile(__in LPCWSTR);
+ErrorCode OpenIndex(__in Args*, __in LPCWSTR, __out ManifestIndex*);
+void CloseIndex(__in ManifestIndex*);
+IndexEntry* IndexLookup(__in ManifestIndex*, __in LPCSTR, __in DWORD);
+ErrorCode IndexEntryToFileHash(__in Args*, __in ManifestIndex*, __in ULONGLONG, __out FileHash*);
+ErrorCode ConvertManifest(__in Args*);
+ErrorCode LookupChecksum(__in Args*);
+
+ErrorCode DiffTree(__in Args*);
+
+ErrorCode CalcTreeDigest(__in Args*, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE);
+ErrorCode TreeDigest(__in Args*);
+
+ErrorCode WatchDirectory(__in Args*);
+void StopWatch(void);
+
+ErrorCode OpenJournal(__in Args*, __out Journal**);
+BOOL JournalLookup(__in Journal*, __in ULONGLONG, __out BOOL*);
+ErrorCode JournalAppend(__inout Journal*, __in BOOL, __in_ecount(SHA256_DIGEST_LENGTH) PBYTE);
+ErrorCode CloseJournal(__in_opt Journal*, __in BOOL);
+
+ErrorCode LoadAppendState(__in Args*);
+ErrorCode HashAppendedFile(__in Args*, __in HANDLE, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE, __out ULONGLONG*);
+ErrorCode SaveAppendState(__in Args*);
+
+ErrorCode HashTar(__in Args*);
+
+ErrorCode CopyFiles(__in Args*);
+ErrorCode TeeStdin(__in Args*);
+
+ErrorCode CreatePathFilter(__in Args*, __out PathFilter**);
+BOOL PathFilterMatches(__in PathFilter*, __in LPCWSTR);
+void FreePathFilter(__in_opt PathFilter*);
+
+extern RunStats runStats;
+void PrintRunStats(void);
+
+void StartProgress(__in Args*);
+void StopProgress(void);
+void ProgressStartFile(__in LPCWSTR);
+void FormatProgress(__out_ecount(count) LPWSTR, __in size_t count, __in ULONGLONG, __in ULONGLONG, __in ULONGLONG, __in ULONGLONG, __in_opt LPCWSTR);
+
+void ThrottleRead(__in Args*, __in DWORD);
+
 #ifdef __cplusplus
 }
 #endif
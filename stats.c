@@ -0,0 +1,38 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+RunStats runStats = { 0 };
+
+// the summary goes to stderr so it never ends up in a redirected manifest
+void PrintRunStats(void)
+{
+    WCHAR message[512];
+
+    HRESULT hr = StringCchPrintfW(message,
+                                  _countof(message),
+                                  L"files hashed: %lld\r\n"
+                                  L"bytes read: %lld\r\n"
+                                  L"duplicates: %lld\r\n"
+                                  L"bytes saved: %lld\r\n"
+                                  L"files opened ahead: %lld\r\n",
+                                  runStats.filesHashed,
+                                  runStats.bytesRead,
+                                  runStats.duplicates,
+                                  runStats.bytesSaved,
+                                  runStats.filesPrefetched);
+    if (SUCCEEDED(hr))
+    {
+        WriteStderr(message);
+    }
+
+    // only runs that went through the scheduler decided on workers
+    if (runStats.workers > 0)
+    {
+        hr = StringCchPrintfW(message, _countof(message), L"workers: %lu, %ls\r\n", runStats.workers, runStats.workersReason);
+        if (SUCCEEDED(hr))
+        {
+            WriteStderr(message);
+        }
+    }
+}
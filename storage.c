@@ -0,0 +1,283 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define MAXIMUM_STORAGE_VOLUMES 64
+#define STORAGE_NO_DEVICE 0      // shared entry of everything not resolved to a disk
+#define STORAGE_MAXIMUM_EXTENTS 16
+
+// Disks seen so far, volumes are resolved once per run and mapped by their
+// serial number, the same one the scheduler gets from its stat of each file.
+typedef struct storage_table_t
+{
+    SRWLOCK lock;
+    DWORD volumeSerials[MAXIMUM_STORAGE_VOLUMES];
+    DWORD volumeDevices[MAXIMUM_STORAGE_VOLUMES];
+    size_t volumeCount;
+    StorageDevice devices[MAXIMUM_STORAGE_DEVICES];
+    size_t deviceCount;
+} StorageTable;
+
+static StorageTable storage = { SRWLOCK_INIT, { 0 }, { 0 }, 0, { { 0 } }, 1 };
+
+static const LPCWSTR storageNames[] = { L"auto", L"rotational", L"solid state", L"unknown" };
+
+static StorageKind ClassifyDevice(__in StorageDevice* device)
+{
+    if (device->hasSeekPenalty)
+    {
+        return device->seekPenalty ? STORAGE_ROTATIONAL : STORAGE_SOLID_STATE;
+    }
+
+    // older drivers do not answer the seek penalty query, these buses have no heads
+    if (device->busType == BusTypeNvme || device->busType == BusTypeSd || device->busType == BusTypeMmc)
+    {
+        return STORAGE_SOLID_STATE;
+    }
+    return STORAGE_UNKNOWN;
+}
+
+// Decides the readers per disk and the number of workers: one sequential stream
+// per spindle of a rotational disk, where a second one would only add seeks, and
+// one per logical processor shared by everything else, where hashing is the
+// limit. forced replaces the detected kind of every disk. Returns the workers.
+DWORD PlanStorage(__inout_ecount(count) StorageDevice* devices, __in size_t count, __in StorageKind forced, __in DWORD processors)
+{
+    DWORD rotationalReaders = 0;
+    BOOL shared = FALSE;
+
+    if (processors == 0)
+    {
+        processors = 1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        devices[i].kind = forced != STORAGE_AUTO ? forced : ClassifyDevice(&devices[i]);
+        if (devices[i].kind == STORAGE_ROTATIONAL)
+        {
+            devices[i].readers = devices[i].spindles > 0 ? (LONG)devices[i].spindles : 1;
+            rotationalReaders += (DWORD)devices[i].readers;
+        }
+        else
+        {
+            devices[i].readers = (LONG)processors;
+            shared = TRUE;
+        }
+    }
+
+    DWORD workers = rotationalReaders + (shared ? processors : 0);
+    if (workers > MAXIMUM_JOBS)
+    {
+        workers = MAXIMUM_JOBS;
+    }
+    return workers > 0 ? workers : 1;
+}
+
+static HANDLE OpenVolume(__in LPCWSTR file)
+{
+    WCHAR mountPoint[MAX_PATH];
+    WCHAR volume[MAX_PATH];
+
+    if (!GetVolumePathNameW(file, mountPoint, _countof(mountPoint))
+        || !GetVolumeNameForVolumeMountPointW(mountPoint, volume, _countof(volume)))
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // \\?\Volume{guid}\ opens the root directory, without the backslash the volume
+    size_t length = wcslen(volume);
+    if (length > 0 && volume[length - 1] == L'\\')
+    {
+        volume[length - 1] = L'\0';
+    }
+
+    // no access rights are needed for the queries, so this works without elevation
+    return CreateFileW(volume, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+static void QueryDisk(__in DWORD disk, __out StorageDevice* device)
+{
+    WCHAR path[32];
+    DWORD dwBytesReturned;
+    STORAGE_PROPERTY_QUERY query;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seekPenalty;
+    STORAGE_ADAPTER_DESCRIPTOR adapter;
+
+    device->hasSeekPenalty = FALSE;
+    device->seekPenalty = FALSE;
+    device->busType = BusTypeUnknown;
+
+    StringCchPrintfW(path, _countof(path), L"\\\\.\\PhysicalDrive%lu", disk);
+    HANDLE hDisk = CreateFileW(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (hDisk == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    ZeroMemory(&query, sizeof(query));
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    if (DeviceIoControl(hDisk, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                        &seekPenalty, sizeof(seekPenalty), &dwBytesReturned, NULL)
+        && dwBytesReturned >= sizeof(seekPenalty))
+    {
+        device->hasSeekPenalty = TRUE;
+        device->seekPenalty = seekPenalty.IncursSeekPenalty;
+    }
+
+    query.PropertyId = StorageAdapterProperty;
+    if (DeviceIoControl(hDisk, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+                        &adapter, sizeof(adapter), &dwBytesReturned, NULL)
+        && dwBytesReturned >= FIELD_OFFSET(STORAGE_ADAPTER_DESCRIPTOR, BusType) + sizeof(adapter.BusType))
+    {
+        device->busType = adapter.BusType;
+    }
+
+    CloseHandle(hDisk);
+}
+
+// Resolves the volume of file to the disk it lives on. Striped and spanned
+// volumes count their disks as spindles and are named after the first one.
+// Returns the index in the table, STORAGE_NO_DEVICE if it cannot be resolved.
+static DWORD ResolveVolume(__in LPCWSTR file)
+{
+    BYTE buffer[sizeof(VOLUME_DISK_EXTENTS) + (STORAGE_MAXIMUM_EXTENTS - 1) * sizeof(DISK_EXTENT)];
+    VOLUME_DISK_EXTENTS* extents = (VOLUME_DISK_EXTENTS*)buffer;
+    DWORD dwBytesReturned;
+    StorageDevice device;
+
+    HANDLE hVolume = OpenVolume(file);
+    if (hVolume == INVALID_HANDLE_VALUE)
+    {
+        return STORAGE_NO_DEVICE;
+    }
+
+    BOOL hasExtents = DeviceIoControl(hVolume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, NULL, 0,
+                                      buffer, sizeof(buffer), &dwBytesReturned, NULL);
+    CloseHandle(hVolume);
+    if (!hasExtents || extents->NumberOfDiskExtents == 0)
+    {
+        return STORAGE_NO_DEVICE;
+    }
+
+    ZeroMemory(&device, sizeof(device));
+    device.disk = extents->Extents[0].DiskNumber;
+    for (DWORD i = 0; i < extents->NumberOfDiskExtents; i++)
+    {
+        BOOL seen = FALSE;
+        for (DWORD j = 0; j < i && !seen; j++)
+        {
+            seen = extents->Extents[j].DiskNumber == extents->Extents[i].DiskNumber;
+        }
+        device.spindles += seen ? 0 : 1;
+    }
+
+    for (size_t i = STORAGE_NO_DEVICE + 1; i < storage.deviceCount; i++)
+    {
+        if (storage.devices[i].disk == device.disk)
+        {
+            return (DWORD)i;
+        }
+    }
+
+    if (storage.deviceCount == MAXIMUM_STORAGE_DEVICES)
+    {
+        return STORAGE_NO_DEVICE;
+    }
+
+    QueryDisk(device.disk, &device);
+    storage.devices[storage.deviceCount] = device;
+    return (DWORD)storage.deviceCount++;
+}
+
+// index of the disk the file is on, file is only looked at for a new volume
+DWORD StorageDeviceOf(__in DWORD volumeSerialNumber, __in LPCWSTR file)
+{
+    DWORD device = STORAGE_NO_DEVICE;
+
+    AcquireSRWLockExclusive(&storage.lock);
+    for (size_t i = 0; i < storage.volumeCount; i++)
+    {
+        if (storage.volumeSerials[i] == volumeSerialNumber)
+        {
+            device = storage.volumeDevices[i];
+            goto Cleanup;
+        }
+    }
+
+    device = ResolveVolume(file);
+    if (storage.volumeCount < MAXIMUM_STORAGE_VOLUMES)
+    {
+        storage.volumeSerials[storage.volumeCount] = volumeSerialNumber;
+        storage.volumeDevices[storage.volumeCount++] = device;
+    }
+
+Cleanup:
+    ReleaseSRWLockExclusive(&storage.lock);
+    return device;
+}
+
+// Fills readers for the disks marked in used and returns the number of workers,
+// the decision is kept for --stats. -j keeps its number and no per disk limit.
+// rotational tells whether any of the disks is, or is taken to be.
+DWORD PlanStorageWorkers(__in Args* args, __in_ecount(MAXIMUM_STORAGE_DEVICES) BOOL* used, __out_ecount(MAXIMUM_STORAGE_DEVICES) LONG* readers, __out BOOL* rotational)
+{
+    StorageDevice devices[MAXIMUM_STORAGE_DEVICES];
+    DWORD indexes[MAXIMUM_STORAGE_DEVICES];
+    DWORD count = 0;
+    DWORD kinds[4] = { 0 };
+    SYSTEM_INFO info;
+
+    *rotational = args->storage == STORAGE_ROTATIONAL;
+    if (args->jobs > 0)
+    {
+        for (DWORD i = 0; i < MAXIMUM_STORAGE_DEVICES; i++)
+        {
+            readers[i] = (LONG)args->jobs;
+        }
+        runStats.workers = args->jobs;
+        StringCchCopyW(runStats.workersReason, _countof(runStats.workersReason), L"set by --jobs");
+        return args->jobs;
+    }
+
+    AcquireSRWLockShared(&storage.lock);
+    for (DWORD i = 0; i < storage.deviceCount; i++)
+    {
+        if (used[i])
+        {
+            indexes[count] = i;
+            devices[count++] = storage.devices[i];
+        }
+    }
+    ReleaseSRWLockShared(&storage.lock);
+
+    GetSystemInfo(&info);
+    DWORD workers = PlanStorage(devices, count, args->storage, info.dwNumberOfProcessors);
+
+    for (DWORD i = 0; i < MAXIMUM_STORAGE_DEVICES; i++)
+    {
+        readers[i] = (LONG)workers;
+    }
+    for (DWORD i = 0; i < count; i++)
+    {
+        readers[indexes[i]] = devices[i].readers;
+        ++kinds[devices[i].kind];
+        *rotational |= devices[i].kind == STORAGE_ROTATIONAL;
+    }
+
+    runStats.workers = workers;
+    if (args->storage != STORAGE_AUTO)
+    {
+        StringCchPrintfW(runStats.workersReason, _countof(runStats.workersReason),
+                         L"every disk taken as %ls by --storage", storageNames[args->storage]);
+    }
+    else
+    {
+        StringCchPrintfW(runStats.workersReason, _countof(runStats.workersReason),
+                         L"%lu rotational disks read by one worker per spindle, %lu solid state and %lu unknown by up to %lu",
+                         kinds[STORAGE_ROTATIONAL], kinds[STORAGE_SOLID_STATE], kinds[STORAGE_UNKNOWN],
+                         info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1);
+    }
+    return workers;
+}
@@ -0,0 +1,852 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_READ_SIZE (1024 * 1024)
+#define TAR_MAX_PATH_BYTES 4096
+#define TAR_MAX_EXTENDED_SIZE (1024 * 1024) // of a pax header or GNU long name
+
+// ustar header, every field is ASCII and not necessarily terminated
+typedef struct tar_header_t
+{
+    CHAR name[100];
+    CHAR mode[8];
+    CHAR uid[8];
+    CHAR gid[8];
+    CHAR size[12];
+    CHAR mtime[12];
+    CHAR checksum[8];
+    CHAR typeflag;
+    CHAR linkname[100];
+    CHAR magic[6];
+    CHAR version[2];
+    CHAR uname[32];
+    CHAR gname[32];
+    CHAR devmajor[8];
+    CHAR devminor[8];
+    CHAR prefix[155];
+    CHAR padding[12];
+} TarHeader;
+
+// buffered reader over a file or a pipe, which may return less than asked
+typedef struct tar_reader_t
+{
+    Args* args;
+    HANDLE hInput;
+    BOOL isFile;
+    PBYTE buffer;
+    DWORD start;
+    DWORD end;
+    BOOL eof;
+} TarReader;
+
+// what pax headers and GNU long names say about the next member
+typedef struct tar_next_t
+{
+    CHAR path[TAR_MAX_PATH_BYTES];
+    BOOL hasPath;
+    CHAR linkPath[TAR_MAX_PATH_BYTES];
+    BOOL hasLinkPath;
+    ULONGLONG size;
+    BOOL hasSize;
+} TarNext;
+
+// a member that was hashed, path as in TarExpected
+typedef struct tar_member_t
+{
+    LPSTR path;
+    DWORD pathLength;
+    ULONGLONG size;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+} TarMember;
+
+// a manifest entry for --check, path with / as separator and without ./
+typedef struct tar_expected_t
+{
+    LPSTR path;
+    DWORD pathLength;
+    FileHash fh;
+    BOOL seen;
+} TarExpected;
+
+typedef struct tar_run_t
+{
+    Args* args;
+    TarReader reader;
+    StreamHash* hash;
+    PathFilter* filter;
+    TarExpected* expected; // sorted by path
+    size_t expectedCount;
+    TarMember* members; // for hard links
+    size_t memberCount;
+    size_t memberCapacity;
+    BOOL failed;
+} TarRun;
+
+// makes at least wanted bytes available from reader->start, fewer only at the end
+static ErrorCode Fill(__inout TarReader* reader, __in DWORD wanted)
+{
+    DWORD dwBytesRead;
+
+    if (reader->end - reader->start >= wanted || reader->eof)
+    {
+        return SUCCESS;
+    }
+
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+
+    while (reader->end < wanted && !reader->eof)
+    {
+        DWORD request = TAR_READ_SIZE - reader->end;
+        if (reader->isFile)
+        {
+            ThrottleRead(reader->args, request);
+        }
+
+        if (!ReadFile(reader->hInput, reader->buffer + reader->end, request, &dwBytesRead, NULL))
+        {
+            // the writing end of a pipe was closed, that is the end of the archive
+            if (GetLastError() == ERROR_BROKEN_PIPE)
+            {
+                reader->eof = TRUE;
+                break;
+            }
+            LogError(reader->args, L"failed to read '%ls' with error: %lu\r\n", reader->args->tarFile, GetLastError());
+            return TAR_FAILED_TO_READ;
+        }
+
+        InterlockedAddNoFence64(&runStats.bytesRead, dwBytesRead);
+        reader->end += dwBytesRead;
+        reader->eof = dwBytesRead == 0;
+    }
+
+    return SUCCESS;
+}
+
+// passes size bytes to hash, or drops them without one
+static ErrorCode Consume(__inout TarRun* run, __in ULONGLONG size, __in_opt StreamHash* hash)
+{
+    TarReader* reader = &run->reader;
+
+    while (size > 0)
+    {
+        ErrorCode status = Fill(reader, 1);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+        if (reader->end == reader->start)
+        {
+            LogError(run->args, L"'%ls' ends inside a member\r\n", run->args->tarFile, 0);
+            return TAR_INVALID;
+        }
+
+        DWORD available = reader->end - reader->start;
+        DWORD chunk = size < available ? (DWORD)size : available;
+        if (hash != NULL)
+        {
+            status = StreamHashData(run->args, hash, reader->buffer + reader->start, chunk);
+            if (status != SUCCESS)
+            {
+                return status;
+            }
+        }
+        reader->start += chunk;
+        size -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+static ULONGLONG Padding(__in ULONGLONG size)
+{
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+// octal, or base-256 with the high bit of the first byte set for large values
+static BOOL ParseNumber(__in_ecount(length) const CHAR* field, __in size_t length, __out ULONGLONG* value)
+{
+    size_t i = 0;
+
+    *value = 0;
+    if ((BYTE)field[0] & 0x80)
+    {
+        *value = (BYTE)field[0] & 0x7f;
+        for (i = 1; i < length; i++)
+        {
+            if (*value >> 56)
+            {
+                return FALSE;
+            }
+            *value = (*value << 8) | (BYTE)field[i];
+        }
+        return TRUE;
+    }
+
+    while (i < length && field[i] == ' ')
+    {
+        i++;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+    {
+        *value = (*value << 3) | (ULONGLONG)(field[i] - '0');
+    }
+    return i == length || field[i] == ' ' || field[i] == '\0';
+}
+
+static BOOL ValidChecksum(__in TarHeader* header)
+{
+    const BYTE* bytes = (const BYTE*)header;
+    ULONGLONG expected;
+    ULONGLONG sum = 0;
+
+    if (!ParseNumber(header->checksum, sizeof(header->checksum), &expected))
+    {
+        return FALSE;
+    }
+
+    // the checksum field itself counts as spaces
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        BOOL inField = i >= FIELD_OFFSET(TarHeader, checksum) && i < FIELD_OFFSET(TarHeader, typeflag);
+        sum += inField ? ' ' : bytes[i];
+    }
+    return sum == expected;
+}
+
+static BOOL IsZeroBlock(__in const BYTE* block)
+{
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        if (block[i] != 0)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// reads the data of a pax header or GNU long name into a terminated buffer
+static ErrorCode ReadExtended(__inout TarRun* run, __in ULONGLONG size, __out LPSTR* data)
+{
+    TarReader* reader = &run->reader;
+
+    *data = NULL;
+    if (size > TAR_MAX_EXTENDED_SIZE)
+    {
+        LogError(run->args, L"'%ls' has an extended header of %lu bytes\r\n", run->args->tarFile, (DWORD)size);
+        return TAR_INVALID;
+    }
+
+    *data = malloc((size_t)size + 1);
+    if (*data == NULL)
+    {
+        return TAR_ALLOCATE_ERROR;
+    }
+
+    for (ULONGLONG copied = 0; copied < size;)
+    {
+        ErrorCode status = Fill(reader, 1);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+        if (reader->end == reader->start)
+        {
+            LogError(run->args, L"'%ls' ends inside a member\r\n", run->args->tarFile, 0);
+            return TAR_INVALID;
+        }
+
+        DWORD available = reader->end - reader->start;
+        DWORD chunk = size - copied < available ? (DWORD)(size - copied) : available;
+        memcpy(*data + copied, reader->buffer + reader->start, chunk);
+        reader->start += chunk;
+        copied += chunk;
+    }
+    (*data)[size] = '\0';
+
+    return Consume(run, Padding(size), NULL);
+}
+
+// Takes path, linkpath and size from pax records, "<length> <key>=<value>\n"
+// each. The values of other keys do not change the data of the member.
+static void ParsePax(__in LPSTR data, __in size_t size, __inout TarNext* next)
+{
+    size_t position = 0;
+
+    while (position < size)
+    {
+        size_t length = 0;
+        size_t i = position;
+        for (; i < size && data[i] >= '0' && data[i] <= '9'; i++)
+        {
+            length = length * 10 + (size_t)(data[i] - '0');
+        }
+        if (i >= size || data[i] != ' ' || length == 0 || length > size - position || data[position + length - 1] != '\n')
+        {
+            return;
+        }
+
+        LPSTR key = data + i + 1;
+        LPSTR recordEnd = data + position + length - 1;
+        LPSTR equals = memchr(key, '=', (size_t)(recordEnd - key));
+        if (equals != NULL)
+        {
+            LPSTR value = equals + 1;
+            size_t keyLength = (size_t)(equals - key);
+            size_t valueLength = (size_t)(recordEnd - value);
+            if (keyLength == 4 && memcmp(key, "path", 4) == 0 && valueLength < TAR_MAX_PATH_BYTES)
+            {
+                memcpy(next->path, value, valueLength);
+                next->path[valueLength] = '\0';
+                next->hasPath = TRUE;
+            }
+            else if (keyLength == 8 && memcmp(key, "linkpath", 8) == 0 && valueLength < TAR_MAX_PATH_BYTES)
+            {
+                memcpy(next->linkPath, value, valueLength);
+                next->linkPath[valueLength] = '\0';
+                next->hasLinkPath = TRUE;
+            }
+            else if (keyLength == 4 && memcmp(key, "size", 4) == 0)
+            {
+                ULONGLONG parsed = 0;
+                for (size_t k = 0; k < valueLength && value[k] >= '0' && value[k] <= '9'; k++)
+                {
+                    parsed = parsed * 10 + (ULONGLONG)(value[k] - '0');
+                }
+                next->size = parsed;
+                next->hasSize = TRUE;
+            }
+        }
+        position += length;
+    }
+}
+
+// manifests written on Windows use \, archives use /, and ./ means nothing
+static DWORD NormalizePath(__inout_ecount(length) LPSTR path, __in DWORD length)
+{
+    DWORD skip = 0;
+    while (length - skip >= 2 && path[skip] == '.' && (path[skip + 1] == '/' || path[skip + 1] == '\\'))
+    {
+        skip += 2;
+    }
+
+    memmove(path, path + skip, length - skip);
+    length -= skip;
+    for (DWORD i = 0; i < length; i++)
+    {
+        path[i] = path[i] == '\\' ? '/' : path[i];
+    }
+    return length;
+}
+
+static int CompareExpected(const void* a, const void* b)
+{
+    const TarExpected* left = (const TarExpected*)a;
+    const TarExpected* right = (const TarExpected*)b;
+
+    int result = memcmp(left->path, right->path, left->pathLength < right->pathLength ? left->pathLength : right->pathLength);
+    if (result != 0)
+    {
+        return result;
+    }
+    return left->pathLength < right->pathLength ? -1 : (left->pathLength > right->pathLength ? 1 : 0);
+}
+
+// reads the whole manifest of -c, the archive may list its members in any order
+static ErrorCode LoadExpected(__inout TarRun* run)
+{
+    ManifestReader* reader = NULL;
+    size_t capacity = 0;
+    BOOL found = TRUE;
+
+    ErrorCode status = OpenManifest(run->args, run->args->sumFile, &reader);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    while (status == SUCCESS)
+    {
+        FileHash fh;
+        status = NextManifestEntry(reader, &fh, &found);
+        if (status != SUCCESS || !found)
+        {
+            break;
+        }
+
+        if (run->expectedCount == capacity)
+        {
+            size_t newCapacity = capacity == 0 ? 1024 : capacity * 2;
+            TarExpected* grown = realloc(run->expected, newCapacity * sizeof(TarExpected));
+            if (grown == NULL)
+            {
+                free(fh.line);
+                status = TAR_ALLOCATE_ERROR;
+                break;
+            }
+            run->expected = grown;
+            capacity = newCapacity;
+        }
+
+        TarExpected* expected = &run->expected[run->expectedCount];
+        expected->path = malloc(fh.pathLength + 1);
+        if (expected->path == NULL)
+        {
+            free(fh.line);
+            status = TAR_ALLOCATE_ERROR;
+            break;
+        }
+        memcpy(expected->path, fh.path, fh.pathLength);
+        expected->pathLength = NormalizePath(expected->path, fh.pathLength);
+        expected->fh = fh;
+        expected->seen = FALSE;
+        ++run->expectedCount;
+    }
+
+    CloseManifest(reader);
+    if (status == SUCCESS && run->expectedCount > 0)
+    {
+        qsort(run->expected, run->expectedCount, sizeof(TarExpected), CompareExpected);
+    }
+    return status;
+}
+
+static TarExpected* FindExpected(__in TarRun* run, __in LPSTR path, __in DWORD length)
+{
+    TarExpected key;
+
+    if (run->expectedCount == 0)
+    {
+        return NULL;
+    }
+
+    key.path = path;
+    key.pathLength = length;
+    return bsearch(&key, run->expected, run->expectedCount, sizeof(TarExpected), CompareExpected);
+}
+
+static void WriteMemberResult(__in LPCSTR path, __in DWORD length, __in LPCSTR result)
+{
+    WriteStdoutUTF8(path, length);
+    WriteStdoutUTF8(result, strlen(result));
+}
+
+// a hard link has no data, it gets the digest of the member it links to
+static TarMember* FindMember(__in TarRun* run, __in LPCSTR path, __in DWORD length)
+{
+    for (size_t i = run->memberCount; i > 0; i--)
+    {
+        TarMember* member = &run->members[i - 1];
+        if (member->pathLength == length && memcmp(member->path, path, length) == 0)
+        {
+            return member;
+        }
+    }
+    return NULL;
+}
+
+static ErrorCode AddMember(__inout TarRun* run, __in LPCSTR path, __in DWORD length, __in ULONGLONG size, __in PBYTE digest)
+{
+    if (run->memberCount == run->memberCapacity)
+    {
+        size_t newCapacity = run->memberCapacity == 0 ? 1024 : run->memberCapacity * 2;
+        TarMember* grown = realloc(run->members, newCapacity * sizeof(TarMember));
+        if (grown == NULL)
+        {
+            return TAR_ALLOCATE_ERROR;
+        }
+        run->members = grown;
+        run->memberCapacity = newCapacity;
+    }
+
+    TarMember* member = &run->members[run->memberCount];
+    member->path = malloc(length + 1);
+    if (member->path == NULL)
+    {
+        return TAR_ALLOCATE_ERROR;
+    }
+    memcpy(member->path, path, length);
+    member->path[length] = '\0';
+    member->pathLength = length;
+    member->size = size;
+    memcpy(member->digest, digest, SHA256_DIGEST_LENGTH);
+    ++run->memberCount;
+    return SUCCESS;
+}
+
+// prints the digest of a member, or with -c whether it matches the manifest
+static void ReportMember(__inout TarRun* run, __in LPSTR path, __in LPSTR normalized, __in DWORD normalizedLength, __in ULONGLONG size, __in PBYTE digest)
+{
+    Args* args = run->args;
+    DWORD length = (DWORD)strlen(path);
+
+    InterlockedIncrementNoFence64(&runStats.filesHashed);
+    if (args->sumFile != NULL)
+    {
+        TarExpected* expected = FindExpected(run, normalized, normalizedLength);
+        if (expected == NULL)
+        {
+            return;
+        }
+        expected->seen = TRUE;
+
+        BOOL matched = (!expected->fh.hasSize || expected->fh.size == size)
+            && memcmp(digest, expected->fh.digest, SHA256_DIGEST_LENGTH) == 0;
+        if (matched)
+        {
+            if (!args->status && !args->quiet)
+            {
+                WriteMemberResult(path, length, ": OK\r\n");
+            }
+        }
+        else
+        {
+            if (!args->status)
+            {
+                WriteMemberResult(path, length, ": FAILED\r\n");
+            }
+            run->failed = TRUE;
+        }
+        return;
+    }
+
+    // the line of FILE arguments, with the member path as written in the archive
+    CHAR line[SHA256_DIGEST_LENGTH * 2 + 32];
+    FormatDigestUTF8(line, digest);
+    StringCchCatA(line, _countof(line), " ");
+    if (args->withSize)
+    {
+        CHAR sizeField[24];
+        StringCchPrintfA(sizeField, _countof(sizeField), "%llu ", size);
+        StringCchCatA(line, _countof(line), sizeField);
+    }
+    StringCchCatA(line, _countof(line), "*");
+    WriteStdoutUTF8(line, strlen(line));
+    WriteStdoutUTF8(path, length);
+    WriteStdoutUTF8("\r\n", 2);
+}
+
+// Hashes one regular member, the reader is at its data, or looks up the target
+// of a hard link. Every member is hashed, even one that -c does not list, a
+// later hard link may point to it.
+static ErrorCode HashMember(__inout TarRun* run, __in LPSTR path, __in ULONGLONG size, __in_opt LPSTR linkPath)
+{
+    Args* args = run->args;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    CHAR normalized[TAR_MAX_PATH_BYTES];
+    ErrorCode status;
+
+    DWORD length = (DWORD)strlen(path);
+    memcpy(normalized, path, length);
+    DWORD normalizedLength = NormalizePath(normalized, length);
+
+    if (run->filter != NULL)
+    {
+        WCHAR widePath[TAR_MAX_PATH_BYTES];
+        int wideLength = MultiByteToWideChar(CP_UTF8, 0, path, (int)length, widePath, _countof(widePath) - 1);
+        widePath[wideLength > 0 ? wideLength : 0] = L'\0';
+        if (!PathFilterMatches(run->filter, widePath))
+        {
+            return Consume(run, size + Padding(size), NULL);
+        }
+    }
+
+    if (linkPath != NULL)
+    {
+        CHAR target[TAR_MAX_PATH_BYTES];
+        DWORD targetLength = (DWORD)strlen(linkPath);
+        memcpy(target, linkPath, targetLength);
+        targetLength = NormalizePath(target, targetLength);
+
+        TarMember* member = FindMember(run, target, targetLength);
+        if (member == NULL)
+        {
+            WCHAR wideLink[MAX_PATH];
+            int wideLength = MultiByteToWideChar(CP_UTF8, 0, path, (int)length, wideLink, _countof(wideLink) - 1);
+            wideLink[wideLength > 0 ? wideLength : 0] = L'\0';
+            LogError(args, L"skipping hard link '%ls' to a member that was not hashed\r\n", wideLink, 0);
+            return SUCCESS;
+        }
+
+        size = member->size;
+        memcpy(digest, member->digest, SHA256_DIGEST_LENGTH);
+    }
+    else
+    {
+        status = Consume(run, size, run->hash);
+        if (status == SUCCESS)
+        {
+            status = FinishStreamHash(args, run->hash, digest);
+        }
+        if (status == SUCCESS)
+        {
+            status = Consume(run, Padding(size), NULL);
+        }
+        if (status == SUCCESS)
+        {
+            status = AddMember(run, normalized, normalizedLength, size, digest);
+        }
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    ReportMember(run, path, normalized, normalizedLength, size, digest);
+    return SUCCESS;
+}
+
+// the path of the header, unless a pax record or GNU long name replaced it
+static void HeaderPath(__in TarHeader* header, __out_ecount(TAR_MAX_PATH_BYTES) LPSTR path)
+{
+    // only POSIX ustar has a prefix, GNU keeps other fields there
+    size_t nameLength = strnlen(header->name, sizeof(header->name));
+    size_t prefixLength = memcmp(header->magic, "ustar\0", 6) == 0 ? strnlen(header->prefix, sizeof(header->prefix)) : 0;
+    size_t used = 0;
+
+    if (prefixLength > 0)
+    {
+        memcpy(path, header->prefix, prefixLength);
+        path[prefixLength] = '/';
+        used = prefixLength + 1;
+    }
+    memcpy(path + used, header->name, nameLength);
+    path[used + nameLength] = '\0';
+}
+
+// walks the members in one pass, pax headers and GNU long names apply to the next header
+static ErrorCode WalkArchive(__inout TarRun* run)
+{
+    TarReader* reader = &run->reader;
+    TarNext next;
+
+    ZeroMemory(&next, sizeof(next));
+    while (TRUE)
+    {
+        TarHeader header;
+        ULONGLONG size;
+        CHAR path[TAR_MAX_PATH_BYTES];
+
+        ErrorCode status = Fill(reader, TAR_BLOCK_SIZE);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+
+        // the end marker is two zero blocks, a missing one is tolerated like tar does
+        DWORD available = reader->end - reader->start;
+        if (available == 0 || (available >= TAR_BLOCK_SIZE && IsZeroBlock(reader->buffer + reader->start)))
+        {
+            return SUCCESS;
+        }
+        if (available < TAR_BLOCK_SIZE)
+        {
+            LogError(run->args, L"'%ls' ends inside a header\r\n", run->args->tarFile, 0);
+            return TAR_INVALID;
+        }
+
+        memcpy(&header, reader->buffer + reader->start, TAR_BLOCK_SIZE);
+        reader->start += TAR_BLOCK_SIZE;
+
+        if (!ValidChecksum(&header) || !ParseNumber(header.size, sizeof(header.size), &size))
+        {
+            LogError(run->args, L"'%ls' has an invalid header\r\n", run->args->tarFile, 0);
+            return TAR_INVALID;
+        }
+
+        if (header.typeflag == 'x' || header.typeflag == 'L' || header.typeflag == 'K')
+        {
+            LPSTR data = NULL;
+            status = ReadExtended(run, size, &data);
+            if (status == SUCCESS && header.typeflag == 'x')
+            {
+                ParsePax(data, (size_t)size, &next);
+            }
+            else if (status == SUCCESS && strlen(data) < TAR_MAX_PATH_BYTES)
+            {
+                StringCchCopyA(header.typeflag == 'L' ? next.path : next.linkPath, TAR_MAX_PATH_BYTES, data);
+                *(header.typeflag == 'L' ? &next.hasPath : &next.hasLinkPath) = TRUE;
+            }
+            free(data);
+            if (status != SUCCESS)
+            {
+                return status;
+            }
+            continue;
+        }
+
+        if (next.hasPath)
+        {
+            StringCchCopyA(path, _countof(path), next.path);
+        }
+        else
+        {
+            HeaderPath(&header, path);
+        }
+        if (next.hasSize)
+        {
+            size = next.size;
+        }
+
+        switch (header.typeflag)
+        {
+        case '0':
+        case '\0':
+        case '7':
+            status = HashMember(run, path, size, NULL);
+            break;
+
+        case '1':
+            if (!next.hasLinkPath)
+            {
+                size_t linkLength = strnlen(header.linkname, sizeof(header.linkname));
+                memcpy(next.linkPath, header.linkname, linkLength);
+                next.linkPath[linkLength] = '\0';
+            }
+            status = HashMember(run, path, 0, next.linkPath);
+            break;
+
+        default:
+            // directories, symbolic links and devices have no data, GNU sparse members are not expanded
+            if (header.typeflag == 'S')
+            {
+                LogError(run->args, L"skipping a sparse member of '%ls'\r\n", run->args->tarFile, 0);
+            }
+            status = header.typeflag == '2' || header.typeflag == '5'
+                ? SUCCESS
+                : Consume(run, size + Padding(size), NULL);
+            break;
+        }
+
+        ZeroMemory(&next, sizeof(next));
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+        if (run->failed && run->args->failFast)
+        {
+            return SUCCESS;
+        }
+    }
+}
+
+// Hashes every regular member of the tar archive args->tarFile, - for stdin, in
+// a single pass over the stream, and prints them like FILE arguments. With -c
+// the members are checked against the manifest instead, entries of the
+// manifest that are not in the archive fail.
+ErrorCode HashTar(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    TarRun run;
+    BOOL isStdin = wcscmp(args->tarFile, L"-") == 0;
+
+    ZeroMemory(&run, sizeof(run));
+    run.args = args;
+    run.reader.args = args;
+    run.reader.hInput = INVALID_HANDLE_VALUE;
+
+    run.reader.buffer = malloc(TAR_READ_SIZE);
+    if (run.reader.buffer == NULL)
+    {
+        status = TAR_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    if (args->sumFile != NULL)
+    {
+        status = LoadExpected(&run);
+    }
+    else
+    {
+        status = CreatePathFilter(args, &run.filter);
+    }
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    status = CreateStreamHash(args, &run.hash);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    if (isStdin)
+    {
+        run.reader.hInput = GetStdHandle(STD_INPUT_HANDLE);
+    }
+    else
+    {
+        run.reader.hInput = CreateFileW(args->tarFile,
+                                        GENERIC_READ,
+                                        FILE_SHARE_READ,
+                                        NULL,
+                                        OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                        NULL);
+        run.reader.isFile = TRUE;
+    }
+    if (run.reader.hInput == INVALID_HANDLE_VALUE || run.reader.hInput == NULL)
+    {
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", args->tarFile, GetLastError());
+        status = TAR_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    ProgressStartFile(args->tarFile);
+    status = WalkArchive(&run);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // listed but not in the archive
+    for (size_t i = 0; i < run.expectedCount && !(run.failed && args->failFast); i++)
+    {
+        if (!run.expected[i].seen)
+        {
+            if (!args->status)
+            {
+                WriteMemberResult(run.expected[i].fh.path, run.expected[i].fh.pathLength, ": FAILED\r\n");
+            }
+            run.failed = TRUE;
+        }
+    }
+
+    if (run.failed)
+    {
+        status = CHECK_SUM_CHECKSUM_FAILED;
+        if (!args->status)
+        {
+            WCHAR message[] = L"checksum failed\r\n";
+            WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), message, lstrlenW(message), NULL, NULL);
+        }
+    }
+
+Cleanup:
+    if (!isStdin && run.reader.hInput != INVALID_HANDLE_VALUE && run.reader.hInput != NULL)
+    {
+        CloseHandle(run.reader.hInput);
+    }
+
+    for (size_t i = 0; i < run.expectedCount; i++)
+    {
+        free(run.expected[i].path);
+        free(run.expected[i].fh.line);
+    }
+    free(run.expected);
+    for (size_t i = 0; i < run.memberCount; i++)
+    {
+        free(run.members[i].path);
+    }
+    free(run.members);
+    FreeStreamHash(run.hash);
+    FreePathFilter(run.filter);
+    free(run.reader.buffer);
+
+    return status;
+}
@@ -0,0 +1,173 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace append {
+static void Grow(const char* file, size_t size, char seed)
+{
+    std::ofstream out(file, std::ios::binary | std::ios::app);
+    for (size_t i = 0; i < size; i++)
+    {
+        out.put((char)(i * 31 + seed));
+    }
+}
+
+// hashes the file once with the state, the way a run of the program does
+static std::wstring StateDigest(Args* args, LPCWSTR file)
+{
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+
+    Assert::AreEqual((int)SUCCESS, (int)LoadAppendState(args));
+    Assert::AreEqual((int)SUCCESS, (int)CalcDigest(args, digest, (LPWSTR)file));
+    Assert::AreEqual((int)SUCCESS, (int)SaveAppendState(args));
+    FormatDigest(hash, digest);
+    return hash;
+}
+
+static std::wstring FullDigest(LPCWSTR file)
+{
+    Args args = { 0 };
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+
+    Assert::AreEqual((int)SUCCESS, (int)CalcDigest(&args, digest, (LPWSTR)file));
+    FormatDigest(hash, digest);
+    return hash;
+}
+
+static BY_HANDLE_FILE_INFORMATION FileInformation(LPCWSTR file)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE hFile = CreateFileW(file, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    Assert::IsTrue(GetFileInformationByHandle(hFile, &info));
+    CloseHandle(hFile);
+    return info;
+}
+
+// a second past the given time, so the write is seen even within the timestamp resolution
+static void TouchLater(LPCWSTR file, FILETIME time)
+{
+    ULARGE_INTEGER later;
+    later.LowPart = time.dwLowDateTime;
+    later.HighPart = time.dwHighDateTime;
+    later.QuadPart += 10000000;
+    time.dwLowDateTime = later.LowPart;
+    time.dwHighDateTime = later.HighPart;
+
+    HANDLE hFile = CreateFileW(file, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    Assert::IsTrue(SetFileTime(hFile, NULL, NULL, &time));
+    CloseHandle(hFile);
+}
+
+TEST_CLASS(fAppendState)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(RemoveState)
+    {
+        DeleteFileW(L"AppendState.bin");
+        DeleteFileW(L"AppendGrowing.log");
+    }
+
+    TEST_METHOD(TestKnownDigest)
+    {
+        std::ofstream file("AppendGrowing.log", std::ios::binary);
+        file << "abc";
+        file.close();
+
+        Args args = { 0 };
+        args.appendState = (LPWSTR)L"AppendState.bin";
+        Assert::AreEqual(std::wstring(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"),
+                         StateDigest(&args, L"AppendGrowing.log"));
+    }
+
+    TEST_METHOD(TestMatchesFullRehash)
+    {
+        Args args = { 0 };
+        args.appendState = (LPWSTR)L"AppendState.bin";
+
+        // across block and midstate boundaries and the size of one read
+        const size_t steps[] = { 0, 1, 55, 9, 63, 4096, 1, 4095, 100000, 1048576, 3 };
+        for (size_t i = 0; i < _countof(steps); i++)
+        {
+            Grow("AppendGrowing.log", steps[i], (char)i);
+            Assert::AreEqual(FullDigest(L"AppendGrowing.log"), StateDigest(&args, L"AppendGrowing.log"));
+        }
+    }
+
+    TEST_METHOD(TestReadsOnlyAppended)
+    {
+        Args args = { 0 };
+        args.appendState = (LPWSTR)L"AppendState.bin";
+
+        Grow("AppendGrowing.log", 1000000, 1);
+        StateDigest(&args, L"AppendGrowing.log");
+
+        Grow("AppendGrowing.log", 1000, 2);
+        LONG64 before = runStats.bytesRead;
+        std::wstring act = StateDigest(&args, L"AppendGrowing.log");
+        LONG64 read = runStats.bytesRead - before;
+
+        // the sample block before the midstate, then from the midstate on
+        Assert::AreEqual(FullDigest(L"AppendGrowing.log"), act);
+        Assert::IsTrue(read <= 4096 + 4096 + 1000);
+    }
+
+    TEST_METHOD(TestRewrittenFileIsReadAgain)
+    {
+        Args args = { 0 };
+        args.appendState = (LPWSTR)L"AppendState.bin";
+
+        Grow("AppendGrowing.log", 10000, 1);
+        StateDigest(&args, L"AppendGrowing.log");
+        BY_HANDLE_FILE_INFORMATION before = FileInformation(L"AppendGrowing.log");
+
+        // rewritten in place, same file and size, other content right before the midstate at 8192
+        std::fstream file("AppendGrowing.log", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(8100);
+        file << std::string(92, 'x');
+        file.close();
+        TouchLater(L"AppendGrowing.log", before.ftLastWriteTime);
+
+        BY_HANDLE_FILE_INFORMATION after = FileInformation(L"AppendGrowing.log");
+        Assert::AreEqual(before.nFileIndexLow, after.nFileIndexLow);
+        Assert::AreEqual(before.nFileIndexHigh, after.nFileIndexHigh);
+        Assert::AreEqual(before.nFileSizeLow, after.nFileSizeLow);
+        Assert::AreEqual(FullDigest(L"AppendGrowing.log"), StateDigest(&args, L"AppendGrowing.log"));
+    }
+
+    TEST_METHOD(TestMaxRateChargesWhatIsRead)
+    {
+        std::ofstream file("AppendGrowing.log", std::ios::binary);
+        file << "abc";
+        file.close();
+
+        Args args = { 0 };
+        args.appendState = (LPWSTR)L"AppendState.bin";
+        args.maxRate.limit = 1 << 20;
+
+        // one boundary is charged, not the whole 1 MiB buffer, which would take most of a second
+        ULONGLONG started = GetTickCount64();
+        StateDigest(&args, L"AppendGrowing.log");
+        Assert::IsTrue(GetTickCount64() - started < 500);
+    }
+
+    TEST_METHOD(TestInvalidState)
+    {
+        std::ofstream state("AppendState.bin", std::ios::binary);
+        state << "not a state file";
+        state.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.appendState = (LPWSTR)L"AppendState.bin";
+        Assert::AreEqual((int)APPEND_STATE_INVALID, (int)LoadAppendState(&args));
+    }
+};
+}
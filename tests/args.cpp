@@ -110,5 +110,293 @@ public:
         Assert::AreEqual((int)act, (int)exp);
         Assert::AreEqual(args.warn, TRUE);
     }
+
+    TEST_METHOD(TestDaemon)
+    {
+        LPWSTR argv[] = { L"prog", L"--daemon", L"--pipe", L"\\\\.\\pipe\\test", L"file1" };
+        int argc = 5;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)act, (int)exp);
+        Assert::AreEqual(args.daemon, TRUE);
+        Assert::AreEqual(args.pipeName, L"\\\\.\\pipe\\test");
+        Assert::AreEqual(args.files->file, L"file1");
+    }
+
+    TEST_METHOD(TestPipeWithoutName)
+    {
+        LPWSTR argv[] = { L"prog", L"--serve", L"--pipe" };
+        int argc = 3;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = PARSE_ARGS_MISSING_PIPE_NAME;
+
+        Assert::AreEqual((int)act, (int)exp);
+    }
+
+    TEST_METHOD(TestFilesFrom)
+    {
+        LPWSTR argv[] = { L"prog", L"--files-from", L"-", L"-0" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)act, (int)exp);
+        Assert::AreEqual(args.filesFrom, L"-");
+        Assert::AreEqual(args.nullDelimited, TRUE);
+        Assert::IsNull(args.files);
+    }
+
+    TEST_METHOD(TestFilesFromWithoutFile)
+    {
+        LPWSTR argv[] = { L"prog", L"--files-from" };
+        int argc = 2;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = PARSE_ARGS_MISSING_FILES_FROM_FILE;
+
+        Assert::AreEqual((int)act, (int)exp);
+    }
+
+    TEST_METHOD(TestJobsAndOrder)
+    {
+        LPWSTR argv[] = { L"prog", L"-j", L"4", L"--order", L"input", L"file1" };
+        int argc = 6;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)act, (int)exp);
+        Assert::AreEqual((int)args.jobs, 4);
+        Assert::AreEqual((int)args.order, (int)ORDER_INPUT);
+        Assert::AreEqual(args.files->file, L"file1");
+    }
+
+    TEST_METHOD(TestInvalidJobs)
+    {
+        LPWSTR argv[] = { L"prog", L"--jobs", L"many" };
+        int argc = 3;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = PARSE_ARGS_INVALID_JOBS;
+
+        Assert::AreEqual((int)act, (int)exp);
+    }
+
+    TEST_METHOD(TestInvalidOrder)
+    {
+        LPWSTR argv[] = { L"prog", L"--order", L"random" };
+        int argc = 3;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = PARSE_ARGS_INVALID_ORDER;
+
+        Assert::AreEqual((int)act, (int)exp);
+    }
+
+    TEST_METHOD(TestPhysicalOrder)
+    {
+        LPWSTR argv[] = { L"prog", L"--order", L"physical", L"file1" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((int)ORDER_PHYSICAL, (int)args.order);
+    }
+
+    TEST_METHOD(TestPrefetch)
+    {
+        LPWSTR argv[] = { L"prog", L"file1" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 2, argv));
+        Assert::AreEqual((int)DEFAULT_PREFETCH, (int)args.prefetch);
+
+        LPWSTR off[] = { L"prog", L"--prefetch", L"0", L"file1" };
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 4, off));
+        Assert::AreEqual(0, (int)args.prefetch);
+
+        LPWSTR invalid[] = { L"prog", L"--prefetch", L"-1", L"file1" };
+        Assert::AreEqual((int)PARSE_ARGS_INVALID_PREFETCH, (int)ParseArgs(&args, 4, invalid));
+    }
+
+    TEST_METHOD(TestTreeDigest)
+    {
+        LPWSTR argv[] = { L"prog", L"--tree-digest", L"dir", L"--tree-cache", L"dir.cache" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 5, argv));
+        Assert::AreEqual(L"dir", args.treeDirectory);
+        Assert::AreEqual(L"dir.cache", args.treeCache);
+
+        LPWSTR missing[] = { L"prog", L"--tree-digest" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_TREE_DIRECTORY, (int)ParseArgs(&args, 2, missing));
+
+        LPWSTR noCache[] = { L"prog", L"--tree-digest", L"dir", L"--tree-cache" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_TREE_CACHE, (int)ParseArgs(&args, 4, noCache));
+    }
+
+    TEST_METHOD(TestWatch)
+    {
+        LPWSTR argv[] = { L"prog", L"--watch", L"dir", L"--output", L"dir.sums" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 5, argv));
+        Assert::AreEqual(L"dir", args.watchDirectory);
+        Assert::AreEqual(L"dir.sums", args.watchOutput);
+
+        LPWSTR missing[] = { L"prog", L"--watch" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_WATCH_DIRECTORY, (int)ParseArgs(&args, 2, missing));
+
+        Args noOutputArgs = { 0 };
+        LPWSTR noOutput[] = { L"prog", L"--watch", L"dir" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_OUTPUT, (int)ParseArgs(&noOutputArgs, 3, noOutput));
+    }
+
+    TEST_METHOD(TestJournal)
+    {
+        LPWSTR argv[] = { L"prog", L"-c", L"SHA256SUMS", L"--journal", L"check.journal" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 5, argv));
+        Assert::AreEqual(L"check.journal", args.journal);
+
+        LPWSTR missing[] = { L"prog", L"-c", L"SHA256SUMS", L"--journal" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_JOURNAL, (int)ParseArgs(&args, 4, missing));
+    }
+
+    TEST_METHOD(TestAppendState)
+    {
+        LPWSTR argv[] = { L"prog", L"--append-state", L"logs.state", L"app.log" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 4, argv));
+        Assert::AreEqual(L"logs.state", args.appendState);
+
+        LPWSTR missing[] = { L"prog", L"--append-state" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_APPEND_STATE, (int)ParseArgs(&args, 2, missing));
+    }
+
+    TEST_METHOD(TestTar)
+    {
+        LPWSTR argv[] = { L"prog", L"--tar", L"-", L"-c", L"release.sums" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 5, argv));
+        Assert::AreEqual(L"-", args.tarFile);
+        Assert::AreEqual(L"release.sums", args.sumFile);
+
+        LPWSTR missing[] = { L"prog", L"--tar" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_TAR, (int)ParseArgs(&args, 2, missing));
+    }
+
+    TEST_METHOD(TestCopyToAndTee)
+    {
+        LPWSTR argv[] = { L"prog", L"--copy-to", L"D:\\release", L"app.exe" };
+        Args args = { 0 };
+
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 4, argv));
+        Assert::AreEqual(L"D:\\release", args.copyTo);
+
+        LPWSTR tee[] = { L"prog", L"--tee", L"--expect", L"BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD" };
+        Assert::AreEqual((int)SUCCESS, (int)ParseArgs(&args, 4, tee));
+        Assert::IsTrue(args.tee);
+
+        LPWSTR shortDigest[] = { L"prog", L"--tee", L"--expect", L"ba7816bf" };
+        Assert::AreEqual((int)PARSE_ARGS_INVALID_EXPECT, (int)ParseArgs(&args, 4, shortDigest));
+
+        LPWSTR withoutTee[] = { L"prog", L"--expect", L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" };
+        Assert::AreEqual((int)PARSE_ARGS_INVALID_EXPECT, (int)ParseArgs(&args, 3, withoutTee));
+
+        LPWSTR missing[] = { L"prog", L"--copy-to" };
+        Assert::AreEqual((int)PARSE_ARGS_MISSING_COPY_TO, (int)ParseArgs(&args, 2, missing));
+    }
+
+    TEST_METHOD(TestDirectAndDropCache)
+    {
+        LPWSTR argv[] = { L"prog", L"--direct", L"--drop-cache", L"--stats", L"file1" };
+        int argc = 5;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)act, (int)exp);
+        Assert::IsTrue(args.direct);
+        Assert::IsTrue(args.dropCache);
+        Assert::IsTrue(args.showStats);
+        Assert::AreEqual(args.files->file, L"file1");
+    }
+
+    TEST_METHOD(TestProgress)
+    {
+        LPWSTR argv[] = { L"prog", L"-c", L"SHA256SUMS", L"--progress" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::IsTrue(args.progress);
+    }
+
+    TEST_METHOD(TestMaxRateAndIops)
+    {
+        LPWSTR argv[] = { L"prog", L"--max-rate", L"50M", L"--max-iops", L"200", L"file1" };
+        int argc = 6;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::IsTrue(args.maxRate.limit == 50ULL << 20);
+        Assert::IsTrue(args.maxIops.limit == 200);
+    }
+
+    TEST_METHOD(TestInvalidMaxRate)
+    {
+        LPWSTR argv[] = { L"prog", L"--max-rate", L"10T", L"file1" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)PARSE_ARGS_INVALID_LIMIT, (int)act);
+    }
+
+    TEST_METHOD(TestStorage)
+    {
+        LPWSTR argv[] = { L"prog", L"--storage", L"hdd", L"file1" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((int)STORAGE_ROTATIONAL, (int)args.storage);
+    }
+
+    TEST_METHOD(TestInvalidStorage)
+    {
+        LPWSTR argv[] = { L"prog", L"--storage", L"tape", L"file1" };
+        int argc = 4;
+        Args args = { 0 };
+
+        ErrorCode act = ParseArgs(&args, argc, argv);
+
+        Assert::AreEqual((int)PARSE_ARGS_INVALID_STORAGE, (int)act);
+    }
 };
 }
@@ -0,0 +1,94 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace batch {
+TEST_CLASS(fHashFilesFrom)
+{
+public:
+
+    TEST_METHOD(TestNewlineDelimited)
+    {
+        std::ofstream list("FilesFromNewline.txt", std::ios::binary);
+        list << "CalcHashTestFile.txt\r\n\r\n.\\CalcHashTestFile.txt\n./CalcHashTestFile.txt";
+        list.close();
+
+        Args args = { 0 };
+        args.filesFrom = L"FilesFromNewline.txt";
+
+        ErrorCode act = HashFilesFrom(&args);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestNullDelimited)
+    {
+        std::string paths("CalcHashTestFile.txt\0.\\CalcHashTestFile.txt\0", 44);
+        std::ofstream list("FilesFromNull.txt", std::ios::binary);
+        list << paths;
+        list.close();
+
+        Args args = { 0 };
+        args.filesFrom = L"FilesFromNull.txt";
+        args.nullDelimited = TRUE;
+
+        ErrorCode act = HashFilesFrom(&args);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestPathTooLong)
+    {
+        std::ofstream list("FilesFromTooLong.txt", std::ios::binary);
+        list << std::string(MAX_PATH * 3 + 1, 'a') << "\n";
+        list.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.filesFrom = L"FilesFromTooLong.txt";
+
+        ErrorCode act = HashFilesFrom(&args);
+        ErrorCode exp = FILES_FROM_PATH_TOO_LONG;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestMoreThanWindow)
+    {
+        // more paths than are in flight at once, with a missing file in between
+        std::ofstream list("FilesFromMany.txt", std::ios::binary);
+        for (int i = 0; i < 3000; i++)
+        {
+            list << (i == 1500 ? "Missing.txt" : "CalcHashTestFile.txt") << "\n";
+        }
+        list.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.jobs = 4;
+        args.filesFrom = L"FilesFromMany.txt";
+
+        ErrorCode act = HashFilesFrom(&args);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestMissingList)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.filesFrom = L"Missing.txt";
+
+        ErrorCode act = HashFilesFrom(&args);
+        ErrorCode exp = FILES_FROM_FAILED_TO_OPEN;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+};
+}
@@ -0,0 +1,135 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace copy {
+static std::string ReadAll(const char* file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+TEST_CLASS(fCopyFiles)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateSource)
+    {
+        // larger than one buffer, so both buffers are written
+        std::ofstream file("CopySource.bin", std::ios::binary);
+        for (size_t i = 0; i < 9 * 1024 * 1024 + 7; i++)
+        {
+            file.put((char)(i * 7 + i / 4096));
+        }
+        file.close();
+
+        CreateDirectoryW(L"CopyTarget", NULL);
+        DeleteFileW(L"CopyTarget\\CopySource.bin");
+        DeleteFileW(L"CopyTarget.bin");
+    }
+
+    TEST_METHOD(TestCopyToDirectory)
+    {
+        FileList file = { (LPWSTR)L"CopySource.bin", NULL };
+        Args args = { 0 };
+        args.status = TRUE;
+        args.files = &file;
+        args.copyTo = (LPWSTR)L"CopyTarget";
+
+        Assert::AreEqual((int)SUCCESS, (int)CopyFiles(&args));
+        Assert::IsTrue(ReadAll("CopySource.bin") == ReadAll("CopyTarget\\CopySource.bin"));
+        Assert::AreEqual(INVALID_FILE_ATTRIBUTES, GetFileAttributesW(L"CopyTarget\\CopySource.bin.tmp"));
+    }
+
+    TEST_METHOD(TestCopyToFile)
+    {
+        FileList file = { (LPWSTR)L"CopySource.bin", NULL };
+        Args args = { 0 };
+        args.status = TRUE;
+        args.files = &file;
+        args.copyTo = (LPWSTR)L"CopyTarget.bin";
+
+        Assert::AreEqual((int)SUCCESS, (int)CopyFiles(&args));
+        Assert::IsTrue(ReadAll("CopySource.bin") == ReadAll("CopyTarget.bin"));
+
+        BYTE source[SHA256_DIGEST_LENGTH];
+        BYTE copied[SHA256_DIGEST_LENGTH];
+        Assert::AreEqual((int)SUCCESS, (int)CalcDigest(&args, source, (LPWSTR)L"CopySource.bin"));
+        Assert::AreEqual((int)SUCCESS, (int)CalcDigest(&args, copied, (LPWSTR)L"CopyTarget.bin"));
+        Assert::AreEqual(0, memcmp(source, copied, SHA256_DIGEST_LENGTH));
+    }
+
+    TEST_METHOD(TestSeveralFilesNeedDirectory)
+    {
+        FileList second = { (LPWSTR)L"CopySource.bin", NULL };
+        FileList first = { (LPWSTR)L"CopySource.bin", &second };
+        Args args = { 0 };
+        args.status = TRUE;
+        args.files = &first;
+        args.copyTo = (LPWSTR)L"CopyTarget.bin";
+
+        Assert::AreEqual((int)COPY_FAILED_TO_OPEN, (int)CopyFiles(&args));
+        Assert::AreEqual(INVALID_FILE_ATTRIBUTES, GetFileAttributesW(L"CopyTarget.bin"));
+    }
+
+    TEST_METHOD(TestMissingSource)
+    {
+        FileList file = { (LPWSTR)L"CopyMissing.bin", NULL };
+        Args args = { 0 };
+        args.status = TRUE;
+        args.files = &file;
+        args.copyTo = (LPWSTR)L"CopyTarget";
+
+        Assert::AreEqual((int)MAIN_FAILED_TO_FIND_FILES, (int)CopyFiles(&args));
+    }
+};
+
+TEST_CLASS(fTeeStdin)
+{
+public:
+
+    static HANDLE Redirect(DWORD stdHandle, LPCWSTR file, DWORD access, DWORD disposition)
+    {
+        HANDLE hFile = CreateFileW(file, access, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+        Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+        HANDLE previous = GetStdHandle(stdHandle);
+        SetStdHandle(stdHandle, hFile);
+        return previous;
+    }
+
+    static void Restore(DWORD stdHandle, HANDLE previous)
+    {
+        CloseHandle(GetStdHandle(stdHandle));
+        SetStdHandle(stdHandle, previous);
+    }
+
+    TEST_METHOD(TestDigestToRedirectedStderr)
+    {
+        std::ofstream input("TeeInput.txt", std::ios::binary);
+        input << "abc";
+        input.close();
+
+        Args args = { 0 };
+        args.tee = TRUE;
+
+        // a file is not a console, the digest has to be written to it as UTF-8
+        HANDLE previousInput = Redirect(STD_INPUT_HANDLE, L"TeeInput.txt", GENERIC_READ, OPEN_EXISTING);
+        HANDLE previousOutput = Redirect(STD_OUTPUT_HANDLE, L"TeeOutput.txt", GENERIC_WRITE, CREATE_ALWAYS);
+        HANDLE previousError = Redirect(STD_ERROR_HANDLE, L"TeeError.txt", GENERIC_WRITE, CREATE_ALWAYS);
+        ErrorCode act = TeeStdin(&args);
+        Restore(STD_ERROR_HANDLE, previousError);
+        Restore(STD_OUTPUT_HANDLE, previousOutput);
+        Restore(STD_INPUT_HANDLE, previousInput);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::IsTrue(ReadAll("TeeOutput.txt") == "abc");
+        Assert::IsTrue(ReadAll("TeeError.txt") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *-\r\n");
+    }
+};
+}
@@ -0,0 +1,137 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace daemon {
+TEST_CLASS(fRunDaemon)
+{
+public:
+
+    TEST_METHOD(TestHashOverPipe)
+    {
+        Args server = { 0 };
+        server.pipeName = L"\\\\.\\pipe\\sha256sum-tests-hash";
+
+        ErrorCode serverResult = SUCCESS;
+        std::thread daemonThread([&]() { serverResult = RunDaemon(&server); });
+
+        // wait until the daemon created its first pipe instance
+        for (int i = 0; i < 100 && !WaitNamedPipeW(server.pipeName, 100); i++)
+        {
+            Sleep(10);
+        }
+
+        Args client = { 0 };
+        client.daemon = TRUE;
+        client.pipeName = server.pipeName;
+
+        WCHAR file[] = L"CalcHashTestFile.txt";
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&client, &hash, file);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"5825c4a88eddd074eb3c12b23dedc0eb4d7d5f2356a61a4078a0bd3ccf69c7a1", hash);
+        free(hash);
+
+        // the second request is answered from the digest cache
+        const int requests = 100;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < requests; i++)
+        {
+            act = CalcHash(&client, &hash, file);
+            Assert::AreEqual((int)SUCCESS, (int)act);
+            Assert::AreEqual(L"5825c4a88eddd074eb3c12b23dedc0eb4d7d5f2356a61a4078a0bd3ccf69c7a1", hash);
+            free(hash);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        std::wstring message = L"daemon latency per request: " + std::to_wstring(elapsed.count() / requests) + L" us\n";
+        Logger::WriteMessage(message.c_str());
+
+        Assert::AreEqual((int)SUCCESS, (int)StopDaemon(&client));
+        daemonThread.join();
+        Assert::AreEqual((int)SUCCESS, (int)serverResult);
+    }
+
+    TEST_METHOD(TestMissingFile)
+    {
+        Args server = { 0 };
+        server.status = TRUE;
+        server.pipeName = L"\\\\.\\pipe\\sha256sum-tests-missing";
+
+        std::thread daemonThread([&]() { RunDaemon(&server); });
+
+        for (int i = 0; i < 100 && !WaitNamedPipeW(server.pipeName, 100); i++)
+        {
+            Sleep(10);
+        }
+
+        Args client = { 0 };
+        client.daemon = TRUE;
+        client.status = TRUE;
+        client.pipeName = server.pipeName;
+
+        WCHAR file[] = L"Missing.txt";
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&client, &hash, file);
+
+        Assert::AreEqual((int)CALC_HASH_FAILED_TO_OPEN_FILE, (int)act);
+
+        StopDaemon(&client);
+        daemonThread.join();
+    }
+
+    TEST_METHOD(TestStopWithIdleConnection)
+    {
+        Args server = { 0 };
+        server.status = TRUE;
+        server.pipeName = L"\\\\.\\pipe\\sha256sum-tests-idle";
+
+        std::atomic<bool> stopped(false);
+        std::thread daemonThread([&]() { RunDaemon(&server); stopped = true; });
+
+        for (int i = 0; i < 100 && !WaitNamedPipeW(server.pipeName, 100); i++)
+        {
+            Sleep(10);
+        }
+
+        // a second client, like another -j worker, connected but sending nothing
+        HANDLE hIdle = CreateFileW(server.pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        Assert::IsTrue(hIdle != INVALID_HANDLE_VALUE);
+
+        Args client = { 0 };
+        client.status = TRUE;
+        client.pipeName = server.pipeName;
+        Assert::AreEqual((int)SUCCESS, (int)StopDaemon(&client));
+
+        for (int i = 0; i < 500 && !stopped; i++)
+        {
+            Sleep(10);
+        }
+        bool stoppedInTime = stopped;
+
+        CloseHandle(hIdle);
+        daemonThread.join();
+        Assert::IsTrue(stoppedInTime);
+    }
+
+    TEST_METHOD(TestNoDaemon)
+    {
+        Args client = { 0 };
+        client.daemon = TRUE;
+        client.status = TRUE;
+        client.pipeName = L"\\\\.\\pipe\\sha256sum-tests-nobody";
+
+        WCHAR file[] = L"CalcHashTestFile.txt";
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&client, &hash, file);
+
+        Assert::AreEqual((int)DAEMON_FAILED_TO_CONNECT, (int)act);
+    }
+};
+}
@@ -0,0 +1,75 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace diff {
+TEST_CLASS(fDiffTree)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateTree)
+    {
+        CreateDirectoryW(L"DiffTree", NULL);
+        CreateDirectoryW(L"DiffTree\\sub", NULL);
+
+        std::ofstream a("DiffTree\\a.bin", std::ios::binary);
+        a << "abc";
+        a.close();
+
+        std::ofstream b("DiffTree\\sub\\b.bin", std::ios::binary);
+        b << "abc";
+        b.close();
+    }
+
+    TEST_METHOD(TestUnchanged)
+    {
+        std::ofstream manifest("DiffUnchanged.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *./a.bin\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *sub/b.bin\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.diffManifest = L"DiffUnchanged.txt";
+        args.diffDirectory = L"DiffTree";
+
+        ErrorCode act = DiffTree(&args);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+    }
+
+    TEST_METHOD(TestAddedRemovedChanged)
+    {
+        std::ofstream manifest("DiffChanged.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *removed.bin\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ae *sub\\b.bin\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.diffManifest = L"DiffChanged.txt";
+        args.diffDirectory = L"DiffTree";
+
+        ErrorCode act = DiffTree(&args);
+
+        Assert::AreEqual((int)DIFF_DIFFERENCES_FOUND, (int)act);
+    }
+
+    TEST_METHOD(TestMissingDirectory)
+    {
+        std::ofstream manifest("DiffMissing.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *a.bin\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.diffManifest = L"DiffMissing.txt";
+        args.diffDirectory = L"DiffTreeMissing";
+
+        ErrorCode act = DiffTree(&args);
+
+        Assert::AreEqual((int)DIFF_FAILED_TO_WALK, (int)act);
+    }
+};
+}
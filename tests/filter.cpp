@@ -0,0 +1,123 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace filter {
+TEST_CLASS(fPathFilter)
+{
+public:
+
+    TEST_METHOD(TestNoFilter)
+    {
+        Args args = { 0 };
+        PathFilter* filter = (PathFilter*)1;
+
+        ErrorCode act = CreatePathFilter(&args, &filter);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::IsNull(filter);
+    }
+
+    TEST_METHOD(TestInclude)
+    {
+        FileList include = { L"*.DLL", NULL };
+        Args args = { 0 };
+        args.includes = &include;
+        PathFilter* filter = NULL;
+
+        Assert::AreEqual((int)SUCCESS, (int)CreatePathFilter(&args, &filter));
+
+        Assert::IsTrue(PathFilterMatches(filter, L"a.dll"));
+        Assert::IsTrue(PathFilterMatches(filter, L"./bin/a.dll"));
+        Assert::IsFalse(PathFilterMatches(filter, L"a.dll.txt"));
+        Assert::IsFalse(PathFilterMatches(filter, L"bin\\a.exe"));
+
+        FreePathFilter(filter);
+    }
+
+    TEST_METHOD(TestPathPatterns)
+    {
+        FileList logs = { L"logs/*", NULL };
+        FileList bin = { L"bin\\**\\*.exe", &logs };
+        FileList tmp = { L"tmp.*", NULL };
+        FileList exclude = { L"**/t?mp/**", &tmp };
+        Args args = { 0 };
+        args.includes = &bin;
+        args.excludes = &exclude;
+        PathFilter* filter = NULL;
+
+        Assert::AreEqual((int)SUCCESS, (int)CreatePathFilter(&args, &filter));
+
+        Assert::IsTrue(PathFilterMatches(filter, L"bin\\a.exe"));
+        Assert::IsTrue(PathFilterMatches(filter, L"bin\\x64\\release\\a.exe"));
+        Assert::IsTrue(PathFilterMatches(filter, L"logs\\today.log"));
+        Assert::IsFalse(PathFilterMatches(filter, L"logs\\old\\today.log"));
+        Assert::IsFalse(PathFilterMatches(filter, L"binary\\a.exe"));
+        Assert::IsFalse(PathFilterMatches(filter, L"bin\\temp\\a.exe"));
+        Assert::IsFalse(PathFilterMatches(filter, L"logs\\tmp.log"));
+
+        FreePathFilter(filter);
+    }
+
+    TEST_METHOD(TestPathsFrom)
+    {
+        std::ofstream list("PathsFrom.txt", std::ios::binary);
+        list << "./a.bin\r\n"
+             << "sub/b.bin\n"
+             << "\n";
+        list.close();
+
+        FileList exclude = { L"a.*", NULL };
+        Args args = { 0 };
+        args.pathsFrom = L"PathsFrom.txt";
+        args.excludes = &exclude;
+        PathFilter* filter = NULL;
+
+        Assert::AreEqual((int)SUCCESS, (int)CreatePathFilter(&args, &filter));
+
+        Assert::IsTrue(PathFilterMatches(filter, L"SUB\\b.bin"));
+        Assert::IsFalse(PathFilterMatches(filter, L"a.bin"));
+        Assert::IsFalse(PathFilterMatches(filter, L"c.bin"));
+
+        FreePathFilter(filter);
+    }
+
+    TEST_METHOD(TestMissingPathsFrom)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.pathsFrom = L"PathsFromMissing.txt";
+        PathFilter* filter = NULL;
+
+        ErrorCode act = CreatePathFilter(&args, &filter);
+
+        Assert::AreEqual((int)FILTER_FAILED_TO_READ_PATHS, (int)act);
+        Assert::IsNull(filter);
+    }
+
+    TEST_METHOD(TestVerifySkipsFiltered)
+    {
+        std::ofstream file("FilterKept.bin", std::ios::binary);
+        file << "abc";
+        file.close();
+
+        // the missing file is never opened because it is excluded
+        std::ofstream manifest("FilterManifest.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *FilterKept.bin\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *FilterMissing.bin\n";
+        manifest.close();
+
+        FileList exclude = { L"*Missing*", NULL };
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"FilterManifest.txt";
+        args.excludes = &exclude;
+
+        ErrorCode act = VerifyChecksums(&args);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+    }
+};
+}
@@ -0,0 +1,137 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace manifestindex {
+
+static std::string ReadAll(const char* file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+TEST_CLASS(fConvertManifest)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateFiles)
+    {
+        std::ofstream file("IndexTestFile.bin", std::ios::binary);
+        file << "abc";
+        file.close();
+
+        // already in path order, so converting back gives the same bytes
+        std::ofstream manifest("IndexManifest.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *IndexTestFile.bin\r\n"
+                 << "30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58 1048576 *sub\\large.bin\r\n"
+                 << "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 *sub\\\xc3\xa4.txt\r\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.convertFrom = L"IndexManifest.txt";
+        args.convertTo = L"IndexManifest.idx";
+        Assert::AreEqual((int)SUCCESS, (int)ConvertManifest(&args));
+    }
+
+    TEST_METHOD(TestRoundTrip)
+    {
+        Args args = { 0 };
+        args.convertFrom = L"IndexManifest.idx";
+        args.convertTo = L"IndexManifestRoundTrip.txt";
+
+        ErrorCode act = ConvertManifest(&args);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::IsTrue(ReadAll("IndexManifest.txt") == ReadAll("IndexManifestRoundTrip.txt"));
+    }
+
+    TEST_METHOD(TestRoundTripUnsorted)
+    {
+        // out of path order and with a repeated path, -c and converting back keep the manifest order
+        std::ofstream manifest("IndexUnsorted.txt", std::ios::binary);
+        manifest << "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 *z.txt\r\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *IndexTestFile.bin\r\n"
+                 << "0000000000000000000000000000000000000000000000000000000000000000 *a.txt\r\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ae *IndexTestFile.bin\r\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.convertFrom = L"IndexUnsorted.txt";
+        args.convertTo = L"IndexUnsorted.idx";
+        Assert::AreEqual((int)SUCCESS, (int)ConvertManifest(&args));
+
+        args.convertFrom = L"IndexUnsorted.idx";
+        args.convertTo = L"IndexUnsortedRoundTrip.txt";
+        Assert::AreEqual((int)SUCCESS, (int)ConvertManifest(&args));
+        Assert::IsTrue(ReadAll("IndexUnsorted.txt") == ReadAll("IndexUnsortedRoundTrip.txt"));
+
+        // the first of the repeated entries is the one that is found
+        ManifestIndex manifestIndex;
+        Assert::AreEqual((int)SUCCESS, (int)OpenIndex(&args, L"IndexUnsorted.idx", &manifestIndex));
+        IndexEntry* entry = IndexLookup(&manifestIndex, "IndexTestFile.bin", 17);
+        Assert::IsNotNull(entry);
+        Assert::AreEqual((ULONGLONG)1, entry->ordinal);
+        Assert::AreEqual(0xad, (int)entry->digest[SHA256_DIGEST_LENGTH - 1]);
+        CloseIndex(&manifestIndex);
+    }
+
+    TEST_METHOD(TestLookup)
+    {
+        Args args = { 0 };
+        ManifestIndex manifestIndex;
+
+        Assert::IsTrue(IsIndexFile(L"IndexManifest.idx"));
+        Assert::IsFalse(IsIndexFile(L"IndexManifest.txt"));
+        Assert::AreEqual((int)SUCCESS, (int)OpenIndex(&args, L"IndexManifest.idx", &manifestIndex));
+        Assert::AreEqual((ULONGLONG)3, manifestIndex.header->count);
+
+        IndexEntry* entry = IndexLookup(&manifestIndex, "sub\\large.bin", 13);
+        Assert::IsNotNull(entry);
+        Assert::AreEqual((ULONGLONG)1048576, entry->size);
+        Assert::AreEqual(0x30, (int)entry->digest[0]);
+
+        Assert::IsNull(IndexLookup(&manifestIndex, "sub\\large", 9));
+        Assert::IsNull(IndexLookup(&manifestIndex, "missing.bin", 11));
+
+        CloseIndex(&manifestIndex);
+    }
+
+    TEST_METHOD(TestCheckIndex)
+    {
+        std::ofstream manifest("IndexCheck.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *IndexTestFile.bin\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.convertFrom = L"IndexCheck.txt";
+        args.convertTo = L"IndexCheck.idx";
+        Assert::AreEqual((int)SUCCESS, (int)ConvertManifest(&args));
+
+        Args check = { 0 };
+        check.sumFile = L"IndexCheck.idx";
+        ErrorCode act = VerifyChecksums(&check);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+    }
+
+    TEST_METHOD(TestInvalidIndex)
+    {
+        std::ofstream truncated("IndexTruncated.idx", std::ios::binary);
+        truncated << "S2IX";
+        truncated.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"IndexTruncated.idx";
+        ErrorCode act = VerifyChecksums(&args);
+
+        Assert::AreEqual((int)INDEX_INVALID, (int)act);
+    }
+};
+}
@@ -0,0 +1,133 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace journal {
+TEST_CLASS(fVerifyJournal)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateManifest)
+    {
+        std::ofstream file("JournalFile.bin", std::ios::binary);
+        file << "abc";
+        file.close();
+
+        std::ofstream manifest("JournalManifest.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *JournalFile.bin\n"
+                 << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *JournalFile.bin\n";
+        manifest.close();
+
+        DeleteFileW(L"Journal.bin");
+    }
+
+    TEST_METHOD(TestFinishedRunDeletesJournal)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"JournalManifest.txt";
+        args.journal = L"Journal.bin";
+
+        Assert::AreEqual((int)SUCCESS, (int)VerifyChecksums(&args));
+        Assert::AreEqual(INVALID_FILE_ATTRIBUTES, GetFileAttributesW(L"Journal.bin"));
+    }
+
+    TEST_METHOD(TestResumeKeepsRecordedResults)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"JournalManifest.txt";
+        args.journal = L"Journal.bin";
+
+        // an interrupted run that found the first entry failed, the file has
+        // been repaired since, the resumed run still reports the failure
+        Journal* journal = NULL;
+        BYTE digest[SHA256_DIGEST_LENGTH] = { 0 };
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::AreEqual((int)SUCCESS, (int)JournalAppend(journal, FALSE, digest));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        BOOL matched = TRUE;
+        Assert::IsTrue(JournalLookup(journal, 0, &matched));
+        Assert::IsFalse(matched);
+        Assert::IsFalse(JournalLookup(journal, 1, &matched));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        Assert::AreEqual((int)CHECK_SUM_CHECKSUM_FAILED, (int)VerifyChecksums(&args));
+    }
+
+    TEST_METHOD(TestTornRecordIsDropped)
+    {
+        Args args = { 0 };
+        args.sumFile = L"JournalManifest.txt";
+        args.journal = L"Journal.bin";
+
+        Journal* journal = NULL;
+        BYTE digest[SHA256_DIGEST_LENGTH] = { 0 };
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::AreEqual((int)SUCCESS, (int)JournalAppend(journal, TRUE, digest));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        std::ofstream torn("Journal.bin", std::ios::binary | std::ios::app);
+        torn << "partial";
+        torn.close();
+
+        BOOL matched = FALSE;
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::IsTrue(JournalLookup(journal, 0, &matched));
+        Assert::IsTrue(matched);
+        Assert::IsFalse(JournalLookup(journal, 1, &matched));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+    }
+
+    TEST_METHOD(TestChangedManifestStartsOver)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"JournalManifest.txt";
+        args.journal = L"Journal.bin";
+
+        Journal* journal = NULL;
+        BYTE digest[SHA256_DIGEST_LENGTH] = { 0 };
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::AreEqual((int)SUCCESS, (int)JournalAppend(journal, FALSE, digest));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        std::ofstream manifest("JournalManifest.txt", std::ios::binary);
+        manifest << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *JournalFile.bin\n";
+        manifest.close();
+
+        Assert::AreEqual((int)SUCCESS, (int)VerifyChecksums(&args));
+    }
+
+    TEST_METHOD(TestChangedFilterStartsOver)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"JournalManifest.txt";
+        args.journal = L"Journal.bin";
+
+        // the first entry of the unfiltered run failed
+        Journal* journal = NULL;
+        BYTE digest[SHA256_DIGEST_LENGTH] = { 0 };
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::AreEqual((int)SUCCESS, (int)JournalAppend(journal, FALSE, digest));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        // with a filter the indexes count other entries, the record does not apply
+        WCHAR pattern[] = L"*.bin";
+        FileList include = { pattern, NULL };
+        args.includes = &include;
+
+        BOOL matched = TRUE;
+        Assert::AreEqual((int)SUCCESS, (int)OpenJournal(&args, &journal));
+        Assert::IsFalse(JournalLookup(journal, 0, &matched));
+        Assert::AreEqual((int)SUCCESS, (int)CloseJournal(journal, FALSE));
+
+        Assert::AreEqual((int)SUCCESS, (int)VerifyChecksums(&args));
+    }
+};
+}
@@ -0,0 +1,39 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace progress {
+TEST_CLASS(fFormatProgress)
+{
+public:
+
+    TEST_METHOD(TestKnownTotal)
+    {
+        WCHAR line[200];
+
+        // 1 GiB of 4 GiB at 128 MiB/s leaves 24 seconds
+        FormatProgress(line, _countof(line), 1ULL << 30, 4ULL << 30, 3, 128ULL << 20, L"big.iso");
+
+        Assert::AreEqual(L"1.0 GiB of 4.0 GiB, 128.0 MiB/s, ETA 0:00:24, 3 files, big.iso", line);
+    }
+
+    TEST_METHOD(TestUnknownTotal)
+    {
+        WCHAR line[200];
+
+        FormatProgress(line, _countof(line), 1536, 0, 1, 0, NULL);
+
+        Assert::AreEqual(L"1.5 KiB, 0 B/s, 1 files", line);
+    }
+
+    TEST_METHOD(TestLongEta)
+    {
+        WCHAR line[200];
+
+        FormatProgress(line, _countof(line), 0, 10000ULL * 1000, 0, 1000, L"");
+
+        Assert::AreEqual(L"0 B of 9.5 MiB, 1000 B/s, ETA 2:46:40, 0 files", line);
+    }
+};
+}
@@ -0,0 +1,406 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace scheduler {
+
+static BOOL CollectResult(Args* args, HashJob* job, PVOID context)
+{
+    std::vector<std::wstring>* hashes = (std::vector<std::wstring>*)context;
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1] = { 0 };
+
+    if (job->status == SUCCESS && !job->skip)
+    {
+        FormatDigest(hash, job->digest);
+    }
+    hashes->push_back(hash);
+    return TRUE;
+}
+
+static BOOL StopAfterFirst(Args* args, HashJob* job, PVOID context)
+{
+    CollectResult(args, job, context);
+    return FALSE;
+}
+
+TEST_CLASS(fRunHashJobs)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateFiles)
+    {
+        std::ofstream small("SchedulerSmall.bin", std::ios::binary);
+        small << "abc";
+        small.close();
+
+        std::ofstream large("SchedulerLarge.bin", std::ios::binary);
+        large << std::string(1048576, '\0');
+        large.close();
+    }
+
+    TEST_METHOD(TestResultsInInputOrder)
+    {
+        Args args = { 0 };
+        args.jobs = 4;
+
+        // the large file is dispatched first but reported where it is listed
+        WCHAR files[6][MAX_PATH] = { L"SchedulerSmall.bin", L"SchedulerSmall.bin", L"SchedulerSmall.bin",
+                                     L"SchedulerSmall.bin", L"SchedulerSmall.bin", L"SchedulerLarge.bin" };
+        HashJob jobs[6] = { 0 };
+        for (int i = 0; i < 6; i++)
+        {
+            jobs[i].file = files[i];
+        }
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 6, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)6, hashes.size());
+        for (int i = 0; i < 5; i++)
+        {
+            Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[i].c_str());
+        }
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[5].c_str());
+    }
+
+    TEST_METHOD(TestInputOrderSingleThread)
+    {
+        Args args = { 0 };
+        args.jobs = 1;
+        args.order = ORDER_INPUT;
+
+        WCHAR files[2][MAX_PATH] = { L"SchedulerLarge.bin", L"SchedulerSmall.bin" };
+        HashJob jobs[2] = { 0 };
+        jobs[0].file = files[0];
+        jobs[1].file = files[1];
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 2, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)2, hashes.size());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[0].c_str());
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[1].c_str());
+    }
+
+    TEST_METHOD(TestPhysicalOrderSingleThread)
+    {
+        Args args = { 0 };
+        args.jobs = 1;
+        args.order = ORDER_PHYSICAL;
+
+        // read in the order of the clusters, reported in the order of the list
+        WCHAR files[4][MAX_PATH] = { L"SchedulerLarge.bin", L"SchedulerSmall.bin", L"Missing.txt", L"SchedulerLarge.bin" };
+        HashJob jobs[4] = { 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            jobs[i].file = files[i];
+        }
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 4, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)4, hashes.size());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[0].c_str());
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[1].c_str());
+        Assert::AreEqual((int)CALC_HASH_FAILED_TO_OPEN_FILE, (int)jobs[2].status);
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[3].c_str());
+    }
+
+    TEST_METHOD(TestFileIdOrder)
+    {
+        Args args = { 0 };
+        args.jobs = 3;
+        args.order = ORDER_FILE_ID;
+
+        WCHAR files[3][MAX_PATH] = { L"SchedulerSmall.bin", L"SchedulerLarge.bin", L"SchedulerSmall.bin" };
+        HashJob jobs[3] = { 0 };
+        for (int i = 0; i < 3; i++)
+        {
+            jobs[i].file = files[i];
+        }
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 3, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)3, hashes.size());
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[0].c_str());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[1].c_str());
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[2].c_str());
+    }
+
+    TEST_METHOD(TestSkipAndCancel)
+    {
+        Args args = { 0 };
+        args.jobs = 2;
+
+        WCHAR files[3][MAX_PATH] = { L"Missing.txt", L"SchedulerSmall.bin", L"SchedulerLarge.bin" };
+        HashJob jobs[3] = { 0 };
+        for (int i = 0; i < 3; i++)
+        {
+            jobs[i].file = files[i];
+        }
+        jobs[0].skip = TRUE; // would fail to open if it was hashed
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 3, StopAfterFirst, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)1, hashes.size());
+        Assert::AreEqual((int)SUCCESS, (int)jobs[0].status);
+    }
+
+    TEST_METHOD(TestCancelledStopsReading)
+    {
+        Args args = { 0 };
+        args.cancelled = TRUE;
+
+        // a file larger than one read is not read to EOF once the run is cancelled
+        BYTE digest[SHA256_DIGEST_LENGTH];
+        ErrorCode act = CalcDigest(&args, digest, (LPWSTR)L"SchedulerLarge.bin");
+        Assert::AreEqual((int)CALC_HASH_CANCELLED, (int)act);
+
+        // RunHashJobs starts and leaves a run with the flag cleared
+        WCHAR files[2][MAX_PATH] = { L"SchedulerLarge.bin", L"SchedulerSmall.bin" };
+        HashJob jobs[2] = { 0 };
+        for (int i = 0; i < 2; i++)
+        {
+            jobs[i].file = files[i];
+        }
+
+        std::vector<std::wstring> hashes;
+        act = RunHashJobs(&args, jobs, 2, StopAfterFirst, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((int)SUCCESS, (int)jobs[0].status);
+        Assert::AreEqual((LONG)FALSE, (LONG)args.cancelled);
+    }
+
+    TEST_METHOD(TestDuplicatesHashedOnce)
+    {
+        Args args = { 0 };
+        args.jobs = 4;
+
+        DeleteFileW(L"SchedulerLink.bin");
+        Assert::IsTrue(CreateHardLinkW(L"SchedulerLink.bin", L"SchedulerLarge.bin", NULL));
+
+        // a repeated path and a hardlink to the same file, each only read once
+        WCHAR files[4][MAX_PATH] = { L"SchedulerLarge.bin", L"SchedulerSmall.bin",
+                                     L"SchedulerLarge.bin", L"SchedulerLink.bin" };
+        HashJob jobs[4] = { 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            jobs[i].file = files[i];
+        }
+
+        LONG64 duplicates = runStats.duplicates;
+        LONG64 bytesSaved = runStats.bytesSaved;
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 4, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)4, hashes.size());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[2].c_str());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[3].c_str());
+        Assert::AreEqual((LONG64)2, runStats.duplicates - duplicates);
+        Assert::AreEqual((LONG64)2 * 1048576, runStats.bytesSaved - bytesSaved);
+    }
+
+    TEST_METHOD(TestPrefetch)
+    {
+        Args args = { 0 };
+        args.jobs = 2;
+        args.prefetch = 8;
+
+        std::vector<std::wstring> files;
+        HashJob jobs[32] = { 0 };
+        for (int i = 0; i < 32; i++)
+        {
+            files.push_back(i == 5 ? L"Missing.txt" : i % 4 == 3 ? L"SchedulerLarge.bin" : L"SchedulerSmall.bin");
+        }
+        for (int i = 0; i < 32; i++)
+        {
+            jobs[i].file = &files[i][0];
+        }
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 32, CollectResult, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)32, hashes.size());
+        Assert::AreEqual((int)CALC_HASH_FAILED_TO_OPEN_FILE, (int)jobs[5].status);
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hashes[0].c_str());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[31].c_str());
+    }
+
+    TEST_METHOD(TestPrefetchClosedOnCancel)
+    {
+        Args args = { 0 };
+        args.jobs = 1;
+        args.prefetch = 16;
+
+        std::vector<std::wstring> files;
+        HashJob jobs[16] = { 0 };
+        for (int i = 0; i < 16; i++)
+        {
+            files.push_back(L"SchedulerPrefetch" + std::to_wstring(i) + L".bin");
+            std::ofstream file("SchedulerPrefetch" + std::to_string(i) + ".bin", std::ios::binary);
+            file << "abc";
+            file.close();
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            jobs[i].file = &files[i][0];
+        }
+
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunHashJobs(&args, jobs, 16, StopAfterFirst, &hashes);
+
+        // files opened ahead but never hashed are closed again
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)1, hashes.size());
+        for (int i = 0; i < 16; i++)
+        {
+            Assert::IsTrue(DeleteFileW(files[i].c_str()));
+        }
+    }
+};
+
+TEST_CLASS(fHashPool)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateFiles)
+    {
+        std::ofstream small("PoolSmall.bin", std::ios::binary);
+        small << "abc";
+        small.close();
+
+        std::ofstream large("PoolLarge.bin", std::ios::binary);
+        large << std::string(1048576, '\0');
+        large.close();
+    }
+
+    static ErrorCode RunPool(Args* args, size_t window, std::vector<std::wstring>& files, std::vector<std::wstring>* hashes)
+    {
+        HashPool* pool;
+        ErrorCode status = StartHashPool(args, window, CollectResult, hashes, &pool);
+        if (status != SUCCESS)
+        {
+            return status;
+        }
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            HashJob* job = ReserveHashJob(pool);
+            if (job == NULL)
+            {
+                break;
+            }
+            job->file = &files[i][0];
+            SubmitHashJob(pool, job);
+        }
+
+        return FinishHashPool(pool);
+    }
+
+    TEST_METHOD(TestMoreJobsThanWindow)
+    {
+        Args args = { 0 };
+        args.jobs = 4;
+
+        std::vector<std::wstring> files;
+        for (int i = 0; i < 100; i++)
+        {
+            files.push_back(i % 7 == 3 ? L"PoolLarge.bin" : L"PoolSmall.bin");
+        }
+
+        // the window wraps many times, results still come in submission order
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunPool(&args, 4, files, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)100, hashes.size());
+        for (int i = 0; i < 100; i++)
+        {
+            Assert::AreEqual(i % 7 == 3 ? L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58"
+                                        : L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+                             hashes[i].c_str());
+        }
+    }
+
+    TEST_METHOD(TestHardlinkOutsideWindow)
+    {
+        Args args = { 0 };
+        args.jobs = 1;
+
+        DeleteFileW(L"PoolLink.bin");
+        Assert::IsTrue(CreateHardLinkW(L"PoolLink.bin", L"PoolLarge.bin", NULL));
+
+        // the link is submitted long after the first name was reported
+        std::vector<std::wstring> files = { L"PoolLarge.bin", L"PoolSmall.bin", L"PoolSmall.bin",
+                                            L"PoolSmall.bin", L"PoolSmall.bin", L"PoolLink.bin" };
+
+        LONG64 bytesSaved = runStats.bytesSaved;
+        std::vector<std::wstring> hashes;
+        ErrorCode act = RunPool(&args, 2, files, &hashes);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual((size_t)6, hashes.size());
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hashes[5].c_str());
+        Assert::AreEqual((LONG64)1048576, runStats.bytesSaved - bytesSaved);
+        Assert::IsTrue(DeleteFileW(L"PoolLink.bin"));
+    }
+
+    TEST_METHOD(TestStopReturnsNoMoreJobs)
+    {
+        Args args = { 0 };
+        args.jobs = 2;
+
+        HashPool* pool;
+        std::vector<std::wstring> hashes;
+        Assert::AreEqual((int)SUCCESS, (int)StartHashPool(&args, 1, StopAfterFirst, &hashes, &pool));
+
+        WCHAR file[] = L"PoolSmall.bin";
+        HashJob* job = ReserveHashJob(pool);
+        job->file = file;
+        SubmitHashJob(pool, job);
+
+        // the first result stops the run before a second job is handed out
+        Assert::IsNull(ReserveHashJob(pool));
+        Assert::AreEqual((int)SUCCESS, (int)FinishHashPool(pool));
+        Assert::AreEqual((size_t)1, hashes.size());
+        Assert::AreEqual((LONG)FALSE, (LONG)args.cancelled);
+    }
+
+    TEST_METHOD(TestSizeMismatchNotRead)
+    {
+        Args args = { 0 };
+        args.jobs = 2;
+
+        HashPool* pool;
+        std::vector<std::wstring> hashes;
+        Assert::AreEqual((int)SUCCESS, (int)StartHashPool(&args, 4, CollectResult, &hashes, &pool));
+
+        LONG64 bytesRead = runStats.bytesRead;
+        WCHAR file[] = L"PoolLarge.bin";
+        HashJob* job = ReserveHashJob(pool);
+        job->file = file;
+        job->checkSize = TRUE;
+        job->expectedSize = 3;
+        SubmitHashJob(pool, job);
+
+        Assert::AreEqual((int)SUCCESS, (int)FinishHashPool(pool));
+        Assert::AreEqual((size_t)1, hashes.size());
+        Assert::AreEqual(L"", hashes[0].c_str());
+        Assert::AreEqual(bytesRead, runStats.bytesRead);
+    }
+};
+}
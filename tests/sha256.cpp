@@ -98,6 +98,197 @@ public:
     }
 };
 
+TEST_CLASS(fCalcHashDirect)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateDirectTestFiles)
+    {
+        std::ofstream small("DirectSmall.bin", std::ios::binary);
+        small << "abc";
+        small.close();
+
+        std::ofstream large("DirectLarge.bin", std::ios::binary);
+        large << std::string(1048576, '\0');
+        large.close();
+    }
+
+    TEST_METHOD(TestDirectSmallFile)
+    {
+        Args args = { 0 };
+        args.direct = TRUE;
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"DirectSmall.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hash);
+    }
+
+    TEST_METHOD(TestDirectAndDropCacheLargeFile)
+    {
+        Args args = { 0 };
+        args.direct = TRUE;
+        args.dropCache = TRUE;
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"DirectLarge.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hash);
+    }
+};
+
+TEST_CLASS(fCalcHashSmall)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateSmallTestFiles)
+    {
+        std::ofstream empty("SmallEmpty.bin", std::ios::binary);
+        empty.close();
+
+        std::ofstream sector("SmallSector.bin", std::ios::binary);
+        sector << std::string(4096, '\0');
+        sector.close();
+
+        std::ofstream below("SmallBelow.bin", std::ios::binary);
+        below << std::string(65535, '\0');
+        below.close();
+
+        std::ofstream limit("SmallLimit.bin", std::ios::binary);
+        limit << std::string(65536, '\0');
+        limit.close();
+    }
+
+    TEST_METHOD(TestEmptyFile)
+    {
+        Args args = { 0 };
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SmallEmpty.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", hash);
+    }
+
+    TEST_METHOD(TestSectorSizeDirect)
+    {
+        Args args = { 0 };
+        args.direct = TRUE;
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SmallSector.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"ad7facb2586fc6e966c004d7d1d16b024f5805ff7cb47c7a85dabd8b48892ca7", hash);
+    }
+
+    TEST_METHOD(TestBelowAndAtLimit)
+    {
+        Args args = { 0 };
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SmallBelow.bin");
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"9f797b60edaf440d5831da53c35f4d4847a2f55adc64cfe887a7bcfcd9eca495", hash);
+
+        act = CalcHash(&args, &hash, L"SmallLimit.bin");
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"de2f256064a0af797747c2b97505dc0b9f3df0de4f489eac731c23ae9ca9cc31", hash);
+    }
+
+    TEST_METHOD(TestGrownSinceStat)
+    {
+        std::ofstream grown("SmallGrown.bin", std::ios::binary);
+        grown << "abcdefgh";
+        grown.close();
+
+        // the scheduler saw 3 bytes, the file has 8 by the time it is hashed
+        Args args = { 0 };
+        HashJob job = { 0 };
+        job.file = (LPWSTR)L"SmallGrown.bin";
+        job.facts.known = TRUE;
+        job.facts.size = 3;
+        job.facts.attributes = FILE_ATTRIBUTE_NORMAL;
+
+        ErrorCode act = CalcJobDigest(&args, &job);
+
+        WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+        FormatDigest(hash, job.digest);
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"9c56cc51b374c3ba189210d5b6d4bf57790d351c96c47c02190ecf1e430635ab", hash);
+
+        // --with-size writes what was hashed, not what the scheduler saw
+        Assert::IsTrue(job.hashedSize == 8);
+    }
+};
+
+// writes data at offset into a sparse file of the given size, everything else is a hole
+static void CreateSparseFile(LPCWSTR file, LONGLONG size, LONGLONG offset, LPCSTR data)
+{
+    DWORD dwBytes;
+    LARGE_INTEGER position;
+
+    HANDLE hFile = CreateFileW(file, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    Assert::IsTrue(DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwBytes, NULL));
+
+    position.QuadPart = size;
+    SetFilePointerEx(hFile, position, NULL, FILE_BEGIN);
+    SetEndOfFile(hFile);
+
+    if (data != NULL)
+    {
+        position.QuadPart = offset;
+        SetFilePointerEx(hFile, position, NULL, FILE_BEGIN);
+        WriteFile(hFile, data, lstrlenA(data), &dwBytes, NULL);
+    }
+    CloseHandle(hFile);
+}
+
+TEST_CLASS(fCalcHashSparse)
+{
+public:
+
+    TEST_METHOD(TestOnlyHole)
+    {
+        CreateSparseFile(L"SparseHole.bin", 1048576, 0, NULL);
+        Args args = { 0 };
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SparseHole.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"30e14955ebf1352266dc2ff8067e68104607e750abb9d3b36582b8af909fcb58", hash);
+    }
+
+    TEST_METHOD(TestDataBetweenHoles)
+    {
+        CreateSparseFile(L"SparseMiddle.bin", 64 * 1048576, 32 * 1048576, "abc");
+        Args args = { 0 };
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SparseMiddle.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"95fe357a7a22bbd35583c5d89605a77cfa5f176b9e0bde85893ff354901492c8", hash);
+    }
+
+    TEST_METHOD(TestDataAtEndDirect)
+    {
+        CreateSparseFile(L"SparseEnd.bin", 8 * 1048576, 8 * 1048576 - 3, "abc");
+        Args args = { 0 };
+        args.direct = TRUE;
+
+        LPWSTR hash = NULL;
+        ErrorCode act = CalcHash(&args, &hash, L"SparseEnd.bin");
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+        Assert::AreEqual(L"75a2e346b623156509ede14f6b6310134490ae58963fdcffb17fb3f238156338", hash);
+    }
+};
+
 TEST_CLASS(fVerifyChecksums)
 {
 public:
@@ -205,6 +396,327 @@ public:
 
         Assert::AreEqual((int)exp, (int)act);
     }
+
+    TEST_METHOD(TestUppercaseHashAndUTF8Path)
+    {
+        HANDLE hFile = CreateFileW(L"Verify\u00e4\u6f22.bin", GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        DWORD written;
+        WriteFile(hFile, "abc", 3, &written, NULL);
+        CloseHandle(hFile);
+
+        // the path is UTF-8 in the manifest and has to reach CreateFileW intact
+        std::ofstream manifest("ShasumUTF8.txt", std::ios::binary);
+        manifest << "BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD *Verify\xc3\xa4\xe6\xbc\xa2.bin\r\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"ShasumUTF8.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+
+        Assert::AreEqual((int)SUCCESS, (int)act);
+    }
+
+    TEST_METHOD(TestHashNotHexadecimal)
+    {
+        std::ofstream manifest("ShasumNotHex.txt", std::ios::binary);
+        manifest << "xa7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *CalcHashTestFile.txt\n";
+        manifest.close();
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"ShasumNotHex.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+
+        Assert::AreEqual((int)PARSE_LINE_INVALID_HASH_TOKEN, (int)act);
+    }
+};
+
+TEST_CLASS(fVerifyChecksumsSize)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateSizeTestFile)
+    {
+        std::ofstream file("SizeTestFile.bin", std::ios::binary);
+        file << "abc";
+    }
+
+    TEST_METHOD(TestSizeMatches)
+    {
+        std::ofstream checksumFile("ShasumSizeMatches.txt");
+        checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *SizeTestFile.bin" << std::endl;
+        checksumFile.close();
+
+        Args args = { 0 };
+        args.sumFile = L"ShasumSizeMatches.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestSizeMismatch)
+    {
+        std::ofstream checksumFile("ShasumSizeMismatch.txt");
+        checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 4 *SizeTestFile.bin" << std::endl;
+        checksumFile.close();
+
+        Args args = { 0 };
+        args.sumFile = L"ShasumSizeMismatch.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = CHECK_SUM_CHECKSUM_FAILED;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestFailFast)
+    {
+        // without --fail-fast the missing file would be reached and reported
+        std::ofstream checksumFile("ShasumFailFast.txt");
+        checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ae *SizeTestFile.bin" << std::endl;
+        checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *Missing.txt" << std::endl;
+        checksumFile.close();
+
+        Args args = { 0 };
+        args.sumFile = L"ShasumFailFast.txt";
+        args.failFast = TRUE;
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = CHECK_SUM_CHECKSUM_FAILED;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+};
+
+// manifests longer than the window of entries in flight, every line refers to the same file
+TEST_CLASS(fVerifyChecksumsStreaming)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateStreamingTestFile)
+    {
+        std::ofstream file("StreamingTestFile.bin", std::ios::binary);
+        file << "abc";
+    }
+
+    static void WriteManifest(const char* name, int lines, const char* lastLine)
+    {
+        std::ofstream checksumFile(name, std::ios::binary);
+        for (int i = 0; i < lines; i++)
+        {
+            checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *StreamingTestFile.bin\n";
+        }
+        checksumFile << lastLine;
+    }
+
+    TEST_METHOD(TestManyEntries)
+    {
+        WriteManifest("ShasumStreaming.txt", 20000, "");
+
+        Args args = { 0 };
+        args.quiet = TRUE;
+        args.sumFile = L"ShasumStreaming.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = SUCCESS;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestFailureInLastBatch)
+    {
+        // last line without line break
+        WriteManifest("ShasumStreamingFailure.txt", 20000,
+                      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ae *StreamingTestFile.bin");
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"ShasumStreamingFailure.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = CHECK_SUM_CHECKSUM_FAILED;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+
+    TEST_METHOD(TestInvalidLineAfterFirstBatch)
+    {
+        WriteManifest("ShasumStreamingInvalid.txt", 10000, "ba7816bf *StreamingTestFile.bin\n");
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.sumFile = L"ShasumStreamingInvalid.txt";
+
+        ErrorCode act = VerifyChecksums(&args);
+        ErrorCode exp = PARSE_LINE_INVALID_HASH_LENGTH;
+
+        Assert::AreEqual((int)exp, (int)act);
+    }
+};
+
+// manifests above the size that is split into ranges and parsed on several threads,
+// longer than one segment so lines are carried across segment boundaries
+TEST_CLASS(fManifestParallel)
+{
+public:
+
+    static void WriteManifest(const char* name, int lines, int invalidLine)
+    {
+        std::ofstream checksumFile(name, std::ios::binary);
+        for (int i = 1; i <= lines; i++)
+        {
+            if (i == invalidLine)
+            {
+                checksumFile << "ba7816bf *ParallelFile" << i << ".bin\n";
+            }
+            else if (i % 1000 == 0)
+            {
+                checksumFile << "\r\n";
+            }
+            else
+            {
+                checksumFile << "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *ParallelFile" << i << ".bin\r\n";
+            }
+        }
+    }
+
+    TEST_METHOD(TestEntriesInLineOrder)
+    {
+        WriteManifest("ShasumParallel.txt", 250000, 0);
+
+        Args args = { 0 };
+        ManifestReader* reader = NULL;
+        Assert::AreEqual((int)SUCCESS, (int)OpenManifest(&args, L"ShasumParallel.txt", &reader));
+
+        FileHash fh;
+        BOOL found = TRUE;
+        int line = 0;
+        while (TRUE)
+        {
+            Assert::AreEqual((int)SUCCESS, (int)NextManifestEntry(reader, &fh, &found));
+            if (!found)
+            {
+                break;
+            }
+
+            line++;
+            if (line % 1000 == 0)
+            {
+                line++;
+            }
+            std::string exp = "ParallelFile" + std::to_string(line) + ".bin";
+            Assert::AreEqual(exp, std::string(fh.path, fh.pathLength));
+            Assert::IsTrue(fh.hasSize && fh.size == 3);
+            free(fh.line);
+        }
+        CloseManifest(reader);
+
+        Assert::AreEqual(249999, line);
+    }
+
+    TEST_METHOD(TestInvalidLineInLaterRange)
+    {
+        WriteManifest("ShasumParallelInvalid.txt", 250000, 234567);
+
+        Args args = { 0 };
+        args.status = TRUE;
+        ManifestReader* reader = NULL;
+        Assert::AreEqual((int)SUCCESS, (int)OpenManifest(&args, L"ShasumParallelInvalid.txt", &reader));
+
+        FileHash fh;
+        BOOL found = TRUE;
+        ErrorCode status = SUCCESS;
+        int entries = 0;
+        while ((status = NextManifestEntry(reader, &fh, &found)) == SUCCESS && found)
+        {
+            entries++;
+            free(fh.line);
+        }
+        CloseManifest(reader);
+
+        // every entry before the invalid line, then its error
+        Assert::AreEqual((int)PARSE_LINE_INVALID_HASH_LENGTH, (int)status);
+        Assert::AreEqual(234566 - 234, entries);
+    }
+
+    TEST_METHOD(TestWarnLineNumbersInLaterSegment)
+    {
+        WriteManifest("ShasumParallelWarn.txt", 250000, 234567);
+
+        Args args = { 0 };
+        args.warn = TRUE;
+        ManifestReader* reader = NULL;
+        Assert::AreEqual((int)SUCCESS, (int)OpenManifest(&args, L"ShasumParallelWarn.txt", &reader));
+
+        // the warnings are written to a file, the invalid line is in the second segment
+        HANDLE hFile = CreateFileW(L"ShasumParallelWarn.log", GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+        HANDLE previous = GetStdHandle(STD_ERROR_HANDLE);
+        SetStdHandle(STD_ERROR_HANDLE, hFile);
+
+        FileHash fh;
+        BOOL found = TRUE;
+        ErrorCode status = SUCCESS;
+        while ((status = NextManifestEntry(reader, &fh, &found)) == SUCCESS && found)
+        {
+            free(fh.line);
+        }
+        CloseManifest(reader);
+
+        SetStdHandle(STD_ERROR_HANDLE, previous);
+        CloseHandle(hFile);
+
+        // one warning per empty line before the invalid one, in line order, then the invalid line
+        std::ifstream log("ShasumParallelWarn.log", std::ios::binary);
+        std::string line;
+        int empty = 0;
+        while (std::getline(log, line) && line.rfind("skip empty line ", 0) == 0)
+        {
+            empty++;
+            Assert::AreEqual("skip empty line " + std::to_string(empty * 1000) + "\r", line);
+        }
+        Assert::AreEqual((int)PARSE_LINE_INVALID_HASH_LENGTH, (int)status);
+        Assert::AreEqual(234, empty);
+        Assert::AreEqual(std::string("invalid hash on line 234567\r"), line);
+        Assert::IsFalse((bool)std::getline(log, line));
+    }
+};
+
+TEST_CLASS(fWriteStderr)
+{
+public:
+
+    TEST_METHOD(TestBufferedResultsGoFirst)
+    {
+        HANDLE hOutput = CreateFileW(L"StderrOrder.txt", GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        Assert::IsTrue(hOutput != INVALID_HANDLE_VALUE);
+        HANDLE previousOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+        HANDLE previousError = GetStdHandle(STD_ERROR_HANDLE);
+        SetStdHandle(STD_OUTPUT_HANDLE, hOutput);
+        SetStdHandle(STD_ERROR_HANDLE, hOutput);
+
+        // stdout and stderr in one file, like 2>&1, the message must follow the results
+        FlushStdout();
+        WriteStdoutUTF8("first: OK\r\n", 11);
+        WriteStdoutUTF8("second: OK\r\n", 12);
+        WCHAR message[] = L"warning\r\n";
+        WriteStderr(message);
+        WriteStdoutUTF8("third: OK\r\n", 11);
+        FlushStdout();
+
+        SetStdHandle(STD_ERROR_HANDLE, previousError);
+        SetStdHandle(STD_OUTPUT_HANDLE, previousOutput);
+        CloseHandle(hOutput);
+
+        std::ifstream in("StderrOrder.txt", std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Assert::AreEqual(std::string("first: OK\r\nsecond: OK\r\nwarning\r\nthird: OK\r\n"), content);
+    }
 };
 
 TEST_CLASS(fPathRemoveFileName)
@@ -0,0 +1,115 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace storage {
+
+// what the disk queries would have returned, without a disk
+static StorageDevice Disk(DWORD spindles, BOOL hasSeekPenalty, BOOL seekPenalty, DWORD busType)
+{
+    StorageDevice device = { 0 };
+    device.spindles = spindles;
+    device.hasSeekPenalty = hasSeekPenalty;
+    device.seekPenalty = seekPenalty;
+    device.busType = busType;
+    return device;
+}
+
+TEST_CLASS(fPlanStorage)
+{
+public:
+
+    TEST_METHOD(TestRotationalOneReaderPerSpindle)
+    {
+        StorageDevice devices[] = { Disk(1, TRUE, TRUE, BusTypeSata) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_AUTO, 8);
+
+        Assert::AreEqual(1, (int)workers);
+        Assert::AreEqual((int)STORAGE_ROTATIONAL, (int)devices[0].kind);
+        Assert::AreEqual(1, (int)devices[0].readers);
+    }
+
+    TEST_METHOD(TestStripedRotational)
+    {
+        StorageDevice devices[] = { Disk(3, TRUE, TRUE, BusTypeRAID) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_AUTO, 8);
+
+        Assert::AreEqual(3, (int)workers);
+        Assert::AreEqual(3, (int)devices[0].readers);
+    }
+
+    TEST_METHOD(TestSolidStateOneReaderPerProcessor)
+    {
+        StorageDevice devices[] = { Disk(1, TRUE, FALSE, BusTypeSata) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_AUTO, 8);
+
+        Assert::AreEqual(8, (int)workers);
+        Assert::AreEqual((int)STORAGE_SOLID_STATE, (int)devices[0].kind);
+        Assert::AreEqual(8, (int)devices[0].readers);
+    }
+
+    TEST_METHOD(TestNvmeWithoutSeekPenaltyQuery)
+    {
+        StorageDevice devices[] = { Disk(1, FALSE, FALSE, BusTypeNvme) };
+
+        PlanStorage(devices, _countof(devices), STORAGE_AUTO, 4);
+
+        Assert::AreEqual((int)STORAGE_SOLID_STATE, (int)devices[0].kind);
+    }
+
+    TEST_METHOD(TestUnknownKeepsProcessorCount)
+    {
+        StorageDevice devices[] = { Disk(0, FALSE, FALSE, BusTypeUnknown) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_AUTO, 4);
+
+        Assert::AreEqual(4, (int)workers);
+        Assert::AreEqual((int)STORAGE_UNKNOWN, (int)devices[0].kind);
+    }
+
+    TEST_METHOD(TestMixedDisks)
+    {
+        StorageDevice devices[] = {
+            Disk(0, FALSE, FALSE, BusTypeUnknown),
+            Disk(1, TRUE, TRUE, BusTypeSata),
+            Disk(1, TRUE, TRUE, BusTypeUsb),
+            Disk(1, TRUE, FALSE, BusTypeNvme),
+        };
+
+        // a stream for each rotational disk next to the processors for the rest
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_AUTO, 8);
+
+        Assert::AreEqual(10, (int)workers);
+        Assert::AreEqual(8, (int)devices[0].readers);
+        Assert::AreEqual(1, (int)devices[1].readers);
+        Assert::AreEqual(1, (int)devices[2].readers);
+        Assert::AreEqual(8, (int)devices[3].readers);
+    }
+
+    TEST_METHOD(TestForcedRotational)
+    {
+        StorageDevice devices[] = { Disk(1, TRUE, FALSE, BusTypeNvme), Disk(0, FALSE, FALSE, BusTypeUnknown) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_ROTATIONAL, 8);
+
+        Assert::AreEqual(2, (int)workers);
+        Assert::AreEqual((int)STORAGE_ROTATIONAL, (int)devices[0].kind);
+        Assert::AreEqual(1, (int)devices[0].readers);
+        Assert::AreEqual(1, (int)devices[1].readers);
+    }
+
+    TEST_METHOD(TestForcedSolidState)
+    {
+        StorageDevice devices[] = { Disk(1, TRUE, TRUE, BusTypeSata) };
+
+        DWORD workers = PlanStorage(devices, _countof(devices), STORAGE_SOLID_STATE, 8);
+
+        Assert::AreEqual(8, (int)workers);
+        Assert::AreEqual(8, (int)devices[0].readers);
+    }
+};
+}
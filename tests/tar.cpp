@@ -0,0 +1,146 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace tar {
+static const char* abcDigest = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+static const char* emptyDigest = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+static void AddHeader(std::string& archive, const std::string& name, char type, size_t size, const std::string& link = "")
+{
+    char header[512] = { 0 };
+    memcpy(header, name.data(), name.size() < 100 ? name.size() : 100);
+    memcpy(header + 157, link.data(), link.size() < 100 ? link.size() : 100);
+    memcpy(header + 100, "0000644", 7);
+    sprintf_s(header + 124, 12, "%011o", (unsigned)size);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    unsigned sum = 0;
+    memset(header + 148, ' ', 8);
+    for (size_t i = 0; i < sizeof(header); i++)
+    {
+        sum += (unsigned char)header[i];
+    }
+    sprintf_s(header + 148, 8, "%06o", sum);
+    archive.append(header, sizeof(header));
+}
+
+static void AddData(std::string& archive, const std::string& data)
+{
+    archive += data;
+    archive.append((512 - data.size() % 512) % 512, '\0');
+}
+
+static void AddFile(std::string& archive, const std::string& name, const std::string& data)
+{
+    AddHeader(archive, name, '0', data.size());
+    AddData(archive, data);
+}
+
+// a name longer than the 100 bytes of the header, in a pax record
+static void AddPaxFile(std::string& archive, const std::string& name, const std::string& data)
+{
+    std::string record = " path=" + name + "\n";
+    size_t length = record.size() + 1;
+    while (std::to_string(length).size() + record.size() != length)
+    {
+        length++;
+    }
+    record = std::to_string(length) + record;
+
+    AddHeader(archive, "PaxHeaders/file", 'x', record.size());
+    AddData(archive, record);
+    AddFile(archive, name.substr(0, 99), data);
+}
+
+static void WriteFile(const char* file, const std::string& data)
+{
+    std::ofstream out(file, std::ios::binary);
+    out << data;
+}
+
+TEST_CLASS(fHashTar)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateArchive)
+    {
+        std::string archive;
+        AddHeader(archive, "dir/", '5', 0);
+        AddFile(archive, "dir/abc.txt", "abc");
+        AddFile(archive, "./empty.txt", "");
+        AddPaxFile(archive, "dir/" + std::string(150, 'n') + ".txt", "abc");
+        AddHeader(archive, "dir/link.txt", '1', 0, "./dir/abc.txt");
+        archive.append(1024, '\0');
+        WriteFile("TarArchive.tar", archive);
+    }
+
+    TEST_METHOD(TestCheckMembers)
+    {
+        WriteFile("TarManifest.txt", std::string(abcDigest) + " *dir\\abc.txt\n"
+                                     + emptyDigest + " *empty.txt\n"
+                                     + abcDigest + " *dir/" + std::string(150, 'n') + ".txt\n"
+                                     + abcDigest + " 3 *dir/link.txt\n");
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.tarFile = (LPWSTR)L"TarArchive.tar";
+        args.sumFile = (LPWSTR)L"TarManifest.txt";
+        Assert::AreEqual((int)SUCCESS, (int)HashTar(&args));
+    }
+
+    TEST_METHOD(TestChangedMember)
+    {
+        WriteFile("TarManifest.txt", std::string(emptyDigest) + " *dir/abc.txt\n");
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.tarFile = (LPWSTR)L"TarArchive.tar";
+        args.sumFile = (LPWSTR)L"TarManifest.txt";
+        Assert::AreEqual((int)CHECK_SUM_CHECKSUM_FAILED, (int)HashTar(&args));
+    }
+
+    TEST_METHOD(TestMissingMember)
+    {
+        WriteFile("TarManifest.txt", std::string(abcDigest) + " *dir/abc.txt\n"
+                                     + abcDigest + " *dir/missing.txt\n");
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.tarFile = (LPWSTR)L"TarArchive.tar";
+        args.sumFile = (LPWSTR)L"TarManifest.txt";
+        Assert::AreEqual((int)CHECK_SUM_CHECKSUM_FAILED, (int)HashTar(&args));
+    }
+
+    TEST_METHOD(TestInvalidHeader)
+    {
+        std::string archive;
+        AddFile(archive, "abc.txt", "abc");
+        archive[148] = '7';
+        WriteFile("TarArchive.tar", archive);
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.tarFile = (LPWSTR)L"TarArchive.tar";
+        Assert::AreEqual((int)TAR_INVALID, (int)HashTar(&args));
+    }
+
+    TEST_METHOD(TestTruncatedMember)
+    {
+        std::string archive;
+        AddHeader(archive, "abc.txt", '0', 4096);
+        archive += "abc";
+        WriteFile("TarArchive.tar", archive);
+
+        Args args = { 0 };
+        args.status = TRUE;
+        args.tarFile = (LPWSTR)L"TarArchive.tar";
+        Assert::AreEqual((int)TAR_INVALID, (int)HashTar(&args));
+    }
+};
+}
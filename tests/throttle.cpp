@@ -0,0 +1,93 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace throttle {
+
+#define THROTTLE_TEST_SIZE (8 << 20)
+
+// seconds spent hashing the test file, the digest has to come out the same as unthrottled
+static double TimedHash(Args* args)
+{
+    LPWSTR hash = NULL;
+    ULONGLONG started = GetTickCount64();
+
+    ErrorCode act = CalcHash(args, &hash, L"Throttle.bin");
+    double elapsed = (GetTickCount64() - started) / 1000.0;
+
+    Assert::AreEqual((int)SUCCESS, (int)act);
+    Assert::AreEqual(L"2daeb1f36095b44b318410b3f4e8b5d989dcc7bb023d1426c492dab0a3053e74", hash);
+    return elapsed;
+}
+
+TEST_CLASS(fThrottleRead)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateThrottleTestFile)
+    {
+        std::ofstream file("Throttle.bin", std::ios::binary);
+        file << std::string(THROTTLE_TEST_SIZE, '\0');
+        file.close();
+    }
+
+    TEST_METHOD(TestMaxRate)
+    {
+        Args args = { 0 };
+        args.maxRate.limit = 4 << 20;
+
+        // 2 seconds worth of reads, the first 100 ms of it may go out at once
+        double elapsed = TimedHash(&args);
+
+        Assert::IsTrue(elapsed >= 1.9 * 0.97);
+        Assert::IsTrue(elapsed <= 2.0 * 1.25);
+    }
+
+    TEST_METHOD(TestMaxIops)
+    {
+        Args args = { 0 };
+        args.maxIops.limit = 8;
+
+        // one read per 1 MiB buffer, 8 reads take a second less the burst
+        double elapsed = TimedHash(&args);
+
+        Assert::IsTrue(elapsed >= 0.9 * 0.97);
+        Assert::IsTrue(elapsed <= 1.0 * 1.25);
+    }
+
+    TEST_METHOD(TestSharedBetweenThreads)
+    {
+        Args args = { 0 };
+        args.maxRate.limit = 16 << 20;
+
+        // four readers draw from one budget, 32 MiB at 16 MiB/s
+        ULONGLONG started = GetTickCount64();
+        std::vector<std::thread> readers;
+        ErrorCode results[4];
+        LPWSTR hashes[4] = { NULL };
+        for (int i = 0; i < 4; ++i)
+        {
+            readers.emplace_back([&args, &results, &hashes, i]() { results[i] = CalcHash(&args, &hashes[i], L"Throttle.bin"); });
+        }
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        double elapsed = (GetTickCount64() - started) / 1000.0;
+
+        for (int i = 0; i < 4; ++i)
+        {
+            Assert::AreEqual((int)SUCCESS, (int)results[i]);
+            Assert::AreEqual(L"2daeb1f36095b44b318410b3f4e8b5d989dcc7bb023d1426c492dab0a3053e74", hashes[i]);
+        }
+
+        Assert::IsTrue(elapsed >= 1.9 * 0.97);
+        Assert::IsTrue(elapsed <= 2.0 * 1.25);
+    }
+};
+}
@@ -0,0 +1,94 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace tree {
+static std::wstring Digest(Args* args, ErrorCode expected = SUCCESS)
+{
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1] = L"";
+
+    ErrorCode act = CalcTreeDigest(args, digest);
+    Assert::AreEqual((int)expected, (int)act);
+    if (act == SUCCESS)
+    {
+        FormatDigest(hash, digest);
+    }
+    return hash;
+}
+
+TEST_CLASS(fTreeDigest)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateTree)
+    {
+        CreateDirectoryW(L"Tree", NULL);
+        CreateDirectoryW(L"Tree\\sub", NULL);
+
+        std::ofstream a("Tree\\a.bin", std::ios::binary);
+        a << "abc";
+        a.close();
+
+        std::ofstream b("Tree\\sub\\b.bin", std::ios::binary);
+        b << "abc";
+        b.close();
+    }
+
+    TEST_METHOD(TestKnownDigest)
+    {
+        Args args = { 0 };
+        args.treeDirectory = (LPWSTR)L"Tree";
+
+        // the nodes are 'f' or 'd', the UTF-8 name, a zero byte and the digest
+        Assert::AreEqual(std::wstring(L"5b31e7f6034f3f8fb0d2623f9c79bb63136e1c975fe83bb2594c5aa3a37fe57c"), Digest(&args));
+    }
+
+    TEST_METHOD(TestEmptyDirectoryCounts)
+    {
+        CreateDirectoryW(L"Tree\\empty", NULL);
+        Args args = { 0 };
+        args.treeDirectory = (LPWSTR)L"Tree";
+
+        std::wstring act = Digest(&args);
+        RemoveDirectoryW(L"Tree\\empty");
+
+        Assert::AreEqual(std::wstring(L"8d638e2daca6529302a758b75f8bec33cc5ee115553671a25f62c6db51f5f83e"), act);
+    }
+
+    TEST_METHOD(TestCacheFollowsChanges)
+    {
+        DeleteFileW(L"TreeCache.bin");
+        Args args = { 0 };
+        args.treeDirectory = (LPWSTR)L"Tree";
+        args.treeCache = (LPWSTR)L"TreeCache.bin";
+
+        std::wstring first = Digest(&args);
+        std::wstring cached = Digest(&args);
+        Assert::AreEqual(first, cached);
+
+        std::ofstream b("Tree\\sub\\b.bin", std::ios::binary);
+        b << "abcd";
+        b.close();
+
+        std::wstring changed = Digest(&args);
+        args.treeCache = NULL;
+        std::wstring uncached = Digest(&args);
+
+        Assert::AreNotEqual(first, changed);
+        Assert::AreEqual(uncached, changed);
+    }
+
+    TEST_METHOD(TestMissingDirectory)
+    {
+        Args args = { 0 };
+        args.status = TRUE;
+        args.treeDirectory = (LPWSTR)L"TreeMissing";
+
+        Digest(&args, TREE_FAILED_TO_WALK);
+    }
+};
+}
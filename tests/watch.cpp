@@ -0,0 +1,150 @@
+#include <CppUnitTest.h>
+#include <sha256sum.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace watch {
+static DWORD WINAPI RunWatch(LPVOID parameter)
+{
+    return (DWORD)WatchDirectory((Args*)parameter);
+}
+
+static std::string ReadManifest()
+{
+    std::ifstream in("Watched.sums", std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// the manifest is replaced as a whole, so it either has the lines or not yet
+static std::string WaitForManifest(const std::string& expected)
+{
+    std::string act;
+    for (int i = 0; i < 100; i++)
+    {
+        act = ReadManifest();
+        if (act == expected)
+        {
+            break;
+        }
+        Sleep(100);
+    }
+    return act;
+}
+
+TEST_CLASS(fWatchDirectory)
+{
+public:
+
+    TEST_METHOD_INITIALIZE(CreateTree)
+    {
+        CreateDirectoryW(L"Watched", NULL);
+        CreateDirectoryW(L"Watched\\sub", NULL);
+        DeleteFileW(L"Watched.sums");
+        DeleteFileW(L"Watched\\c.bin");
+
+        std::ofstream a("Watched\\a.bin", std::ios::binary);
+        a << "abc";
+        a.close();
+
+        std::ofstream b("Watched\\sub\\b.bin", std::ios::binary);
+        b << "";
+        b.close();
+    }
+
+    TEST_METHOD(TestFollowsChanges)
+    {
+        Args args = { 0 };
+        args.watchDirectory = (LPWSTR)L"Watched";
+        args.watchOutput = (LPWSTR)L"Watched.sums";
+
+        HANDLE hThread = CreateThread(NULL, 0, RunWatch, &args, 0, NULL);
+        Assert::IsNotNull(hThread);
+
+        std::string initial = WaitForManifest(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *a.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 *sub\\b.bin\r\n");
+
+        std::ofstream b("Watched\\sub\\b.bin", std::ios::binary);
+        b << "abc";
+        b.close();
+        DeleteFileW(L"Watched\\a.bin");
+
+        std::string changed = WaitForManifest(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *sub\\b.bin\r\n");
+
+        StopWatch();
+        WaitForSingleObject(hThread, INFINITE);
+        DWORD exitCode = 0;
+        GetExitCodeThread(hThread, &exitCode);
+        CloseHandle(hThread);
+
+        Assert::AreEqual(std::string(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *a.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 *sub\\b.bin\r\n"), initial);
+        Assert::AreEqual(std::string(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad *sub\\b.bin\r\n"), changed);
+        Assert::AreEqual((DWORD)SUCCESS, exitCode);
+    }
+
+    TEST_METHOD(TestRetriesFileOpenForWriting)
+    {
+        Args args = { 0 };
+        args.watchDirectory = (LPWSTR)L"Watched";
+        args.watchOutput = (LPWSTR)L"Watched.sums";
+        args.withSize = TRUE;
+
+        // still open for writing, so it cannot be hashed yet
+        HANDLE hWriter = CreateFileW(L"Watched\\c.bin", GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        Assert::IsTrue(hWriter != INVALID_HANDLE_VALUE);
+        DWORD written = 0;
+        WriteFile(hWriter, "abc", 3, &written, NULL);
+
+        HANDLE hThread = CreateThread(NULL, 0, RunWatch, &args, 0, NULL);
+        Assert::IsNotNull(hThread);
+
+        std::string busy = WaitForManifest(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *a.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 0 *sub\\b.bin\r\n");
+        Sleep(2000);
+        std::string stillOpen = ReadManifest();
+
+        CloseHandle(hWriter);
+
+        std::string closed = WaitForManifest(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *a.bin\r\n"
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *c.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 0 *sub\\b.bin\r\n");
+
+        StopWatch();
+        WaitForSingleObject(hThread, INFINITE);
+        DWORD exitCode = 0;
+        GetExitCodeThread(hThread, &exitCode);
+        CloseHandle(hThread);
+
+        std::string withoutC(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *a.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 0 *sub\\b.bin\r\n");
+        Assert::AreEqual(withoutC, busy);
+        Assert::AreEqual(withoutC, stillOpen);
+        Assert::AreEqual(std::string(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *a.bin\r\n"
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad 3 *c.bin\r\n"
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855 0 *sub\\b.bin\r\n"), closed);
+        Assert::AreEqual((DWORD)SUCCESS, exitCode);
+    }
+
+    TEST_METHOD(TestMissingDirectory)
+    {
+        Args args = { 0 };
+        args.watchDirectory = (LPWSTR)L"NotWatched";
+        args.watchOutput = (LPWSTR)L"Watched.sums";
+
+        Assert::AreEqual((int)WATCH_FAILED_TO_OPEN, (int)WatchDirectory(&args));
+    }
+};
+}
@@ -0,0 +1,64 @@
+#include "sha256sum.h"
+
+#define THROTTLE_BURST_DIVISOR 10 // up to 100 ms worth of I/O may start at once
+
+static LONG64 Frequency(void)
+{
+    static LONG64 frequency = 0;
+
+    // constant for the lifetime of the system, racing threads store the same value
+    if (frequency == 0)
+    {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        frequency = value.QuadPart;
+    }
+    return frequency;
+}
+
+static LONG64 Now(void)
+{
+    LARGE_INTEGER value;
+    QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+// Generic cell rate algorithm: limit->next is the time at which everything that
+// was reserved so far is paid for. A reservation moves it forward by its cost
+// with a single compare exchange, the caller sleeps until its share of the
+// timeline begins, less the burst. Idle time is not saved up beyond that.
+static void Reserve(__inout RateLimit* limit, __in ULONGLONG units)
+{
+    LONG64 frequency = Frequency();
+    LONG64 cost = (LONG64)(units * (ULONGLONG)frequency / limit->limit);
+    LONG64 burst = frequency / THROTTLE_BURST_DIVISOR;
+    LONG64 now = Now();
+    LONG64 next;
+    LONG64 reserved;
+
+    do
+    {
+        next = limit->next;
+        LONG64 start = next > now ? next : now;
+        reserved = start + cost;
+    } while (InterlockedCompareExchange64(&limit->next, reserved, next) != next);
+
+    LONG64 wait = reserved - burst - now;
+    if (wait > 0)
+    {
+        Sleep((DWORD)(wait * 1000 / frequency));
+    }
+}
+
+// called before every block read, shared by all threads that read with args
+void ThrottleRead(__in Args* args, __in DWORD bytes)
+{
+    if (args->maxRate.limit > 0)
+    {
+        Reserve(&args->maxRate, bytes);
+    }
+    if (args->maxIops.limit > 0)
+    {
+        Reserve(&args->maxIops, 1);
+    }
+}
@@ -0,0 +1,715 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define TREE_CACHE_MAGIC 0x43543253 // "S2TC"
+#define TREE_CACHE_VERSION 1
+#define TREE_CACHE_DIRECTORY 1
+#define TREE_NODE_FILE 'f'
+#define TREE_NODE_DIRECTORY 'd'
+
+// The tree cache file is a TreeCacheHeader, count TreeCacheEntry sorted by path
+// and the pool of UTF-8 paths, like the binary index. It is mapped read only
+// and replaced as a whole at the end of a run.
+typedef struct tree_cache_header_t
+{
+    DWORD magic;
+    WORD version;
+    WORD flags;
+    ULONGLONG count;
+    ULONGLONG poolSize;
+    BYTE root[SHA256_DIGEST_LENGTH]; // of the full path of the directory
+} TreeCacheHeader;
+
+typedef struct tree_cache_entry_t
+{
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    BYTE key[SHA256_DIGEST_LENGTH]; // the metadata the digest was computed for
+    ULONGLONG pathOffset;
+    DWORD pathLength;
+    DWORD flags;
+} TreeCacheEntry;
+
+typedef struct tree_cache_t
+{
+    HANDLE hFile;
+    HANDLE hMapping;
+    PBYTE view;
+    TreeCacheHeader* header;
+    TreeCacheEntry* entries;
+    PBYTE pool;
+} TreeCache;
+
+// A file or directory below the root. The children of a directory follow each
+// other in the array, sorted by name, and always come after their parent.
+typedef struct tree_node_t
+{
+    LPSTR path; // UTF-8, relative to the root, backslash separated
+    DWORD pathLength;
+    DWORD nameOffset;
+    BOOL directory;
+    size_t firstChild;
+    size_t childCount;
+    ULONGLONG size;
+    FILETIME lastWriteTime;
+    BYTE key[SHA256_DIGEST_LENGTH];
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    BOOL known;
+    ErrorCode status;
+} TreeNode;
+
+typedef struct tree_t
+{
+    Args* args;
+    PathFilter* filter;
+    BYTE root[SHA256_DIGEST_LENGTH];
+    TreeNode* nodes;
+    size_t count;
+    size_t capacity;
+    PBYTE scratch; // serialized children of the directory being hashed
+    size_t scratchCapacity;
+} Tree;
+
+// ordinal byte order, a path sorts before every longer path it is a prefix of
+static int ComparePath(__in LPCSTR left, __in DWORD leftLength, __in LPCSTR right, __in DWORD rightLength)
+{
+    int result = memcmp(left, right, leftLength < rightLength ? leftLength : rightLength);
+    if (result != 0)
+    {
+        return result;
+    }
+    return leftLength < rightLength ? -1 : (leftLength > rightLength ? 1 : 0);
+}
+
+static int CompareNames(const void* a, const void* b)
+{
+    const TreeNode* left = (const TreeNode*)a;
+    const TreeNode* right = (const TreeNode*)b;
+
+    return ComparePath(left->path + left->nameOffset, left->pathLength - left->nameOffset,
+                       right->path + right->nameOffset, right->pathLength - right->nameOffset);
+}
+
+static void CloseTreeCache(__inout TreeCache* cache)
+{
+    if (cache->view != NULL)
+    {
+        UnmapViewOfFile(cache->view);
+    }
+    if (cache->hMapping != NULL)
+    {
+        CloseHandle(cache->hMapping);
+    }
+    if (cache->hFile != NULL)
+    {
+        CloseHandle(cache->hFile);
+    }
+    ZeroMemory(cache, sizeof(TreeCache));
+}
+
+// A missing cache is empty, so is the cache of another directory. A cache that
+// does not check out is reported and ignored, it is rebuilt at the end of the run.
+static void OpenTreeCache(__in Args* args, __in_ecount(SHA256_DIGEST_LENGTH) PBYTE root, __out TreeCache* cache)
+{
+    LARGE_INTEGER fileSize;
+
+    ZeroMemory(cache, sizeof(TreeCache));
+    if (args->treeCache == NULL)
+    {
+        return;
+    }
+
+    cache->hFile = CreateFileW(args->treeCache, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (cache->hFile == INVALID_HANDLE_VALUE)
+    {
+        cache->hFile = NULL;
+        return;
+    }
+
+    if (!GetFileSizeEx(cache->hFile, &fileSize) || (ULONGLONG)fileSize.QuadPart < sizeof(TreeCacheHeader))
+    {
+        goto Invalid;
+    }
+
+    cache->hMapping = CreateFileMappingW(cache->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    cache->view = cache->hMapping != NULL ? (PBYTE)MapViewOfFile(cache->hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (cache->view == NULL)
+    {
+        goto Invalid;
+    }
+
+    cache->header = (TreeCacheHeader*)cache->view;
+    cache->entries = (TreeCacheEntry*)(cache->view + sizeof(TreeCacheHeader));
+
+    ULONGLONG available = (ULONGLONG)fileSize.QuadPart - sizeof(TreeCacheHeader);
+    if (cache->header->magic != TREE_CACHE_MAGIC
+        || cache->header->version != TREE_CACHE_VERSION
+        || cache->header->count > available / sizeof(TreeCacheEntry)
+        || cache->header->poolSize != available - cache->header->count * sizeof(TreeCacheEntry))
+    {
+        goto Invalid;
+    }
+    cache->pool = (PBYTE)(cache->entries + cache->header->count);
+
+    // the same relative paths in a copy of the tree do not share digests
+    if (memcmp(cache->header->root, root, SHA256_DIGEST_LENGTH) != 0)
+    {
+        CloseTreeCache(cache);
+    }
+    return;
+
+Invalid:
+    LogError(args, L"'%ls' is not a valid tree cache, it is rebuilt\r\n", args->treeCache, 0);
+    CloseTreeCache(cache);
+}
+
+static TreeCacheEntry* TreeCacheLookup(__in TreeCache* cache, __in LPCSTR path, __in DWORD pathLength)
+{
+    if (cache->header == NULL)
+    {
+        return NULL;
+    }
+
+    ULONGLONG low = 0;
+    ULONGLONG high = cache->header->count;
+    while (low < high)
+    {
+        ULONGLONG middle = low + (high - low) / 2;
+        TreeCacheEntry* entry = &cache->entries[middle];
+        if (entry->pathOffset > cache->header->poolSize
+            || entry->pathLength > cache->header->poolSize - entry->pathOffset)
+        {
+            return NULL;
+        }
+
+        int order = ComparePath((LPCSTR)cache->pool + entry->pathOffset, entry->pathLength, path, pathLength);
+        if (order == 0)
+        {
+            return entry;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+static TreeNode* AddNode(__inout Tree* tree)
+{
+    if (tree->count == tree->capacity)
+    {
+        size_t newCapacity = tree->capacity == 0 ? 1024 : tree->capacity * 2;
+        TreeNode* grown = realloc(tree->nodes, newCapacity * sizeof(TreeNode));
+        if (grown == NULL)
+        {
+            return NULL;
+        }
+        tree->nodes = grown;
+        tree->capacity = newCapacity;
+    }
+
+    TreeNode* node = &tree->nodes[tree->count++];
+    ZeroMemory(node, sizeof(TreeNode));
+    return node;
+}
+
+static size_t AppendSeparator(__inout LPWSTR file, __in size_t used)
+{
+    if (used == 0 || file[used - 1] == L'\\' || file[used - 1] == L'/')
+    {
+        return 0;
+    }
+    file[used] = L'\\';
+    return 1;
+}
+
+// root joined with the UTF-8 path of a node, with \* appended to list it
+static LPWSTR NodeFile(__in LPCWSTR root, __in LPCSTR path, __in DWORD pathLength, __in BOOL pattern)
+{
+    size_t used = wcslen(root);
+    size_t length = used + pathLength + 4;
+    LPWSTR file = malloc(length * sizeof(WCHAR));
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(file, root, used * sizeof(WCHAR));
+    if (pathLength > 0)
+    {
+        used += AppendSeparator(file, used);
+        used += MultiByteToWideChar(CP_UTF8, 0, path, (int)pathLength, file + used, (int)(length - used));
+    }
+    if (pattern)
+    {
+        used += AppendSeparator(file, used);
+        file[used++] = L'*';
+    }
+    file[used] = L'\0';
+    return file;
+}
+
+// lists the directory of tree->nodes[index], its children are appended sorted by name
+static ErrorCode ListDirectory(__inout Tree* tree, __in size_t index)
+{
+    ErrorCode status = SUCCESS;
+    WIN32_FIND_DATAW data;
+    CHAR name[MAX_PATH * 3];
+
+    LPWSTR pattern = NodeFile(tree->args->treeDirectory, tree->nodes[index].path, tree->nodes[index].pathLength, TRUE);
+    if (pattern == NULL)
+    {
+        return TREE_ALLOCATE_ERROR;
+    }
+
+    HANDLE hFind = FindFirstFileExW(pattern, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        // a directory that cannot be listed would silently change the digest
+        LogError(tree->args, L"failed to list '%ls' with error: %lu\r\n", pattern, GetLastError());
+        free(pattern);
+        return TREE_FAILED_TO_WALK;
+    }
+    free(pattern);
+
+    tree->nodes[index].firstChild = tree->count;
+    do
+    {
+        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        BOOL directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+        // junctions and symlinks to directories could loop
+        if (directory && (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+        {
+            continue;
+        }
+
+        int nameLength = WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, name, sizeof(name), NULL, NULL) - 1;
+        if (nameLength < 0)
+        {
+            status = TREE_FAILED_TO_WALK;
+            break;
+        }
+
+        DWORD parentLength = tree->nodes[index].pathLength;
+        DWORD offset = parentLength > 0 ? parentLength + 1 : 0;
+        LPSTR path = malloc(offset + nameLength + 1);
+        if (path == NULL)
+        {
+            status = TREE_ALLOCATE_ERROR;
+            break;
+        }
+        if (parentLength > 0)
+        {
+            memcpy(path, tree->nodes[index].path, parentLength);
+            path[parentLength] = '\\';
+        }
+        memcpy(path + offset, name, nameLength + 1);
+
+        // files left out of the selection are not part of the digest
+        if (!directory && tree->filter != NULL)
+        {
+            LPWSTR relative = NodeFile(L"", path, offset + nameLength, FALSE);
+            BOOL matches = relative != NULL && PathFilterMatches(tree->filter, relative);
+            free(relative);
+            if (!matches)
+            {
+                free(path);
+                continue;
+            }
+        }
+
+        TreeNode* node = AddNode(tree);
+        if (node == NULL)
+        {
+            free(path);
+            status = TREE_ALLOCATE_ERROR;
+            break;
+        }
+        node->path = path;
+        node->pathLength = offset + nameLength;
+        node->nameOffset = offset;
+        node->directory = directory;
+        node->size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        node->lastWriteTime = data.ftLastWriteTime;
+    } while (FindNextFileW(hFind, &data) != 0);
+
+    FindClose(hFind);
+
+    TreeNode* parent = &tree->nodes[index];
+    parent->childCount = tree->count - parent->firstChild;
+    qsort(tree->nodes + parent->firstChild, parent->childCount, sizeof(TreeNode), CompareNames);
+    return status;
+}
+
+static BOOL GrowScratch(__inout Tree* tree, __in size_t size)
+{
+    if (size <= tree->scratchCapacity)
+    {
+        return TRUE;
+    }
+
+    size_t newCapacity = tree->scratchCapacity == 0 ? 64 * 1024 : tree->scratchCapacity;
+    while (newCapacity < size)
+    {
+        newCapacity *= 2;
+    }
+    PBYTE grown = realloc(tree->scratch, newCapacity);
+    if (grown == NULL)
+    {
+        return FALSE;
+    }
+    tree->scratch = grown;
+    tree->scratchCapacity = newCapacity;
+    return TRUE;
+}
+
+// Hashes the children of a directory in name order, each one as its type, its
+// UTF-8 name, a zero byte and the 32 bytes of either its key or its digest.
+static ErrorCode HashChildren(__inout Tree* tree, __in size_t index, __in BOOL keys, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    TreeNode* parent = &tree->nodes[index];
+    size_t used = 0;
+
+    for (size_t i = parent->firstChild; i < parent->firstChild + parent->childCount; i++)
+    {
+        TreeNode* child = &tree->nodes[i];
+        DWORD nameLength = child->pathLength - child->nameOffset;
+
+        if (!GrowScratch(tree, used + nameLength + 2 + SHA256_DIGEST_LENGTH))
+        {
+            return TREE_ALLOCATE_ERROR;
+        }
+        tree->scratch[used++] = child->directory ? TREE_NODE_DIRECTORY : TREE_NODE_FILE;
+        memcpy(tree->scratch + used, child->path + child->nameOffset, nameLength);
+        used += nameLength;
+        tree->scratch[used++] = 0;
+        memcpy(tree->scratch + used, keys ? child->key : child->digest, SHA256_DIGEST_LENGTH);
+        used += SHA256_DIGEST_LENGTH;
+    }
+
+    if (used > MAXDWORD)
+    {
+        return TREE_ALLOCATE_ERROR;
+    }
+    return HashMemory(tree->args, tree->scratch, (DWORD)used, digest);
+}
+
+static BOOL StoreDigest(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    TreeNode* node = (TreeNode*)job->context;
+
+    UNREFERENCED_PARAMETER(args);
+    UNREFERENCED_PARAMETER(context);
+
+    // CalcDigest already reported a failure
+    node->status = job->status;
+    node->known = job->status == SUCCESS;
+    memcpy(node->digest, job->digest, SHA256_DIGEST_LENGTH);
+    return TRUE;
+}
+
+static int CompareNodePaths(void* context, const void* a, const void* b)
+{
+    TreeNode* nodes = (TreeNode*)context;
+    const TreeNode* left = &nodes[*(const size_t*)a];
+    const TreeNode* right = &nodes[*(const size_t*)b];
+
+    return ComparePath(left->path, left->pathLength, right->path, right->pathLength);
+}
+
+static BOOL WriteAll(__in HANDLE hFile, __in LPCVOID data, __in ULONGLONG size)
+{
+    const BYTE* current = (const BYTE*)data;
+    while (size > 0)
+    {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written;
+        if (!WriteFile(hFile, current, chunk, &written, NULL))
+        {
+            return FALSE;
+        }
+        current += written;
+        size -= written;
+    }
+    return TRUE;
+}
+
+// writes every node of this run next to the cache and moves it over the old one
+static ErrorCode WriteTreeCache(__in Args* args, __in Tree* tree)
+{
+    ErrorCode status = SUCCESS;
+    HANDLE hOutput = INVALID_HANDLE_VALUE;
+    TreeCacheEntry* entries = malloc((tree->count > 0 ? tree->count : 1) * sizeof(TreeCacheEntry));
+    size_t* order = malloc((tree->count > 0 ? tree->count : 1) * sizeof(size_t));
+    PBYTE pool = NULL;
+    size_t temporaryLength = wcslen(args->treeCache) + 5;
+    LPWSTR temporary = malloc(temporaryLength * sizeof(WCHAR));
+    TreeCacheHeader header = { 0 };
+
+    if (entries == NULL || order == NULL || temporary == NULL)
+    {
+        status = TREE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    StringCchPrintfW(temporary, temporaryLength, L"%ls.tmp", args->treeCache);
+
+    for (size_t i = 0; i < tree->count; i++)
+    {
+        order[i] = i;
+    }
+    qsort_s(order, tree->count, sizeof(size_t), CompareNodePaths, tree->nodes);
+
+    for (size_t i = 0; i < tree->count; i++)
+    {
+        TreeNode* node = &tree->nodes[order[i]];
+        memcpy(entries[i].digest, node->digest, SHA256_DIGEST_LENGTH);
+        memcpy(entries[i].key, node->key, SHA256_DIGEST_LENGTH);
+        entries[i].pathOffset = header.poolSize;
+        entries[i].pathLength = node->pathLength;
+        entries[i].flags = node->directory ? TREE_CACHE_DIRECTORY : 0;
+        header.poolSize += node->pathLength;
+    }
+
+    pool = malloc(header.poolSize > 0 ? (size_t)header.poolSize : 1);
+    if (pool == NULL)
+    {
+        status = TREE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    for (size_t i = 0; i < tree->count; i++)
+    {
+        memcpy(pool + entries[i].pathOffset, tree->nodes[order[i]].path, entries[i].pathLength);
+    }
+
+    hOutput = CreateFileW(temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hOutput == INVALID_HANDLE_VALUE)
+    {
+        status = TREE_FAILED_TO_WRITE_CACHE;
+        goto Cleanup;
+    }
+
+    header.magic = TREE_CACHE_MAGIC;
+    header.version = TREE_CACHE_VERSION;
+    header.count = tree->count;
+    memcpy(header.root, tree->root, SHA256_DIGEST_LENGTH);
+    BOOL written = WriteAll(hOutput, &header, sizeof(header))
+        && WriteAll(hOutput, entries, tree->count * sizeof(TreeCacheEntry))
+        && WriteAll(hOutput, pool, header.poolSize);
+    CloseHandle(hOutput);
+
+    if (!written || !MoveFileExW(temporary, args->treeCache, MOVEFILE_REPLACE_EXISTING))
+    {
+        status = TREE_FAILED_TO_WRITE_CACHE;
+    }
+
+Cleanup:
+    if (status == TREE_FAILED_TO_WRITE_CACHE)
+    {
+        LogError(args, L"failed to write tree cache '%ls' with error: %lu\r\n", args->treeCache, GetLastError());
+        DeleteFileW(temporary);
+    }
+    free(temporary);
+    free(pool);
+    free(order);
+    free(entries);
+
+    return status;
+}
+
+// Computes one digest for the directory args->treeDirectory, see README.md for
+// the layout of the nodes. With --tree-cache, a file whose size and last write
+// time are unchanged and a directory whose key is unchanged keep their digest
+// from the last run, so only changed files are read and only the directories
+// on their path to the root are hashed again.
+ErrorCode CalcTreeDigest(__in Args* args, __out_ecount(SHA256_DIGEST_LENGTH) PBYTE digest)
+{
+    ErrorCode status = SUCCESS;
+    Tree tree = { 0 };
+    TreeCache cache;
+    HashJob* jobs = NULL;
+    size_t jobCount = 0;
+
+    tree.args = args;
+    ZeroMemory(&cache, sizeof(cache));
+
+    // the cache belongs to one directory, named by the hash of its full path
+    WCHAR fullPath[MAX_PATH];
+    DWORD fullLength = GetFullPathNameW(args->treeDirectory, _countof(fullPath), fullPath, NULL);
+    if (fullLength == 0 || fullLength >= _countof(fullPath))
+    {
+        LogError(args, L"failed to list '%ls' with error: %lu\r\n", args->treeDirectory, GetLastError());
+        status = TREE_FAILED_TO_WALK;
+        goto Cleanup;
+    }
+    CharUpperBuffW(fullPath, fullLength);
+    status = HashMemory(args, (PBYTE)fullPath, fullLength * sizeof(WCHAR), tree.root);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+    OpenTreeCache(args, tree.root, &cache);
+
+    status = CreatePathFilter(args, &tree.filter);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    TreeNode* root = AddNode(&tree);
+    LPSTR rootPath = malloc(1);
+    if (root == NULL || rootPath == NULL)
+    {
+        free(rootPath);
+        status = TREE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    rootPath[0] = '\0';
+    root->path = rootPath;
+    root->directory = TRUE;
+
+    // breadth first, the array grows while it is walked
+    for (size_t i = 0; i < tree.count && status == SUCCESS; i++)
+    {
+        if (tree.nodes[i].directory)
+        {
+            status = ListDirectory(&tree, i);
+        }
+    }
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // keys bottom up, a directory changes with anything below it
+    for (size_t i = tree.count; i-- > 0;)
+    {
+        TreeNode* node = &tree.nodes[i];
+        if (node->directory)
+        {
+            status = HashChildren(&tree, i, TRUE, node->key);
+            if (status != SUCCESS)
+            {
+                goto Cleanup;
+            }
+        }
+        else
+        {
+            memcpy(node->key, &node->size, sizeof(node->size));
+            memcpy(node->key + sizeof(node->size), &node->lastWriteTime, sizeof(node->lastWriteTime));
+        }
+    }
+
+    jobs = calloc(tree.count, sizeof(HashJob));
+    if (jobs == NULL)
+    {
+        status = TREE_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    for (size_t i = 0; i < tree.count; i++)
+    {
+        TreeNode* node = &tree.nodes[i];
+        TreeCacheEntry* entry = TreeCacheLookup(&cache, node->path, node->pathLength);
+        if (entry != NULL
+            && (entry->flags & TREE_CACHE_DIRECTORY) == (node->directory ? TREE_CACHE_DIRECTORY : 0)
+            && memcmp(entry->key, node->key, SHA256_DIGEST_LENGTH) == 0)
+        {
+            memcpy(node->digest, entry->digest, SHA256_DIGEST_LENGTH);
+            node->known = TRUE;
+            continue;
+        }
+
+        if (!node->directory)
+        {
+            jobs[jobCount].file = NodeFile(args->treeDirectory, node->path, node->pathLength, FALSE);
+            jobs[jobCount].context = node;
+            if (jobs[jobCount++].file == NULL)
+            {
+                status = TREE_ALLOCATE_ERROR;
+                goto Cleanup;
+            }
+        }
+    }
+
+    status = RunHashJobs(args, jobs, jobCount, StoreDigest, NULL);
+    if (status != SUCCESS)
+    {
+        goto Cleanup;
+    }
+
+    // digests bottom up for the directories that changed
+    for (size_t i = tree.count; i-- > 0;)
+    {
+        TreeNode* node = &tree.nodes[i];
+        if (!node->directory && node->status != SUCCESS)
+        {
+            status = node->status;
+            goto Cleanup;
+        }
+        if (node->directory && !node->known)
+        {
+            status = HashChildren(&tree, i, FALSE, node->digest);
+            if (status != SUCCESS)
+            {
+                goto Cleanup;
+            }
+            node->known = TRUE;
+        }
+    }
+
+    memcpy(digest, tree.nodes[0].digest, SHA256_DIGEST_LENGTH);
+
+    if (args->treeCache != NULL)
+    {
+        CloseTreeCache(&cache);
+        status = WriteTreeCache(args, &tree);
+    }
+
+Cleanup:
+    for (size_t i = 0; i < jobCount; i++)
+    {
+        free(jobs[i].file);
+    }
+    free(jobs);
+    for (size_t i = 0; i < tree.count; i++)
+    {
+        free(tree.nodes[i].path);
+    }
+    free(tree.nodes);
+    free(tree.scratch);
+    FreePathFilter(tree.filter);
+    CloseTreeCache(&cache);
+
+    return status;
+}
+
+// --tree-digest prints the root digest followed by the directory
+ErrorCode TreeDigest(__in Args* args)
+{
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+    WCHAR line[MAX_PATH + SHA256_DIGEST_LENGTH * 2 + 8];
+
+    ErrorCode status = CalcTreeDigest(args, digest);
+    if (status != SUCCESS || args->status)
+    {
+        return status;
+    }
+
+    FormatDigest(hash, digest);
+    if (SUCCEEDED(StringCchPrintfW(line, _countof(line), L"%ls  %ls\r\n", hash, args->treeDirectory)))
+    {
+        WriteStdout(line);
+    }
+    return SUCCESS;
+}
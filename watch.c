@@ -0,0 +1,699 @@
+#include <strsafe.h>
+
+#include "sha256sum.h"
+
+#define WATCH_BUFFER_SIZE (64 * 1024)
+#define WATCH_DEBOUNCE 500 // ms without events before a changed file is hashed
+#define WATCH_RETRY 1000   // ms until a file still open for writing is tried again
+#define WATCH_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+// a line of the manifest, path is relative to the watched directory
+typedef struct watch_entry_t
+{
+    LPWSTR path;
+    BYTE digest[SHA256_DIGEST_LENGTH];
+    ULONGLONG size;
+} WatchEntry;
+
+// a file that changed, hashed once no event came in for it until due
+typedef struct watch_pending_t
+{
+    LPWSTR path;
+    ULONGLONG due;
+} WatchPending;
+
+typedef struct watch_t
+{
+    Args* args;
+    PathFilter* filter;
+    WCHAR root[MAX_PATH];
+    WCHAR output[MAX_PATH];
+    WCHAR temporary[MAX_PATH];
+    WatchEntry* entries; // sorted by path
+    size_t count;
+    size_t capacity;
+    WatchPending* pending;
+    size_t pendingCount;
+    size_t pendingCapacity;
+    BOOL dirty; // the manifest on disk is behind the entries
+    ErrorCode status;
+} Watch;
+
+static volatile LONG watchStopping = FALSE;
+static HANDLE watchStop = NULL;
+
+// file systems on Windows compare names case insensitive
+static int ComparePaths(__in LPCWSTR left, __in LPCWSTR right)
+{
+    return CompareStringOrdinal(left, -1, right, -1, TRUE) - CSTR_EQUAL;
+}
+
+// path itself or anything below it
+static BOOL IsBelow(__in LPCWSTR path, __in LPCWSTR directory, __in size_t directoryLength)
+{
+    if (directoryLength == 0)
+    {
+        return TRUE;
+    }
+    return wcslen(path) >= directoryLength
+        && CompareStringOrdinal(path, (int)directoryLength, directory, (int)directoryLength, TRUE) == CSTR_EQUAL
+        && (path[directoryLength] == L'\0' || path[directoryLength] == L'\\');
+}
+
+static LPWSTR JoinPath(__in LPCWSTR directory, __in LPCWSTR name, __in size_t nameLength)
+{
+    size_t directoryLength = wcslen(directory);
+    size_t length = directoryLength + nameLength + 2;
+    LPWSTR path = malloc(length * sizeof(WCHAR));
+    if (path != NULL)
+    {
+        size_t used = directoryLength;
+        memcpy(path, directory, directoryLength * sizeof(WCHAR));
+        if (used > 0 && path[used - 1] != L'\\')
+        {
+            path[used++] = L'\\';
+        }
+        memcpy(path + used, name, nameLength * sizeof(WCHAR));
+        path[used + nameLength] = L'\0';
+    }
+    return path;
+}
+
+// index of path in the entries, or where it would go
+static size_t FindEntry(__in Watch* watch, __in LPCWSTR path, __out BOOL* found)
+{
+    size_t low = 0;
+    size_t high = watch->count;
+
+    *found = FALSE;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        int order = ComparePaths(watch->entries[middle].path, path);
+        if (order == 0)
+        {
+            *found = TRUE;
+            return middle;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static BOOL SetEntry(__inout Watch* watch, __in LPCWSTR path, __in PBYTE digest, __in ULONGLONG size)
+{
+    BOOL found;
+    size_t index = FindEntry(watch, path, &found);
+
+    if (!found)
+    {
+        if (watch->count == watch->capacity)
+        {
+            size_t newCapacity = watch->capacity == 0 ? 1024 : watch->capacity * 2;
+            WatchEntry* grown = realloc(watch->entries, newCapacity * sizeof(WatchEntry));
+            if (grown == NULL)
+            {
+                return FALSE;
+            }
+            watch->entries = grown;
+            watch->capacity = newCapacity;
+        }
+
+        LPWSTR copy = JoinPath(L"", path, wcslen(path));
+        if (copy == NULL)
+        {
+            return FALSE;
+        }
+        memmove(&watch->entries[index + 1], &watch->entries[index], (watch->count - index) * sizeof(WatchEntry));
+        watch->entries[index].path = copy;
+        ++watch->count;
+    }
+
+    memcpy(watch->entries[index].digest, digest, SHA256_DIGEST_LENGTH);
+    watch->entries[index].size = size;
+    watch->dirty = TRUE;
+    return TRUE;
+}
+
+// removes a file, or a directory with everything below it
+static void RemoveEntries(__inout Watch* watch, __in LPCWSTR path)
+{
+    size_t pathLength = wcslen(path);
+    size_t kept = 0;
+
+    for (size_t i = 0; i < watch->count; i++)
+    {
+        if (IsBelow(watch->entries[i].path, path, pathLength))
+        {
+            free(watch->entries[i].path);
+            watch->dirty = TRUE;
+            continue;
+        }
+        watch->entries[kept++] = watch->entries[i];
+    }
+    watch->count = kept;
+
+    kept = 0;
+    for (size_t i = 0; i < watch->pendingCount; i++)
+    {
+        if (IsBelow(watch->pending[i].path, path, pathLength))
+        {
+            free(watch->pending[i].path);
+            continue;
+        }
+        watch->pending[kept++] = watch->pending[i];
+    }
+    watch->pendingCount = kept;
+}
+
+// the manifest and its temporary file may be inside the watched directory
+static BOOL IsOutput(__in Watch* watch, __in LPCWSTR path)
+{
+    WCHAR file[MAX_PATH];
+
+    if (FAILED(StringCchPrintfW(file, _countof(file), L"%ls%ls%ls", watch->root, watch->root[wcslen(watch->root) - 1] == L'\\' ? L"" : L"\\", path)))
+    {
+        return FALSE;
+    }
+    return ComparePaths(file, watch->output) == 0 || ComparePaths(file, watch->temporary) == 0;
+}
+
+// a later event for the same file moves the hash out again, so a file that is
+// written in many pieces is read once
+static BOOL AddPending(__inout Watch* watch, __in LPCWSTR path, __in ULONGLONG due)
+{
+    if (IsOutput(watch, path) || (watch->filter != NULL && !PathFilterMatches(watch->filter, path)))
+    {
+        return TRUE;
+    }
+
+    for (size_t i = 0; i < watch->pendingCount; i++)
+    {
+        if (ComparePaths(watch->pending[i].path, path) == 0)
+        {
+            watch->pending[i].due = due;
+            return TRUE;
+        }
+    }
+
+    if (watch->pendingCount == watch->pendingCapacity)
+    {
+        size_t newCapacity = watch->pendingCapacity == 0 ? 256 : watch->pendingCapacity * 2;
+        WatchPending* grown = realloc(watch->pending, newCapacity * sizeof(WatchPending));
+        if (grown == NULL)
+        {
+            return FALSE;
+        }
+        watch->pending = grown;
+        watch->pendingCapacity = newCapacity;
+    }
+
+    LPWSTR copy = JoinPath(L"", path, wcslen(path));
+    if (copy == NULL)
+    {
+        return FALSE;
+    }
+    watch->pending[watch->pendingCount].path = copy;
+    watch->pending[watch->pendingCount++].due = due;
+    return TRUE;
+}
+
+// queues every file below directory, relative to the root
+static ErrorCode ScanDirectory(__inout Watch* watch, __in LPCWSTR directory, __in ULONGLONG due)
+{
+    ErrorCode status = SUCCESS;
+    WIN32_FIND_DATAW data;
+
+    LPWSTR absolute = directory[0] != L'\0' ? JoinPath(watch->root, directory, wcslen(directory)) : JoinPath(L"", watch->root, wcslen(watch->root));
+    LPWSTR pattern = absolute != NULL ? JoinPath(absolute, L"*", 1) : NULL;
+    free(absolute);
+    if (pattern == NULL)
+    {
+        return WATCH_ALLOCATE_ERROR;
+    }
+
+    HANDLE hFind = FindFirstFileExW(pattern, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        // a directory that is gone again is reported by its own event
+        DWORD error = GetLastError();
+        free(pattern);
+        return directory[0] == L'\0' && error != ERROR_FILE_NOT_FOUND ? WATCH_FAILED_TO_OPEN : SUCCESS;
+    }
+    free(pattern);
+
+    do
+    {
+        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+        {
+            continue;
+        }
+
+        LPWSTR path = JoinPath(directory, data.cFileName, wcslen(data.cFileName));
+        if (path == NULL)
+        {
+            status = WATCH_ALLOCATE_ERROR;
+            break;
+        }
+
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            // junctions and symlinks to directories could loop
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+                status = ScanDirectory(watch, path, due);
+            }
+        }
+        else if (!AddPending(watch, path, due))
+        {
+            status = WATCH_ALLOCATE_ERROR;
+        }
+        free(path);
+    } while (status == SUCCESS && FindNextFileW(hFind, &data) != 0);
+
+    FindClose(hFind);
+    return status;
+}
+
+// the context of a job is the path relative to the watched directory
+static BOOL StoreWatchDigest(__in Args* args, __in HashJob* job, __in_opt PVOID context)
+{
+    Watch* watch = (Watch*)context;
+    LPCWSTR path = (LPCWSTR)job->context;
+
+    // Windows has no event for a file that was closed after writing, a file that
+    // another process still has open for writing cannot be opened without write
+    // sharing and is tried again later instead
+    if (job->status == CALC_HASH_FAILED_TO_OPEN_FILE && job->openError == ERROR_SHARING_VIOLATION)
+    {
+        if (!AddPending(watch, path, GetTickCount64() + WATCH_RETRY))
+        {
+            watch->status = WATCH_ALLOCATE_ERROR;
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    // a file that is gone by now is not reported, one that could not be opened
+    // for another reason is reported here and CalcDigest already reported one
+    // that could not be read, they stay out of the manifest until their next change
+    if (job->status != SUCCESS)
+    {
+        if (job->status == CALC_HASH_FAILED_TO_OPEN_FILE && job->openError != ERROR_FILE_NOT_FOUND && job->openError != ERROR_PATH_NOT_FOUND)
+        {
+            LogError(args, L"failed to open file '%ls' with error: %lu\r\n", job->file, job->openError);
+        }
+        RemoveEntries(watch, path);
+        return TRUE;
+    }
+
+    if (!SetEntry(watch, path, job->digest, job->hashedSize))
+    {
+        watch->status = WATCH_ALLOCATE_ERROR;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Hashes the pending files that are due on the scheduler's workers, the ones
+// that are still being written come back as pending from StoreWatchDigest.
+static ErrorCode HashDue(__inout Watch* watch)
+{
+    ErrorCode status = SUCCESS;
+    ULONGLONG now = GetTickCount64();
+    HashJob* jobs = calloc(watch->pendingCount > 0 ? watch->pendingCount : 1, sizeof(HashJob));
+    size_t count = 0;
+    size_t kept = 0;
+
+    if (jobs == NULL)
+    {
+        status = WATCH_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+
+    for (size_t i = 0; i < watch->pendingCount; i++)
+    {
+        WatchPending* pending = &watch->pending[i];
+        if (pending->due > now)
+        {
+            watch->pending[kept++] = *pending;
+            continue;
+        }
+
+        LPWSTR file = JoinPath(watch->root, pending->path, wcslen(pending->path));
+        if (file == NULL)
+        {
+            watch->pending[kept++] = *pending;
+            status = WATCH_ALLOCATE_ERROR;
+            continue;
+        }
+
+        jobs[count].file = file;
+        jobs[count].quietOpen = TRUE;
+        jobs[count].context = pending->path;
+        ++count;
+    }
+    watch->pendingCount = kept;
+
+    if (count > 0)
+    {
+        ErrorCode hashStatus = RunHashJobs(watch->args, jobs, count, StoreWatchDigest, watch);
+        if (status == SUCCESS)
+        {
+            status = hashStatus != SUCCESS ? hashStatus : watch->status;
+        }
+    }
+
+Cleanup:
+    for (size_t i = 0; i < count; i++)
+    {
+        free(jobs[i].file);
+        free(jobs[i].context);
+    }
+    free(jobs);
+
+    return status;
+}
+
+// Writes the manifest in the format of FILE arguments, sorted by path, next to
+// it and moves it over the old one, so readers never see half a manifest.
+static ErrorCode WriteWatchManifest(__inout Watch* watch)
+{
+    ErrorCode status = SUCCESS;
+    HANDLE hOutput = INVALID_HANDLE_VALUE;
+
+    if (!watch->dirty)
+    {
+        return SUCCESS;
+    }
+
+    hOutput = CreateFileW(watch->temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hOutput == INVALID_HANDLE_VALUE)
+    {
+        LogError(watch->args, L"failed to create '%ls' with error: %lu\r\n", watch->temporary, GetLastError());
+        return WATCH_FAILED_TO_WRITE;
+    }
+
+    for (size_t i = 0; i < watch->count; i++)
+    {
+        WatchEntry* entry = &watch->entries[i];
+        WCHAR hash[SHA256_DIGEST_LENGTH * 2 + 1];
+        WCHAR field[SHA256_DIGEST_LENGTH * 2 + 22];
+        size_t length = wcslen(entry->path) + _countof(field) + 4;
+        LPWSTR line = malloc(length * sizeof(WCHAR));
+
+        if (line == NULL)
+        {
+            status = WATCH_ALLOCATE_ERROR;
+            break;
+        }
+
+        FormatDigest(hash, entry->digest);
+        if (watch->args->withSize)
+        {
+            StringCchPrintfW(field, _countof(field), L"%ls %llu", hash, entry->size);
+        }
+        else
+        {
+            StringCchCopyW(field, _countof(field), hash);
+        }
+        StringCchPrintfW(line, length, L"%ls *%ls\r\n", field, entry->path);
+        WriteFileUTF8(hOutput, line);
+        free(line);
+    }
+
+    if (!FlushFileBuffers(hOutput))
+    {
+        status = WATCH_FAILED_TO_WRITE;
+    }
+    CloseHandle(hOutput);
+
+    if (status == SUCCESS && !MoveFileExW(watch->temporary, watch->output, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        status = WATCH_FAILED_TO_WRITE;
+    }
+
+    if (status == WATCH_FAILED_TO_WRITE)
+    {
+        LogError(watch->args, L"failed to write '%ls' with error: %lu\r\n", watch->output, GetLastError());
+    }
+    if (status != SUCCESS)
+    {
+        DeleteFileW(watch->temporary);
+        return status;
+    }
+
+    watch->dirty = FALSE;
+    return SUCCESS;
+}
+
+// applies one batch of change notifications
+static ErrorCode ApplyChanges(__inout Watch* watch, __in PBYTE buffer, __in DWORD size)
+{
+    ErrorCode status = SUCCESS;
+    ULONGLONG due = GetTickCount64() + WATCH_DEBOUNCE;
+    DWORD offset = 0;
+
+    while (status == SUCCESS && offset + sizeof(FILE_NOTIFY_INFORMATION) <= size)
+    {
+        FILE_NOTIFY_INFORMATION* change = (FILE_NOTIFY_INFORMATION*)(buffer + offset);
+        LPWSTR path = JoinPath(L"", change->FileName, change->FileNameLength / sizeof(WCHAR));
+        LPWSTR file = path != NULL ? JoinPath(watch->root, path, wcslen(path)) : NULL;
+
+        if (file == NULL)
+        {
+            free(path);
+            return WATCH_ALLOCATE_ERROR;
+        }
+
+        switch (change->Action)
+        {
+        case FILE_ACTION_ADDED:
+        case FILE_ACTION_RENAMED_NEW_NAME:
+        case FILE_ACTION_MODIFIED:
+        {
+            DWORD attributes = GetFileAttributesW(file);
+            if (attributes == INVALID_FILE_ATTRIBUTES)
+            {
+                break;
+            }
+            if (!(attributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                status = AddPending(watch, path, due) ? SUCCESS : WATCH_ALLOCATE_ERROR;
+            }
+            // a directory moved in brings its files without an event for each of them
+            else if (change->Action != FILE_ACTION_MODIFIED && !(attributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+                status = ScanDirectory(watch, path, due);
+            }
+            break;
+        }
+
+        case FILE_ACTION_REMOVED:
+        case FILE_ACTION_RENAMED_OLD_NAME:
+            RemoveEntries(watch, path);
+            break;
+        }
+
+        free(file);
+        free(path);
+
+        if (change->NextEntryOffset == 0)
+        {
+            break;
+        }
+        offset += change->NextEntryOffset;
+    }
+
+    return status;
+}
+
+static BOOL WINAPI WatchCtrlHandler(__in DWORD ctrlType)
+{
+    UNREFERENCED_PARAMETER(ctrlType);
+    StopWatch();
+    return TRUE;
+}
+
+// ends WatchDirectory after the batch it is working on, also from Ctrl+C
+void StopWatch(void)
+{
+    InterlockedExchange(&watchStopping, TRUE);
+    if (watchStop != NULL)
+    {
+        SetEvent(watchStop);
+    }
+}
+
+// Hashes all files below args->watchDirectory into args->watchOutput and keeps
+// it current: files that were written, moved in or deleted are hashed again or
+// dropped, after WATCH_DEBOUNCE ms without further changes to them. Runs until
+// StopWatch.
+ErrorCode WatchDirectory(__in Args* args)
+{
+    ErrorCode status = SUCCESS;
+    Watch watch = { 0 };
+    HANDLE hDirectory = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped = { 0 };
+    PBYTE buffer = NULL;
+    BOOL reading = FALSE;
+    BOOL rescan = TRUE;
+    DWORD dwBytesReturned = 0;
+
+    watch.args = args;
+    InterlockedExchange(&watchStopping, FALSE);
+
+    if (GetFullPathNameW(args->watchDirectory, _countof(watch.root), watch.root, NULL) == 0
+        || GetFullPathNameW(args->watchOutput, _countof(watch.output), watch.output, NULL) == 0
+        || FAILED(StringCchPrintfW(watch.temporary, _countof(watch.temporary), L"%ls.tmp", watch.output)))
+    {
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", args->watchDirectory, GetLastError());
+        return WATCH_FAILED_TO_OPEN;
+    }
+
+    status = CreatePathFilter(args, &watch.filter);
+    if (status != SUCCESS)
+    {
+        return status;
+    }
+
+    buffer = malloc(WATCH_BUFFER_SIZE);
+    watchStop = CreateEventW(NULL, TRUE, watchStopping, NULL);
+    overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (buffer == NULL || watchStop == NULL || overlapped.hEvent == NULL)
+    {
+        status = WATCH_ALLOCATE_ERROR;
+        goto Cleanup;
+    }
+    SetConsoleCtrlHandler(WatchCtrlHandler, TRUE);
+
+    hDirectory = CreateFileW(watch.root,
+                             FILE_LIST_DIRECTORY,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                             NULL);
+    if (hDirectory == INVALID_HANDLE_VALUE)
+    {
+        LogError(args, L"failed to open '%ls' with error: %lu\r\n", watch.root, GetLastError());
+        status = WATCH_FAILED_TO_OPEN;
+        goto Cleanup;
+    }
+
+    // changes are collected from here on, so none is lost during the first hash
+    while (!watchStopping)
+    {
+        if (!reading)
+        {
+            ResetEvent(overlapped.hEvent);
+            if (!ReadDirectoryChangesW(hDirectory, buffer, WATCH_BUFFER_SIZE, TRUE, WATCH_FILTER, NULL, &overlapped, NULL))
+            {
+                LogError(args, L"failed to watch '%ls' with error: %lu\r\n", watch.root, GetLastError());
+                status = WATCH_FAILED_TO_OPEN;
+                break;
+            }
+            reading = TRUE;
+        }
+
+        // the first pass and a lost batch of changes hash the whole directory again
+        if (rescan)
+        {
+            RemoveEntries(&watch, L"");
+            watch.dirty = TRUE;
+            status = ScanDirectory(&watch, L"", 0);
+            rescan = FALSE;
+        }
+
+        if (status == SUCCESS)
+        {
+            status = HashDue(&watch);
+        }
+        if (status == SUCCESS)
+        {
+            status = WriteWatchManifest(&watch);
+        }
+        if (status != SUCCESS)
+        {
+            break;
+        }
+
+        DWORD timeout = INFINITE;
+        ULONGLONG now = GetTickCount64();
+        for (size_t i = 0; i < watch.pendingCount; i++)
+        {
+            DWORD wait = watch.pending[i].due > now ? (DWORD)(watch.pending[i].due - now) : 0;
+            timeout = wait < timeout ? wait : timeout;
+        }
+
+        HANDLE events[2] = { overlapped.hEvent, watchStop };
+        if (WaitForMultipleObjects(2, events, FALSE, timeout) != WAIT_OBJECT_0)
+        {
+            continue;
+        }
+
+        reading = FALSE;
+        if (!GetOverlappedResult(hDirectory, &overlapped, &dwBytesReturned, FALSE))
+        {
+            if (GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+            {
+                LogError(args, L"failed to watch '%ls' with error: %lu\r\n", watch.root, GetLastError());
+                status = WATCH_FAILED_TO_OPEN;
+                break;
+            }
+            dwBytesReturned = 0;
+        }
+
+        if (dwBytesReturned == 0)
+        {
+            rescan = TRUE;
+            continue;
+        }
+        status = ApplyChanges(&watch, buffer, dwBytesReturned);
+        if (status != SUCCESS)
+        {
+            break;
+        }
+    }
+
+    // changes hashed before the stop still make it to the manifest
+    if (status == SUCCESS)
+    {
+        status = WriteWatchManifest(&watch);
+    }
+
+Cleanup:
+    SetConsoleCtrlHandler(WatchCtrlHandler, FALSE);
+    if (hDirectory != INVALID_HANDLE_VALUE)
+    {
+        if (reading)
+        {
+            CancelIoEx(hDirectory, &overlapped);
+            GetOverlappedResult(hDirectory, &overlapped, &dwBytesReturned, TRUE);
+        }
+        CloseHandle(hDirectory);
+    }
+    if (overlapped.hEvent != NULL)
+    {
+        CloseHandle(overlapped.hEvent);
+    }
+    if (watchStop != NULL)
+    {
+        CloseHandle(watchStop);
+        watchStop = NULL;
+    }
+    RemoveEntries(&watch, L"");
+    free(watch.entries);
+    free(watch.pending);
+    free(buffer);
+    FreePathFilter(watch.filter);
+
+    return status;
+}